@@ -34,6 +34,7 @@ LOCAL uint8 m_nLastSCL;
 
 #ifdef I2C_MASTER_CLOCK_STRETCH_VAR
 static uint32 I2C_MASTER_CLOCK_STRETCH_VAR = 0;
+static uint32 I2C_MASTER_CLOCK_STRETCH_TOTAL = 0;
 #endif
 
 
@@ -337,3 +338,19 @@ i2c_master_writeByte(uint8 wrdata)
         i2c_master_wait(5);
     }
 }
+
+/******************************************************************************
+ * FunctionName : i2c_master_get_stretch_us
+ * Description  : get the accumulated clock stretching time since boot
+ * Parameters   : NONE
+ * Returns      : uint32 - stretch time in us (wraps around)
+*******************************************************************************/
+uint32 ICACHE_FLASH_ATTR
+i2c_master_get_stretch_us(void)
+{
+#ifdef I2C_MASTER_CLOCK_STRETCH_VAR
+    return I2C_MASTER_CLOCK_STRETCH_TOTAL;
+#else
+    return 0;
+#endif
+}
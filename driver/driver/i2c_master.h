@@ -30,12 +30,22 @@
 #define I2C_MASTER_CLOCK_STRETCH
 #define I2C_MASTER_MAX_CLOCK_STRETCH 100000
 
+#ifdef I2C_MASTER_HSPI_PINS
+/* SDA on HSPI MOSI (GPIO13), SCL on HSPI CLK (GPIO14). See examples/hspi_i2c */
+#define I2C_MASTER_SDA_MUX PERIPHS_IO_MUX_MTCK_U
+#define I2C_MASTER_SCL_MUX PERIPHS_IO_MUX_MTMS_U
+#define I2C_MASTER_SDA_GPIO 13
+#define I2C_MASTER_SCL_GPIO 14
+#define I2C_MASTER_SDA_FUNC FUNC_GPIO13
+#define I2C_MASTER_SCL_FUNC FUNC_GPIO14
+#else
 #define I2C_MASTER_SDA_MUX PERIPHS_IO_MUX_GPIO4_U
 #define I2C_MASTER_SCL_MUX PERIPHS_IO_MUX_GPIO5_U
 #define I2C_MASTER_SDA_GPIO 4
 #define I2C_MASTER_SCL_GPIO 5
 #define I2C_MASTER_SDA_FUNC FUNC_GPIO4
 #define I2C_MASTER_SCL_FUNC FUNC_GPIO5
+#endif
 
 // #define I2C_MASTER_SDA_MUX PERIPHS_IO_MUX_GPIO5_U
 // #define I2C_MASTER_SCL_MUX PERIPHS_IO_MUX_GPIO4_U
@@ -73,6 +83,7 @@
 #ifdef I2C_MASTER_CLOCK_STRETCH
 
 #define I2C_MASTER_CLOCK_STRETCH_VAR clock_stretch_limit
+#define I2C_MASTER_CLOCK_STRETCH_TOTAL clock_stretch_total
 
 #define I2C_MASTER_CLOCK_STRETCH_WAIT() do {                                \
     I2C_MASTER_CLOCK_STRETCH_VAR = 0;                                       \
@@ -80,6 +91,7 @@
         (I2C_MASTER_CLOCK_STRETCH_VAR++) < I2C_MASTER_MAX_CLOCK_STRETCH) {  \
         i2c_master_wait(1);                                                 \
     }                                                                       \
+    I2C_MASTER_CLOCK_STRETCH_TOTAL += I2C_MASTER_CLOCK_STRETCH_VAR;         \
 } while (0)
 
 #else
@@ -115,4 +127,6 @@ bool i2c_master_checkAck(void);
 void i2c_master_send_ack(void);
 void i2c_master_send_nack(void);
 
+uint32 i2c_master_get_stretch_us(void);
+
 #endif
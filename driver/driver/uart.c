@@ -43,6 +43,8 @@ LOCAL struct UartBuffer* pRxBuffer = NULL;
 #define uart_recvTaskQueueLen    10
 os_event_t    uart_recvTaskQueue[uart_recvTaskQueueLen];
 
+LOCAL uart_rx_callback_t uart_rx_callback = NULL;
+
 #define DBG  
 #define DBG1 uart1_sendStr_no_wait
 #define DBG2 os_printf
@@ -299,7 +301,11 @@ uart_recvTask(os_event_t *events)
         uint8 idx=0;
         for(idx=0;idx<fifo_len;idx++) {
             d_tmp = READ_PERI_REG(UART_FIFO(UART0)) & 0xFF;
-            uart_tx_one_char(UART0, d_tmp);
+            if (uart_rx_callback != NULL) {
+                uart_rx_callback(d_tmp);
+            } else {
+                uart_tx_one_char(UART0, d_tmp);
+            }
         }
         WRITE_PERI_REG(UART_INT_CLR(UART0), UART_RXFIFO_FULL_INT_CLR|UART_RXFIFO_TOUT_INT_CLR);
         uart_rx_intr_enable(UART0);
@@ -351,6 +357,19 @@ uart_init(UartBautRate uart0_br, UartBautRate uart1_br)
     #endif
 }
 
+/******************************************************************************
+ * FunctionName : uart_rx_callback_set
+ * Description  : set a user handler for the uart0 received chars (task context).
+ *                With no handler the received data is echoed back
+ * Parameters   : uart_rx_callback_t callback - handler, NULL to restore the echo
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR
+uart_rx_callback_set(uart_rx_callback_t callback)
+{
+    uart_rx_callback = callback;
+}
+
 void ICACHE_FLASH_ATTR
 uart_reattach()
 {
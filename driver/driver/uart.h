@@ -153,8 +153,11 @@ typedef struct {
     int                      buff_uart_no;  //indicate which uart use tx/rx buffer
 } UartDevice;
 
+typedef void (*uart_rx_callback_t)(uint8 rx_char);
+
 void uart_init(UartBautRate uart0_br, UartBautRate uart1_br);
 void uart0_sendStr(const char *str);
+void uart_rx_callback_set(uart_rx_callback_t callback);
 
 
 ///////////////////////////////////////
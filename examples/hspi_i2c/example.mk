@@ -0,0 +1,2 @@
+# HSPI data phase needs the bit-banged bus on the HSPI CLK/MOSI pins
+CFLAGS += -DI2C_MASTER_HSPI_PINS
@@ -0,0 +1,191 @@
+/**
+ * \file hspi_i2c.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief I2C read bursts clocked by the HSPI peripheral. Source file.
+ * \version 0.1
+ * \date 2021-04-06
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <ets_sys.h>
+#include <user_interface.h>
+
+#include "hspi_i2c.h"
+#include "i2c_bus.h"
+#include "simple_i2c.h"
+#include "driver/spi_register.h"
+
+/* The SDK runs one task per priority and uc_init_i2c() registers the bus scheduler first.
+ * The priorities are enum values, #if can not compare them */
+_Static_assert(HSPI_I2C_TASK_PRIO != I2C_BUS_TASK_PRIO, "HSPI_I2C_TASK_PRIO is taken by the I2C bus scheduler");
+
+#define HSPI 1
+
+/* SPI_USER full-duplex bit, missing from spi_register.h */
+#define HSPI_I2C_DOUTDIN BIT(0)
+
+/* Shared SPI/HSPI/I2S interrupt status. BIT7 is HSPI */
+#define HSPI_I2C_INTR_STATUS_REG 0x3ff00020
+#define HSPI_I2C_INTR_HSPI       BIT7
+
+#define HSPI_I2C_BUFF_WORDS (HSPI_I2C_BUFF_BITS / 32)
+
+#define HSPI_I2C_PINS_SPI() do {                 \
+    PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDI_U, 2);   \
+    PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTCK_U, 2);   \
+    PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTMS_U, 2);   \
+} while(0)
+
+#define HSPI_I2C_PINS_GPIO() do {                                   \
+    PIN_FUNC_SELECT(I2C_MASTER_SDA_MUX, I2C_MASTER_SDA_FUNC);       \
+    PIN_FUNC_SELECT(I2C_MASTER_SCL_MUX, I2C_MASTER_SCL_FUNC);       \
+} while(0)
+
+static os_event_t task_queue[1];
+
+static uint32_t pattern[HSPI_I2C_BUFF_WORDS];
+static size_t   pattern_len;
+
+static uint8_t rx_buff[HSPI_I2C_BUFF_WORDS * 4];
+static uint8_t data[HSPI_I2C_MAX_BYTES];
+
+static volatile uint8_t  busy;
+static volatile uint32_t start_us;
+static volatile uint32_t done_us;
+
+static size_t          burst_len;
+static hspi_i2c_done_t burst_cb;
+static void*           burst_arg;
+
+static hspi_i2c_timing_t timing;
+
+/**
+ * All bits released ('1') except the ACK slot of every byte but the last one,
+ * which stays '1' as the final NACK. Cached, the same lengths are read every time.
+ */
+static void ICACHE_FLASH_ATTR
+build_pattern(size_t len) {
+    uint8_t* p_bytes = (uint8_t*)pattern;
+
+    if (len == pattern_len) {
+        return;
+    }
+
+    os_memset(pattern, 0xFF, sizeof(pattern));
+    for (size_t i = 0; i < len - 1; ++i) {
+        size_t bit = i * HSPI_I2C_FRAME_BITS + 8;
+        p_bytes[bit >> 3] &= ~(0x80 >> (bit & 7));
+    }
+
+    pattern_len = len;
+}
+
+static void ICACHE_FLASH_ATTR
+unpack(size_t len) {
+    for (size_t i = 0; i < HSPI_I2C_BUFF_WORDS; ++i) {
+        uint32_t word = READ_PERI_REG(SPI_W0(HSPI) + 4*i);
+        os_memcpy(&rx_buff[4*i], &word, 4);
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        size_t bit   = i * HSPI_I2C_FRAME_BITS;
+        size_t index = bit >> 3;
+        uint8_t shift = bit & 7;
+
+        data[i] = (rx_buff[index] << shift) | (shift ? rx_buff[index + 1] >> (8 - shift) : 0);
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+hspi_i2c_task(os_event_t* events) {
+    uint32_t t0 = system_get_time();
+    uint8_t result;
+
+    unpack(burst_len);
+
+    /* The burst ends with SCL low after the NACK, as the bit-banged read does */
+    HSPI_I2C_PINS_GPIO();
+    I2C_STOP(&result);
+
+    timing.wall_us   = done_us - start_us;
+    timing.unpack_us = system_get_time() - t0;
+
+    busy = 0;
+
+    if (burst_cb != NULL) {
+        burst_cb(data, burst_len, &timing, burst_arg);
+    }
+}
+
+static void
+hspi_i2c_isr(void* arg) {
+    if (!(READ_PERI_REG(HSPI_I2C_INTR_STATUS_REG) & HSPI_I2C_INTR_HSPI)) {
+        return;
+    }
+
+    CLEAR_PERI_REG_MASK(SPI_SLAVE(HSPI), SPI_TRANS_DONE);
+    done_us = system_get_time();
+    system_os_post(HSPI_I2C_TASK_PRIO, 0, 0);
+}
+
+status_t ICACHE_FLASH_ATTR
+hspi_i2c_init() {
+    /* HSPI clock divided from the 80MHz clock (0x305 would feed it undivided) */
+    WRITE_PERI_REG(PERIPHS_IO_MUX, 0x105);
+
+    WRITE_PERI_REG(SPI_CLOCK(HSPI),
+                   (((HSPI_I2C_CLK_PRE - 1) & SPI_CLKDIV_PRE) << SPI_CLKDIV_PRE_S) |
+                   (((HSPI_I2C_CLK_N - 1) & SPI_CLKCNT_N) << SPI_CLKCNT_N_S) |
+                   (((HSPI_I2C_CLK_N / 2 - 1) & SPI_CLKCNT_H) << SPI_CLKCNT_H_S) |
+                   (((HSPI_I2C_CLK_N - 1) & SPI_CLKCNT_L) << SPI_CLKCNT_L_S));
+
+    /* Mode 0, MSB first, no command/address/dummy phases, no CS */
+    WRITE_PERI_REG(SPI_USER(HSPI), SPI_USR_MOSI | SPI_USR_MISO | HSPI_I2C_DOUTDIN);
+    CLEAR_PERI_REG_MASK(SPI_CTRL(HSPI), SPI_WR_BIT_ORDER | SPI_RD_BIT_ORDER);
+    CLEAR_PERI_REG_MASK(SPI_PIN(HSPI), SPI_IDLE_EDGE);
+    SET_PERI_REG_MASK(SPI_PIN(HSPI), SPI_CS0_DIS);
+
+    CLEAR_PERI_REG_MASK(SPI_SLAVE(HSPI), SPI_TRANS_DONE);
+    SET_PERI_REG_MASK(SPI_SLAVE(HSPI), SPI_TRANS_DONE_EN);
+
+    system_os_task(hspi_i2c_task, HSPI_I2C_TASK_PRIO, task_queue, 1);
+
+    ETS_SPI_INTR_ATTACH(hspi_i2c_isr, NULL);
+    ETS_SPI_INTR_ENABLE();
+
+    return STA_OK;
+}
+
+status_t ICACHE_FLASH_ATTR
+hspi_i2c_read_start(size_t len, hspi_i2c_done_t cb, void* arg) {
+    uint32_t t0 = system_get_time();
+    size_t bits = len * HSPI_I2C_FRAME_BITS;
+
+    if (busy || len == 0 || len > HSPI_I2C_MAX_BYTES) {
+        return STA_ERR;
+    }
+
+    busy      = 1;
+    burst_len = len;
+    burst_cb  = cb;
+    burst_arg = arg;
+
+    build_pattern(len);
+    for (size_t i = 0; i < (bits + 31) / 32; ++i) {
+        WRITE_PERI_REG(SPI_W0(HSPI) + 4*i, pattern[i]);
+    }
+
+    WRITE_PERI_REG(SPI_USER1(HSPI),
+                   (((bits - 1) & SPI_USR_MOSI_BITLEN) << SPI_USR_MOSI_BITLEN_S) |
+                   (((bits - 1) & SPI_USR_MISO_BITLEN) << SPI_USR_MISO_BITLEN_S));
+
+    HSPI_I2C_PINS_SPI();
+
+    start_us = system_get_time();
+    SET_PERI_REG_MASK(SPI_CMD(HSPI), SPI_USR);
+
+    timing.setup_us = start_us - t0;
+
+    return STA_OK;
+}
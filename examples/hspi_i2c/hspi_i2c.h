@@ -0,0 +1,88 @@
+/**
+ * \file hspi_i2c.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief I2C read bursts clocked by the HSPI peripheral. Header file.
+ * \version 0.1
+ * \date 2021-04-06
+ *
+ * Experiment: none of the sensors has a SPI variant, so instead of switching the
+ * interface, the data phase of a bulk I2C read is shifted out by the HSPI block.
+ * Each I2C byte is sent as a 9 bit frame: 8 released ('1') bits while the slave
+ * drives SDA, followed by the master ACK ('0') or the final NACK ('1'). SDA is read
+ * back through MISO and every 9th bit is dropped.
+ *
+ * START, address and STOP are still bit-banged by the i2c_master driver, so the
+ * driver has to be built with I2C_MASTER_HSPI_PINS (SDA GPIO13, SCL GPIO14).
+ *
+ * Wiring of the evaluation board:
+ *  - SCL: GPIO14 (HSPI CLK)
+ *  - SDA: GPIO13 (HSPI MOSI, open-drain pad) tied to GPIO12 (HSPI MISO)
+ *  - GPIO15 (HSPI CS) is not used. GPIO13 is the CCS811 nWAKE on the logger board,
+ *    so this runs on a separate board with the SCD30 and the ZMOD4410 only.
+ *
+ * Limitations: the HSPI clock does not honour clock stretching, so only the
+ * data phase (where the SCD30 and ZMOD4410 do not stretch) is offloaded.
+ */
+
+#ifndef HSPI_I2C_H
+#define HSPI_I2C_H
+
+#include <c_types.h>
+
+#include "status.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define HSPI_I2C_TASK_PRIO  USER_TASK_PRIO_1                  /*!< USER_TASK_PRIO_2 is the I2C bus scheduler */
+#define HSPI_I2C_FRAME_BITS 9
+#define HSPI_I2C_BUFF_BITS  512                                 /*!< W0..W15 */
+#define HSPI_I2C_MAX_BYTES  (HSPI_I2C_BUFF_BITS / HSPI_I2C_FRAME_BITS)
+
+/* SCL = 80MHz / (PRE * N). 20 * 40 -> 100kHz, same as the bit-banged bus */
+#define HSPI_I2C_CLK_PRE 20
+#define HSPI_I2C_CLK_N   40
+
+/**
+ * \brief           Burst timing, filled by the driver
+ */
+typedef struct {
+    uint32_t setup_us;                          /*!< CPU time to load the pattern and start */
+    uint32_t wall_us;                           /*!< Start to TransDone interrupt */
+    uint32_t unpack_us;                         /*!< CPU time to unpack and send the STOP */
+} hspi_i2c_timing_t;
+
+/**
+ * \brief           Burst completion callback. Runs from a system task
+ * \param[in]       p_data: Received bytes
+ * \param[in]       len: Number of bytes
+ * \param[in]       p_timing: Burst timing
+ * \param[in]       arg: User argument given to hspi_i2c_read_start
+ */
+typedef void (*hspi_i2c_done_t)(const uint8_t* p_data, size_t len, const hspi_i2c_timing_t* p_timing, void* arg);
+
+/**
+ * \brief           Setup the HSPI block as a 100kHz full-duplex master and attach the interrupt
+ * \return          STA_OK on success
+ */
+status_t hspi_i2c_init();
+
+/**
+ * \brief           Read `len` bytes with the HSPI block
+ *
+ * Must be called after the address of a read transaction was acknowledged (SCL low).
+ * Returns right after starting the burst. The STOP condition is sent before calling `cb`.
+ *
+ * \param[in]       len: Number of bytes, up to HSPI_I2C_MAX_BYTES
+ * \param[in]       cb: Completion callback
+ * \param[in]       arg: Callback argument
+ * \return          STA_OK if the burst started. STA_ERR if busy or `len` is out of range
+ */
+status_t hspi_i2c_read_start(size_t len, hspi_i2c_done_t cb, void* arg);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* HSPI_I2C_H */
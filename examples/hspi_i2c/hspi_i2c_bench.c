@@ -0,0 +1,244 @@
+/**
+ * \file hspi_i2c_bench.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Compare bit-banged and HSPI clocked bulk reads of the SCD30 and ZMOD4410.
+ * \version 0.1
+ * \date 2021-04-06
+ *
+ * Build with `make EXAMPLE=hspi_i2c`. Every run reads the SCD30 measurement (18 bytes)
+ * and the ZMOD4410 ADC block (32 bytes) twice, first bit-banged and then with HSPI,
+ * and prints the data phase timing. Reading the SCD30 measurement consumes it, so each
+ * of its two reads waits for its own data ready and only the CRCs are checked:
+ *  - bb:     CPU busy time of the bit-banged data phase
+ *  - setup:  CPU time to load the HSPI pattern and start the burst
+ *  - wall:   duration of the HSPI burst, the CPU is free meanwhile
+ *  - unpack: CPU time to unpack the bytes and send the STOP
+ *  - match:  Both reads returned the same bytes (ZMOD)
+ *  - crc:    Both reads have valid word CRCs (SCD30, two different samples)
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <user_interface.h>
+
+#include "uc_init.h"
+#include "simple_i2c.h"
+#include "scd30/scd30.h"
+#include "crc8/crc8.h"
+#include "hspi_i2c.h"
+
+#ifndef I2C_MASTER_HSPI_PINS
+#error "The I2C bus must be on the HSPI pins, build with I2C_MASTER_HSPI_PINS"
+#endif
+
+#define BENCH_PERIOD_MS     5000
+#define BENCH_SCD30_DELAY   3003                /*!< Same wait as scd30_read */
+#define BENCH_ZMOD_I2C_ADDR 0x32
+#define BENCH_ZMOD_ADC_REG  0x97
+#define BENCH_BUFF_SIZE     32
+#define BENCH_READY_POLL_MS 100
+#define BENCH_READY_POLLS   50                  /*!< 5 s, over twice the default SCD30 interval */
+
+typedef struct {
+    const char* name;
+    uint8_t     addr;
+    uint8_t     cmd[2];
+    uint8_t     cmd_len;
+    uint8_t     stop_before_read;               /*!< SCD30 needs STOP + delay, ZMOD a repeated START */
+    uint8_t     len;
+    uint8_t     consumed;                       /*!< A read takes the sample: wait data ready, check CRCs */
+} bench_target_t;
+
+static const bench_target_t targets[] = {
+    {"scd30", SCD30_I2C_ADDR,      {SCD30_CMD_READ_MEASUREMENT >> 8, SCD30_CMD_READ_MEASUREMENT & 0xFF}, 2, 1, 18, 1},
+    {"zmod",  BENCH_ZMOD_I2C_ADDR, {BENCH_ZMOD_ADC_REG, 0},                                             1, 0, 32, 0},
+};
+
+#define BENCH_TARGETS (sizeof(targets) / sizeof(targets[0]))
+
+static volatile os_timer_t timer_bench;
+static volatile os_timer_t timer_ready;
+
+static uint8_t  bb_data[BENCH_BUFF_SIZE];
+static uint32_t bb_us;
+static uint8_t  target_idx;
+static uint8_t  bb_done;                        /*!< Bit-banged read of the target done */
+static uint8_t  ready_polls;
+static uint8_t  running;
+
+static void bench_next(void);
+
+/**
+ * \brief           Send the command/register and start the read, leaving SCL low after the address ACK
+ */
+static uint8_t ICACHE_FLASH_ATTR
+bench_prefix(const bench_target_t* p_target) {
+    uint8_t result;
+
+    I2C_START_WRITE(p_target->addr, &result);
+    if (!result) {
+        I2C_STOP(&result);
+        return 0;
+    }
+
+    I2C_WRITE_BYTES(p_target->cmd, p_target->cmd_len, &result);
+    if (!result) {
+        I2C_STOP(&result);
+        return 0;
+    }
+
+    if (p_target->stop_before_read) {
+        I2C_STOP(&result);
+        os_delay_us(BENCH_SCD30_DELAY);
+    }
+
+    I2C_START_READ(p_target->addr, &result);
+    if (!result) {
+        I2C_STOP(&result);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * \brief           Sensirion words: 2 data bytes + CRC8
+ */
+static uint8_t ICACHE_FLASH_ATTR
+bench_crc_ok(const uint8_t* p_data, size_t len) {
+    uint8_t crc;
+
+    for (size_t i = 0; i + 3 <= len; i += 3) {
+        crc = 0xFF;
+        crc8_fast(p_data + i, 2, &crc);
+        if (crc != p_data[i + 2]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void ICACHE_FLASH_ATTR
+bench_target_end(void) {
+    ++target_idx;
+    bb_done = 0;
+    ready_polls = 0;
+    bench_next();
+}
+
+/**
+ * \brief           Wait for a new sample of a consumed target
+ * \return          1 to read now, 0 if bench_next runs again later
+ */
+static uint8_t ICACHE_FLASH_ATTR
+bench_ready(const bench_target_t* p_target) {
+    uint8_t ready = 0;
+
+    if (!p_target->consumed || (scd30_check_data_ready(&ready) && ready)) {
+        ready_polls = 0;
+        return 1;
+    }
+
+    if (++ready_polls > BENCH_READY_POLLS) {
+        os_printf("%-6s no data ready\n", p_target->name);
+        bench_target_end();
+        return 0;
+    }
+
+    os_timer_arm((os_timer_t*)&timer_ready, BENCH_READY_POLL_MS, 0);
+    return 0;
+}
+
+static void ICACHE_FLASH_ATTR
+bench_done(const uint8_t* p_data, size_t len, const hspi_i2c_timing_t* p_timing, void* arg) {
+    const bench_target_t* p_target = (const bench_target_t*)arg;
+    uint8_t match;
+
+    if (p_target->consumed) {
+        match = bench_crc_ok(p_data, len) && bench_crc_ok(bb_data, len);
+    } else {
+        match = os_memcmp(p_data, bb_data, len) == 0;
+    }
+
+    os_printf("%-6s %2d B | bb %5d us | hspi setup %3d us, wall %5d us, unpack %3d us | %s %d\n",
+              p_target->name, len, bb_us, p_timing->setup_us, p_timing->wall_us, p_timing->unpack_us,
+              p_target->consumed ? "crc" : "match", match);
+
+    bench_target_end();
+}
+
+static void ICACHE_FLASH_ATTR
+bench_next(void) {
+    const bench_target_t* p_target;
+    uint32_t t0;
+    uint8_t result;
+
+    if (target_idx >= BENCH_TARGETS) {
+        os_printf("\n");
+        running = 0;
+        return;
+    }
+    p_target = &targets[target_idx];
+
+    /* Bit-banged reference */
+    if (!bb_done) {
+        if (!bench_ready(p_target)) {
+            return;
+        }
+        if (!bench_prefix(p_target)) {
+            os_printf("%-6s no ACK\n", p_target->name);
+            bench_target_end();
+            return;
+        }
+        t0 = system_get_time();
+        I2C_READ_BYTES(bb_data, p_target->len, &result);
+        bb_us = system_get_time() - t0;
+        I2C_STOP(&result);
+        bb_done = 1;
+    }
+
+    /* HSPI burst, bench_done continues with the next target */
+    if (!bench_ready(p_target)) {
+        return;
+    }
+    if (!bench_prefix(p_target)) {
+        os_printf("%-6s no ACK\n", p_target->name);
+        bench_target_end();
+        return;
+    }
+    if (hspi_i2c_read_start(p_target->len, bench_done, (void*)p_target) != STA_OK) {
+        I2C_STOP(&result);
+        os_printf("%-6s HSPI busy\n", p_target->name);
+        bench_target_end();
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+bench_run(void* arg) {
+    /* Waiting for the SCD30 may outlast BENCH_PERIOD_MS */
+    if (running) {
+        return;
+    }
+
+    running = 1;
+    target_idx = 0;
+    bb_done = 0;
+    ready_polls = 0;
+    bench_next();
+}
+
+void ICACHE_FLASH_ATTR
+user_pre_init() {}
+
+void ICACHE_FLASH_ATTR
+user_init()
+{
+    uc_init_uart();
+    uc_init_i2c();
+    hspi_i2c_init();
+
+    os_timer_setfn((os_timer_t*)&timer_ready, (os_timer_func_t *)bench_next, NULL);
+    os_timer_setfn((os_timer_t*)&timer_bench, (os_timer_func_t *)bench_run, NULL);
+    os_timer_arm((os_timer_t*)&timer_bench, BENCH_PERIOD_MS, 1);
+}
@@ -9,12 +9,22 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <c_types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
 char* common_strdup(const char* str);
 
+/**
+ * \brief           Write a float rounded to two decimals, e.g. "-0.50". Unlike f2c, the integer part is always printed
+ * \param[out]      buff: Destination buffer. At least 15 bytes
+ * \param[in]       value: Value
+ * \return          Written characters. 0 if `value` is NaN or does not fit 32 bits
+ */
+size_t common_ftoa(char* buff, float value);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
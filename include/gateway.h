@@ -0,0 +1,106 @@
+/**
+ * \file gateway.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Room gateway: peers send binary samples over UDP, one upload for all. Header file.
+ * \version 0.1
+ * \date 2021-04-22
+ *
+ * GATEWAY_PEER_ENABLE: every sample is encoded into one datagram to GATEWAY_IP, instead
+ * of uploading it. GATEWAY_ENABLE: peer samples are decoded into line protocol, tagged
+ * `peer=<MAC>`, and posted to INFLUX_URL together with our own sample, one request per
+ * SERVER_WRITE_INTERVAL for the whole room. Own lines are not tagged.
+ *
+ * Datagram, little endian:
+ *
+ *     0  'G' 'W' version  lines
+ *     4  MAC[6]
+ *     10 seq u16          Random start, +1 per datagram. The gateway counts the gaps
+ *     12 ts u32           Sample time [s], 0 if the peer has no SNTP time yet
+ *     16 lines x { id u8, fields x i32 }
+ *
+ * Field values are fixed point, x1000, clamped to +-2147483. The id selects the measurement and its fields,
+ * in the timer_send_data order:
+ *
+ *     1 zmod, 2 zmod_reset, 3 zmod_halt   eco2 etoh rcda iaq tvoc rmox
+ *     4 scd30                             temp co2 rh
+ *     5 ccs811                            eco2 tvoc current adc
+ *
+ * Lines of other measurements are not sent. The HTTP request follows the HTTP sink
+ * rules: one in flight, upload_sched holds and hints, and the posted batch is kept
+ * until it gets a 2xx. An error status, a timeout or a failed request posts it again.
+ * Meanwhile lines are collected in a second batch, and our sample stays queued in
+ * telemetry, so it goes out with the peer lines of its interval once the previous
+ * batch is acknowledged.
+ *
+ * A batch holds a sample of every peer and ours, one request per interval. A full one is
+ * posted early if nothing is pending. Otherwise peer lines past it are dropped.
+ */
+
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include <c_types.h>
+
+#include "status.h"
+#include "telemetry.h"
+#include "user_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define GATEWAY_VERSION     1
+#define GATEWAY_HEADER_SIZE 16
+#define GATEWAY_MAX_LINES   8                   /* Lines per datagram */
+#define GATEWAY_TIMEOUT     30000000            /* [us] Request without callback, given up */
+#define GATEWAY_BATCH_SIZE  ((GATEWAY_MAX_PEERS + 1) * TELEMETRY_SAMPLE_SIZE) /* Collected and posted batch, each */
+
+/**
+ * \brief           Gateway statistics
+ */
+typedef struct {
+    uint32_t datagrams;                         /*!< Valid datagrams received, or sent by a peer */
+    uint32_t invalid;                           /*!< Bad magic, version or length */
+    uint32_t lines;                             /*!< Lines added to the batch, or sent by a peer */
+    uint32_t dropped;                           /*!< Lines over the batch or not encodable */
+    uint32_t lost;                              /*!< Gaps in the peer sequence numbers */
+    uint32_t requests;                          /*!< Batches posted */
+    uint32_t ok;                                /*!< 2xx answers */
+    uint32_t err;                               /*!< Failed or timed out requests, the batch is posted again. Peer: failed sends */
+} gateway_stats_t;
+
+/**
+ * \brief           Gateway: listen on GATEWAY_PORT. Peer: create the connection to GATEWAY_IP
+ * \return          STA_OK on success, STA_ERR otherwise
+ */
+status_t gateway_init(void);
+
+/**
+ * \brief           Gateway: add our lines to the batch and post it. Peer: send them to the gateway
+ * \param[in]       lines: '\n' separated lines, timestamps included
+ * \param[in]       len: Length of `lines`
+ * \param[in]       ts: Sample timestamp [s]
+ * \return          1 if taken, 0 to retry later: the previous batch is not acknowledged yet
+ */
+uint8_t gateway_write(const char* lines, size_t len, uint32_t ts);
+
+/**
+ * \brief           Gateway: post the pending batch again, or the collected one if none is pending
+ */
+void gateway_flush(void);
+
+/**
+ * \brief           Statistics since boot
+ */
+const gateway_stats_t* gateway_stats(void);
+
+/**
+ * \brief           Number of peers heard from since boot, up to GATEWAY_MAX_PEERS
+ */
+uint8_t gateway_peers(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* GATEWAY_H */
@@ -0,0 +1,111 @@
+/**
+ * \file history.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Sample history ring in SPI flash with a sparse time index. Header file.
+ * \version 0.1
+ * \date 2021-04-15
+ *
+ * Fixed size records are appended to a ring of HISTORY_FLASH_SECTORS sectors starting
+ * at HISTORY_FLASH_SECTOR. Timestamps only grow, so the ring is sorted. The sparse
+ * index is the first timestamp of every sector, kept in RAM (4 bytes per sector) and
+ * rebuilt from flash on boot. A lookup is a binary search over the index followed by
+ * a binary search over the records of one sector, O(log n) flash reads in total.
+ *
+ * Sector layout: HISTORY_SECTOR_MAGIC word, written with the first record, followed by
+ * HISTORY_SECTOR_SLOTS records. An erased timestamp (0xFFFFFFFF) marks a free slot.
+ * When the ring is full, the oldest sector is erased to make room.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <c_types.h>
+
+#include "status.h"
+#include "user_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define HISTORY_SECTOR_SIZE  4096
+#define HISTORY_SECTOR_MAGIC 0x48495354         /* "HIST" */
+#define HISTORY_SECTOR_SLOTS ((HISTORY_SECTOR_SIZE - 4) / sizeof(history_record_t))
+#define HISTORY_TS_EMPTY     0xFFFFFFFF
+
+#define HISTORY_VALID_SCD30  BIT(0)
+#define HISTORY_VALID_CCS811 BIT(1)
+#define HISTORY_VALID_ZMOD   BIT(2)
+
+/**
+ * \brief           Stored sample. Size must be a multiple of 4 (flash access unit)
+ */
+typedef struct {
+    uint32_t ts;                                /*!< SNTP timestamp [s] */
+    uint16_t scd30_co2;                         /*!< [ppm] */
+    int16_t  scd30_temp;                        /*!< [0.01 C] */
+    uint16_t scd30_rh;                          /*!< [0.01 %] */
+    uint16_t ccs811_eco2;                       /*!< [ppm] */
+    uint16_t ccs811_tvoc;                       /*!< [ppb] */
+    uint16_t zmod_eco2;                         /*!< [ppm] */
+    uint16_t zmod_iaq;                          /*!< [0.01] */
+    uint16_t zmod_tvoc;                         /*!< [0.01 mg/m^3] */
+    uint8_t  valid;                             /*!< HISTORY_VALID_* flags */
+    uint8_t  reserved[3];
+} history_record_t;
+
+/**
+ * \brief           Read position
+ */
+typedef struct {
+    uint16_t sector;                            /*!< Ring sector */
+    uint16_t slot;                              /*!< Record inside the sector */
+    uint32_t sector_ts;                         /*!< First timestamp of the sector, detects a reused sector */
+} history_pos_t;
+
+/**
+ * \brief           Rebuild the index from flash and find the write position
+ * \return          STA_OK on success
+ */
+status_t history_init(void);
+
+/**
+ * \brief           Append a record. Erases the oldest sector when the ring is full
+ * \param[in]       p_record: Record. Its timestamp must be newer than the last one
+ * \return          STA_OK on success. STA_ERR on an old timestamp or a flash error
+ */
+status_t history_append(const history_record_t* p_record);
+
+/**
+ * \brief           Find the first record at or after `ts`
+ * \param[in]       ts: Timestamp
+ * \param[out]      p_pos: Read position
+ * \return          1 if found, 0 if there are no records at or after `ts`
+ */
+uint8_t history_seek(uint32_t ts, history_pos_t* p_pos);
+
+/**
+ * \brief           Read the record at `p_pos` and move to the next one
+ * \param[in,out]   p_pos: Read position
+ * \param[out]      p_record: Record
+ * \return          1 on success. 0 at the end or if the sector was reused meanwhile
+ */
+uint8_t history_next(history_pos_t* p_pos, history_record_t* p_record);
+
+/**
+ * \brief           Get the timestamp of the newest record. It changes with every append
+ * \return          Timestamp. 0 if the ring is empty
+ */
+uint32_t history_last_ts(void);
+
+/**
+ * \brief           Get the number of stored records
+ * \return          Records in the ring
+ */
+uint32_t history_count(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* HISTORY_H */
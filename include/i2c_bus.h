@@ -0,0 +1,110 @@
+/**
+ * \file i2c_bus.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Shared I2C bus scheduler. Header file.
+ * \version 0.1
+ * \date 2021-04-04
+ *
+ * All the sensors share the same software I2C bus. Instead of accessing it directly
+ * from the timers, each device operation is submitted as a job. Jobs are executed one
+ * by one from a system task, highest priority first (FIFO within the same priority),
+ * so transactions of two devices never interleave.
+ */
+
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <c_types.h>
+
+#include "status.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define I2C_BUS_QUEUE_SIZE 8
+#define I2C_BUS_TASK_PRIO  USER_TASK_PRIO_2  /* Highest user task, sensor jobs run before web work */
+#define I2C_BUS_REPORT_SIZE (80 * (I2C_BUS_DEV_MAX + 1))
+
+/**
+ * \brief           Devices attached to the bus
+ */
+typedef enum i2c_bus_dev {
+    I2C_BUS_DEV_ZMOD,
+    I2C_BUS_DEV_CCS811,
+    I2C_BUS_DEV_SCD30,
+    I2C_BUS_DEV_MAX,
+} i2c_bus_dev_t;
+
+/**
+ * \brief           Job priorities. Higher runs first
+ */
+typedef enum i2c_bus_prio {
+    I2C_BUS_PRIO_LOW,
+    I2C_BUS_PRIO_MEDIUM,
+    I2C_BUS_PRIO_HIGH,
+} i2c_bus_prio_t;
+
+/**
+ * \brief           Bus job function. Owns the bus until it returns
+ */
+typedef void (*i2c_bus_job_t)(void* arg);
+
+/**
+ * \brief           Per device scheduler statistics
+ */
+typedef struct {
+    uint32_t jobs;                              /*!< Executed jobs */
+    uint32_t coalesced;                         /*!< Submits dropped, job of the device already queued */
+    uint32_t rejected;                          /*!< Submits dropped, queue full */
+    uint32_t wait_us;                           /*!< Total queueing delay */
+    uint32_t wait_max_us;                       /*!< Max queueing delay */
+    uint32_t run_us;                            /*!< Total time owning the bus */
+} i2c_bus_stats_t;
+
+/**
+ * \brief           Init the scheduler task
+ * \return          Result of the operation
+ */
+status_t i2c_bus_init(void);
+
+/**
+ * \brief           Queue a device job
+ * \param[in]       dev: Device that the job talks to
+ * \param[in]       prio: Job priority
+ * \param[in]       job: Job function
+ * \param[in]       arg: Job function argument
+ * \return          STA_OK if queued. STA_ERR if the device has a job pending or the queue is full
+ */
+status_t i2c_bus_submit(i2c_bus_dev_t dev, i2c_bus_prio_t prio, i2c_bus_job_t job, void* arg);
+
+/**
+ * \brief           Take the bus outside of a job (ex. init code)
+ * \return          STA_OK if the bus was free
+ */
+status_t i2c_bus_acquire(void);
+
+/**
+ * \brief           Release the bus taken with \ref i2c_bus_acquire
+ */
+void i2c_bus_release(void);
+
+/**
+ * \brief           Get the statistics of a device
+ * \param[in]       dev: Device
+ * \return          Statistics
+ */
+const i2c_bus_stats_t* i2c_bus_get_stats(i2c_bus_dev_t dev);
+
+/**
+ * \brief           Write a text report of the statistics
+ * \param[out]      buff: Destination buffer. At least I2C_BUS_REPORT_SIZE bytes
+ * \return          Written characters
+ */
+size_t i2c_bus_sprintf(char* buff);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* I2C_BUS_H */
@@ -0,0 +1,127 @@
+/**
+ * \file i2c_trace.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief I2C bus transaction tracer and per device statistics. Header file.
+ * \version 0.1
+ * \date 2021-04-02
+ *
+ * A transaction is everything between an I2C START and the next STOP (or START).
+ * Every transaction is timestamped with system_get_time() and stored in a fixed
+ * size trace ring. Per slave address, bytes, duration, NACKs, clock stretching and
+ * the idle gap from the previous transaction to the same slave are accumulated.
+ */
+
+#ifndef I2C_TRACE_H
+#define I2C_TRACE_H
+
+#include <c_types.h>
+
+#include "user_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define I2C_TRACE_RING_SIZE    32               /* Must be a power of 2 */
+#define I2C_TRACE_MAX_DEVICES  4
+#define I2C_TRACE_HIST_BUCKETS 8
+#define I2C_TRACE_DURATION_MIN 128              /* [us] Upper limit of the first duration bucket */
+#define I2C_TRACE_GAP_MAX      100000           /* [us] Longer gaps are not accounted as device gap */
+
+#define I2C_TRACE_DEV_LINE_SIZE   100           /* Max length of a statistics line of the text report */
+#define I2C_TRACE_ENTRY_LINE_SIZE 64            /* Max length of a transaction line of the text report */
+#define I2C_TRACE_REPORT_SIZE     (I2C_TRACE_DEV_LINE_SIZE * (3 * I2C_TRACE_MAX_DEVICES + 2) + \
+                                   I2C_TRACE_ENTRY_LINE_SIZE * I2C_TRACE_RING_SIZE)
+
+/**
+ * \brief           Single I2C transaction
+ */
+typedef struct {
+    uint32_t start_us;                          /*!< system_get_time() on START */
+    uint32_t duration_us;                       /*!< START to STOP */
+    uint32_t stretch_us;                        /*!< Clock stretching inside the transaction */
+    uint16_t bytes;                             /*!< Data bytes, address byte excluded */
+    uint8_t  addr;                              /*!< 7-bit slave address */
+    uint8_t  op    : 1;                         /*!< i2c_start_op_t */
+    uint8_t  nacks : 7;                         /*!< Not acknowledged bytes */
+} i2c_trace_entry_t;
+
+/**
+ * \brief           Accumulated statistics of a slave address
+ */
+typedef struct {
+    uint8_t  addr;                              /*!< 7-bit slave address */
+    uint32_t transactions;                      /*!< Number of transactions */
+    uint32_t bytes;                             /*!< Total data bytes */
+    uint32_t nacks;                             /*!< Total NACKs */
+    uint32_t busy_us;                           /*!< Total time inside transactions */
+    uint32_t stretch_us;                        /*!< Total clock stretching time */
+    uint32_t gap_us;                            /*!< Total idle time between consecutive transactions */
+    uint32_t max_us;                            /*!< Longest transaction */
+    uint32_t duration_hist[I2C_TRACE_HIST_BUCKETS];   /*!< log2 buckets from I2C_TRACE_DURATION_MIN us */
+    uint32_t bytes_hist[I2C_TRACE_HIST_BUCKETS];      /*!< log2 buckets: 0, 1, 2, 3-4, 5-8, .. */
+} i2c_trace_device_t;
+
+#ifdef I2C_TRACE_ENABLE
+
+void i2c_trace_start(uint8_t addr, uint8_t op);
+void i2c_trace_ack(uint8_t ack);
+void i2c_trace_bytes(uint16_t bytes);
+void i2c_trace_stop(void);
+
+#define I2C_TRACE_START(addr, op) i2c_trace_start(addr, op)
+#define I2C_TRACE_ACK(ack)        i2c_trace_ack(ack)
+#define I2C_TRACE_BYTES(n)        i2c_trace_bytes(n)
+#define I2C_TRACE_STOP()          i2c_trace_stop()
+
+/**
+ * \brief           Init the tracer. Registers the 'i2c' serial command if the console is enabled
+ */
+void i2c_trace_init(void);
+
+/**
+ * \brief           Clear the trace ring and all the statistics
+ */
+void i2c_trace_reset(void);
+
+/**
+ * \brief           Copy the last transactions, oldest first
+ * \param[out]      p_entries: Destination buffer
+ * \param[in]       max_entries: Destination buffer length
+ * \return          Number of copied entries
+ */
+size_t i2c_trace_get_entries(i2c_trace_entry_t* p_entries, size_t max_entries);
+
+/**
+ * \brief           Get the statistics of a slave address
+ * \param[in]       addr: 7-bit slave address
+ * \return          Statistics or NULL if the address was never seen
+ */
+const i2c_trace_device_t* i2c_trace_get_device(uint8_t addr);
+
+/**
+ * \brief           Write a text report (statistics + trace ring)
+ * \param[out]      buff: Destination buffer. At least I2C_TRACE_REPORT_SIZE bytes
+ * \return          Written characters
+ */
+size_t i2c_trace_sprintf(char* buff);
+
+/**
+ * \brief           Print the text report through the serial port
+ */
+void i2c_trace_print(void);
+
+#else
+
+#define I2C_TRACE_START(addr, op) do {} while (0)
+#define I2C_TRACE_ACK(ack)        do {} while (0)
+#define I2C_TRACE_BYTES(n)        do {} while (0)
+#define I2C_TRACE_STOP()          do {} while (0)
+
+#endif /* I2C_TRACE_ENABLE */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* I2C_TRACE_H */
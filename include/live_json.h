@@ -0,0 +1,129 @@
+/**
+ * \file live_json.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Latest sample of every sensor as a precomputed JSON document. Header file.
+ * \version 0.1
+ * \date 2021-04-12
+ *
+ * The document layout is built once by live_json_init(). Every value has a fixed
+ * width slot, right aligned and padded with spaces (valid JSON whitespace), so a new
+ * sample only rewrites its own slots and `/api/v1/latest` is served as is.
+ *
+ * Updates patch a master document in place. live_json_get() hands out a copy of it
+ * and pins the copy until live_json_release(), so a response in flight is never
+ * modified, however many updates come before it is sent. The copy is refreshed only
+ * when the sequence number moved. With all LIVE_JSON_COPIES pinned the most recent
+ * copy is served again: behind the master, but consistent with its sequence number.
+ *
+ * Only valid samples are written. `valid` is true once a sensor delivered one, an
+ * invalid or not ready read leaves its object untouched and `ts` tells its age.
+ *
+ * A sensor job patches its objects and then calls live_json_commit(), which bumps the
+ * sample sequence number once if anything was written. The number identifies the
+ * document and is its HTTP entity tag, so polling clients only get a new body when
+ * there is a new sample. It starts at a random value on boot, a tag cached before a
+ * reboot does not match the new documents.
+ */
+
+#ifndef LIVE_JSON_H
+#define LIVE_JSON_H
+
+#include <c_types.h>
+
+#include "sensors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define LIVE_JSON_SIZE   800
+#define LIVE_JSON_COPIES 2                      /* Documents that can be in flight at the same time */
+
+/**
+ * \brief           ZMOD4410 result lanes
+ */
+typedef enum live_json_zmod_lane {
+    LIVE_JSON_ZMOD,                             /*!< Continuous LP mode */
+    LIVE_JSON_ZMOD_RESET,                       /*!< LP mode with periodic algorithm reset */
+    LIVE_JSON_ZMOD_HALT,                        /*!< LP mode with periodic halt */
+    LIVE_JSON_ZMOD_MAX,
+} live_json_zmod_lane_t;
+
+/**
+ * \brief           Top level objects of the document
+ */
+typedef enum live_json_section {
+    LIVE_JSON_SECTION_SCD30,
+    LIVE_JSON_SECTION_CCS811,
+    LIVE_JSON_SECTION_ZMOD,                     /*!< Followed by the other ZMOD lanes, in live_json_zmod_lane_t order */
+    LIVE_JSON_SECTION_ZMOD_RESET,
+    LIVE_JSON_SECTION_ZMOD_HALT,
+    LIVE_JSON_SECTION_MAX,
+} live_json_section_t;
+
+/**
+ * \brief           Build the document layout, all sensors invalid
+ */
+void live_json_init(void);
+
+/**
+ * \brief           Patch the SCD30 slots
+ * \param[in]       valid: 1 if `p_result` holds a new sample, 0 to leave the slots as they are
+ * \param[in]       p_result: SCD30 result
+ */
+void live_json_update_scd30(uint8_t valid, const scd30_result_t* p_result);
+
+/**
+ * \brief           Patch the CCS811 slots
+ * \param[in]       valid: 1 if `p_data` holds a new sample, 0 to leave the slots as they are
+ * \param[in]       p_data: CCS811 data
+ */
+void live_json_update_ccs811(uint8_t valid, const ccs811_data_t* p_data);
+
+/**
+ * \brief           Patch the slots of a ZMOD4410 lane
+ * \param[in]       lane: Result lane
+ * \param[in]       valid: 1 if `p_results` holds a new sample, 0 to leave the slots as they are
+ * \param[in]       p_results: Algorithm results
+ */
+void live_json_update_zmod(live_json_zmod_lane_t lane, uint8_t valid, const iaq_1st_gen_results_t* p_results);
+
+/**
+ * \brief           Publish the samples written since the last call: bump the sequence number
+ *                  once if there is any. Call it at the end of every sensor job
+ */
+void live_json_commit(void);
+
+/**
+ * \brief           Current document, pinned until live_json_release()
+ * \param[out]      p_len: Document length
+ * \param[out]      p_seq: Sequence number of the returned document, for the entity tag
+ * \return          Pointer to the document, not NUL terminated
+ */
+char* live_json_get(size_t* p_len, uint32_t* p_seq);
+
+/**
+ * \brief           Unpin a document. A simple_http_server_release_t for `keep_response`
+ * \param[in]       arg: Pointer returned by live_json_get()
+ */
+void live_json_release(void* arg);
+
+/**
+ * \brief           Object of a single sensor inside the current document, e.g. `{"valid":true ,...}`
+ * \param[in]       section: Sensor object
+ * \param[out]      p_len: Object length
+ * \return          Pointer into the document, not NUL terminated. NULL if `section` is not valid
+ */
+const char* live_json_section(live_json_section_t section, size_t* p_len);
+
+/**
+ * \brief           Sample sequence number of the master document
+ * \return          Sequence number, bumped by live_json_commit()
+ */
+uint32_t live_json_seq(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* LIVE_JSON_H */
@@ -0,0 +1,94 @@
+/**
+ * \file sensor_irq.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Sensor data ready interrupts. Header file.
+ * \version 0.1
+ * \date 2021-04-08
+ *
+ * SCD30 RDY (active high) and CCS811 nINT (active low, open-drain) are wired to GPIOs.
+ * An edge disables the pin interrupt and schedules the source callback from a timer,
+ * out of the interrupt context. The callback queues the bus job, and the job calls
+ * sensor_irq_done() after reading, which re-arms the pin. If the line is still
+ * active at that point (missed edge), the callback is scheduled again right away.
+ * A read that found no data with the line still active re-arms only after the old
+ * polling period (SCD30_READ_INTERVAL, CCS_READ_INTERVAL): a sensor holding its line
+ * in an error state is retried at that rate instead of back to back.
+ */
+
+#ifndef SENSOR_IRQ_H
+#define SENSOR_IRQ_H
+
+#include <c_types.h>
+
+#include "status.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define SENSOR_IRQ_SCD30_MUX   PERIPHS_IO_MUX_MTDI_U
+#define SENSOR_IRQ_SCD30_GPIO  12
+#define SENSOR_IRQ_SCD30_FUNC  FUNC_GPIO12
+
+#define SENSOR_IRQ_CCS811_MUX  PERIPHS_IO_MUX_MTMS_U
+#define SENSOR_IRQ_CCS811_GPIO 14
+#define SENSOR_IRQ_CCS811_FUNC FUNC_GPIO14
+
+/**
+ * \brief           Interrupt sources
+ */
+typedef enum sensor_irq_src {
+    SENSOR_IRQ_SCD30,
+    SENSOR_IRQ_CCS811,
+    SENSOR_IRQ_MAX,
+} sensor_irq_src_t;
+
+/**
+ * \brief           Data ready callback. Runs from a timer, not from the ISR
+ */
+typedef void (*sensor_irq_cb_t)(void);
+
+/**
+ * \brief           Per source statistics
+ */
+typedef struct {
+    uint32_t irqs;                              /*!< Edges seen */
+    uint32_t rearm_active;                      /*!< Line already active when re-armed */
+    uint32_t reads;                             /*!< Reads reported with sensor_irq_done */
+    uint32_t not_ready;                         /*!< Reads that found no new data */
+    uint32_t backoffs;                          /*!< Re-arms delayed, line active without data */
+} sensor_irq_stats_t;
+
+/**
+ * \brief           Configure the pins and attach the GPIO interrupt handler. Sources start disarmed
+ * \param[in]       scd30_cb: SCD30 data ready callback
+ * \param[in]       ccs811_cb: CCS811 data ready callback
+ * \return          STA_OK on success
+ */
+status_t sensor_irq_init(sensor_irq_cb_t scd30_cb, sensor_irq_cb_t ccs811_cb);
+
+/**
+ * \brief           Enable the edge interrupt of a source
+ * \param[in]       src: Interrupt source
+ */
+void sensor_irq_arm(sensor_irq_src_t src);
+
+/**
+ * \brief           Report a finished read and re-arm the source
+ * \param[in]       src: Interrupt source
+ * \param[in]       data_ready: 1 if the read returned new data
+ */
+void sensor_irq_done(sensor_irq_src_t src, uint8_t data_ready);
+
+/**
+ * \brief           Get the statistics of a source
+ * \param[in]       src: Interrupt source
+ * \return          Pointer to the statistics. NULL if `src` is not valid
+ */
+const sensor_irq_stats_t* sensor_irq_get_stats(sensor_irq_src_t src);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* SENSOR_IRQ_H */
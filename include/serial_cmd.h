@@ -0,0 +1,47 @@
+/**
+ * \file serial_cmd.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Minimal line based command console over UART0. Header file.
+ * \version 0.1
+ * \date 2021-04-02
+ */
+
+#ifndef SERIAL_CMD_H
+#define SERIAL_CMD_H
+
+#include <c_types.h>
+
+#include "status.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define SERIAL_CMD_LINE_SIZE 48
+#define SERIAL_CMD_MAX_CMDS  12                 /* help and every module console, all options enabled: 10 */
+
+/**
+ * \brief           Command handler function definition
+ * \param[in]       args: Rest of the line after the command name (never NULL)
+ */
+typedef void (*serial_cmd_handler_t)(const char* args);
+
+/**
+ * \brief           Start listening for commands on UART0
+ * \return          Result of the operation
+ */
+status_t serial_cmd_init(void);
+
+/**
+ * \brief           Add a command to the console
+ * \param[in]       name: Command name. Must be a static string
+ * \param[in]       handler: Function called when the command is received
+ * \return          Result of the operation
+ */
+status_t serial_cmd_register(const char* name, serial_cmd_handler_t handler);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* SERIAL_CMD_H */
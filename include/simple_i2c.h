@@ -12,6 +12,7 @@
 
 #include <c_types.h>
 #include "driver/i2c_master.h"
+#include "i2c_trace.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -41,9 +42,11 @@ typedef enum i2c_start_op {
  * \hideinitializer
  */
 #define I2C_START(addr, op, p_result) do { \
+    I2C_TRACE_START(addr, op);             \
     i2c_master_start();                    \
     i2c_master_writeByte((addr<<1) + op);  \
     *p_result = i2c_master_checkAck();     \
+    I2C_TRACE_ACK(*p_result);              \
 } while(0)
 
 /**
@@ -73,6 +76,7 @@ typedef enum i2c_start_op {
  */
 #define I2C_STOP(p_result) do { \
     i2c_master_stop();          \
+    I2C_TRACE_STOP();           \
     *p_result = 1;              \
 } while(0)
 
@@ -85,6 +89,8 @@ typedef enum i2c_start_op {
 #define I2C_WRITE_BYTE(data, p_result) do { \
     i2c_master_writeByte(data);             \
     *p_result = i2c_master_checkAck();      \
+    I2C_TRACE_BYTES(1);                     \
+    I2C_TRACE_ACK(*p_result);               \
 } while(0)
 
 /**
@@ -119,6 +125,7 @@ typedef enum i2c_start_op {
     } else {                                 \
         *p_data = i2c_master_readByte();     \
         i2c_master_send_nack();              \
+        I2C_TRACE_BYTES(1);                  \
         *p_result = 1;                       \
     }                                        \
 } while(0)
@@ -140,6 +147,7 @@ typedef enum i2c_start_op {
         }                                               \
         p_data[data_len-1] = i2c_master_readByte();     \
         i2c_master_send_nack();                         \
+        I2C_TRACE_BYTES(data_len);                      \
         *p_result = 1;                                  \
    }                                                    \
 } while(0)
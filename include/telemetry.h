@@ -0,0 +1,112 @@
+/**
+ * \file telemetry.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Sample fan-out to the upload sinks. Header file.
+ * \version 0.1
+ * \date 2021-04-19
+ *
+ * A sample is encoded once, as line protocol lines with the timestamp appended, and
+ * copied into a shared ring. Every sink keeps its own read position, its queue is the
+ * part of the ring it has not taken yet, bounded by the sink `depth`. A sink that
+ * refuses a sample (transport busy or down) keeps it queued and is retried every
+ * TELEMETRY_RETRY_INTERVAL ms. Past `depth`, its oldest samples are dropped, so a slow
+ * or dead sink never holds back the others.
+ *
+ * Batching is the sink policy: HTTP posts one sample per request, MQTT publishes one
+ * message per line, UDP packs lines into datagrams and flushes on its own timer.
+ * telemetry_flush pushes out whatever the sinks hold.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <c_types.h>
+
+#include "status.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define TELEMETRY_RING_LEN       4              /* Must be a power of 2. Max sink depth */
+#define TELEMETRY_SAMPLE_SIZE    640            /* Encoded sample, terminator included */
+#define TELEMETRY_MAX_SINKS      4
+#define TELEMETRY_RETRY_INTERVAL 1000           /* [ms] */
+
+/**
+ * \brief           Encoded sample, shared by all sinks
+ */
+typedef struct {
+    uint32_t seq;                               /*!< Sample number since boot */
+    uint32_t ts;                                /*!< SNTP timestamp [s], 0 if not synced */
+    uint16_t len;                               /*!< Length of `text` */
+    uint8_t  lines;                             /*!< Lines in `text` */
+    char     text[TELEMETRY_SAMPLE_SIZE];       /*!< '\n' terminated lines, " <ts>" appended if synced */
+} telemetry_sample_t;
+
+/**
+ * \brief           Upload sink
+ */
+typedef struct {
+    const char* name;                           /*!< Short name for stats and metrics */
+    status_t (*init)(void);                     /*!< Called once from telemetry_init. May be NULL */
+    uint8_t (*enqueue)(const telemetry_sample_t* p_sample); /*!< Take the sample. 0 to keep it queued */
+    void (*flush)(void);                        /*!< Send what the sink buffers. May be NULL */
+    uint8_t depth;                              /*!< Max queued samples, up to TELEMETRY_RING_LEN */
+} telemetry_sink_t;
+
+/**
+ * \brief           Per sink statistics
+ */
+typedef struct {
+    uint32_t queued;                            /*!< Samples waiting now */
+    uint32_t sent;                              /*!< Samples taken by the sink */
+    uint32_t dropped;                           /*!< Samples over `depth` */
+    uint32_t busy;                              /*!< Times the sink refused a sample */
+} telemetry_stats_t;
+
+/**
+ * \brief           Set the sinks and call their init
+ * \param[in]       p_sinks: Sink table. Must be static
+ * \param[in]       sinks_len: Entries in `p_sinks`, up to TELEMETRY_MAX_SINKS
+ * \return          STA_OK if every sink started, STA_ERR otherwise
+ */
+status_t telemetry_init(const telemetry_sink_t* p_sinks, uint8_t sinks_len);
+
+/**
+ * \brief           Encode a sample and hand it to every sink
+ * \param[in]       lines: '\n' separated line protocol lines without timestamp
+ * \param[in]       len: Length of `lines`
+ * \param[in]       ts: Timestamp appended to every line [s]. 0 to let the database set it
+ * \return          STA_ERR if nothing fit a sample, STA_OK otherwise
+ */
+status_t telemetry_publish(const char* lines, size_t len, uint32_t ts);
+
+/**
+ * \brief           Flush every sink
+ */
+void telemetry_flush(void);
+
+/**
+ * \brief           Sink count
+ */
+uint8_t telemetry_sinks_len(void);
+
+/**
+ * \brief           Sink name
+ * \param[in]       sink: Index in the sink table
+ */
+const char* telemetry_sink_name(uint8_t sink);
+
+/**
+ * \brief           Sink statistics
+ * \param[in]       sink: Index in the sink table
+ * \param[out]      p_stats: Statistics since boot
+ */
+void telemetry_sink_stats(uint8_t sink, telemetry_stats_t* p_stats);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* TELEMETRY_H */
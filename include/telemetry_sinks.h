@@ -0,0 +1,70 @@
+/**
+ * \file telemetry_sinks.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief HTTP (InfluxDB), UDP, MQTT and serial telemetry sinks. Header file.
+ * \version 0.1
+ * \date 2021-04-19
+ *
+ * Every sink enabled in user_config.h is registered: INFLUX_HTTP_ENABLE,
+ * UDP_SINK_ENABLE, MQTT_ENABLE, TELEMETRY_SERIAL_ENABLE and GATEWAY_ENABLE or
+ * GATEWAY_PEER_ENABLE.
+ *
+ * HTTP: one POST per sample, one request at a time. A sample stays queued until its
+ * POST gets a 2xx. An error status, a timeout or a Retry-After hold keeps it, and it is
+ * posted again on the next retry. Samples queue while a request is in flight or the
+ * station is offline.
+ * UDP: never busy, lines are packed by udp_sink.
+ * MQTT: one message per line, to MQTT_TOPIC_PREFIX + measurement. With QoS 1 a sample
+ * waits until the in-flight window has room for all its lines, with QoS 0 until the
+ * client is connected and its send queue has room for all of them. A line over
+ * SIMPLE_MQTT_MSG_SIZE is never published, its sample waits until dropped.
+ * Serial: prints every sample on UART0.
+ * Gateway: view gateway.h. The gateway waits like HTTP, until its previous batch gets
+ * a 2xx. A peer never waits.
+ */
+
+#ifndef TELEMETRY_SINKS_H
+#define TELEMETRY_SINKS_H
+
+#include <c_types.h>
+
+#include "status.h"
+#include "user_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define TELEMETRY_HTTP_DEPTH   4                /* ~40 s of samples at SERVER_WRITE_INTERVAL */
+#define TELEMETRY_HTTP_TIMEOUT 30000000         /* [us] Request without callback, given up */
+#define TELEMETRY_UDP_DEPTH    1
+#define TELEMETRY_MQTT_DEPTH   4
+#define TELEMETRY_SERIAL_DEPTH 1
+#define TELEMETRY_GW_DEPTH     4
+
+/**
+ * \brief           HTTP upload statistics
+ */
+typedef struct {
+    uint32_t ok;                                /*!< 2xx responses */
+    uint32_t err;                               /*!< Failed requests */
+    uint32_t busy_us;                           /*!< Time from request to response callback */
+    uint32_t lines;                             /*!< Lines acknowledged with a 2xx */
+} telemetry_http_stats_t;
+
+/**
+ * \brief           Register the enabled sinks with telemetry_init
+ * \return          STA_OK if every sink started, STA_ERR otherwise
+ */
+status_t telemetry_sinks_init(void);
+
+/**
+ * \brief           HTTP upload statistics since boot
+ */
+const telemetry_http_stats_t* telemetry_http_stats(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* TELEMETRY_SINKS_H */
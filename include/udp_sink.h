@@ -0,0 +1,73 @@
+/**
+ * \file udp_sink.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Line protocol upload over UDP (InfluxDB / Telegraf UDP listener). Header file.
+ * \version 0.1
+ * \date 2021-04-17
+ *
+ * Lines are packed into one datagram of up to UDP_SINK_PAYLOAD bytes, so there is no
+ * fragmentation, no connection and no DNS lookup per upload. A datagram is sent when
+ * the next line does not fit, or UDP_SINK_FLUSH_DELAY ms after its first line.
+ *
+ * Every datagram starts with a `udp_sink,host=<HOSTNAME> seq=<n>i` line. `seq` grows by
+ * one per datagram, also when a send fails, so the receiver counts lost datagrams from
+ * the gaps. Lines are timestamped on the device [s], the listener must use
+ * `precision = "s"`, like INFLUX_URL.
+ *
+ * `busy_us` adds the time from `espconn_sendto` to the sent callback. It is the proxy
+ * for radio on time used to compare against the HTTP upload, with both sinks enabled.
+ */
+
+#ifndef UDP_SINK_H
+#define UDP_SINK_H
+
+#include <c_types.h>
+
+#include "status.h"
+#include "user_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief           Sink statistics
+ */
+typedef struct {
+    uint32_t datagrams;                         /*!< Datagrams handed to the stack */
+    uint32_t lines;                             /*!< Lines sent, header lines not included */
+    uint32_t bytes;                             /*!< Payload bytes sent */
+    uint32_t errors;                            /*!< Failed sends, their lines are lost */
+    uint32_t dropped;                           /*!< Lines longer than a datagram */
+    uint32_t busy_us;                           /*!< Time from send to sent callback */
+} udp_sink_stats_t;
+
+/**
+ * \brief           Create the UDP connection to UDP_SINK_IP:UDP_SINK_PORT
+ * \return          STA_OK on success, STA_ERR otherwise
+ */
+status_t udp_sink_init(void);
+
+/**
+ * \brief           Queue '\n' separated line protocol lines
+ * \param[in]       lines: Lines without timestamp
+ * \param[in]       len: Length of `lines`
+ * \param[in]       ts: Timestamp appended to every line [s]. 0 to let the receiver set it
+ */
+void udp_sink_write(const char* lines, size_t len, uint32_t ts);
+
+/**
+ * \brief           Send the pending datagram now
+ */
+void udp_sink_flush(void);
+
+/**
+ * \brief           Statistics since boot
+ */
+const udp_sink_stats_t* udp_sink_stats(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* UDP_SINK_H */
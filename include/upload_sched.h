@@ -0,0 +1,80 @@
+/**
+ * \file upload_sched.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Upload timing across a fleet: phase, jitter and server hints. Header file.
+ * \version 0.1
+ * \date 2021-04-21
+ *
+ * With a fixed SERVER_WRITE_INTERVAL, boards powered on together upload in the same
+ * few milliseconds for as long as they run. Three things spread them:
+ *
+ *   - Phase: the first upload waits SERVER_WRITE_INTERVAL plus an offset in
+ *     [0, SERVER_WRITE_INTERVAL) hashed from the station MAC. Stable across reboots.
+ *   - Jitter: every following interval is SERVER_WRITE_INTERVAL +- UPLOAD_JITTER ms,
+ *     from os_random. The mean rate does not change.
+ *   - Hints: a `Retry-After: <s>` on a 429 or 503 holds the HTTP sink for that long,
+ *     up to UPLOAD_RETRY_AFTER_MAX. An UPLOAD_SLOT_HEADER `<ms>` header on any response
+ *     delays the next upload once by that much, up to SERVER_WRITE_INTERVAL, so the
+ *     collector can move boards out of a crowded slot. HTTP-date Retry-After values
+ *     are ignored.
+ */
+
+#ifndef UPLOAD_SCHED_H
+#define UPLOAD_SCHED_H
+
+#include <c_types.h>
+
+#include "user_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief           Scheduler state and counters
+ */
+typedef struct {
+    uint32_t phase_ms;                          /*!< Offset of the first upload, from the MAC */
+    uint32_t hints;                             /*!< Slot hints applied */
+    uint32_t holds;                             /*!< Retry-After holds */
+    uint32_t held_s;                            /*!< Sum of the Retry-After holds */
+} upload_sched_stats_t;
+
+/**
+ * \brief           Compute the phase from the station MAC
+ */
+void upload_sched_init(void);
+
+/**
+ * \brief           Delay of the first upload, SERVER_WRITE_INTERVAL + phase [ms]
+ */
+uint32_t upload_sched_first(void);
+
+/**
+ * \brief           Delay to the next upload, with jitter and a pending slot hint [ms]
+ */
+uint32_t upload_sched_next(void);
+
+/**
+ * \brief           Take the hints of an upload response
+ * \param[in]       status: HTTP status
+ * \param[in]       buffer: Whole response, headers included
+ */
+void upload_sched_response(uint16_t status, const char* buffer);
+
+/**
+ * \brief           Check for a Retry-After hold
+ * \return          1 while the collector asked to wait, 0 otherwise
+ */
+uint8_t upload_sched_held(void);
+
+/**
+ * \brief           Statistics since boot
+ */
+const upload_sched_stats_t* upload_sched_stats(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* UPLOAD_SCHED_H */
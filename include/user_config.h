@@ -1,3 +1,6 @@
+#ifndef USER_CONFIG_H
+#define USER_CONFIG_H
+
 // Debug
 #ifndef DEBUG_PRINT_MODE
 #define DEBUG_PRINT_MODE
@@ -5,6 +8,7 @@
 
 // UART
 #define	BITRATE 115200
+// #define SERIAL_CMD_ENABLE  /* Command console on UART0. Type 'help' */
 
 // Network
 #define SSID     "mrrb_dev"
@@ -19,6 +23,7 @@
 
 // I2C
 // View header $(PROJECT_ROOT)/driver/driver/i2c_master.h
+// #define I2C_TRACE_ENABLE   /* Bus transaction tracer. Serial 'i2c' command and web '/i2c' */
 
 // Status LED
 #define STATUS_LED_ENABLE
@@ -32,6 +37,18 @@
 #define CCS_READ_INTERVAL     10101
 #define SERVER_WRITE_INTERVAL 10201
 
+// #define SENSOR_IRQ_ENABLE              /* SCD30 RDY / CCS811 nINT interrupts. Pins in sensor_irq.h */
+#define SENSOR_IRQ_FALLBACK_INTERVAL 60000  /* Poll anyway in case an edge is lost */
+
+// #define CCS811_THRESH_ENABLE           /* nINT only on eCO2 band changes. Needs SENSOR_IRQ_ENABLE */
+#define CCS811_THRESH_LOW_MEDIUM  1500      /* eCO2 ppm */
+#define CCS811_THRESH_MEDIUM_HIGH 2500      /* eCO2 ppm */
+#define CCS811_HEARTBEAT_INTERVAL 300000    /* Read and upload a sample at least this often */
+
+// #define HISTORY_ENABLE                 /* Sample history in flash, web '/api/v1/history'. Needs >= 2MB flash */
+#define HISTORY_FLASH_SECTOR  0x100         /* First sector (1MB offset, after the firmware) */
+#define HISTORY_FLASH_SECTORS 256           /* 170 samples each, ~5 days at SERVER_WRITE_INTERVAL */
+
 // 111  * 6 ≈ 666s  ≈ 11min
 // 1111 * 6 ≈ 6666s ≈ 1111min ≈ 1h 50min
 #define ZMOD_TEST_RESET_COUNT_ON  111   /* ZMOD measures before reseting ZMOD variables */
@@ -47,11 +64,43 @@
 #define SNTP_SERVERNAME_1 "1.es.pool.ntp.org"
 #define SNTP_TIMEZONE     1
 
+// Telemetry sinks, any combination. View telemetry_sinks.h
+#define INFLUX_HTTP_ENABLE                  /* POST to INFLUX_URL */
+#define TELEMETRY_SERIAL_ENABLE             /* Print every sample on UART0 */
+
 // InfluxDB 2
 #define INFLUX_URL         "http://<db_url>/api/v2/write?org=<org>>&bucket=<bucket_name>&precision=s"
 #define INFLUX_TOKEN       ""
 #define INFLUX_AUTH_HEADER "Authorization: Token "INFLUX_TOKEN
 
+#define UPLOAD_SPREAD_ENABLE                /* Upload phase from the MAC, jitter and server hints. View upload_sched.h */
+#define UPLOAD_JITTER          500          /* [ms] +- on every SERVER_WRITE_INTERVAL */
+#define UPLOAD_RETRY_AFTER_MAX 300          /* [s] Longer Retry-After values are clamped */
+#define UPLOAD_SLOT_HEADER     "x-upload-delay" /* [ms] One-shot delay of the next upload. Lower case */
+
+// #define UDP_SINK_ENABLE                /* Line protocol over UDP. View udp_sink.h */
+#define UDP_SINK_IP          {192, 168, 1, 2}  /* InfluxDB / Telegraf UDP listener, precision = "s" */
+#define UDP_SINK_PORT        8089
+#define UDP_SINK_PAYLOAD     1472           /* 1500 B MTU - IP and UDP headers */
+#define UDP_SINK_FLUSH_DELAY 30000          /* Max wait of a line for a full datagram [ms] */
+
+// #define MQTT_ENABLE                    /* Publish over MQTT. View simple_mqtt.h */
+#define MQTT_HOST         "192.168.1.2"
+#define MQTT_PORT         1883
+#define MQTT_USER         NULL
+#define MQTT_PASSWORD     NULL
+#define MQTT_QOS          1
+#define MQTT_TOPIC_PREFIX "co2logger/"HOSTNAME"/"  /* One topic per sensor, prefix + measurement */
+
+// Gateway, one upload per room. View gateway.h. Instead of INFLUX_HTTP_ENABLE
+// #define GATEWAY_ENABLE                 /* Collect peer samples and post them with ours */
+// #define GATEWAY_PEER_ENABLE            /* Send our samples to the gateway */
+#define GATEWAY_IP         {192, 168, 1, 3}
+#define GATEWAY_PORT       8090
+#define GATEWAY_MAX_PEERS  6                /* Each peer takes 2 x TELEMETRY_SAMPLE_SIZE of batch */
+
 // Other
 #define USE_OPTIMIZE_PRINTF
 // #define MEMLEAK_DEBUG
+
+#endif /* USER_CONFIG_H */
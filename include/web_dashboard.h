@@ -0,0 +1,39 @@
+/**
+ * \file web_dashboard.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Static HTML dashboard served from flash. Header file.
+ * \version 0.1
+ * \date 2021-04-16
+ *
+ * web/dashboard.html is gzip compressed by the Makefile and linked into flash as a
+ * word aligned array (build/web/dashboard_gz.c). The page is sent as is with
+ * `Content-Encoding: gzip`, copied to the socket a piece at a time by the HTTP server,
+ * so serving it takes no heap and no RAM copy of the page. The page reads its values
+ * from `/api/v1/latest`, `/events` and, if enabled, `/api/v1/history`.
+ *
+ * The entity tag is a hash of the compressed page, made at build time. Browsers keep
+ * the page but revalidate it on every load (`no-cache`): the same firmware answers a
+ * header-only 304, a reflashed one with a new page sends it again.
+ */
+
+#ifndef WEB_DASHBOARD_H
+#define WEB_DASHBOARD_H
+
+#include <c_types.h>
+
+#include "simple_http/simple_http.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief           `/` route callback
+ */
+char* web_dashboard_view(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* WEB_DASHBOARD_H */
@@ -0,0 +1,80 @@
+/**
+ * \file web_events.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Server-Sent Events stream of new samples. Header file.
+ * \version 0.1
+ * \date 2021-04-13
+ *
+ * `/events` keeps the connection open and streams every published sample as
+ * `id: <seq>\nevent: <name>\ndata: <json>\n\n`, using the chunked producer of the
+ * HTTP server. Events are copied once into a shared ring, every subscriber only keeps
+ * its read position. A subscriber that falls more than WEB_EVENTS_RING_LEN events behind
+ * skips the oldest ones (drop-oldest), so a slow client never holds more than the ring.
+ *
+ * A comment line is pushed every WEB_EVENTS_KEEPALIVE ms, whatever was published in
+ * between, so a stream is never silent for longer than that and the server idle
+ * timeout does not close it.
+ */
+
+#ifndef WEB_EVENTS_H
+#define WEB_EVENTS_H
+
+#include <c_types.h>
+
+#include "simple_http/simple_http.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define WEB_EVENTS_MAX_SUBS   (SIMPLE_HTTP_SERVER_MAX_CONN - 1)  /* Keep a connection for plain requests */
+#define WEB_EVENTS_RING_LEN   8                 /* Must be a power of 2 */
+#define WEB_EVENTS_EVENT_SIZE 256               /* Max length of a formatted event */
+#define WEB_EVENTS_KEEPALIVE  4000              /* [ms] Max silence. At most half SIMPLE_HTTP_SERVER_IDLE_TIMEOUT */
+
+#if WEB_EVENTS_KEEPALIVE * 2 > SIMPLE_HTTP_SERVER_IDLE_TIMEOUT * 1000
+#error "WEB_EVENTS_KEEPALIVE too close to SIMPLE_HTTP_SERVER_IDLE_TIMEOUT"
+#endif
+
+/**
+ * \brief           Stream statistics
+ */
+typedef struct {
+    uint32_t published;                         /*!< Events published */
+    uint32_t delivered;                         /*!< Events handed to the TCP stack, all subscribers */
+    uint32_t dropped;                           /*!< Events skipped by slow subscribers */
+    uint32_t rejected;                          /*!< Subscriptions refused, no free slot */
+    uint32_t latency_max_us;                    /*!< Longest publish to send delay */
+    uint32_t latency_sum_us;                    /*!< Sum of publish to send delays, over `delivered` */
+    uint8_t  subscribers;                       /*!< Current subscribers */
+} web_events_stats_t;
+
+/**
+ * \brief           Start the keepalive timer
+ */
+void web_events_init(void);
+
+/**
+ * \brief           Queue an event for all subscribers and wake up the paused streams
+ * \param[in]       name: Event name
+ * \param[in]       data: Event data, single line
+ * \param[in]       data_len: Data length
+ */
+void web_events_publish(const char* name, const char* data, size_t data_len);
+
+/**
+ * \brief           `/events` route callback
+ */
+char* web_events_view(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type);
+
+/**
+ * \brief           Get the stream statistics
+ * \return          Pointer to the statistics
+ */
+const web_events_stats_t* web_events_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* WEB_EVENTS_H */
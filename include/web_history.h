@@ -0,0 +1,37 @@
+/**
+ * \file web_history.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief `/api/v1/history` endpoint, streamed from the flash history. Header file.
+ * \version 0.1
+ * \date 2021-04-15
+ *
+ * `GET /api/v1/history?from=<ts>&to=<ts>&step=<s>` answers
+ * `{"fields":[...],"rows":[[ts,...],...]}` with the stored records in [from, to].
+ * With `step`, a row is only sent if it is at least `step` seconds after the previous
+ * one, and the gap is skipped with a history seek instead of reading every record.
+ * Values of a sensor without a valid sample are null. Rows are read and formatted a
+ * chunk at a time from the sent callback of the streamed response. The entity tag is
+ * the timestamp of the newest record, so a repeated poll with no new sample gets a 304.
+ */
+
+#ifndef WEB_HISTORY_H
+#define WEB_HISTORY_H
+
+#include <c_types.h>
+
+#include "simple_http/simple_http.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * \brief           `/api/v1/history` route callback
+ */
+char* web_history_view(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* WEB_HISTORY_H */
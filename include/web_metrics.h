@@ -0,0 +1,89 @@
+/**
+ * \file web_metrics.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Prometheus text exposition at /metrics. Header file.
+ * \version 0.1
+ * \date 2021-04-14
+ *
+ * Metrics come from registered writers, called in registration order. Every writer
+ * prints a whole metric family (TYPE line and samples) of up to WEB_METRICS_WRITER_SIZE
+ * bytes straight into the chunk buffer of the streamed response, so the exposition
+ * is never built as a single string. Free heap, HTTP server and I2C bus scheduler
+ * metrics are registered by web_metrics_init(), the application adds its own.
+ */
+
+#ifndef WEB_METRICS_H
+#define WEB_METRICS_H
+
+#include <c_types.h>
+
+#include "status.h"
+#include "simple_http/simple_http.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define WEB_METRICS_MAX_WRITERS 40
+#define WEB_METRICS_WRITER_SIZE 320             /* Max output of a writer, must fit a response chunk */
+
+/**
+ * \brief           Metric family writer
+ * \param[out]      buff: Destination buffer, WEB_METRICS_WRITER_SIZE bytes
+ * \param[in]       arg: Argument given on registration
+ * \return          Written characters
+ */
+typedef size_t (*web_metrics_writer_t)(char* buff, void* arg);
+
+/**
+ * \brief           Register the built-in writers
+ */
+void web_metrics_init(void);
+
+/**
+ * \brief           Add a writer at the end of the exposition
+ * \param[in]       writer: Writer function
+ * \param[in]       arg: Writer argument
+ * \return          STA_OK on success. STA_ERR if the table is full
+ */
+status_t web_metrics_register(web_metrics_writer_t writer, void* arg);
+
+/**
+ * \brief           Write a TYPE line
+ * \param[out]      buff: Destination buffer
+ * \param[in]       name: Metric name
+ * \param[in]       type: "counter" or "gauge"
+ * \return          Written characters
+ */
+size_t web_metrics_type(char* buff, const char* name, const char* type);
+
+/**
+ * \brief           Write an integer sample
+ * \param[out]      buff: Destination buffer
+ * \param[in]       name: Metric name
+ * \param[in]       labels: Label set without braces, e.g. `lane="halt"`. NULL for none
+ * \param[in]       value: Value
+ * \return          Written characters
+ */
+size_t web_metrics_uint(char* buff, const char* name, const char* labels, uint32_t value);
+
+/**
+ * \brief           Write a float sample, NaN if out of range
+ * \param[out]      buff: Destination buffer
+ * \param[in]       name: Metric name
+ * \param[in]       labels: Label set without braces. NULL for none
+ * \param[in]       value: Value
+ * \return          Written characters
+ */
+size_t web_metrics_float(char* buff, const char* name, const char* labels, float value);
+
+/**
+ * \brief           `/metrics` route callback
+ */
+char* web_metrics_view(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* WEB_METRICS_H */
@@ -31,14 +31,38 @@ extern "C" {
 #define SIMPLE_HTTP_SERVER_MAX_REQUEST_PATH   100
 #define SIMPLE_HTTP_SERVER_MAX_REQUEST_METHOD 8
 
+#define SIMPLE_HTTP_SERVER_MAX_CONN     3         /* Concurrent client connections */
+#define SIMPLE_HTTP_SERVER_IDLE_TIMEOUT 10        /* Seconds without traffic before closing a connection */
+#define SIMPLE_HTTP_SERVER_RX_SIZE      512       /* Request assembly buffer, per connection */
+#define SIMPLE_HTTP_SERVER_HEADER_SIZE  256       /* Response header buffer, per connection. Extra headers included */
+#define SIMPLE_HTTP_SERVER_CHUNK_SIZE   512       /* Streamed response chunk buffer, per connection */
+#define SIMPLE_HTTP_SERVER_TASK_PRIO    USER_TASK_PRIO_1 /* Deferred request handling. Keep it below the sensor tasks */
+#ifndef SIMPLE_HTTP_SERVER_RATE                   /* Overridable, the host load tests lift the limit */
+#define SIMPLE_HTTP_SERVER_RATE         4         /* Admitted requests per second, sustained */
+#endif
+#ifndef SIMPLE_HTTP_SERVER_BURST
+#define SIMPLE_HTTP_SERVER_BURST        8         /* Requests admitted back to back before the rate applies */
+#endif
+
 #define SIMPLE_HTTP_CLIENT_MAX_REQUEST_PATH SIMPLE_HTTP_SERVER_MAX_REQUEST_PATH
 
+// #define SIMPLE_HTTP_CLIENT_KEEP_OPEN           /* HTTP/1.1, the connection stays open between requests to the same host */
+#define SIMPLE_HTTP_CLIENT_SSL_SIZE     5120      /* TLS record buffer. 2048 is enough if the server sends small records */
+#define SIMPLE_HTTP_CLIENT_HOST_SIZE    64        /* Hostname kept to match the open connection */
+#define SIMPLE_HTTP_CLIENT_TIMEOUT      30000000  /* [us] Request on the open connection without response, given up */
+#define SIMPLE_HTTP_CLIENT_SEND_SIZE    1460      /* Request body bytes per send, one TCP segment. The stack takes 2920 at most */
+
+#if defined(SIMPLE_HTTP_CLIENT_KEEP_OPEN) && !defined(SIMPLE_HTTP_SINGLE_CONN_ONLY)
+#error "SIMPLE_HTTP_CLIENT_KEEP_OPEN needs SIMPLE_HTTP_SINGLE_CONN_ONLY"
+#endif
+
 #define HTTP_CONTENT_TYPE_TEXT_HTML_TEXT           "text/html"
 #define HTTP_CONTENT_TYPE_TEXT_PLAIN_TEXT          "text/plain"
 #define HTTP_CONTENT_TYPE_TEXT_XML_TEXT            "text/xml"
 #define HTTP_CONTENT_TYPE_MULTIPART_FORM_DATA_TEXT "multipart/form-data"
 #define HTTP_CONTENT_TYPE_APPLICATION_JSON_TEXT    "application/json"
 #define HTTP_CONTENT_TYPE_APPLICATION_XML_TEXT     "application/xml"
+#define HTTP_CONTENT_TYPE_TEXT_EVENT_STREAM_TEXT   "text/event-stream"
 
 #define HTTP_CONTENT_TYPE_TEXT_HTML_SIZE           10
 #define HTTP_CONTENT_TYPE_TEXT_PLAIN_SIZE          11
@@ -46,6 +70,7 @@ extern "C" {
 #define HTTP_CONTENT_TYPE_MULTIPART_FORM_DATA_SIZE 20
 #define HTTP_CONTENT_TYPE_APPLICATION_JSON_SIZE    17
 #define HTTP_CONTENT_TYPE_APPLICATION_XML_SIZE     16
+#define HTTP_CONTENT_TYPE_TEXT_EVENT_STREAM_SIZE   18
 
 #define HTTP_DEFAULT_PORT 80
 #define HTTPS_DEFAULT_PORT 443
@@ -61,7 +86,8 @@ typedef enum http_content_type {
     HTTP_CONTENT_TYPE_TEXT_XML,
     HTTP_CONTENT_TYPE_MULTIPART_FORM_DATA,
     HTTP_CONTENT_TYPE_APPLICATION_JSON,
-    HTTP_CONTENT_TYPE_APPLICATION_XML
+    HTTP_CONTENT_TYPE_APPLICATION_XML,
+    HTTP_CONTENT_TYPE_TEXT_EVENT_STREAM
 } http_content_type_t;
 
 typedef enum simple_http_status {
@@ -78,18 +104,55 @@ typedef enum simple_http_status {
     SIMPLE_HTTP_ERROR
 } simple_http_status_t;
 
+/**
+ * \brief           Streamed response producer
+ *
+ * Called from the sent callback every time the previous chunk left the TCP buffer.
+ * Writes up to `buff_len` body bytes in `p_buff` and sets `*p_done` on the last piece.
+ * Returning 0 without `*p_done` pauses the stream until simple_http_server_stream_resume.
+ * Called once with `p_buff` NULL if the connection closes before the end, to release `arg`.
+ */
+typedef size_t (*simple_http_server_producer_t)(void* arg, char* p_buff, size_t buff_len, uint8_t* p_done);
+
+/**
+ * \brief           Kept response release
+ *
+ * Called once the server is done with a `keep_response` buffer: sent, dropped for a
+ * 304 or an error, or the connection closed. The buffer may change after this call.
+ */
+typedef void (*simple_http_server_release_t)(void* arg);
+
 /**
  * \brief           Info of the incoming request
  */
 typedef struct simple_http_server_request_info {
     struct espconn* p_conn;                     /** System connection object */
     char* request_method;                       /** Request type. Ex. GET, POST, etc.. */
-    char* request_path;                         /** HTTP object path. Ex. /api/v1/thing */
-    char* request_data;                         /** Raw data to send */
+    size_t request_method_len;                  /** Request type length */
+    char* request_path;                         /** HTTP object path, without query. Ex. /api/v1/thing */
+    size_t request_path_len;                    /** HTTP object path length */
+    char* request_query;                        /** Query string after '?'. NULL if none */
+    char* request_data;                         /** Raw data to send. NULL if none */
     char* raw_request;                          /** Raw request header + data */
     size_t raw_request_length;                  /** Raw request header + data length */
+    uint8_t keep_response;                      /** Set by the callback if the returned buffer must not be freed */
+    uint8_t flash_response;                     /** Set by the callback if the returned buffer is 4 byte aligned flash (ICACHE_RODATA_ATTR). Never freed */
+    const char* headers;                        /** Set by the callback to add header lines, each ending in CRLF. Copied once the callback returns */
+    const char* etag;                           /** Set by the callback to tag the response, quoted. A matching If-None-Match gets a header-only 304 */
+    simple_http_server_producer_t producer;     /** Set by the callback to stream the body instead of returning it */
+    void* producer_arg;                         /** Producer argument */
+    simple_http_server_release_t release;       /** Set by the callback with keep_response to know when the buffer is free again */
+    void* release_arg;                          /** Release argument */
 } simple_http_server_request_info_t;
 
+/**
+ * \brief           Status code and reason phrase of a status line
+ */
+typedef struct simple_http_status_line {
+    uint16_t code;
+    const char* text;
+} simple_http_status_line_t;
+
 /**
  * \brief           HTTP server callback function definition
  */
@@ -98,7 +161,7 @@ typedef char* (*simple_http_server_callback_t)(simple_http_server_request_info_t
 /**
  * \brief           HTTP request callback function definition
  */
-typedef void (*simple_http_response_callback_t)(const char* const data, size_t data_len, uint8_t status, const char* const buffer);
+typedef void (*simple_http_response_callback_t)(const char* const data, size_t data_len, uint16_t status, const char* const buffer);
 
 /**
  * \brief           Info of the outgoing request
@@ -110,6 +173,8 @@ typedef struct simple_http_client_request_info {
     uint16_t port;                              /** Request destination port */
     uint8_t secure;                             /** Protocol to HTTP or HTTPS */
     char* data;                                 /** Request included data */
+    size_t data_len;                            /** Length of `data` */
+    size_t data_sent;                           /** Bytes of `data` handed to the TCP stack */
     char* headers;                              /** Request extra headers */
     char* request_method;                       /** Request extra headers length */
     simple_http_response_callback_t callback;   /** Request response user callback */
@@ -117,10 +182,85 @@ typedef struct simple_http_client_request_info {
     size_t response_buffer_len;                 /** HTTP response buffer length */
 } simple_http_client_request_info_t;
 
+/**
+ * \brief           Route table entry
+ */
+typedef struct simple_http_server_route {
+    const char* path;                           /** Exact path, without query */
+    const char* method;                         /** Request method. NULL for any */
+    simple_http_server_callback_t callback;     /** Response generator */
+} simple_http_server_route_t;
+
 typedef struct simple_http_server_config {
-    simple_http_server_callback_t user_callback;
+    simple_http_server_callback_t user_callback;/** Default callback, for paths not in the table */
+    const simple_http_server_route_t* routes;   /** Route table, sorted by path */
+    size_t routes_len;                          /** Number of routes */
 } simple_http_server_config_t;
 
+/**
+ * \brief           Client connection state, from a fixed pool
+ *
+ * The request is assembled in `rx` until the header and the Content-Length body are complete.
+ * A complete request is admitted by the rate limiter and handled later from the server task.
+ * The response header is built in `header`, the body is sent from the callback buffer,
+ * copied from flash one piece at a time into `chunk`, or pulled from the producer into `chunk`.
+ */
+typedef struct simple_http_server_conn {
+    struct espconn* p_conn;                     /** Client connection. NULL if the slot is free */
+    simple_http_server_config_t* p_config;      /** Server configuration */
+    uint8_t remote_ip[4];                       /** Client address, to match disconnect callbacks */
+    int remote_port;                            /** Client port */
+    char rx[SIMPLE_HTTP_SERVER_RX_SIZE];        /** Received, not yet handled, request bytes */
+    uint16_t rx_len;                            /** Bytes in `rx` */
+    uint8_t deferred;                           /** Complete request waiting for the server task */
+    uint8_t close_after;                        /** Close once the buffered requests are answered, input is not read anymore */
+    uint8_t closing;                            /** Disconnect from the server task, not from an espconn callback */
+    uint8_t sending;                            /** Response in flight */
+    char* body;                                 /** Callback body, sent after the header */
+    size_t body_len;                            /** Body bytes still to send */
+    uint8_t free_body;                          /** Free `body` once sent */
+    uint8_t body_in_flash;                      /** `body` is in flash, only aligned 32 bit reads */
+    simple_http_server_release_t release;       /** Called when `body` is not needed anymore. NULL if none */
+    void* release_arg;                          /** Release argument */
+    char header[SIMPLE_HTTP_SERVER_HEADER_SIZE];/** Status line and headers */
+    simple_http_server_producer_t producer;     /** Streamed body producer. NULL if not streaming */
+    void* producer_arg;                         /** Producer argument */
+    uint8_t stream_done;                        /** Last chunk sent */
+    uint8_t stream_paused;                      /** Producer had nothing to send */
+    uint32_t start_us;                          /** system_get_time() when the request was complete */
+    char chunk[SIMPLE_HTTP_SERVER_CHUNK_SIZE];  /** Chunk size line, data and trailer */
+} simple_http_server_conn_t;
+
+/**
+ * \brief           Server statistics. Latency is measured from the complete request to the last byte sent
+ */
+typedef struct simple_http_server_stats {
+    uint32_t requests;                          /** Requests dispatched */
+    uint32_t responses;                         /** Responses sent completely */
+    uint32_t not_modified;                      /** 304 answers to a matching If-None-Match */
+    uint32_t shed;                              /** Requests answered 503 over the rate limit, connections over the pool */
+    uint32_t deferred;                          /** Requests handed to the server task */
+    uint32_t defer_max_us;                      /** Max wait in the server task queue */
+    uint32_t latency_sum_us;                    /** Sum of the latency of `responses` */
+    uint32_t latency_max_us;                    /** Max latency */
+} simple_http_server_stats_t;
+
+/**
+ * \brief           Client statistics. Heap is sampled at every connection callback
+ */
+typedef struct simple_http_client_stats {
+    uint32_t requests;                          /** Requests sent */
+    uint32_t connects;                          /** Connections established */
+    uint32_t reused;                            /** Requests sent on an already open connection */
+    uint32_t handshakes;                        /** TLS handshakes, from connect to the connect callback */
+    uint32_t handshake_last_us;                 /** Last handshake time */
+    uint32_t handshake_max_us;                  /** Max handshake time */
+    uint32_t handshake_sum_us;                  /** Sum of the `handshakes` times */
+    uint32_t heap_free_min;                     /** Lowest free heap seen during a request */
+    uint32_t heap_used_max;                     /** Max heap taken by one request, connection and TLS included */
+    uint32_t send_errors;                       /** Request bodies cut short by a refused send */
+} simple_http_client_stats_t;
+
 /**
  * \brief           Configure and start a basic HTTP server
  * \param[in]       p_conn: Pointer to the espconn sdk struct
@@ -130,6 +270,58 @@ typedef struct simple_http_server_config {
  */
 simple_http_status_t create_basic_http_server(struct espconn* p_conn, uint16_t port, simple_http_server_callback_t callback);
 
+/**
+ * \brief           Configure and start a HTTP server with a route table
+ *
+ * Request method, path and query are tokenized in place, the callbacks get NUL terminated
+ * pointers into the receive buffer.
+ *
+ * Callbacks do not run in the espconn receive callback. Requests over the token bucket
+ * (SIMPLE_HTTP_SERVER_RATE, SIMPLE_HTTP_SERVER_BURST) get a 503 with Retry-After, the
+ * rest are handled one per run of a SIMPLE_HTTP_SERVER_TASK_PRIO task, so timers and
+ * higher priority tasks are not delayed by more than one response generation. Routes are looked up with a binary search, so the table
+ * must be sorted by path (os_strcmp order). A known path with an unknown method gets a 405.
+ *
+ * \param[in]       p_conn: Pointer to the espconn sdk struct
+ * \param[in]       port: Server listen port
+ * \param[in]       routes: Route table, sorted by path. Must outlive the server
+ * \param[in]       routes_len: Number of routes
+ * \param[in]       default_callback: Callback for paths not in the table. NULL to answer 404
+ * \return          simple_http_status_t status code. SIMPLE_HTTP_ERROR if the table is not sorted
+ */
+simple_http_status_t create_http_server(struct espconn* p_conn, uint16_t port, const simple_http_server_route_t* routes, size_t routes_len, simple_http_server_callback_t default_callback);
+
+/**
+ * \brief           Resume a paused streamed response
+ * \param[in]       p_conn: Client connection, from the request info
+ * \return          SIMPLE_HTTP_OK if resumed, SIMPLE_HTTP_ERROR if the stream is not paused
+ */
+simple_http_status_t simple_http_server_stream_resume(struct espconn* p_conn);
+
+/**
+ * \brief           Get the server statistics
+ * \return          Pointer to the statistics
+ */
+const simple_http_server_stats_t* simple_http_server_get_stats(void);
+
+/**
+ * \brief           Find a request header
+ * \param[in]       p_info: Request info, from the callback
+ * \param[in]       name: Header name, lower case, without the colon
+ * \param[out]      p_len: Value length
+ * \return          Pointer to the value, not NUL terminated. NULL if not present
+ */
+const char* simple_http_server_request_header(const simple_http_server_request_info_t* p_info, const char* name, size_t* p_len);
+
+/**
+ * \brief           Find a parameter in a query string, e.g. `from` in `from=10&to=20`
+ * \param[in]       query: Query string, from the request info. May be NULL
+ * \param[in]       name: Parameter name
+ * \param[out]      p_len: Value length
+ * \return          Pointer to the value, not NUL terminated. NULL if not present
+ */
+const char* simple_http_server_query_param(const char* query, const char* name, size_t* p_len);
+
 #define simple_http_get(url, headers, callback) simple_http_request(url, NULL, headers, "GET", callback)
 #define simple_http_post(url, data, headers, callback) simple_http_request(url, data, headers, "POST", callback)
 
@@ -148,6 +340,26 @@ simple_http_status_t simple_http_client_ready(void);
  */
 simple_http_status_t simple_http_client_reset(void);
 
+/**
+ * \brief           Find a response header, e.g. `Retry-After`
+ * \param[in]       buffer: Whole response, from the response callback
+ * \param[in]       name: Header name, lower case, without the colon
+ * \param[out]      p_len: Value length. May be NULL
+ * \return          Pointer to the value, not NUL terminated. NULL if not present
+ */
+const char* simple_http_client_response_header(const char* buffer, const char* name, size_t* p_len);
+
+/**
+ * \brief           Get the client statistics
+ *
+ * With SIMPLE_HTTP_CLIENT_KEEP_OPEN, `reused` requests skip DNS, connect and the TLS
+ * handshake. Otherwise every https request does a full handshake, the SDK has no
+ * session cache.
+ *
+ * \return          Pointer to the statistics
+ */
+const simple_http_client_stats_t* simple_http_client_get_stats(void);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
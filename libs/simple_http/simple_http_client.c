@@ -17,11 +17,45 @@
 #include "simple_http/simple_http.h"
 
 
+#ifdef SIMPLE_HTTP_CLIENT_KEEP_OPEN
+#define CLIENT_PROTO_VERSION "HTTP/1.1"
+#define CLIENT_CONNECTION    "keep-alive"
+#else
+#define CLIENT_PROTO_VERSION HTTP_PROTO_VERSION
+#define CLIENT_CONNECTION    "close"
+#endif /* SIMPLE_HTTP_CLIENT_KEEP_OPEN */
+
 #ifdef SIMPLE_HTTP_SINGLE_CONN_ONLY
 static struct espconn client_conn;
 static uint8_t client_conn_blocked = 0;
 #endif
 
+#ifdef SIMPLE_HTTP_CLIENT_KEEP_OPEN
+/* Idle connection, to reuse if the next request goes to the same server */
+static uint8_t open_conn;
+static uint8_t open_closing;
+static uint8_t open_secure;
+static uint16_t open_port;
+static char open_host[SIMPLE_HTTP_CLIENT_HOST_SIZE];
+static uint32_t request_start_us;
+#endif /* SIMPLE_HTTP_CLIENT_KEEP_OPEN */
+
+static simple_http_client_stats_t client_stats;
+static uint32_t connect_start_us;
+static uint32_t request_heap;                   /* Free heap before the request */
+
+static void ICACHE_FLASH_ATTR
+heap_sample(void) {
+    uint32_t heap = system_get_free_heap_size();
+
+    if (client_stats.heap_free_min == 0 || heap < client_stats.heap_free_min) {
+        client_stats.heap_free_min = heap;
+    }
+    if (request_heap > heap && request_heap - heap > client_stats.heap_used_max) {
+        client_stats.heap_used_max = request_heap - heap;
+    }
+}
+
 static void ICACHE_FLASH_ATTR
 free_client_request_info(simple_http_client_request_info_t* p_info) {
     if (p_info == NULL) {
@@ -72,22 +106,16 @@ free_client_conn(struct espconn* p_conn) {
 #endif /* SIMPLE_HTTP_SINGLE_CONN_ONLY */
 }
 
+/* Deliver the response and free the request, the connection is not touched */
 static void ICACHE_FLASH_ATTR
-request_disconnect_callback(void* arg) {
-	struct espconn* p_conn = (struct espconn*)arg;
-    simple_http_client_request_info_t* p_info;
+request_finish(struct espconn* p_conn) {
+    simple_http_client_request_info_t* p_info = (simple_http_client_request_info_t*)p_conn->reverse;
 
-    uint8_t http_status;
+    uint16_t http_status;
 
-    char* proto_version = HTTP_PROTO_VERSION" ";
+    char* proto_version = CLIENT_PROTO_VERSION" ";
     char* response_data;
 
-    system_soft_wdt_feed();
-	if(p_conn == NULL) {
-		return;
-	}
-
-    p_info = (simple_http_client_request_info_t*)p_conn->reverse;
 	if(p_info != NULL) {
 		http_status = 0;
         response_data = p_info->response_buffer;
@@ -106,31 +134,139 @@ request_disconnect_callback(void* arg) {
         free_client_request_info(p_info);
 	}
 
+    p_conn->reverse = NULL;
+}
+
+static void ICACHE_FLASH_ATTR
+request_disconnect_callback(void* arg) {
+	struct espconn* p_conn = (struct espconn*)arg;
+
+    system_soft_wdt_feed();
+	if(p_conn == NULL) {
+		return;
+	}
+
+    heap_sample();
+    request_finish(p_conn);
+
+#ifdef SIMPLE_HTTP_CLIENT_KEEP_OPEN
+    open_conn    = 0;
+    open_closing = 0;
+#endif /* SIMPLE_HTTP_CLIENT_KEEP_OPEN */
+
     free_client_conn(p_conn);
 }
 
+const char* ICACHE_FLASH_ATTR
+simple_http_client_response_header(const char* buffer, const char* name, size_t* p_len) {
+    const char* end = os_strstr(buffer, "\r\n\r\n");
+    const size_t name_len = os_strlen(name);
+    const char* p_line;
+    const char* p_value;
+    size_t i;
+
+    if (end == NULL) {
+        return NULL;
+    }
+
+    for (p_line = os_strstr(buffer, "\r\n"); p_line != NULL && p_line < end; p_line = os_strstr(p_line + 2, "\r\n")) {
+        for (i = 0; i < name_len && (p_line[2 + i] | 0x20) == name[i]; ++i);
+        if (i == name_len && p_line[2 + i] == ':') {
+            for (p_value = p_line + 3 + name_len; *p_value == ' '; ++p_value);
+            for (i = 0; p_value[i] != '\r' && p_value[i] != '\0'; ++i);
+            if (p_len != NULL) {
+                *p_len = i;
+            }
+            return p_value;
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef SIMPLE_HTTP_CLIENT_KEEP_OPEN
+/* The response is complete once the whole body is in, the connection stays open */
+static uint8_t ICACHE_FLASH_ATTR
+response_complete(const simple_http_client_request_info_t* p_info) {
+    const char* buf = p_info->response_buffer;
+    const size_t len = p_info->response_buffer_len - 1;
+    const char* body = os_strstr(buf, "\r\n\r\n");
+    const char* value;
+    int status;
+
+    if (body == NULL) {
+        return 0;
+    }
+    body += 4;
+
+    status = atoi(buf + os_strlen(CLIENT_PROTO_VERSION" "));
+    if (status == 204 || status == 304) {
+        return 1;
+    }
+
+    if ((value = simple_http_client_response_header(buf, "content-length", NULL)) != NULL) {
+        return buf + len - body >= atoi(value);
+    }
+
+    /* Last chunk, trailers not supported */
+    if ((value = simple_http_client_response_header(buf, "transfer-encoding", NULL)) != NULL && os_strncmp(value, "chunked", 7) == 0) {
+        return len >= 5 && os_strcmp(buf + len - 5, "0\r\n\r\n") == 0;
+    }
+
+    /* Body ends with the connection */
+    return 0;
+}
+#endif /* SIMPLE_HTTP_CLIENT_KEEP_OPEN */
+
+/* The body follows the header one SIMPLE_HTTP_CLIENT_SEND_SIZE piece per sent callback */
 static void ICACHE_FLASH_ATTR
 sent_callback(void* arg) {
     struct espconn* p_conn = (struct espconn*)arg;
     simple_http_client_request_info_t* p_info = (simple_http_client_request_info_t*)p_conn->reverse;
 
+    size_t len;
+    sint8 error;
+
     system_soft_wdt_feed();
+    if (p_info == NULL) {
+        return;
+    }
+
+    heap_sample();
     if (p_info->data == NULL) {
         /* No need to send more data */
-	} else {
-        /* Now its time to send the request data */
-		if (p_info->secure) {
-			espconn_secure_send(p_conn, (uint8_t*)p_info->data, strlen(p_info->data));
-        } else {
-			espconn_send(p_conn, (uint8_t*)p_info->data, strlen(p_info->data));
-        }
+        return;
+    }
 
-        os_delay_us(50);
-        system_soft_wdt_feed();
+    len = p_info->data_len - p_info->data_sent;
+    if (len == 0) {
+        os_free(p_info->data);
+        p_info->data = NULL;
+        return;
+    }
 
-		os_free(p_info->data);
-		p_info->data = NULL;
-	}
+    if (len > SIMPLE_HTTP_CLIENT_SEND_SIZE) {
+        len = SIMPLE_HTTP_CLIENT_SEND_SIZE;
+    }
+
+    if (p_info->secure) {
+        error = espconn_secure_send(p_conn, (uint8_t*)p_info->data + p_info->data_sent, len);
+    } else {
+        error = espconn_send(p_conn, (uint8_t*)p_info->data + p_info->data_sent, len);
+    }
+
+    os_delay_us(50);
+    system_soft_wdt_feed();
+
+    if (error != 0) {
+        /* No more sent callbacks. The server gets a short body, the caller its timeout */
+        client_stats.send_errors += 1;
+        os_free(p_info->data);
+        p_info->data = NULL;
+        return;
+    }
+
+    p_info->data_sent += len;
 }
 
 static void ICACHE_FLASH_ATTR
@@ -138,13 +274,16 @@ receive_callback(void* arg, char* buf, unsigned short len) {
 	struct espconn* p_conn = (struct espconn*)arg;
     simple_http_client_request_info_t* p_info = (simple_http_client_request_info_t*)p_conn->reverse;
 
-    const size_t new_len = p_info->response_buffer_len + len;
+    size_t new_len;
     char* new_buffer;
 
-	if (p_info->response_buffer == NULL) {
+	if (p_info == NULL || p_info->response_buffer == NULL) {
 		return;
 	}
 
+    heap_sample();
+    new_len = p_info->response_buffer_len + len;
+
 	if (new_len > HTTP_MAX_RESPONSE_SIZE || (new_buffer = (char*)os_malloc(sizeof(char) * new_len)) == NULL) {
 		p_info->response_buffer[0] = '\0';
 
@@ -167,30 +306,32 @@ receive_callback(void* arg, char* buf, unsigned short len) {
 	os_free(p_info->response_buffer);
 	p_info->response_buffer     = new_buffer;
 	p_info->response_buffer_len = new_len;
+
+#ifdef SIMPLE_HTTP_CLIENT_KEEP_OPEN
+    if (open_conn && response_complete(p_info)) {
+        request_finish(p_conn);
+    }
+#endif /* SIMPLE_HTTP_CLIENT_KEEP_OPEN */
 }
 
+/* Send the request header, the data follows from the sent callback */
 static void ICACHE_FLASH_ATTR
-request_connect_callback(void* arg) {
-    struct espconn* p_conn = (struct espconn*)arg;
+request_send(struct espconn* p_conn) {
     simple_http_client_request_info_t* p_info = (simple_http_client_request_info_t*)p_conn->reverse;
 
 	char* send_buff;
     size_t buff_len, total_len;
 
-	espconn_regist_sentcb(p_conn, sent_callback);
-    espconn_regist_recvcb(p_conn, receive_callback);
-
-    os_delay_us(50);
-    system_soft_wdt_feed();
-
 	char data_headers[28] = "";
 
+    client_stats.requests += 1;
+
 	if (p_info->data != NULL) {
-		os_sprintf(data_headers, "Content-Length: %d\r\n", strlen(p_info->data));
+		os_sprintf(data_headers, "Content-Length: %d\r\n", p_info->data_len);
 	}
 
     buff_len  = 0;
-    buff_len += os_strlen(p_info->request_method) + os_strlen(p_info->path) + os_strlen(HTTP_PROTO_VERSION) + 4;
+    buff_len += os_strlen(p_info->request_method) + os_strlen(p_info->path) + os_strlen(CLIENT_PROTO_VERSION) + 4;
     buff_len += os_strlen(p_info->hostname) + 5 + 9;
     buff_len += 40;
     buff_len += os_strlen(p_info->headers) + os_strlen(data_headers) + 2;
@@ -200,11 +341,11 @@ request_connect_callback(void* arg) {
 	total_len = os_sprintf(send_buff,
                            "%s %s %s\r\n"
                            "Host: %s:%d\r\n"
-                           "Connection: close\r\n"
+                           "Connection: "CLIENT_CONNECTION"\r\n"
                            "User-Agent: ESP8266\r\n"
                            "%s"
                            "%s\r\n",
-                           p_info->request_method, p_info->path, HTTP_PROTO_VERSION,
+                           p_info->request_method, p_info->path, CLIENT_PROTO_VERSION,
                            p_info->hostname, p_info->port,
                            p_info->headers, data_headers);
 
@@ -222,6 +363,46 @@ request_connect_callback(void* arg) {
     p_info->headers = NULL;    
 }
 
+static void ICACHE_FLASH_ATTR
+request_connect_callback(void* arg) {
+    struct espconn* p_conn = (struct espconn*)arg;
+    simple_http_client_request_info_t* p_info = (simple_http_client_request_info_t*)p_conn->reverse;
+    uint32_t handshake_us;
+
+    client_stats.connects += 1;
+    if (p_info->secure) {
+        handshake_us = system_get_time() - connect_start_us;
+
+        client_stats.handshakes        += 1;
+        client_stats.handshake_last_us  = handshake_us;
+        client_stats.handshake_sum_us  += handshake_us;
+        if (handshake_us > client_stats.handshake_max_us) {
+            client_stats.handshake_max_us = handshake_us;
+        }
+    }
+    heap_sample();
+
+#ifdef SIMPLE_HTTP_CLIENT_KEEP_OPEN
+    /* A name that does not fit never matches */
+    if (os_strlen(p_info->hostname) < SIMPLE_HTTP_CLIENT_HOST_SIZE) {
+        os_strcpy(open_host, p_info->hostname);
+    } else {
+        open_host[0] = '\0';
+    }
+    open_port   = p_info->port;
+    open_secure = p_info->secure;
+    open_conn   = 1;
+#endif /* SIMPLE_HTTP_CLIENT_KEEP_OPEN */
+
+	espconn_regist_sentcb(p_conn, sent_callback);
+    espconn_regist_recvcb(p_conn, receive_callback);
+
+    os_delay_us(50);
+    system_soft_wdt_feed();
+
+    request_send(p_conn);
+}
+
 static void ICACHE_FLASH_ATTR
 request_error_callback(void* arg, sint8 errType) {
     system_soft_wdt_feed();
@@ -239,6 +420,7 @@ request_dns_callback(const char* name, ip_addr_t* p_ip, void* arg) {
         }
 
         free_client_request_info(p_info);
+        p_conn->reverse = NULL;
         return;
     }
 
@@ -260,9 +442,11 @@ request_dns_callback(const char* name, ip_addr_t* p_ip, void* arg) {
         espconn_secure_ca_disable(0x01);
         espconn_secure_cert_req_disable(0x01);
 
-        espconn_secure_set_size(ESPCONN_CLIENT, 5120);
+        espconn_secure_set_size(ESPCONN_CLIENT, SIMPLE_HTTP_CLIENT_SSL_SIZE);
+        connect_start_us = system_get_time();
         espconn_secure_connect(p_conn);
     } else {
+        connect_start_us = system_get_time();
         espconn_connect(p_conn);
     }
 }
@@ -284,7 +468,20 @@ make_http_request(simple_http_client_request_info_t* p_info) {
     }
 #endif /* SIMPLE_HTTP_SINGLE_CONN_ONLY */
 
-    p_conn->reverse = p_info;
+#ifdef SIMPLE_HTTP_CLIENT_KEEP_OPEN
+    if (p_conn->reverse != NULL) {
+        if (system_get_time() - request_start_us < SIMPLE_HTTP_CLIENT_TIMEOUT) {
+            return SIMPLE_HTTP_CLIENT_NOT_READY;
+        }
+        /* No response, the connection is not usable anymore. Retry once it is gone */
+        simple_http_client_reset();
+        return SIMPLE_HTTP_CLIENT_NOT_READY;
+    }
+
+    if (open_closing) {
+        return SIMPLE_HTTP_CLIENT_NOT_READY;
+    }
+#endif /* SIMPLE_HTTP_CLIENT_KEEP_OPEN */
 
     wifi_get_ip_info(STATION_IF, &ipconfig);
     system_soft_wdt_feed();
@@ -294,6 +491,31 @@ make_http_request(simple_http_client_request_info_t* p_info) {
         return SIMPLE_HTTP_NO_CONNECTION;
     }
 
+#ifdef SIMPLE_HTTP_CLIENT_KEEP_OPEN
+    if (open_conn) {
+        if (p_info->port == open_port && p_info->secure == open_secure && os_strcmp(p_info->hostname, open_host) == 0) {
+            p_conn->reverse  = p_info;
+            request_start_us = system_get_time();
+            client_stats.reused += 1;
+            request_send(p_conn);
+            return SIMPLE_HTTP_REQUEST_SENT;
+        }
+
+        /* Other server. The disconnect callback frees the connection, retry after it */
+        open_closing = 1;
+        if (open_secure) {
+            espconn_secure_disconnect(p_conn);
+        } else {
+            espconn_disconnect(p_conn);
+        }
+        return SIMPLE_HTTP_CLIENT_NOT_READY;
+    }
+
+    request_start_us = system_get_time();
+#endif /* SIMPLE_HTTP_CLIENT_KEEP_OPEN */
+
+    p_conn->reverse = p_info;
+
     error = espconn_gethostbyname(p_conn, p_info->hostname, &ip, request_dns_callback);
 
     if (error == ESPCONN_OK) {
@@ -302,7 +524,11 @@ make_http_request(simple_http_client_request_info_t* p_info) {
 		return SIMPLE_HTTP_REQUEST_SENT;
 	} else if (error == ESPCONN_INPROGRESS) {
 		return SIMPLE_HTTP_REQUEST_SENT;
-	} else if (error == ESPCONN_ARG) {
+	}
+
+    /* The caller frees the request */
+    p_conn->reverse = NULL;
+    if (error == ESPCONN_ARG) {
 		return SIMPLE_HTTP_DNS_ARG_ERROR;
     }
 
@@ -326,11 +552,21 @@ simple_http_status_t ICACHE_FLASH_ATTR
 simple_http_client_reset(void) {
 #ifdef SIMPLE_HTTP_SINGLE_CONN_ONLY
     free_client_request_info(client_conn.reverse);
+    client_conn.reverse = NULL;
     free_client_conn(&client_conn);
 #endif /* SIMPLE_HTTP_SINGLE_CONN_ONLY */
+#ifdef SIMPLE_HTTP_CLIENT_KEEP_OPEN
+    open_conn    = 0;
+    open_closing = 0;
+#endif /* SIMPLE_HTTP_CLIENT_KEEP_OPEN */
     return SIMPLE_HTTP_OK;
 }
 
+const simple_http_client_stats_t* ICACHE_FLASH_ATTR
+simple_http_client_get_stats(void) {
+    return &client_stats;
+}
+
 simple_http_status_t ICACHE_FLASH_ATTR
 simple_http_request(char* url, char* data, char* headers, char* request_method, simple_http_response_callback_t response_callback) {
     char default_path[] = "/";
@@ -348,6 +584,7 @@ simple_http_request(char* url, char* data, char* headers, char* request_method,
 #endif /* SIMPLE_HTTP_SINGLE_CONN_ONLY */
 
     system_soft_wdt_feed();
+    request_heap = system_get_free_heap_size();
 
     p_request_info = (simple_http_client_request_info_t*)os_zalloc(sizeof(simple_http_client_request_info_t));
     if (p_request_info == NULL) {
@@ -356,6 +593,13 @@ simple_http_request(char* url, char* data, char* headers, char* request_method,
 
     p_request_info->data     = common_strdup(data);
     p_request_info->callback = response_callback;
+    if (data != NULL && p_request_info->data == NULL) {
+        free_client_request_info(p_request_info);
+        return SIMPLE_HTTP_MEM_ERROR;
+    }
+    if (p_request_info->data != NULL) {
+        p_request_info->data_len = os_strlen(p_request_info->data);
+    }
 
     if (headers == NULL) {
         p_request_info->headers = common_strdup("");
@@ -9,184 +9,945 @@
 #include <osapi.h>
 #include <mem.h>
 #include <espconn.h>
+#include <user_interface.h>
 
 #include "simple_http/simple_http.h"
 
 
-static void ICACHE_FLASH_ATTR
-send_server_response(struct espconn* p_conn, char* data, size_t data_len, uint16_t response_code, http_content_type_t content_type) {
-    size_t msg_size = (3 + 22 + 20 + 20 + 70 + data_len);
+/* Reason phrases. Codes not listed use the one of their class */
+static const simple_http_status_line_t status_lines[] = {
+    {100, "Continue"},
+    {200, "OK"},
+    {204, "No Content"},
+    {300, "Multiple Choices"},
+    {304, "Not Modified"},
+    {400, "Bad Request"},
+    {403, "Forbidden"},
+    {404, "Not Found"},
+    {405, "Method Not Allowed"},
+    {413, "Payload Too Large"},
+    {431, "Request Header Fields Too Large"},
+    {500, "Internal Server Error"},
+    {503, "Service Unavailable"},
+};
+
+static const char* const content_types[] = {
+    [HTTP_CONTENT_TYPE_TEXT_HTML]           = HTTP_CONTENT_TYPE_TEXT_HTML_TEXT,
+    [HTTP_CONTENT_TYPE_TEXT_PLAIN]          = HTTP_CONTENT_TYPE_TEXT_PLAIN_TEXT,
+    [HTTP_CONTENT_TYPE_TEXT_XML]            = HTTP_CONTENT_TYPE_TEXT_XML_TEXT,
+    [HTTP_CONTENT_TYPE_MULTIPART_FORM_DATA] = HTTP_CONTENT_TYPE_MULTIPART_FORM_DATA_TEXT,
+    [HTTP_CONTENT_TYPE_APPLICATION_JSON]    = HTTP_CONTENT_TYPE_APPLICATION_JSON_TEXT,
+    [HTTP_CONTENT_TYPE_APPLICATION_XML]     = HTTP_CONTENT_TYPE_APPLICATION_XML_TEXT,
+    [HTTP_CONTENT_TYPE_TEXT_EVENT_STREAM]   = HTTP_CONTENT_TYPE_TEXT_EVENT_STREAM_TEXT,
+};
+
+/**
+ * Connection pool. Requests are assembled in `rx` across receive callbacks. espconn_send
+ * keeps a reference to the buffer until the sent callback, so every connection owns its
+ * header scratch buffer and the body stays with its owner until sent.
+ * Allocated by the first create_http_server(), a firmware without a server does not pay for it.
+ */
+static simple_http_server_conn_t* conns;
 
-    char* content_type_txt;
+/* Chunk layout: 3 hex digit size line, data, CRLF and, on the last one, the terminating chunk */
+#define CHUNK_SIZE_LINE 5
+#define CHUNK_TRAILER   2
+#define CHUNK_LAST      "0\r\n\r\n"
+#define CHUNK_LAST_LEN  5
+#define CHUNK_DATA_MAX  (SIMPLE_HTTP_SERVER_CHUNK_SIZE - CHUNK_SIZE_LINE - CHUNK_TRAILER - CHUNK_LAST_LEN)
 
-    char* msg;
-    char response_code_msg[22];
+#if SIMPLE_HTTP_SERVER_CHUNK_SIZE > 0xFFF
+#error "SIMPLE_HTTP_SERVER_CHUNK_SIZE must fit the 3 digit chunk size line"
+#endif
 
-    if (response_code >= 100 && response_code < 200) {
-        os_strcpy(response_code_msg, "Continue");
-    } else if (response_code >= 200 && response_code < 300) {
-        os_strcpy(response_code_msg, "OK");
-    } else if (response_code >= 300 && response_code < 400) {
-        os_strcpy(response_code_msg, "Multiple Choices");
-    } else if (response_code >= 400 && response_code < 500) {
-        if (response_code == 404) {
-            os_strcpy(response_code_msg, "Not Found");
-        } else {
-            os_strcpy(response_code_msg, "Bad Request");
+/* Status line and fixed headers with the longest reason phrase and content type, NUL included */
+#define HEADER_FIXED_MAX 136
+#define HEADER_EXTRA_MAX (SIMPLE_HTTP_SERVER_HEADER_SIZE - HEADER_FIXED_MAX)
+
+#if SIMPLE_HTTP_SERVER_HEADER_SIZE <= HEADER_FIXED_MAX
+#error "SIMPLE_HTTP_SERVER_HEADER_SIZE does not fit the fixed response headers"
+#endif
+
+/* Flash pieces are copied a word at a time */
+#if SIMPLE_HTTP_SERVER_CHUNK_SIZE % 4
+#error "SIMPLE_HTTP_SERVER_CHUNK_SIZE must be a multiple of 4"
+#endif
+
+/* Token bucket, kept as microseconds of credit. A request costs 1 s / RATE */
+#define BUCKET_COST_US (1000000 / SIMPLE_HTTP_SERVER_RATE)
+#define BUCKET_FULL_US (BUCKET_COST_US * SIMPLE_HTTP_SERVER_BURST)
+
+#define SERVER_TASK_QUEUE_LEN 2
+
+static simple_http_server_stats_t stats;
+
+static uint32_t bucket_us = BUCKET_FULL_US;
+static uint32_t bucket_time;
+
+static os_event_t task_queue[SERVER_TASK_QUEUE_LEN];
+static uint8_t task_ready;
+static uint8_t task_posted;
+static uint8_t task_next;                       /* Round robin start */
+
+static void server_process(simple_http_server_conn_t* p_hconn);
+
+static const char* ICACHE_FLASH_ATTR
+status_line_text(uint16_t response_code) {
+    uint8_t i;
+
+    for (i = 0; i < sizeof(status_lines) / sizeof(status_lines[0]); ++i) {
+        if (status_lines[i].code == response_code) {
+            return status_lines[i].text;
         }
-    } else if (response_code >= 500 && response_code < 600) {
-        os_strcpy(response_code_msg, "Internal Server Error");
-    } else {
+    }
+
+    /* Fall back to the class reason phrase, xx0 entries come first in each class */
+    for (i = 0; i < sizeof(status_lines) / sizeof(status_lines[0]); ++i) {
+        if (status_lines[i].code / 100 == response_code / 100) {
+            return status_lines[i].text;
+        }
+    }
+
+    return NULL;
+}
+
+static uint8_t ICACHE_FLASH_ATTR
+conn_match(simple_http_server_conn_t* p_hconn, struct espconn* p_conn) {
+    if (p_hconn->p_conn == NULL) {
+        return 0;
+    }
+
+    /* Disconnect callbacks may not get the same espconn object, compare the remote end too */
+    return p_hconn->p_conn == p_conn ||
+           (p_hconn->remote_port == p_conn->proto.tcp->remote_port &&
+            os_memcmp(p_hconn->remote_ip, p_conn->proto.tcp->remote_ip, 4) == 0);
+}
+
+static simple_http_server_conn_t* ICACHE_FLASH_ATTR
+conn_find(struct espconn* p_conn) {
+    if (conns == NULL) {
+        return NULL;
+    }
+
+    for (uint8_t i = 0; i < SIMPLE_HTTP_SERVER_MAX_CONN; ++i) {
+        if (conn_match(&conns[i], p_conn)) {
+            return &conns[i];
+        }
+    }
+
+    return NULL;
+}
+
+static simple_http_server_conn_t* ICACHE_FLASH_ATTR
+conn_alloc(struct espconn* p_conn) {
+    for (uint8_t i = 0; i < SIMPLE_HTTP_SERVER_MAX_CONN; ++i) {
+        if (conns[i].p_conn == NULL) {
+            conns[i].p_conn      = p_conn;
+            conns[i].remote_port = p_conn->proto.tcp->remote_port;
+            os_memcpy(conns[i].remote_ip, p_conn->proto.tcp->remote_ip, 4);
+            conns[i].rx_len      = 0;
+            conns[i].deferred    = 0;
+            conns[i].close_after = 0;
+            conns[i].closing     = 0;
+            conns[i].sending     = 0;
+            conns[i].body        = NULL;
+            conns[i].body_len    = 0;
+            conns[i].body_in_flash = 0;
+            conns[i].producer    = NULL;
+            conns[i].release     = NULL;
+            return &conns[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void ICACHE_FLASH_ATTR
+response_release(simple_http_server_conn_t* p_hconn) {
+    if (p_hconn->body != NULL && p_hconn->free_body) {
+        os_free(p_hconn->body);
+    }
+
+    /* Kept buffer, the owner may reuse it now */
+    if (p_hconn->release != NULL) {
+        p_hconn->release(p_hconn->release_arg);
+        p_hconn->release = NULL;
+    }
+
+    /* Stream cut short, let the producer release its state */
+    if (p_hconn->producer != NULL && !p_hconn->stream_done) {
+        p_hconn->producer(p_hconn->producer_arg, NULL, 0, NULL);
+    }
+
+    p_hconn->body     = NULL;
+    p_hconn->body_len = 0;
+    p_hconn->body_in_flash = 0;
+    p_hconn->sending  = 0;
+    p_hconn->producer = NULL;
+}
+
+static void ICACHE_FLASH_ATTR
+conn_release(simple_http_server_conn_t* p_hconn) {
+    response_release(p_hconn);
+    p_hconn->p_conn = NULL;
+}
+
+static void ICACHE_FLASH_ATTR
+send_server_response(simple_http_server_conn_t* p_hconn, char* data, size_t data_len, uint16_t response_code, http_content_type_t content_type, uint8_t free_data, const char* headers) {
+    const char* response_code_msg;
+    size_t header_len;
+
+    response_code_msg = status_line_text(response_code);
+    if (content_type >= sizeof(content_types) / sizeof(content_types[0])) {
+        content_type = HTTP_CONTENT_TYPE_TEXT_HTML;
+    }
+
+    if (data == NULL) {
+        data_len = 0;
+    }
+
+    p_hconn->body      = data;
+    p_hconn->body_len  = data_len;
+    p_hconn->free_body = free_data;
+    p_hconn->sending   = 1;
+
+    if (response_code_msg == NULL) {
+        response_release(p_hconn);
         return;
     }
 
-    switch(content_type) {
-        case HTTP_CONTENT_TYPE_TEXT_HTML:
-            content_type_txt = (char*)os_malloc(sizeof(char) * HTTP_CONTENT_TYPE_TEXT_HTML_SIZE);
-            os_strcpy(content_type_txt, HTTP_CONTENT_TYPE_TEXT_HTML_TEXT);
-            break;
-        case HTTP_CONTENT_TYPE_TEXT_PLAIN:
-            content_type_txt = (char*)os_malloc(sizeof(char) * HTTP_CONTENT_TYPE_TEXT_PLAIN_SIZE);
-            os_strcpy(content_type_txt, HTTP_CONTENT_TYPE_TEXT_PLAIN_TEXT);
-            break;
-        case HTTP_CONTENT_TYPE_TEXT_XML:
-            content_type_txt = (char*)os_malloc(sizeof(char) * HTTP_CONTENT_TYPE_TEXT_XML_SIZE);
-            os_strcpy(content_type_txt, HTTP_CONTENT_TYPE_TEXT_XML_TEXT);
-            break;
-        case HTTP_CONTENT_TYPE_MULTIPART_FORM_DATA:
-            content_type_txt = (char*)os_malloc(sizeof(char) * HTTP_CONTENT_TYPE_MULTIPART_FORM_DATA_SIZE);
-            os_strcpy(content_type_txt, HTTP_CONTENT_TYPE_MULTIPART_FORM_DATA_TEXT);
-            break;
-        case HTTP_CONTENT_TYPE_APPLICATION_JSON:
-            content_type_txt = (char*)os_malloc(sizeof(char) * HTTP_CONTENT_TYPE_APPLICATION_JSON_SIZE);
-            os_strcpy(content_type_txt, HTTP_CONTENT_TYPE_APPLICATION_JSON_TEXT);
-            break;
-        case HTTP_CONTENT_TYPE_APPLICATION_XML:
-            content_type_txt = (char*)os_malloc(sizeof(char) * HTTP_CONTENT_TYPE_APPLICATION_XML_SIZE);
-            os_strcpy(content_type_txt, HTTP_CONTENT_TYPE_APPLICATION_XML_TEXT);
-            break;
-        default:
-            content_type_txt = (char*)os_malloc(sizeof(char) * HTTP_CONTENT_TYPE_TEXT_HTML_SIZE);
-            os_strcpy(content_type_txt, HTTP_CONTENT_TYPE_TEXT_HTML_TEXT);
-            break;
+    header_len = os_sprintf(p_hconn->header, "HTTP/1.1 %d %s\r\n", response_code, response_code_msg);
+    /* No body by definition, a length would be taken as the one of the cached entity */
+    if (response_code != 304) {
+        header_len += os_sprintf(p_hconn->header + header_len, "Content-Length: %d\r\n", data_len);
+    }
+    header_len += os_sprintf(p_hconn->header + header_len,
+                             "Server: lwIP/1.4.0\r\nContent-Type: %s\r\n%s\r\n",
+                             content_types[content_type], headers != NULL ? headers : "");
+
+    if (espconn_send(p_hconn->p_conn, (uint8*)p_hconn->header, header_len) != 0) {
+        response_release(p_hconn);
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+send_stream_response(simple_http_server_conn_t* p_hconn, uint16_t response_code, http_content_type_t content_type, simple_http_server_producer_t producer, void* producer_arg, const char* headers) {
+    const char* response_code_msg;
+    size_t header_len;
+
+    p_hconn->producer      = producer;
+    p_hconn->producer_arg  = producer_arg;
+    p_hconn->stream_done   = 0;
+    p_hconn->stream_paused = 0;
+    p_hconn->sending       = 1;
+
+    response_code_msg = status_line_text(response_code);
+    if (content_type >= sizeof(content_types) / sizeof(content_types[0])) {
+        content_type = HTTP_CONTENT_TYPE_TEXT_HTML;
     }
 
-    msg = (char*)os_zalloc(sizeof(char) * msg_size);
-    if (msg == NULL) {
+    if (response_code_msg == NULL) {
+        response_release(p_hconn);
         return;
     }
 
-    if (data == NULL || data_len == 0) {
-        msg_size = os_sprintf(msg,
-                              "HTTP/1.1 %d %s\r\nContent-Length: %d\r\nServer: lwIP/1.4.0\r\n" \
-                              "Content-Type: %s\r\n",
-                              response_code, response_code_msg, data_len, content_type_txt);
-    } else {
-        msg_size = os_sprintf(msg,
-                              "HTTP/1.1 %d %s\r\nContent-Length: %d\r\nServer: lwIP/1.4.0\r\n" \
-                              "Content-Type: %s\r\n\r\n%s",
-                              response_code, response_code_msg, data_len, content_type_txt, data);
+    header_len = os_sprintf(p_hconn->header,
+                            "HTTP/1.1 %d %s\r\nTransfer-Encoding: chunked\r\nServer: lwIP/1.4.0\r\n" \
+                            "Content-Type: %s\r\n%s\r\n",
+                            response_code, response_code_msg, content_types[content_type],
+                            headers != NULL ? headers : "");
+
+    if (espconn_send(p_hconn->p_conn, (uint8*)p_hconn->header, header_len) != 0) {
+        response_release(p_hconn);
+    }
+}
+
+/**
+ * Pull the next piece from the producer and send it as one chunk.
+ * Returns 1 while the stream is in flight or paused, 0 once it is over.
+ */
+static uint8_t ICACHE_FLASH_ATTR
+stream_next(simple_http_server_conn_t* p_hconn) {
+    char size_line[CHUNK_SIZE_LINE + 1];
+    uint8_t done = 0;
+    size_t data_len;
+    size_t chunk_len = 0;
+
+    if (p_hconn->stream_done) {
+        return 0;
     }
 
-    // os_printf("%s\n", msg);
-    espconn_send(p_conn, (uint8*)msg, msg_size);
+    data_len = p_hconn->producer(p_hconn->producer_arg, p_hconn->chunk + CHUNK_SIZE_LINE, CHUNK_DATA_MAX, &done);
+    if (data_len > CHUNK_DATA_MAX) {
+        data_len = CHUNK_DATA_MAX;
+    }
 
-    os_free(msg);
+    if (data_len == 0 && !done) {
+        p_hconn->stream_paused = 1;
+        return 1;
+    }
+
+    if (data_len > 0) {
+        /* Fixed width size line, os_sprintf NUL would land on the data */
+        os_sprintf(size_line, "%03x\r\n", data_len);
+        os_memcpy(p_hconn->chunk, size_line, CHUNK_SIZE_LINE);
+        chunk_len = CHUNK_SIZE_LINE + data_len;
+        os_memcpy(p_hconn->chunk + chunk_len, "\r\n", CHUNK_TRAILER);
+        chunk_len += CHUNK_TRAILER;
+    }
+    if (done) {
+        os_memcpy(p_hconn->chunk + chunk_len, CHUNK_LAST, CHUNK_LAST_LEN);
+        chunk_len += CHUNK_LAST_LEN;
+        p_hconn->stream_done = 1;
+    }
+
+    if (espconn_send(p_hconn->p_conn, (uint8*)p_hconn->chunk, chunk_len) != 0) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Copy the next piece of a flash body to `chunk` and send it. Flash only allows aligned
+ * 32 bit reads, so the body is read a word at a time, never with byte accesses.
+ * Returns 1 while the body is in flight, 0 on a send error.
+ */
+static uint8_t ICACHE_FLASH_ATTR
+flash_next(simple_http_server_conn_t* p_hconn) {
+    const uint32_t* p_src = (const uint32_t*)p_hconn->body;
+    size_t len = p_hconn->body_len;
+    uint32_t word;
+
+    if (len > SIMPLE_HTTP_SERVER_CHUNK_SIZE) {
+        len = SIMPLE_HTTP_SERVER_CHUNK_SIZE;
+    }
+
+    for (size_t i = 0; i < len; i += 4) {
+        word = *p_src++;
+        os_memcpy(p_hconn->chunk + i, &word, len - i < 4 ? len - i : 4);
+    }
+
+    p_hconn->body     += len;
+    p_hconn->body_len -= len;
+
+    return espconn_send(p_hconn->p_conn, (uint8*)p_hconn->chunk, len) == 0;
+}
+
+simple_http_status_t ICACHE_FLASH_ATTR
+simple_http_server_stream_resume(struct espconn* p_conn) {
+    simple_http_server_conn_t* p_hconn = conn_find(p_conn);
+
+    if (p_hconn == NULL || p_hconn->producer == NULL || !p_hconn->stream_paused) {
+        return SIMPLE_HTTP_ERROR;
+    }
+
+    p_hconn->stream_paused = 0;
+    if (!stream_next(p_hconn)) {
+        response_release(p_hconn);
+        server_process(p_hconn);
+    }
+
+    return SIMPLE_HTTP_OK;
 }
 
 static void ICACHE_FLASH_ATTR
-server_response(void *arg, char *pusrdata, unsigned short length) {
+server_sent(void* arg) {
     struct espconn* p_conn = arg;
+    simple_http_server_conn_t* p_hconn = conn_find(p_conn);
+    uint32_t latency;
+
+    if (p_hconn == NULL || !p_hconn->sending) {
+        return;
+    }
+
+    /* Streamed body, one chunk per sent callback */
+    if (p_hconn->producer != NULL) {
+        if (stream_next(p_hconn)) {
+            return;
+        }
+    }
+
+    /* Flash body, one piece per sent callback */
+    if (p_hconn->body_in_flash && p_hconn->body_len > 0) {
+        if (flash_next(p_hconn)) {
+            return;
+        }
+        p_hconn->body_len = 0;
+    }
+
+    /* Header done, send the body straight from the callback buffer */
+    if (p_hconn->body_len > 0) {
+        size_t body_len = p_hconn->body_len;
+
+        p_hconn->body_len = 0;
+        if (espconn_send(p_conn, (uint8*)p_hconn->body, body_len) == 0) {
+            return;
+        }
+    }
+
+    latency = system_get_time() - p_hconn->start_us;
+    stats.responses += 1;
+    stats.latency_sum_us += latency;
+    if (latency > stats.latency_max_us) {
+        stats.latency_max_us = latency;
+    }
+
+    response_release(p_hconn);
+
+    /* Pipelined request already buffered */
+    server_process(p_hconn);
+}
+
+static void ICACHE_FLASH_ATTR
+server_disconnected(void* arg) {
+    simple_http_server_conn_t* p_hconn = conn_find((struct espconn*)arg);
+
+    if (p_hconn != NULL) {
+        conn_release(p_hconn);
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+server_reconnected(void* arg, sint8 err) {
+    server_disconnected(arg);
+}
+
+static char* ICACHE_FLASH_ATTR
+find_char(char* p_start, const char* p_end, char c) {
+    for (; p_start < p_end; ++p_start) {
+        if (*p_start == c) {
+            return p_start;
+        }
+    }
 
+    return NULL;
+}
+
+/**
+ * Split the request line in place. Method, path and query are NUL terminated inside the
+ * receive buffer (the separators are overwritten), nothing is copied.
+ * Returns the error response code, 0 on success.
+ */
+static uint16_t ICACHE_FLASH_ATTR
+tokenize_request(char* p_buff, unsigned short length, simple_http_server_request_info_t* p_info) {
+    const char* p_end = p_buff + length;
     char* first_space;
     char* second_space;
-    char* data_start;
+    char* query;
+    char* p;
+
+    first_space = find_char(p_buff, p_end, ' ');
+    if (first_space == NULL || first_space == p_buff ||
+        (first_space - p_buff) >= SIMPLE_HTTP_SERVER_MAX_REQUEST_METHOD) {
+        return 400;
+    }
+
+    second_space = find_char(first_space + 1, p_end, ' ');
+    if (second_space == NULL || (second_space - first_space - 1) >= SIMPLE_HTTP_SERVER_MAX_REQUEST_PATH) {
+        return 400;
+    }
+
+    if ((p_end - second_space - 1) < 4 || os_strncmp(second_space + 1, "HTTP", 4) != 0) {
+        return 400;
+    }
+
+    *first_space  = '\0';
+    *second_space = '\0';
+
+    p_info->request_method     = p_buff;
+    p_info->request_method_len = first_space - p_buff;
+    p_info->request_path       = first_space + 1;
+    p_info->request_path_len   = second_space - first_space - 1;
+    p_info->request_query      = NULL;
+
+    query = find_char(p_info->request_path, second_space, '?');
+    if (query != NULL) {
+        *query = '\0';
+        p_info->request_query    = query + 1;
+        p_info->request_path_len = query - p_info->request_path;
+    }
+
+    p_info->request_data = NULL;
+    for (p = second_space + 1; p + 3 < p_end; ++p) {
+        if (p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n') {
+            p_info->request_data = p + 4;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Binary search in the route table, sorted by path. `p_path_found` is set if some route
+ * has the path, even if the method does not match.
+ */
+static const simple_http_server_route_t* ICACHE_FLASH_ATTR
+route_find(simple_http_server_config_t* p_config, const char* path, const char* method, uint8_t* p_path_found) {
+    const simple_http_server_route_t* p_route;
+    int16_t low = 0;
+    int16_t high = (int16_t)p_config->routes_len - 1;
+    int16_t mid = -1;
+    int cmp;
+
+    *p_path_found = 0;
+
+    while (low <= high) {
+        mid = (low + high) / 2;
+        cmp = os_strcmp(path, p_config->routes[mid].path);
+        if (cmp == 0) {
+            break;
+        } else if (cmp < 0) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    if (low > high) {
+        return NULL;
+    }
+    *p_path_found = 1;
 
-    char* request_method;
-    char* request_path;
+    /* Same path with different methods are adjacent */
+    while (mid > 0 && os_strcmp(path, p_config->routes[mid - 1].path) == 0) {
+        --mid;
+    }
+    for (; mid < (int16_t)p_config->routes_len; ++mid) {
+        p_route = &p_config->routes[mid];
+        if (os_strcmp(path, p_route->path) != 0) {
+            break;
+        }
+        if (p_route->method == NULL || os_strcmp(method, p_route->method) == 0) {
+            return p_route;
+        }
+    }
+
+    return NULL;
+}
 
-    char* data = NULL;
+static uint8_t ICACHE_FLASH_ATTR
+header_name_is(const char* p_line, const char* p_end, const char* name) {
+    char c;
+
+    for (; *name != '\0'; ++name, ++p_line) {
+        if (p_line >= p_end) {
+            return 0;
+        }
+
+        c = *p_line;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (c != *name) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Length of the first complete request in the receive buffer (header + Content-Length body).
+ * 0 if more data is needed.
+ */
+static size_t ICACHE_FLASH_ATTR
+request_length(simple_http_server_conn_t* p_hconn) {
+    char* p_buff = p_hconn->rx;
+    const char* p_end = p_buff + p_hconn->rx_len;
+    size_t header_len = 0;
+    size_t content_len = 0;
+    char* p;
+
+    for (p = p_buff; p + 3 < p_end; ++p) {
+        if (p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n') {
+            header_len = p + 4 - p_buff;
+            break;
+        }
+    }
+    if (header_len == 0) {
+        return 0;
+    }
+
+    for (p = p_buff; p < p_buff + header_len; ++p) {
+        if (*p == '\n' && header_name_is(p + 1, p_buff + header_len, "content-length:")) {
+            for (p += 16; *p == ' '; ++p);
+            for (; *p >= '0' && *p <= '9'; ++p) {
+                /* Saturated, a long digit string must not wrap to a small length */
+                if (content_len <= SIMPLE_HTTP_SERVER_RX_SIZE) {
+                    content_len = content_len * 10 + (*p - '0');
+                }
+            }
+            break;
+        }
+    }
+
+    /* Body too big for the buffer is reported as a full buffer, handled by the caller */
+    if (header_len + content_len > SIMPLE_HTTP_SERVER_RX_SIZE) {
+        return SIMPLE_HTTP_SERVER_RX_SIZE + 1;
+    }
+    if (header_len + content_len > p_hconn->rx_len) {
+        return 0;
+    }
+
+    return header_len + content_len;
+}
+
+/* If-None-Match list against the entity tag. Weak comparison, as the header asks for */
+static uint8_t ICACHE_FLASH_ATTR
+etag_match(const char* p_list, size_t list_len, const char* etag) {
+    const char* p_end = p_list + list_len;
+    size_t etag_len = os_strlen(etag);
+    const char* p_tag;
+
+    while (p_list < p_end) {
+        for (; p_list < p_end && (*p_list == ' ' || *p_list == ','); ++p_list);
+        if (p_list < p_end && *p_list == '*') {
+            return 1;
+        }
+        if (p_end - p_list > 2 && p_list[0] == 'W' && p_list[1] == '/') {
+            p_list += 2;
+        }
+
+        p_tag = p_list;
+        for (; p_list < p_end && *p_list != ',' && *p_list != ' '; ++p_list);
+        if ((size_t)(p_list - p_tag) == etag_len && os_strncmp(p_tag, etag, etag_len) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Drop the callback output, the response goes without it */
+static void ICACHE_FLASH_ATTR
+callback_release(simple_http_server_request_info_t* p_info, char* data) {
+    if (p_info->producer != NULL) {
+        p_info->producer(p_info->producer_arg, NULL, 0, NULL);
+        p_info->producer = NULL;
+    }
+    if (data != NULL && !p_info->keep_response) {
+        os_free(data);
+    }
+    if (p_info->release != NULL) {
+        p_info->release(p_info->release_arg);
+        p_info->release = NULL;
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+server_dispatch(simple_http_server_conn_t* p_hconn, size_t length) {
+    char* data;
     size_t data_len;
     uint16_t response_code;
     http_content_type_t content_type;
+    char extra[HEADER_EXTRA_MAX];
+    size_t extra_len = 0;
+    const char* p_match;
+    size_t match_len;
 
-    simple_http_server_config_t* p_config = (simple_http_server_config_t*)p_conn->reverse;
+    simple_http_server_config_t* p_config = p_hconn->p_config;
+    simple_http_server_callback_t callback = p_config->user_callback;
+    const simple_http_server_route_t* p_route;
+    uint8_t path_found;
 
     simple_http_server_request_info_t request_data;
 
-    first_space = os_strchr(pusrdata, ' ');
-    if (first_space == NULL) {
-        send_server_response(p_conn, NULL, 0, 500, HTTP_CONTENT_TYPE_TEXT_HTML);
+    response_code = tokenize_request(p_hconn->rx, length, &request_data);
+    if (response_code != 0) {
+        send_server_response(p_hconn, NULL, 0, response_code, HTTP_CONTENT_TYPE_TEXT_HTML, 0, NULL);
         return;
     }
 
-    second_space = os_strchr(first_space + 1, ' ');
-    if (second_space == NULL) {
-        send_server_response(p_conn, NULL, 0, 500, HTTP_CONTENT_TYPE_TEXT_HTML);
+    p_route = route_find(p_config, request_data.request_path, request_data.request_method, &path_found);
+    if (p_route != NULL) {
+        callback = p_route->callback;
+    } else if (path_found) {
+        send_server_response(p_hconn, NULL, 0, 405, HTTP_CONTENT_TYPE_TEXT_HTML, 0, NULL);
         return;
     }
 
-    if (!os_strncmp(second_space + 1, "HTTP", 4) == 0) {
-        send_server_response(p_conn, NULL, 0, 400, HTTP_CONTENT_TYPE_TEXT_HTML);
-        return;
+    // Call user response generator
+    if (callback == NULL) {
+        send_server_response(p_hconn, NULL, 0, 404, HTTP_CONTENT_TYPE_TEXT_HTML, 0, NULL);
+    } else {
+        request_data.p_conn = p_hconn->p_conn;
+        request_data.raw_request = p_hconn->rx;
+        request_data.raw_request_length = length;
+        request_data.keep_response = 0;
+        request_data.flash_response = 0;
+        request_data.headers = NULL;
+        request_data.etag = NULL;
+        request_data.producer = NULL;
+        request_data.producer_arg = NULL;
+        request_data.release = NULL;
+        request_data.release_arg = NULL;
+
+        data = callback(&request_data, &data_len, &response_code, &content_type);
+        if (request_data.flash_response) {
+            request_data.keep_response = 1;
+        }
+
+        /* Callback header lines and entity tag, must fit the header buffer */
+        if (request_data.headers != NULL) {
+            extra_len += os_strlen(request_data.headers);
+        }
+        if (request_data.etag != NULL) {
+            extra_len += os_strlen(request_data.etag) + sizeof("ETag: \r\n") - 1;
+        }
+        if (extra_len >= HEADER_EXTRA_MAX) {
+            callback_release(&request_data, data);
+            send_server_response(p_hconn, NULL, 0, 500, HTTP_CONTENT_TYPE_TEXT_HTML, 0, NULL);
+            return;
+        }
+
+        extra_len = 0;
+        extra[0] = '\0';
+        if (request_data.headers != NULL) {
+            extra_len += os_sprintf(extra, "%s", request_data.headers);
+        }
+        if (request_data.etag != NULL) {
+            extra_len += os_sprintf(extra + extra_len, "ETag: %s\r\n", request_data.etag);
+
+            /* The client copy is current, header only */
+            p_match = simple_http_server_request_header(&request_data, "if-none-match", &match_len);
+            if (response_code == 200 && p_match != NULL && etag_match(p_match, match_len, request_data.etag)) {
+                callback_release(&request_data, data);
+                stats.not_modified += 1;
+                send_server_response(p_hconn, NULL, 0, 304, content_type, 0, extra);
+                return;
+            }
+        }
+
+        if (request_data.producer != NULL) {
+            if (data != NULL && !request_data.keep_response) {
+                os_free(data);
+            }
+            if (request_data.release != NULL) {
+                request_data.release(request_data.release_arg);
+            }
+            send_stream_response(p_hconn, response_code, content_type, request_data.producer, request_data.producer_arg, extra);
+        } else {
+            p_hconn->body_in_flash = request_data.flash_response && data != NULL;
+            p_hconn->release       = request_data.release;
+            p_hconn->release_arg   = request_data.release_arg;
+            send_server_response(p_hconn, data, data_len, response_code, content_type, !request_data.keep_response, extra);
+        }
     }
+}
+
+static uint8_t ICACHE_FLASH_ATTR
+bucket_take(void) {
+    uint32_t now = system_get_time();
+    uint32_t elapsed = now - bucket_time;
 
-    data_start = os_strstr(pusrdata, "\n\r\n");
-    if (data_start == NULL) {
-        // return;
+    bucket_time = now;
+    if (elapsed >= BUCKET_FULL_US - bucket_us) {
+        bucket_us = BUCKET_FULL_US;
     } else {
-        data_start += 3;
+        bucket_us += elapsed;
+    }
+
+    if (bucket_us < BUCKET_COST_US) {
+        return 0;
     }
 
-    request_method = (char*)os_malloc(sizeof(char) * SIMPLE_HTTP_SERVER_MAX_REQUEST_METHOD);
-    request_path = (char*)os_malloc(sizeof(char) * SIMPLE_HTTP_SERVER_MAX_REQUEST_PATH);
+    bucket_us -= BUCKET_COST_US;
+    return 1;
+}
+
+static void ICACHE_FLASH_ATTR
+post_task(void) {
+    if (!task_posted) {
+        task_posted = system_os_post(SIMPLE_HTTP_SERVER_TASK_PRIO, 0, 0);
+    }
+}
 
-    if (request_path == NULL || request_method == NULL) {
-        send_server_response(p_conn, NULL, 0, 500, HTTP_CONTENT_TYPE_TEXT_HTML);
+/* Drop the first `length` bytes of the receive buffer */
+static void ICACHE_FLASH_ATTR
+request_consume(simple_http_server_conn_t* p_hconn, size_t length) {
+    p_hconn->rx_len -= length;
+    if (p_hconn->rx_len > 0) {
+        os_memmove(p_hconn->rx, p_hconn->rx + length, p_hconn->rx_len);
+    }
+}
+
+/* Admitted request, from the server task */
+static void ICACHE_FLASH_ATTR
+server_run(simple_http_server_conn_t* p_hconn) {
+    size_t length = request_length(p_hconn);
+    uint32_t wait = system_get_time() - p_hconn->start_us;
+
+    p_hconn->deferred = 0;
+    if (wait > stats.defer_max_us) {
+        stats.defer_max_us = wait;
+    }
+
+    server_dispatch(p_hconn, length);
+    request_consume(p_hconn, length);
+}
+
+/* One request per run, the SDK serves timers and higher priority tasks in between */
+static void ICACHE_FLASH_ATTR
+server_task(os_event_t* events) {
+    simple_http_server_conn_t* p_hconn;
+    uint8_t start = task_next;                  /* task_next moves once a request runs */
+    uint8_t idx;
+    uint8_t pending = 0;
+
+    task_posted = 0;
+
+    for (uint8_t i = 0; i < SIMPLE_HTTP_SERVER_MAX_CONN; ++i) {
+        idx = (start + i) % SIMPLE_HTTP_SERVER_MAX_CONN;
+        p_hconn = &conns[idx];
+
+        /* The disconnect callback releases the slot */
+        if (p_hconn->p_conn != NULL && p_hconn->closing) {
+            p_hconn->closing = 0;
+            espconn_disconnect(p_hconn->p_conn);
+            continue;
+        }
+
+        if (p_hconn->p_conn == NULL || !p_hconn->deferred) {
+            continue;
+        }
+
+        if (pending++ == 0) {
+            task_next = idx + 1;
+            server_run(p_hconn);
+        }
+    }
+
+    if (pending > 1) {
+        post_task();
+    }
+}
+
+/* Error answer to a request that does not fit. Its rest is still on the way, so the connection closes */
+static void ICACHE_FLASH_ATTR
+server_reject(simple_http_server_conn_t* p_hconn, uint16_t response_code) {
+    p_hconn->rx_len = 0;
+    p_hconn->close_after = 1;
+    send_server_response(p_hconn, NULL, 0, response_code, HTTP_CONTENT_TYPE_TEXT_HTML, 0, "Connection: close\r\n");
+}
+
+/* Handle the next buffered request, one at a time per connection */
+static void ICACHE_FLASH_ATTR
+server_process(simple_http_server_conn_t* p_hconn) {
+    size_t length;
+
+    if (p_hconn->p_conn == NULL || p_hconn->sending || p_hconn->deferred) {
         return;
     }
 
-    os_strncpy(request_method, pusrdata, first_space - pusrdata);
-    os_strncpy(request_path, first_space+1, second_space - first_space - 1);
+    length = request_length(p_hconn);
+    if (length != 0 || p_hconn->rx_len >= SIMPLE_HTTP_SERVER_RX_SIZE) {
+        p_hconn->start_us = system_get_time();
+        stats.requests += 1;
+    }
 
-    // Call user response generator
-    if (p_config->user_callback == NULL) {
-        send_server_response(p_conn, NULL, 0, 404, HTTP_CONTENT_TYPE_TEXT_HTML);
-    } else {
-        request_data.p_conn = p_conn;
-        request_data.request_method = request_method;
-        request_data.request_path = request_path;
-        request_data.request_data = data_start;
-        request_data.raw_request = pusrdata;
-        request_data.raw_request_length = length;
+    if (length == 0) {
+        if (p_hconn->rx_len >= SIMPLE_HTTP_SERVER_RX_SIZE) {
+            /* Header does not fit */
+            server_reject(p_hconn, 431);
+        } else if (p_hconn->close_after) {
+            /* Complete requests answered, the rest was cut. The client sends it again */
+            p_hconn->closing = 1;
+            post_task();
+        }
+        return;
+    }
+    if (length > SIMPLE_HTTP_SERVER_RX_SIZE) {
+        server_reject(p_hconn, 413);
+        return;
+    }
 
-        data = p_config->user_callback(&request_data, &data_len, &response_code, &content_type);
-        send_server_response(p_conn, data, data_len, response_code, content_type);
+    /* Over the rate limit, answered without running the route */
+    if (!bucket_take()) {
+        stats.shed += 1;
+        request_consume(p_hconn, length);
+        send_server_response(p_hconn, NULL, 0, 503, HTTP_CONTENT_TYPE_TEXT_HTML, 0, "Retry-After: 1\r\n");
+        return;
     }
 
-    os_free(request_method);
-    os_free(request_path);
+    p_hconn->deferred = 1;
+    stats.deferred += 1;
+    post_task();
+}
 
-    if (data != NULL) {
-        os_free(data);
-        data = NULL;
+static void ICACHE_FLASH_ATTR
+server_response(void *arg, char *pusrdata, unsigned short length) {
+    simple_http_server_conn_t* p_hconn = conn_find((struct espconn*)arg);
+    size_t room;
+
+    if (p_hconn == NULL) {
+        /* Over the pool limit, the idle timeout closes it */
+        return;
+    }
+
+    /* Closing, the rest of a rejected or cut request */
+    if (p_hconn->close_after) {
+        return;
     }
+
+    /* Pipelined requests over the buffer: the one cut is not answered, the connection closes after the others */
+    room = SIMPLE_HTTP_SERVER_RX_SIZE - p_hconn->rx_len;
+    if (length > room) {
+        length = room;
+        p_hconn->close_after = 1;
+    }
+    os_memcpy(p_hconn->rx + p_hconn->rx_len, pusrdata, length);
+    p_hconn->rx_len += length;
+
+    server_process(p_hconn);
 }
 
 static void ICACHE_FLASH_ATTR
 server_conn_call(void *arg) {
     struct espconn* conn = arg;
+    simple_http_server_conn_t* p_hconn = conn_alloc(conn);
+
+    if (p_hconn != NULL) {
+        p_hconn->p_config = (simple_http_server_config_t*)conn->reverse;
+    } else {
+        stats.shed += 1;
+    }
+
     espconn_regist_recvcb(conn, server_response);
-    // espconn_regist_reconcb(conn, );
+    espconn_regist_sentcb(conn, server_sent);
+    espconn_regist_disconcb(conn, server_disconnected);
+    espconn_regist_reconcb(conn, server_reconnected);
 }
 
 simple_http_status_t ICACHE_FLASH_ATTR
-create_basic_http_server(struct espconn* p_conn, uint16_t port, simple_http_server_callback_t callback) {
-    simple_http_server_config_t* p_config = (simple_http_server_config_t*)os_zalloc(sizeof(simple_http_server_config_t));
+create_http_server(struct espconn* p_conn, uint16_t port, const simple_http_server_route_t* routes, size_t routes_len, simple_http_server_callback_t default_callback) {
+    simple_http_server_config_t* p_config;
+
+    for (size_t i = 1; i < routes_len; ++i) {
+        if (os_strcmp(routes[i - 1].path, routes[i].path) > 0) {
+            return SIMPLE_HTTP_ERROR;
+        }
+    }
+
+    if (!task_ready) {
+        if (!system_os_task(server_task, SIMPLE_HTTP_SERVER_TASK_PRIO, task_queue, SERVER_TASK_QUEUE_LEN)) {
+            return SIMPLE_HTTP_ERROR;
+        }
+        task_ready = 1;
+    }
+
+    if (conns == NULL) {
+        conns = (simple_http_server_conn_t*)os_zalloc(sizeof(simple_http_server_conn_t) * SIMPLE_HTTP_SERVER_MAX_CONN);
+        if (conns == NULL) {
+            return SIMPLE_HTTP_MEM_ERROR;
+        }
+    }
 
-    // if (callback == NULL) {
-    //     return SIMPLE_HTTP_NO_CALLBACK;
-    // }
+    p_config = (simple_http_server_config_t*)os_zalloc(sizeof(simple_http_server_config_t));
+    if (p_config == NULL) {
+        return SIMPLE_HTTP_MEM_ERROR;
+    }
 
     p_conn->type = ESPCONN_TCP;
     p_conn->state = ESPCONN_NONE;
@@ -194,11 +955,68 @@ create_basic_http_server(struct espconn* p_conn, uint16_t port, simple_http_serv
     p_conn->proto.tcp = (esp_tcp *)os_zalloc(sizeof(esp_tcp));
     p_conn->proto.tcp->local_port = port;
 
-    p_config->user_callback = callback;
+    p_config->user_callback = default_callback;
+    p_config->routes = routes;
+    p_config->routes_len = routes_len;
     p_conn->reverse = p_config;
 
     espconn_regist_connectcb(p_conn, server_conn_call);
     espconn_accept(p_conn);
+    espconn_tcp_set_max_con_allow(p_conn, SIMPLE_HTTP_SERVER_MAX_CONN);
+    espconn_regist_time(p_conn, SIMPLE_HTTP_SERVER_IDLE_TIMEOUT, 0);
 
     return SIMPLE_HTTP_OK;
 }
+
+simple_http_status_t ICACHE_FLASH_ATTR
+create_basic_http_server(struct espconn* p_conn, uint16_t port, simple_http_server_callback_t callback) {
+    return create_http_server(p_conn, port, NULL, 0, callback);
+}
+
+const simple_http_server_stats_t* ICACHE_FLASH_ATTR
+simple_http_server_get_stats(void) {
+    return &stats;
+}
+
+const char* ICACHE_FLASH_ATTR
+simple_http_server_query_param(const char* query, const char* name, size_t* p_len) {
+    size_t name_len = os_strlen(name);
+    const char* p = query;
+
+    while (p != NULL && *p != '\0') {
+        const char* p_next = (const char*)os_strchr(p, '&');
+        size_t param_len = p_next == NULL ? os_strlen(p) : (size_t)(p_next - p);
+
+        if (param_len > name_len && p[name_len] == '=' && os_strncmp(p, name, name_len) == 0) {
+            *p_len = param_len - name_len - 1;
+            return p + name_len + 1;
+        }
+
+        p = p_next == NULL ? NULL : p_next + 1;
+    }
+
+    *p_len = 0;
+    return NULL;
+}
+
+const char* ICACHE_FLASH_ATTR
+simple_http_server_request_header(const simple_http_server_request_info_t* p_info, const char* name, size_t* p_len) {
+    const char* p = p_info->raw_request;
+    const char* p_end = p_info->request_data != NULL ? p_info->request_data : p + p_info->raw_request_length;
+    size_t name_len = os_strlen(name);
+    const char* p_value;
+
+    for (; p < p_end; ++p) {
+        if (*p != '\n' || p + 1 + name_len >= p_end || !header_name_is(p + 1, p_end, name) || p[1 + name_len] != ':') {
+            continue;
+        }
+
+        for (p_value = p + 2 + name_len; p_value < p_end && *p_value == ' '; ++p_value);
+        for (p = p_value; p < p_end && *p != '\r' && *p != '\n'; ++p);
+
+        *p_len = p - p_value;
+        return p_value;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,605 @@
+/**
+ * \file simple_mqtt.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Minimal MQTT 3.1.1 publisher over espconn. Source file.
+ * \version 0.1
+ * \date 2021-04-18
+ */
+
+#include <osapi.h>
+#include <mem.h>
+#include <espconn.h>
+#include <user_interface.h>
+
+#include "simple_mqtt/simple_mqtt.h"
+
+#define MQTT_CONNECT  0x10
+#define MQTT_CONNACK  0x20
+#define MQTT_PUBLISH  0x30
+#define MQTT_PUBACK   0x40
+#define MQTT_PINGREQ  0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DUP      0x08
+
+#define MQTT_LEVEL_311 4
+#define MQTT_FLAG_USER 0x80
+#define MQTT_FLAG_PASS 0x40
+
+#define RX_BODY_MAX 4                           /* Longest packet read, CONNACK and PUBACK */
+
+typedef enum {
+    RX_TYPE,
+    RX_LEN,
+    RX_BODY,
+} rx_state_t;
+
+/* QoS 1 message waiting for its PUBACK */
+typedef struct {
+    uint16_t id;                                /* 0 if acknowledged */
+    uint16_t len;
+    uint8_t  queued;                            /* Sent on the current connection */
+    uint8_t  pkt[SIMPLE_MQTT_MSG_SIZE];         /* Encoded PUBLISH, resent as is with DUP */
+} inflight_t;
+
+static const simple_mqtt_config_t* p_cfg;
+static struct espconn mqtt_conn;
+static esp_tcp mqtt_tcp;
+static ip_addr_t broker_ip;
+
+static simple_mqtt_state_t state;
+static simple_mqtt_stats_t stats;
+
+static os_timer_t timer_tick;
+static uint32_t now_s;                          /* Ticks since init */
+static uint32_t state_s;                        /* `now_s` of the last state change */
+static uint32_t last_tx_s;
+static uint32_t ping_s;
+static uint32_t retry_s;
+static uint16_t backoff_s;
+static uint8_t ping_pending;
+static uint8_t close_pending;                   /* Closed from the tick, not from an espconn callback */
+
+/* Ring, oldest message at `win_tail`. Allocated by simple_mqtt_init() with the send buffers */
+static inflight_t* window;
+static uint8_t win_tail, win_count;
+static uint16_t last_id;
+
+/* `tx_buf` belongs to the TCP stack until the sent callback, meanwhile packets wait in `tx_queue` */
+static uint8_t* tx_buf;
+static uint8_t* tx_queue;
+static uint16_t queue_len;
+static uint8_t sending;
+
+static rx_state_t rx_state;
+static uint8_t rx_type;
+static uint32_t rx_remaining;
+static uint8_t rx_shift;
+static uint8_t rx_body[RX_BODY_MAX];
+static uint8_t rx_body_len;
+
+static void connect_start(void);
+
+static void ICACHE_FLASH_ATTR
+state_set(simple_mqtt_state_t new_state) {
+    state = new_state;
+    state_s = now_s;
+}
+
+static size_t ICACHE_FLASH_ATTR
+len_size(size_t len) {
+    return len < 128 ? 1 : len < 16384 ? 2 : 3;
+}
+
+/* Remaining length, 7 bits per byte */
+static size_t ICACHE_FLASH_ATTR
+put_len(uint8_t* p, size_t len) {
+    size_t n = 0;
+
+    do {
+        p[n] = len % 128;
+        len /= 128;
+        if (len) {
+            p[n] |= 0x80;
+        }
+        n += 1;
+    } while (len);
+
+    return n;
+}
+
+static size_t ICACHE_FLASH_ATTR
+put_str(uint8_t* p, const char* str, size_t len) {
+    p[0] = len >> 8;
+    p[1] = len & 0xFF;
+    os_memcpy(p + 2, str, len);
+
+    return len + 2;
+}
+
+static size_t ICACHE_FLASH_ATTR
+connect_encode(uint8_t* p) {
+    size_t id_len = os_strlen(p_cfg->client_id);
+    size_t user_len = p_cfg->username ? os_strlen(p_cfg->username) : 0;
+    size_t pass_len = p_cfg->username && p_cfg->password ? os_strlen(p_cfg->password) : 0;
+    size_t remaining = 10 + 2 + id_len;
+    uint8_t flags = 0;                          /* Clean session 0, the broker keeps the session */
+    size_t n;
+
+    if (p_cfg->username) {
+        flags |= MQTT_FLAG_USER;
+        remaining += 2 + user_len;
+    }
+    if (p_cfg->username && p_cfg->password) {
+        flags |= MQTT_FLAG_PASS;
+        remaining += 2 + pass_len;
+    }
+    if (1 + len_size(remaining) + remaining > SIMPLE_MQTT_MSG_SIZE) {
+        return 0;
+    }
+
+    p[0] = MQTT_CONNECT;
+    n = 1 + put_len(p + 1, remaining);
+    n += put_str(p + n, "MQTT", 4);
+    p[n++] = MQTT_LEVEL_311;
+    p[n++] = flags;
+    p[n++] = SIMPLE_MQTT_KEEPALIVE >> 8;
+    p[n++] = SIMPLE_MQTT_KEEPALIVE & 0xFF;
+    n += put_str(p + n, p_cfg->client_id, id_len);
+    if (flags & MQTT_FLAG_USER) {
+        n += put_str(p + n, p_cfg->username, user_len);
+    }
+    if (flags & MQTT_FLAG_PASS) {
+        n += put_str(p + n, p_cfg->password, pass_len);
+    }
+
+    return n;
+}
+
+static size_t ICACHE_FLASH_ATTR
+publish_encode(uint8_t* p, const char* topic, const char* payload, size_t len, uint8_t qos, uint16_t id) {
+    size_t topic_len = os_strlen(topic);
+    size_t remaining = 2 + topic_len + (qos ? 2 : 0) + len;
+    size_t n;
+
+    if (simple_mqtt_publish_len(topic, len, qos) == 0) {
+        return 0;
+    }
+
+    p[0] = MQTT_PUBLISH | (qos << 1);
+    n = 1 + put_len(p + 1, remaining);
+    n += put_str(p + n, topic, topic_len);
+    if (qos) {
+        p[n++] = id >> 8;
+        p[n++] = id & 0xFF;
+    }
+    os_memcpy(p + n, payload, len);
+
+    return n + len;
+}
+
+static void ICACHE_FLASH_ATTR
+tx_kick(void) {
+    uint16_t len = queue_len;
+
+    if (sending || len == 0 || state < SIMPLE_MQTT_STATE_CONNACK) {
+        return;
+    }
+
+    os_memcpy(tx_buf, tx_queue, len);
+    queue_len = 0;
+
+    if (espconn_send(&mqtt_conn, tx_buf, len) != 0) {
+        close_pending = 1;
+        return;
+    }
+    sending = 1;
+    last_tx_s = now_s;
+}
+
+static uint8_t ICACHE_FLASH_ATTR
+tx_append(const uint8_t* p, size_t len) {
+    if (queue_len + len > SIMPLE_MQTT_TX_SIZE) {
+        return 0;
+    }
+
+    os_memcpy(tx_queue + queue_len, p, len);
+    queue_len += len;
+
+    return 1;
+}
+
+/* Queue the window messages not sent on this connection, oldest first */
+static void ICACHE_FLASH_ATTR
+window_pump(void) {
+    inflight_t* p_msg;
+
+    if (state != SIMPLE_MQTT_STATE_CONNECTED) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < win_count; ++i) {
+        p_msg = &window[(win_tail + i) % SIMPLE_MQTT_INFLIGHT];
+        if (p_msg->id == 0 || p_msg->queued) {
+            continue;
+        }
+        if (!tx_append(p_msg->pkt, p_msg->len)) {
+            break;
+        }
+        if (p_msg->pkt[0] & MQTT_DUP) {
+            stats.resent += 1;
+        }
+        p_msg->queued = 1;
+    }
+
+    tx_kick();
+}
+
+static void ICACHE_FLASH_ATTR
+window_ack(uint16_t id) {
+    inflight_t* p_msg;
+
+    for (uint8_t i = 0; i < win_count; ++i) {
+        p_msg = &window[(win_tail + i) % SIMPLE_MQTT_INFLIGHT];
+        if (p_msg->id == id) {
+            p_msg->id = 0;
+            stats.acked += 1;
+            break;
+        }
+    }
+
+    while (win_count > 0 && window[win_tail].id == 0) {
+        win_tail = (win_tail + 1) % SIMPLE_MQTT_INFLIGHT;
+        win_count -= 1;
+    }
+}
+
+/* Connection lost or never made */
+static void ICACHE_FLASH_ATTR
+connect_failed(void) {
+    inflight_t* p_msg;
+
+    if (state <= SIMPLE_MQTT_STATE_BACKOFF) {
+        return;
+    }
+
+    /* Whatever was sent is resent on the next connection */
+    for (uint8_t i = 0; i < win_count; ++i) {
+        p_msg = &window[(win_tail + i) % SIMPLE_MQTT_INFLIGHT];
+        if (p_msg->queued) {
+            p_msg->pkt[0] |= MQTT_DUP;
+            p_msg->queued = 0;
+        }
+    }
+
+    stats.failures += 1;
+    sending = 0;
+    queue_len = 0;
+    ping_pending = 0;
+    close_pending = 0;
+
+    retry_s = now_s + backoff_s + os_random() % (backoff_s / 2 + 1);
+    backoff_s = backoff_s * 2 > SIMPLE_MQTT_BACKOFF_MAX ? SIMPLE_MQTT_BACKOFF_MAX : backoff_s * 2;
+
+    state_set(SIMPLE_MQTT_STATE_BACKOFF);
+}
+
+static void ICACHE_FLASH_ATTR
+rx_packet(void) {
+    switch (rx_type & 0xF0) {
+        case MQTT_CONNACK:
+            if (state != SIMPLE_MQTT_STATE_CONNACK || rx_body_len < 2 || rx_body[1] != 0) {
+                close_pending = 1;
+                break;
+            }
+            stats.connects += 1;
+            backoff_s = SIMPLE_MQTT_BACKOFF_MIN;
+            state_set(SIMPLE_MQTT_STATE_CONNECTED);
+            window_pump();
+            break;
+        case MQTT_PUBACK:
+            if (rx_body_len >= 2) {
+                window_ack(((uint16_t)rx_body[0] << 8) | rx_body[1]);
+            }
+            break;
+        case MQTT_PINGRESP:
+            ping_pending = 0;
+            break;
+        default:
+            /* Nothing subscribed */
+            break;
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+recv_callback(void* arg, char* p_data, unsigned short len) {
+    uint8_t b;
+
+    for (unsigned short i = 0; i < len; ++i) {
+        b = (uint8_t)p_data[i];
+
+        switch (rx_state) {
+            case RX_TYPE:
+                rx_type = b;
+                rx_remaining = 0;
+                rx_shift = 0;
+                rx_body_len = 0;
+                rx_state = RX_LEN;
+                break;
+            case RX_LEN:
+                rx_remaining |= (uint32_t)(b & 0x7F) << rx_shift;
+                rx_shift += 7;
+                if (b & 0x80) {
+                    if (rx_shift > 21) {
+                        close_pending = 1;
+                        return;
+                    }
+                } else if (rx_remaining == 0) {
+                    rx_packet();
+                    rx_state = RX_TYPE;
+                } else {
+                    rx_state = RX_BODY;
+                }
+                break;
+            case RX_BODY:
+                if (rx_body_len < RX_BODY_MAX) {
+                    rx_body[rx_body_len++] = b;
+                }
+                if (--rx_remaining == 0) {
+                    rx_packet();
+                    rx_state = RX_TYPE;
+                }
+                break;
+        }
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+sent_callback(void* arg) {
+    sending = 0;
+    window_pump();
+    tx_kick();
+}
+
+static void ICACHE_FLASH_ATTR
+connect_callback(void* arg) {
+    uint8_t pkt[SIMPLE_MQTT_MSG_SIZE];
+    size_t len;
+
+    espconn_regist_recvcb(&mqtt_conn, recv_callback);
+    espconn_regist_sentcb(&mqtt_conn, sent_callback);
+    espconn_set_opt(&mqtt_conn, ESPCONN_NODELAY);
+
+    rx_state = RX_TYPE;
+    sending = 0;
+    queue_len = 0;
+    state_set(SIMPLE_MQTT_STATE_CONNACK);
+
+    len = connect_encode(pkt);
+    if (len == 0) {
+        close_pending = 1;
+        return;
+    }
+    tx_append(pkt, len);
+    tx_kick();
+}
+
+static void ICACHE_FLASH_ATTR
+disconnect_callback(void* arg) {
+    connect_failed();
+}
+
+static void ICACHE_FLASH_ATTR
+error_callback(void* arg, sint8 err) {
+    connect_failed();
+}
+
+static void ICACHE_FLASH_ATTR
+dns_callback(const char* name, ip_addr_t* p_ip, void* arg) {
+    /* Timed out meanwhile */
+    if (state != SIMPLE_MQTT_STATE_DNS) {
+        return;
+    }
+    if (p_ip == NULL) {
+        connect_failed();
+        return;
+    }
+
+    mqtt_conn.type = ESPCONN_TCP;
+    mqtt_conn.state = ESPCONN_NONE;
+    mqtt_conn.proto.tcp = &mqtt_tcp;
+    mqtt_tcp.local_port = espconn_port();
+    mqtt_tcp.remote_port = p_cfg->port ? p_cfg->port : SIMPLE_MQTT_DEFAULT_PORT;
+    os_memcpy(mqtt_tcp.remote_ip, p_ip, 4);
+
+    espconn_regist_connectcb(&mqtt_conn, connect_callback);
+    espconn_regist_disconcb(&mqtt_conn, disconnect_callback);
+    espconn_regist_reconcb(&mqtt_conn, error_callback);
+
+    state_set(SIMPLE_MQTT_STATE_TCP);
+    if (espconn_connect(&mqtt_conn) != 0) {
+        connect_failed();
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+connect_start(void) {
+    struct ip_info ipconfig;
+    err_t err;
+
+    state_set(SIMPLE_MQTT_STATE_DNS);
+
+    wifi_get_ip_info(STATION_IF, &ipconfig);
+    if (wifi_station_get_connect_status() != STATION_GOT_IP || ipconfig.ip.addr == 0) {
+        connect_failed();
+        return;
+    }
+
+    err = espconn_gethostbyname(&mqtt_conn, p_cfg->host, &broker_ip, dns_callback);
+    if (err == ESPCONN_OK) {
+        /* IP address or cached name */
+        dns_callback(p_cfg->host, &broker_ip, &mqtt_conn);
+    } else if (err != ESPCONN_INPROGRESS) {
+        connect_failed();
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+tick(void* arg) {
+    uint8_t ping[2] = {MQTT_PINGREQ, 0};
+
+    now_s += 1;
+
+    if (close_pending) {
+        if (state >= SIMPLE_MQTT_STATE_TCP) {
+            espconn_abort(&mqtt_conn);
+        }
+        connect_failed();
+        return;
+    }
+
+    switch (state) {
+        case SIMPLE_MQTT_STATE_BACKOFF:
+            if ((int32_t)(now_s - retry_s) >= 0) {
+                connect_start();
+            }
+            break;
+        case SIMPLE_MQTT_STATE_DNS:
+        case SIMPLE_MQTT_STATE_TCP:
+        case SIMPLE_MQTT_STATE_CONNACK:
+            if (now_s - state_s >= SIMPLE_MQTT_CONNECT_TIMEOUT) {
+                close_pending = 1;
+            }
+            break;
+        case SIMPLE_MQTT_STATE_CONNECTED:
+            if (ping_pending) {
+                if (now_s - ping_s >= SIMPLE_MQTT_KEEPALIVE / 2) {
+                    close_pending = 1;
+                }
+            } else if (now_s - last_tx_s >= SIMPLE_MQTT_KEEPALIVE / 2 && tx_append(ping, sizeof(ping))) {
+                ping_pending = 1;
+                ping_s = now_s;
+                stats.pings += 1;
+                tx_kick();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+simple_mqtt_status_t ICACHE_FLASH_ATTR
+simple_mqtt_init(const simple_mqtt_config_t* p_config) {
+    if (p_config == NULL || p_config->host == NULL || p_config->client_id == NULL) {
+        return SIMPLE_MQTT_ARG_ERROR;
+    }
+
+    if (window == NULL) {
+        window = (inflight_t*)os_zalloc(sizeof(inflight_t) * SIMPLE_MQTT_INFLIGHT + 2 * SIMPLE_MQTT_TX_SIZE);
+        if (window == NULL) {
+            return SIMPLE_MQTT_MEM_ERROR;
+        }
+        tx_buf   = (uint8_t*)(window + SIMPLE_MQTT_INFLIGHT);
+        tx_queue = tx_buf + SIMPLE_MQTT_TX_SIZE;
+    }
+
+    p_cfg = p_config;
+    os_memset(&stats, 0, sizeof(stats));
+    win_tail = 0;
+    win_count = 0;
+    backoff_s = SIMPLE_MQTT_BACKOFF_MIN;
+
+    /* Connect on the first tick */
+    now_s = 0;
+    retry_s = 1;
+    state_set(SIMPLE_MQTT_STATE_BACKOFF);
+
+    os_timer_disarm(&timer_tick);
+    os_timer_setfn(&timer_tick, (os_timer_func_t *)tick, NULL);
+    os_timer_arm(&timer_tick, 1000, 1);
+
+    return SIMPLE_MQTT_OK;
+}
+
+simple_mqtt_status_t ICACHE_FLASH_ATTR
+simple_mqtt_publish(const char* topic, const char* payload, size_t len, uint8_t qos) {
+    uint8_t pkt[SIMPLE_MQTT_MSG_SIZE];
+    inflight_t* p_msg;
+    size_t pkt_len;
+
+    if (p_cfg == NULL || topic == NULL || payload == NULL || qos > 1) {
+        return SIMPLE_MQTT_ARG_ERROR;
+    }
+
+    if (qos == 0) {
+        if (state != SIMPLE_MQTT_STATE_CONNECTED) {
+            stats.dropped += 1;
+            return SIMPLE_MQTT_NOT_CONNECTED;
+        }
+
+        pkt_len = publish_encode(pkt, topic, payload, len, 0, 0);
+        if (pkt_len == 0) {
+            stats.dropped += 1;
+            return SIMPLE_MQTT_TOO_LONG;
+        }
+        if (!tx_append(pkt, pkt_len)) {
+            stats.dropped += 1;
+            return SIMPLE_MQTT_BUSY;
+        }
+
+        stats.published += 1;
+        tx_kick();
+        return SIMPLE_MQTT_OK;
+    }
+
+    if (win_count >= SIMPLE_MQTT_INFLIGHT) {
+        stats.dropped += 1;
+        return SIMPLE_MQTT_WINDOW_FULL;
+    }
+
+    /* Never 0 */
+    last_id = last_id == 0xFFFF ? 1 : last_id + 1;
+
+    p_msg = &window[(win_tail + win_count) % SIMPLE_MQTT_INFLIGHT];
+    pkt_len = publish_encode(p_msg->pkt, topic, payload, len, 1, last_id);
+    if (pkt_len == 0) {
+        stats.dropped += 1;
+        return SIMPLE_MQTT_TOO_LONG;
+    }
+
+    p_msg->id = last_id;
+    p_msg->len = pkt_len;
+    p_msg->queued = 0;
+    win_count += 1;
+    stats.published += 1;
+
+    window_pump();
+    return SIMPLE_MQTT_OK;
+}
+
+size_t ICACHE_FLASH_ATTR
+simple_mqtt_publish_len(const char* topic, size_t len, uint8_t qos) {
+    size_t remaining = 2 + os_strlen(topic) + (qos ? 2 : 0) + len;
+    size_t pkt_len = 1 + len_size(remaining) + remaining;
+
+    return pkt_len > SIMPLE_MQTT_MSG_SIZE ? 0 : pkt_len;
+}
+
+size_t ICACHE_FLASH_ATTR
+simple_mqtt_tx_room(void) {
+    return tx_queue == NULL ? 0 : SIMPLE_MQTT_TX_SIZE - queue_len;
+}
+
+simple_mqtt_state_t ICACHE_FLASH_ATTR
+simple_mqtt_state(void) {
+    return state;
+}
+
+uint8_t ICACHE_FLASH_ATTR
+simple_mqtt_window_free(void) {
+    return SIMPLE_MQTT_INFLIGHT - win_count;
+}
+
+const simple_mqtt_stats_t* ICACHE_FLASH_ATTR
+simple_mqtt_stats(void) {
+    return &stats;
+}
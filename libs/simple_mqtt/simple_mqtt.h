@@ -0,0 +1,134 @@
+/**
+ * \file simple_mqtt.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Minimal MQTT 3.1.1 publisher over espconn. Header file.
+ * \version 0.1
+ * \date 2021-04-18
+ *
+ * One long lived TCP connection, publish only. The session is persistent (clean
+ * session 0), so QoS 1 messages that were not acknowledged are sent again, with DUP,
+ * after a reconnect. Up to SIMPLE_MQTT_INFLIGHT QoS 1 messages wait for their PUBACK,
+ * a publish with the window full is refused. QoS 1 messages are accepted while
+ * disconnected as long as the window has room, QoS 0 messages are dropped.
+ *
+ * A PINGREQ is sent after SIMPLE_MQTT_KEEPALIVE / 2 s without traffic. A missing
+ * PINGRESP or CONNACK closes the connection. Reconnects wait SIMPLE_MQTT_BACKOFF_MIN s,
+ * doubled on every failure up to SIMPLE_MQTT_BACKOFF_MAX s, plus a random jitter.
+ */
+
+#ifndef SIMPLE_MQTT_H
+#define SIMPLE_MQTT_H
+
+#include <c_types.h>
+#include <espconn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define SIMPLE_MQTT_KEEPALIVE       60          /* [s] */
+#define SIMPLE_MQTT_CONNECT_TIMEOUT 10          /* [s] DNS, TCP and CONNACK */
+#define SIMPLE_MQTT_BACKOFF_MIN     1           /* [s] */
+#define SIMPLE_MQTT_BACKOFF_MAX     64          /* [s] */
+#define SIMPLE_MQTT_INFLIGHT        8           /* QoS 1 messages waiting for PUBACK. One upload of every sensor */
+#define SIMPLE_MQTT_MSG_SIZE        256         /* Max encoded PUBLISH packet */
+#define SIMPLE_MQTT_TX_SIZE         1024        /* Send buffer, there are two of them. A telemetry sample fits at QoS 0 */
+
+#define SIMPLE_MQTT_DEFAULT_PORT    1883
+
+typedef enum simple_mqtt_status {
+    SIMPLE_MQTT_OK,                             /** Queued for sending */
+    SIMPLE_MQTT_NOT_CONNECTED,                  /** QoS 0 while disconnected, dropped */
+    SIMPLE_MQTT_WINDOW_FULL,                    /** QoS 1 with SIMPLE_MQTT_INFLIGHT messages unacknowledged */
+    SIMPLE_MQTT_TOO_LONG,                       /** Packet over SIMPLE_MQTT_MSG_SIZE */
+    SIMPLE_MQTT_BUSY,                           /** Send buffer full */
+    SIMPLE_MQTT_ARG_ERROR,                      /** Invalid argument */
+    SIMPLE_MQTT_MEM_ERROR,                      /** No heap for the buffers */
+} simple_mqtt_status_t;
+
+typedef enum simple_mqtt_state {
+    SIMPLE_MQTT_STATE_IDLE,                     /** Not started */
+    SIMPLE_MQTT_STATE_BACKOFF,                  /** Waiting to reconnect */
+    SIMPLE_MQTT_STATE_DNS,
+    SIMPLE_MQTT_STATE_TCP,
+    SIMPLE_MQTT_STATE_CONNACK,
+    SIMPLE_MQTT_STATE_CONNECTED,
+} simple_mqtt_state_t;
+
+/**
+ * \brief           Broker and session. Strings must outlive the client
+ */
+typedef struct simple_mqtt_config {
+    const char* host;                           /** Broker hostname or IP */
+    uint16_t port;                              /** 0 for SIMPLE_MQTT_DEFAULT_PORT */
+    const char* client_id;                      /** Must be stable, it names the persistent session */
+    const char* username;                       /** NULL if none */
+    const char* password;                       /** NULL if none. Needs a username */
+} simple_mqtt_config_t;
+
+/**
+ * \brief           Client statistics
+ */
+typedef struct simple_mqtt_stats {
+    uint32_t connects;                          /** Accepted CONNACKs */
+    uint32_t failures;                          /** Lost connections and failed attempts */
+    uint32_t published;                         /** PUBLISH packets queued, resends not included */
+    uint32_t acked;                             /** PUBACKs received */
+    uint32_t resent;                            /** QoS 1 messages sent again after a reconnect */
+    uint32_t dropped;                           /** Refused publishes */
+    uint32_t pings;                             /** PINGREQs sent */
+} simple_mqtt_stats_t;
+
+/**
+ * \brief           Start the client. It connects and keeps reconnecting on its own
+ *
+ * The message window and the send buffers are allocated by the first call, a firmware
+ * that never starts the client does not pay for them.
+ *
+ * \param[in]       p_config: Broker and session
+ */
+simple_mqtt_status_t simple_mqtt_init(const simple_mqtt_config_t* p_config);
+
+/**
+ * \brief           Publish a message
+ * \param[in]       topic: Topic name, no wildcards
+ * \param[in]       payload: Message, copied
+ * \param[in]       len: Message length
+ * \param[in]       qos: 0 or 1
+ */
+simple_mqtt_status_t simple_mqtt_publish(const char* topic, const char* payload, size_t len, uint8_t qos);
+
+/**
+ * \brief           Encoded size of a PUBLISH, to check a group of messages before the first one
+ * \param[in]       topic: Topic name
+ * \param[in]       len: Message length
+ * \param[in]       qos: 0 or 1
+ * \return          Bytes, 0 if over SIMPLE_MQTT_MSG_SIZE
+ */
+size_t simple_mqtt_publish_len(const char* topic, size_t len, uint8_t qos);
+
+/**
+ * \brief           Free bytes in the send queue, QoS 0 messages of up to this total are taken now
+ */
+size_t simple_mqtt_tx_room(void);
+
+/**
+ * \brief           Connection state
+ */
+simple_mqtt_state_t simple_mqtt_state(void);
+
+/**
+ * \brief           QoS 1 messages that can be published before the window is full
+ */
+uint8_t simple_mqtt_window_free(void);
+
+/**
+ * \brief           Statistics since simple_mqtt_init
+ */
+const simple_mqtt_stats_t* simple_mqtt_stats(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* SIMPLE_MQTT_H */
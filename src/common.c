@@ -29,3 +29,33 @@ common_strdup(const char* str) {
 	os_strcpy(new_str, str);
 	return new_str;
 }
+
+size_t ICACHE_FLASH_ATTR
+common_ftoa(char* buff, float value) {
+    const char* sign = "";
+    uint32_t units;
+    uint32_t decimals;
+
+    if (value != value || value >= 2147483647.0f || value <= -2147483647.0f) {
+        return 0;
+    }
+
+    if (value < 0) {
+        sign  = "-";
+        value = -value;
+    }
+
+    /* Rounded to the last digit written, 21.999 is 22.00. Half a digit carries into the units */
+    value   += 0.005f;
+    units    = (uint32_t)value;
+    decimals = (uint32_t)((value - units) * 100);
+    if (decimals > 99) {
+        units   += 1;
+        decimals = 0;
+    }
+    if (units == 0 && decimals == 0) {
+        sign = "";
+    }
+
+    return os_sprintf(buff, "%s%u.%02u", sign, units, decimals);
+}
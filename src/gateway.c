@@ -0,0 +1,527 @@
+/**
+ * \file gateway.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Room gateway: peers send binary samples over UDP, one upload for all. Source file.
+ * \version 0.1
+ * \date 2021-04-22
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <espconn.h>
+#include <user_interface.h>
+
+#include "gateway.h"
+#include "upload_sched.h"
+
+#include "simple_http/simple_http.h"
+
+#ifdef SERIAL_CMD_ENABLE
+#include "serial_cmd.h"
+#endif
+
+#if defined(GATEWAY_ENABLE) || defined(GATEWAY_PEER_ENABLE)
+
+#if defined(GATEWAY_ENABLE) && defined(GATEWAY_PEER_ENABLE)
+#error "GATEWAY_ENABLE and GATEWAY_PEER_ENABLE are exclusive"
+#endif
+
+#define FIELDS_MAX    6
+#define SEQ_WINDOW    256                       /* Larger sequence jumps are peer reboots */
+#define DATAGRAM_SIZE (GATEWAY_HEADER_SIZE + GATEWAY_MAX_LINES * (1 + 4 * FIELDS_MAX))
+
+typedef struct {
+    const char* name;
+    uint8_t     fields_len;
+    const char* fields[FIELDS_MAX];
+} measurement_t;
+
+/* Index + 1 is the id in the datagram. Append only */
+static const measurement_t measurements[] = {
+    {"zmod",       6, {"eco2", "etoh", "rcda", "iaq", "tvoc", "rmox"}},
+    {"zmod_reset", 6, {"eco2", "etoh", "rcda", "iaq", "tvoc", "rmox"}},
+    {"zmod_halt",  6, {"eco2", "etoh", "rcda", "iaq", "tvoc", "rmox"}},
+    {"scd30",      3, {"temp", "co2", "rh"}},
+    {"ccs811",     4, {"eco2", "tvoc", "current", "adc"}},
+};
+
+#define MEASUREMENTS_LEN (sizeof(measurements) / sizeof(measurements[0]))
+
+static struct espconn gw_conn;
+static esp_udp gw_udp;
+static gateway_stats_t stats;
+
+static void ICACHE_FLASH_ATTR
+put_u32(uint8_t* p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t ICACHE_FLASH_ATTR
+get_u32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#ifdef GATEWAY_PEER_ENABLE
+static const uint8_t gateway_ip[4] = GATEWAY_IP;
+static uint8_t mac[6];
+static uint16_t seq;
+
+#define MILLI_MAX 2147483                       /* INT32_MAX / 1000 */
+
+/* "-12.345" -> -12345. Digits past the third decimal are cut, big values clamped */
+static int32_t ICACHE_FLASH_ATTR
+parse_milli(const char* p, const char* p_end) {
+    int32_t value = 0;
+    int32_t scale;
+    uint8_t negative = 0;
+
+    if (p < p_end && *p == '-') {
+        negative = 1;
+        ++p;
+    }
+    for (; p < p_end && *p >= '0' && *p <= '9'; ++p) {
+        value = value * 10 + (*p - '0');
+        if (value > MILLI_MAX) {
+            value = MILLI_MAX;
+        }
+    }
+    value *= 1000;
+
+    if (p < p_end && *p == '.' && value < MILLI_MAX * 1000) {
+        for (++p, scale = 100; p < p_end && *p >= '0' && *p <= '9'; ++p, scale /= 10) {
+            value += (*p - '0') * scale;
+        }
+    }
+
+    return negative ? -value : value;
+}
+
+/* One `name f=v,f=v[ ts]` line into id and fields. 0 if it can not be encoded */
+static size_t ICACHE_FLASH_ATTR
+encode_line(uint8_t* p_out, const char* line, const char* p_eol) {
+    const measurement_t* p_meas = NULL;
+    const char* p_name_end;
+    const char* p_fields_end;
+    const char* p_next;
+    const char* p_eq;
+    uint8_t id, field, found = 0;
+
+    for (p_name_end = line; p_name_end < p_eol && *p_name_end != ' ' && *p_name_end != ','; ++p_name_end);
+    /* No tags in the datagram */
+    if (p_name_end == p_eol || *p_name_end != ' ') {
+        return 0;
+    }
+
+    for (id = 0; id < MEASUREMENTS_LEN; ++id) {
+        if (os_strlen(measurements[id].name) == (size_t)(p_name_end - line) &&
+            os_strncmp(measurements[id].name, line, p_name_end - line) == 0) {
+            p_meas = &measurements[id];
+            break;
+        }
+    }
+    if (p_meas == NULL) {
+        return 0;
+    }
+
+    for (p_fields_end = p_name_end + 1; p_fields_end < p_eol && *p_fields_end != ' '; ++p_fields_end);
+
+    for (line = p_name_end + 1; line < p_fields_end; line = p_next + 1) {
+        for (p_next = line; p_next < p_fields_end && *p_next != ','; ++p_next);
+        for (p_eq = line; p_eq < p_next && *p_eq != '='; ++p_eq);
+
+        for (field = 0; field < p_meas->fields_len; ++field) {
+            if (os_strlen(p_meas->fields[field]) == (size_t)(p_eq - line) &&
+                os_strncmp(p_meas->fields[field], line, p_eq - line) == 0) {
+                put_u32(p_out + 1 + 4 * field, (uint32_t)parse_milli(p_eq + 1, p_next));
+                found |= 1 << field;
+                break;
+            }
+        }
+    }
+
+    if (found != (1 << p_meas->fields_len) - 1) {
+        return 0;
+    }
+
+    p_out[0] = id + 1;
+    return 1 + 4 * p_meas->fields_len;
+}
+
+status_t ICACHE_FLASH_ATTR
+gateway_init(void) {
+    wifi_get_macaddr(STATION_IF, mac);
+    /* Restarts on a reboot, a random start keeps the gateway from taking it as a duplicate */
+    seq = os_random();
+
+    gw_conn.type = ESPCONN_UDP;
+    gw_conn.state = ESPCONN_NONE;
+    gw_conn.proto.udp = &gw_udp;
+    gw_udp.local_port = espconn_port();
+
+    return espconn_create(&gw_conn) == 0 ? STA_OK : STA_ERR;
+}
+
+uint8_t ICACHE_FLASH_ATTR
+gateway_write(const char* lines, size_t len, uint32_t ts) {
+    uint8_t datagram[DATAGRAM_SIZE];
+    const char* p_end = lines + len;
+    const char* p_eol;
+    size_t datagram_len = GATEWAY_HEADER_SIZE;
+    size_t line_len;
+    uint8_t lines_len = 0;
+
+    for (; lines < p_end; lines = p_eol + 1) {
+        for (p_eol = lines; p_eol < p_end && *p_eol != '\n'; ++p_eol);
+        if (p_eol == lines) {
+            continue;
+        }
+
+        line_len = lines_len < GATEWAY_MAX_LINES ? encode_line(datagram + datagram_len, lines, p_eol) : 0;
+        if (line_len == 0) {
+            stats.dropped += 1;
+            continue;
+        }
+        datagram_len += line_len;
+        lines_len += 1;
+    }
+
+    if (lines_len == 0) {
+        return 1;
+    }
+
+    datagram[0] = 'G';
+    datagram[1] = 'W';
+    datagram[2] = GATEWAY_VERSION;
+    datagram[3] = lines_len;
+    os_memcpy(datagram + 4, mac, sizeof(mac));
+    datagram[10] = seq;
+    datagram[11] = seq >> 8;
+    put_u32(datagram + 12, ts);
+    seq += 1;
+
+    gw_udp.remote_port = GATEWAY_PORT;
+    os_memcpy(gw_udp.remote_ip, gateway_ip, sizeof(gateway_ip));
+
+    if (espconn_sendto(&gw_conn, datagram, datagram_len) == 0) {
+        stats.datagrams += 1;
+        stats.lines += lines_len;
+    } else {
+        stats.err += 1;
+    }
+
+    /* Not retried, the gateway counts the gap */
+    return 1;
+}
+
+void ICACHE_FLASH_ATTR
+gateway_flush(void) {
+}
+
+uint8_t ICACHE_FLASH_ATTR
+gateway_peers(void) {
+    return 0;
+}
+#endif /* GATEWAY_PEER_ENABLE */
+
+#ifdef GATEWAY_ENABLE
+typedef struct {
+    uint8_t  mac[6];
+    uint16_t next_seq;
+    uint32_t datagrams;
+    uint32_t lost;
+    uint32_t last_us;                           /* system_get_time() of the last datagram */
+} peer_t;
+
+static peer_t peers[GATEWAY_MAX_PEERS];
+static uint8_t peers_len;
+
+/* Lines are collected in `batch` while `post` waits for its 2xx, then they swap */
+static char batch_buf[2][GATEWAY_BATCH_SIZE];
+static char* batch = batch_buf[0];
+static size_t batch_len;
+static char* post = batch_buf[1];
+static size_t post_len;                         /* 0 if nothing is pending */
+
+static uint32_t request_start_us;
+static uint8_t in_flight;
+
+/* Known peer, or a new slot. The one heard from least recently is replaced */
+static peer_t* ICACHE_FLASH_ATTR
+peer_get(const uint8_t* mac, uint8_t* p_new) {
+    const uint32_t now = system_get_time();
+    peer_t* p_peer = NULL;
+
+    for (uint8_t i = 0; i < peers_len; ++i) {
+        if (os_memcmp(peers[i].mac, mac, 6) == 0) {
+            *p_new = 0;
+            return &peers[i];
+        }
+    }
+
+    if (peers_len < GATEWAY_MAX_PEERS) {
+        p_peer = &peers[peers_len++];
+    } else {
+        p_peer = &peers[0];
+        for (uint8_t i = 1; i < peers_len; ++i) {
+            if (now - peers[i].last_us > now - p_peer->last_us) {
+                p_peer = &peers[i];
+            }
+        }
+    }
+
+    os_memset(p_peer, 0, sizeof(peer_t));
+    os_memcpy(p_peer->mac, mac, 6);
+    *p_new = 1;
+
+    return p_peer;
+}
+
+static uint8_t ICACHE_FLASH_ATTR
+batch_add(const char* text, size_t len) {
+    if (batch_len + len + 1 > GATEWAY_BATCH_SIZE) {
+        return 0;
+    }
+
+    os_memcpy(batch + batch_len, text, len);
+    batch_len += len;
+    batch[batch_len] = '\0';
+
+    return 1;
+}
+
+/* A full batch is posted early if nothing is pending, rather than dropping lines */
+static uint8_t ICACHE_FLASH_ATTR
+batch_take(const char* text, size_t len) {
+    if (batch_add(text, len)) {
+        return 1;
+    }
+
+    if (post_len != 0) {
+        return 0;
+    }
+
+    gateway_flush();
+    return batch_add(text, len);
+}
+
+/* Line protocol of one datagram line, tagged with the peer MAC */
+static size_t ICACHE_FLASH_ATTR
+decode_line(char* p_out, const uint8_t* p_in, const uint8_t* mac, uint32_t ts) {
+    const measurement_t* p_meas = &measurements[p_in[0] - 1];
+    size_t len;
+    int32_t value;
+    uint32_t abs;
+
+    len = os_sprintf(p_out, "%s,peer=%02x%02x%02x%02x%02x%02x ", p_meas->name,
+                     mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    for (uint8_t i = 0; i < p_meas->fields_len; ++i) {
+        value = (int32_t)get_u32(p_in + 1 + 4 * i);
+        abs = value < 0 ? -(uint32_t)value : (uint32_t)value;
+        len += os_sprintf(p_out + len, "%s%s=%s%u.%03u", i ? "," : "", p_meas->fields[i],
+                          value < 0 ? "-" : "", abs / 1000, abs % 1000);
+    }
+
+    if (ts) {
+        len += os_sprintf(p_out + len, " %u", ts);
+    }
+    p_out[len++] = '\n';
+
+    return len;
+}
+
+static void ICACHE_FLASH_ATTR
+gateway_recv(void* arg, char* pdata, unsigned short len) {
+    const uint8_t* p_data = (const uint8_t*)pdata;
+    char line[192];
+    peer_t* p_peer;
+    uint16_t datagram_seq, gap;
+    uint32_t ts;
+    size_t pos;
+    uint8_t lines_len, is_new, id;
+
+    if (len < GATEWAY_HEADER_SIZE || p_data[0] != 'G' || p_data[1] != 'W' ||
+        p_data[2] != GATEWAY_VERSION || p_data[3] > GATEWAY_MAX_LINES) {
+        stats.invalid += 1;
+        return;
+    }
+
+    /* The whole datagram is checked before any line is taken */
+    lines_len = p_data[3];
+    for (pos = GATEWAY_HEADER_SIZE, id = 0; id < lines_len; ++id) {
+        if (pos >= len || p_data[pos] == 0 || p_data[pos] > MEASUREMENTS_LEN) {
+            break;
+        }
+        pos += 1 + 4 * measurements[p_data[pos] - 1].fields_len;
+    }
+    if (id != lines_len || pos != len) {
+        stats.invalid += 1;
+        return;
+    }
+
+    p_peer = peer_get(p_data + 4, &is_new);
+    datagram_seq = p_data[10] | (p_data[11] << 8);
+    ts = get_u32(p_data + 12);
+
+    if (!is_new) {
+        gap = datagram_seq - p_peer->next_seq;
+        /* Duplicate or late, its lines are already in */
+        if ((uint16_t)-gap <= SEQ_WINDOW && gap != 0) {
+            return;
+        }
+        /* Further away it rebooted, with a new random start */
+        if (gap <= SEQ_WINDOW) {
+            p_peer->lost += gap;
+            stats.lost += gap;
+        }
+    }
+    p_peer->next_seq = datagram_seq + 1;
+    p_peer->datagrams += 1;
+    p_peer->last_us = system_get_time();
+    stats.datagrams += 1;
+
+    for (pos = GATEWAY_HEADER_SIZE, id = 0; id < lines_len; ++id) {
+        if (batch_take(line, decode_line(line, p_data + pos, p_peer->mac, ts))) {
+            stats.lines += 1;
+        } else {
+            stats.dropped += 1;
+        }
+        pos += 1 + 4 * measurements[p_data[pos] - 1].fields_len;
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+gateway_done(const char* const data, size_t data_len, uint16_t status, const char* const buffer) {
+    if (!in_flight) {
+        return;
+    }
+
+    in_flight = 0;
+
+#ifdef UPLOAD_SPREAD_ENABLE
+    upload_sched_response(status, buffer);
+#endif
+
+    /* Kept for the next flush otherwise */
+    if (status / 100 == 2) {
+        post_len = 0;
+        stats.ok += 1;
+    } else {
+        stats.err += 1;
+    }
+}
+
+#ifdef SERIAL_CMD_ENABLE
+static void ICACHE_FLASH_ATTR
+gateway_cmd(const char* args) {
+    const uint32_t now = system_get_time();
+
+    os_printf("gw: datagrams %u invalid %u lines %u dropped %u lost %u requests %u ok %u err %u batch %u B pending %u B\n",
+              stats.datagrams, stats.invalid, stats.lines, stats.dropped, stats.lost,
+              stats.requests, stats.ok, stats.err, batch_len, post_len);
+    for (uint8_t i = 0; i < peers_len; ++i) {
+        os_printf("  %02x%02x%02x%02x%02x%02x datagrams %u lost %u last %u s ago\n",
+                  peers[i].mac[0], peers[i].mac[1], peers[i].mac[2], peers[i].mac[3], peers[i].mac[4], peers[i].mac[5],
+                  peers[i].datagrams, peers[i].lost, (now - peers[i].last_us) / 1000000);
+    }
+}
+#endif /* SERIAL_CMD_ENABLE */
+
+status_t ICACHE_FLASH_ATTR
+gateway_init(void) {
+#ifdef SERIAL_CMD_ENABLE
+    serial_cmd_register("gw", gateway_cmd);
+#endif
+
+    peers_len = 0;
+    batch_len = 0;
+    post_len = 0;
+    in_flight = 0;
+
+    gw_conn.type = ESPCONN_UDP;
+    gw_conn.state = ESPCONN_NONE;
+    gw_conn.proto.udp = &gw_udp;
+    gw_udp.local_port = GATEWAY_PORT;
+
+    if (espconn_create(&gw_conn) != 0) {
+        return STA_ERR;
+    }
+    espconn_regist_recvcb(&gw_conn, gateway_recv);
+
+    return STA_OK;
+}
+
+void ICACHE_FLASH_ATTR
+gateway_flush(void) {
+    simple_http_status_t status;
+    char* p_swap;
+
+    if (post_len == 0) {
+        if (batch_len == 0) {
+            return;
+        }
+
+        p_swap = post;
+        post = batch;
+        post_len = batch_len;
+        batch = p_swap;
+        batch_len = 0;
+        batch[0] = '\0';
+    }
+
+#ifdef UPLOAD_SPREAD_ENABLE
+    if (upload_sched_held()) {
+        return;
+    }
+#endif
+
+    if (in_flight) {
+        if (system_get_time() - request_start_us < GATEWAY_TIMEOUT) {
+            return;
+        }
+        in_flight = 0;
+        stats.err += 1;
+    }
+
+    request_start_us = system_get_time();
+    status = simple_http_request(INFLUX_URL, post, INFLUX_AUTH_HEADER"\r\n", "POST", gateway_done);
+
+    if (status == SIMPLE_HTTP_REQUEST_SENT) {
+        in_flight = 1;
+        stats.requests += 1;
+    } else if (status != SIMPLE_HTTP_NO_CONNECTION && status != SIMPLE_HTTP_CLIENT_NOT_READY) {
+        stats.err += 1;
+    }
+}
+
+/* Taken once the previous batch is acknowledged, so our lines go with their interval */
+uint8_t ICACHE_FLASH_ATTR
+gateway_write(const char* lines, size_t len, uint32_t ts) {
+    if (post_len != 0) {
+        gateway_flush();
+        return 0;
+    }
+
+    if (!batch_take(lines, len)) {
+        return 0;
+    }
+
+    gateway_flush();
+    return 1;
+}
+
+uint8_t ICACHE_FLASH_ATTR
+gateway_peers(void) {
+    return peers_len;
+}
+#endif /* GATEWAY_ENABLE */
+
+const gateway_stats_t* ICACHE_FLASH_ATTR
+gateway_stats(void) {
+    return &stats;
+}
+
+#endif /* GATEWAY_ENABLE || GATEWAY_PEER_ENABLE */
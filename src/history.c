@@ -0,0 +1,282 @@
+/**
+ * \file history.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Sample history ring in SPI flash with a sparse time index. Source file.
+ * \version 0.1
+ * \date 2021-04-15
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <spi_flash.h>
+#include <user_interface.h>
+
+#include "history.h"
+
+#ifdef SERIAL_CMD_ENABLE
+#include "serial_cmd.h"
+#endif
+
+#ifdef HISTORY_ENABLE
+
+#define RECORD_WORDS (sizeof(history_record_t) / 4)
+
+/* Sparse index, first timestamp of every sector. HISTORY_TS_EMPTY if not in use */
+static uint32_t first_ts[HISTORY_FLASH_SECTORS];
+
+static uint16_t used;                           /* Sectors in use, they end at `head` */
+static uint16_t head;                           /* Sector being written */
+static uint16_t head_slot;                      /* Next free slot of `head` */
+static uint32_t last_ts;
+
+static uint32_t ICACHE_FLASH_ATTR
+sector_addr(uint16_t sector) {
+    return (HISTORY_FLASH_SECTOR + sector) * HISTORY_SECTOR_SIZE;
+}
+
+static uint32_t ICACHE_FLASH_ATTR
+slot_addr(uint16_t sector, uint16_t slot) {
+    return sector_addr(sector) + 4 + slot * sizeof(history_record_t);
+}
+
+static uint32_t ICACHE_FLASH_ATTR
+read_ts(uint16_t sector, uint16_t slot) {
+    uint32_t ts;
+
+    if (spi_flash_read(slot_addr(sector, slot), &ts, 4) != SPI_FLASH_RESULT_OK) {
+        return HISTORY_TS_EMPTY;
+    }
+
+    return ts;
+}
+
+/* Ring sector of the l-th sector in use, 0 is the oldest */
+static uint16_t ICACHE_FLASH_ATTR
+logical_sector(uint16_t l) {
+    return (head + HISTORY_FLASH_SECTORS - used + 1 + l) % HISTORY_FLASH_SECTORS;
+}
+
+static uint16_t ICACHE_FLASH_ATTR
+sector_records(uint16_t sector) {
+    return sector == head ? head_slot : HISTORY_SECTOR_SLOTS;
+}
+
+static status_t ICACHE_FLASH_ATTR
+erase_sector(uint16_t sector) {
+    system_soft_wdt_feed();
+
+    if (first_ts[sector] != HISTORY_TS_EMPTY) {
+        first_ts[sector] = HISTORY_TS_EMPTY;
+        used -= 1;
+    }
+
+    if (spi_flash_erase_sector(HISTORY_FLASH_SECTOR + sector) != SPI_FLASH_RESULT_OK) {
+        return STA_ERR;
+    }
+
+    return STA_OK;
+}
+
+#ifdef SERIAL_CMD_ENABLE
+static void ICACHE_FLASH_ATTR
+history_cmd(const char* args) {
+    uint32_t oldest = used ? first_ts[logical_sector(0)] : 0;
+
+    os_printf("records %u sectors %u/%u head %u slot %u oldest %u newest %u\n",
+              history_count(), used, HISTORY_FLASH_SECTORS, head, head_slot, oldest, last_ts);
+}
+#endif /* SERIAL_CMD_ENABLE */
+
+status_t ICACHE_FLASH_ATTR
+history_init(void) {
+    uint32_t header[2];
+    uint16_t lo, hi, mid;
+
+#ifdef SERIAL_CMD_ENABLE
+    serial_cmd_register("hist", history_cmd);
+#endif
+
+    used = 0;
+    head = 0;
+    head_slot = 0;
+    last_ts = 0;
+
+    for (uint16_t i = 0; i < HISTORY_FLASH_SECTORS; ++i) {
+        first_ts[i] = HISTORY_TS_EMPTY;
+
+        if (spi_flash_read(sector_addr(i), header, sizeof(header)) != SPI_FLASH_RESULT_OK) {
+            continue;
+        }
+        if (header[0] != HISTORY_SECTOR_MAGIC || header[1] == HISTORY_TS_EMPTY) {
+            continue;
+        }
+
+        first_ts[i] = header[1];
+        if (used == 0 || header[1] > first_ts[head]) {
+            head = i;
+        }
+        used += 1;
+    }
+
+    if (used == 0) {
+        return erase_sector(head);
+    }
+
+    /* Records are written in order, the first free slot is a boundary */
+    lo = 0;
+    hi = HISTORY_SECTOR_SLOTS;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (read_ts(head, mid) == HISTORY_TS_EMPTY) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    head_slot = lo;
+    last_ts = read_ts(head, head_slot - 1);
+
+#ifdef DEBUG_PRINT_MODE
+    os_printf("history: %u records, sector %u slot %u\n", history_count(), head, head_slot);
+#endif
+
+    return STA_OK;
+}
+
+status_t ICACHE_FLASH_ATTR
+history_append(const history_record_t* p_record) {
+    uint32_t words[RECORD_WORDS];
+    uint32_t magic = HISTORY_SECTOR_MAGIC;
+
+    if (p_record->ts == 0 || p_record->ts == HISTORY_TS_EMPTY || p_record->ts <= last_ts) {
+        return STA_ERR;
+    }
+
+    if (head_slot >= HISTORY_SECTOR_SLOTS) {
+        uint16_t next = (head + 1) % HISTORY_FLASH_SECTORS;
+
+        if (erase_sector(next) != STA_OK) {
+            return STA_ERR;
+        }
+        head = next;
+        head_slot = 0;
+    }
+
+    if (head_slot == 0) {
+        if (spi_flash_write(sector_addr(head), &magic, 4) != SPI_FLASH_RESULT_OK) {
+            return STA_ERR;
+        }
+    }
+
+    /* Flash writes need a word aligned source */
+    os_memcpy(words, p_record, sizeof(words));
+    if (spi_flash_write(slot_addr(head, head_slot), words, sizeof(words)) != SPI_FLASH_RESULT_OK) {
+        return STA_ERR;
+    }
+
+    if (head_slot == 0) {
+        first_ts[head] = p_record->ts;
+        used += 1;
+    }
+    head_slot += 1;
+    last_ts = p_record->ts;
+
+    return STA_OK;
+}
+
+uint8_t ICACHE_FLASH_ATTR
+history_seek(uint32_t ts, history_pos_t* p_pos) {
+    uint16_t lo, hi, mid;
+    uint16_t sector;
+    uint16_t slot_hi;
+
+    if (used == 0) {
+        return 0;
+    }
+
+    /* Last sector starting at or before `ts` */
+    lo = 0;
+    hi = used - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (first_ts[logical_sector(mid)] <= ts) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    sector = logical_sector(lo);
+
+    /* First record at or after `ts` inside it */
+    lo = 0;
+    slot_hi = sector_records(sector);
+    hi = slot_hi;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (read_ts(sector, mid) < ts) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo >= slot_hi) {
+        if (sector == head) {
+            return 0;
+        }
+        sector = (sector + 1) % HISTORY_FLASH_SECTORS;
+        lo = 0;
+    }
+
+    p_pos->sector    = sector;
+    p_pos->slot      = lo;
+    p_pos->sector_ts = first_ts[sector];
+
+    return 1;
+}
+
+uint8_t ICACHE_FLASH_ATTR
+history_next(history_pos_t* p_pos, history_record_t* p_record) {
+    uint32_t words[RECORD_WORDS];
+
+    if (p_pos->slot >= HISTORY_SECTOR_SLOTS) {
+        if (p_pos->sector == head) {
+            return 0;
+        }
+        p_pos->sector    = (p_pos->sector + 1) % HISTORY_FLASH_SECTORS;
+        p_pos->slot      = 0;
+        p_pos->sector_ts = first_ts[p_pos->sector];
+    }
+
+    /* Erased by the writer since the position was taken */
+    if (p_pos->sector_ts == HISTORY_TS_EMPTY || first_ts[p_pos->sector] != p_pos->sector_ts) {
+        return 0;
+    }
+    if (p_pos->sector == head && p_pos->slot >= head_slot) {
+        return 0;
+    }
+
+    if (spi_flash_read(slot_addr(p_pos->sector, p_pos->slot), words, sizeof(words)) != SPI_FLASH_RESULT_OK) {
+        return 0;
+    }
+    os_memcpy(p_record, words, sizeof(words));
+    p_pos->slot += 1;
+
+    return 1;
+}
+
+uint32_t ICACHE_FLASH_ATTR
+history_last_ts(void) {
+    return last_ts;
+}
+
+uint32_t ICACHE_FLASH_ATTR
+history_count(void) {
+    if (used == 0) {
+        return 0;
+    }
+
+    return (uint32_t)(used - 1) * HISTORY_SECTOR_SLOTS + head_slot;
+}
+
+#endif /* HISTORY_ENABLE */
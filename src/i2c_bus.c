@@ -0,0 +1,216 @@
+/**
+ * \file i2c_bus.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Shared I2C bus scheduler. Source file.
+ * \version 0.1
+ * \date 2021-04-04
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <user_interface.h>
+
+#include "i2c_bus.h"
+#include "user_config.h"
+
+#ifdef SERIAL_CMD_ENABLE
+#include "serial_cmd.h"
+#endif
+
+#define I2C_BUS_TASK_QUEUE_LEN 2
+
+typedef struct {
+    i2c_bus_job_t job;
+    void*         arg;
+    uint32_t      submit_us;
+    uint32_t      seq;
+    uint8_t       dev;
+    uint8_t       prio;
+} i2c_bus_entry_t;
+
+static const char* const dev_names[I2C_BUS_DEV_MAX] = {
+    "zmod",
+    "ccs811",
+    "scd30",
+};
+
+static os_event_t task_queue[I2C_BUS_TASK_QUEUE_LEN];
+
+static i2c_bus_entry_t queue[I2C_BUS_QUEUE_SIZE];
+static uint8_t  queue_len;
+static uint32_t queue_seq;
+static uint8_t  pending_mask;
+
+static i2c_bus_stats_t stats[I2C_BUS_DEV_MAX];
+
+static uint8_t bus_busy;
+static uint8_t task_posted;
+
+static void ICACHE_FLASH_ATTR
+post_task(void) {
+    if (!task_posted) {
+        task_posted = system_os_post(I2C_BUS_TASK_PRIO, 0, 0);
+    }
+}
+
+static uint8_t ICACHE_FLASH_ATTR
+pop_next(i2c_bus_entry_t* p_entry) {
+    uint8_t best = 0;
+
+    if (queue_len == 0) {
+        return 0;
+    }
+
+    for (uint8_t i = 1; i < queue_len; ++i) {
+        if (queue[i].prio > queue[best].prio ||
+            (queue[i].prio == queue[best].prio && (int32_t)(queue[i].seq - queue[best].seq) < 0)) {
+            best = i;
+        }
+    }
+
+    *p_entry = queue[best];
+    queue[best] = queue[--queue_len];
+    pending_mask &= ~(1 << p_entry->dev);
+
+    return 1;
+}
+
+static void ICACHE_FLASH_ATTR
+i2c_bus_task(os_event_t* events) {
+    i2c_bus_entry_t entry;
+    i2c_bus_stats_t* p_stats;
+    uint32_t start_us, wait_us;
+
+    task_posted = 0;
+
+    if (bus_busy) {
+        /* Owned through i2c_bus_acquire(), i2c_bus_release() posts again */
+        return;
+    }
+
+    if (!pop_next(&entry)) {
+        return;
+    }
+
+    p_stats  = &stats[entry.dev];
+    start_us = system_get_time();
+    wait_us  = start_us - entry.submit_us;
+
+    bus_busy = 1;
+    entry.job(entry.arg);
+    bus_busy = 0;
+
+    p_stats->jobs    += 1;
+    p_stats->wait_us += wait_us;
+    p_stats->run_us  += system_get_time() - start_us;
+    if (wait_us > p_stats->wait_max_us) {
+        p_stats->wait_max_us = wait_us;
+    }
+
+    /* One job per task run, so WiFi and timers get CPU between jobs */
+    if (queue_len > 0) {
+        post_task();
+    }
+}
+
+status_t ICACHE_FLASH_ATTR
+i2c_bus_submit(i2c_bus_dev_t dev, i2c_bus_prio_t prio, i2c_bus_job_t job, void* arg) {
+    i2c_bus_entry_t* p_entry;
+
+    if (dev >= I2C_BUS_DEV_MAX || job == NULL) {
+        return STA_ERR;
+    }
+
+    if (pending_mask & (1 << dev)) {
+        stats[dev].coalesced += 1;
+        return STA_ERR;
+    }
+
+    if (queue_len >= I2C_BUS_QUEUE_SIZE) {
+        stats[dev].rejected += 1;
+        return STA_ERR;
+    }
+
+    p_entry = &queue[queue_len++];
+    p_entry->job       = job;
+    p_entry->arg       = arg;
+    p_entry->dev       = dev;
+    p_entry->prio      = prio;
+    p_entry->seq       = queue_seq++;
+    p_entry->submit_us = system_get_time();
+
+    pending_mask |= (1 << dev);
+    post_task();
+
+    return STA_OK;
+}
+
+status_t ICACHE_FLASH_ATTR
+i2c_bus_acquire(void) {
+    if (bus_busy) {
+        return STA_ERR;
+    }
+
+    bus_busy = 1;
+    return STA_OK;
+}
+
+void ICACHE_FLASH_ATTR
+i2c_bus_release(void) {
+    bus_busy = 0;
+
+    if (queue_len > 0) {
+        post_task();
+    }
+}
+
+const i2c_bus_stats_t* ICACHE_FLASH_ATTR
+i2c_bus_get_stats(i2c_bus_dev_t dev) {
+    if (dev >= I2C_BUS_DEV_MAX) {
+        return NULL;
+    }
+
+    return &stats[dev];
+}
+
+size_t ICACHE_FLASH_ATTR
+i2c_bus_sprintf(char* buff) {
+    size_t len = 0;
+
+    len += os_sprintf(buff + len, "# dev jobs coalesced rejected wait_us wait_max_us run_us\n");
+    for (uint8_t i = 0; i < I2C_BUS_DEV_MAX; ++i) {
+        len += os_sprintf(buff + len, "%s %u %u %u %u %u %u\n", dev_names[i],
+                          stats[i].jobs, stats[i].coalesced, stats[i].rejected,
+                          stats[i].wait_us, stats[i].wait_max_us, stats[i].run_us);
+    }
+
+    return len;
+}
+
+#ifdef SERIAL_CMD_ENABLE
+static void ICACHE_FLASH_ATTR
+i2c_bus_cmd(const char* args) {
+    char buff[I2C_BUS_REPORT_SIZE];
+
+    i2c_bus_sprintf(buff);
+    os_printf("%s", buff);
+}
+#endif /* SERIAL_CMD_ENABLE */
+
+status_t ICACHE_FLASH_ATTR
+i2c_bus_init(void) {
+    queue_len    = 0;
+    pending_mask = 0;
+    bus_busy     = 0;
+    task_posted  = 0;
+
+    if (!system_os_task(i2c_bus_task, I2C_BUS_TASK_PRIO, task_queue, I2C_BUS_TASK_QUEUE_LEN)) {
+        return STA_ERR;
+    }
+
+#ifdef SERIAL_CMD_ENABLE
+    serial_cmd_register("bus", i2c_bus_cmd);
+#endif
+
+    return STA_OK;
+}
@@ -0,0 +1,272 @@
+/**
+ * \file i2c_trace.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief I2C bus transaction tracer and per device statistics. Source file.
+ * \version 0.1
+ * \date 2021-04-02
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <user_interface.h>
+#include <mem.h>
+
+#include "i2c_trace.h"
+#include "driver/i2c_master.h"
+
+#ifdef SERIAL_CMD_ENABLE
+#include "serial_cmd.h"
+#endif
+
+#ifdef I2C_TRACE_ENABLE
+
+#define I2C_TRACE_RING_MASK (I2C_TRACE_RING_SIZE - 1)
+
+/* Single producer ring. Only the writer moves `ring_head`, and it does it after the
+ * slot is complete, so readers only have to check that the slots they copied were
+ * not overwritten meanwhile */
+static i2c_trace_entry_t ring[I2C_TRACE_RING_SIZE];
+static volatile uint32_t ring_head;
+
+static i2c_trace_device_t devices[I2C_TRACE_MAX_DEVICES];
+static uint8_t devices_len;
+
+static i2c_trace_entry_t current;
+static uint8_t  current_open;
+static uint32_t current_stretch_start;
+
+static uint8_t  last_addr;
+static uint32_t last_stop_us;
+
+static uint8_t ICACHE_FLASH_ATTR
+log2_bucket(uint32_t value, uint32_t first_limit) {
+    uint8_t bucket = 0;
+
+    while (bucket < I2C_TRACE_HIST_BUCKETS - 1 && value >= first_limit) {
+        first_limit <<= 1;
+        bucket += 1;
+    }
+
+    return bucket;
+}
+
+static uint8_t ICACHE_FLASH_ATTR
+bytes_bucket(uint16_t bytes) {
+    uint8_t bucket;
+
+    if (bytes == 0) {
+        return 0;
+    }
+
+    bucket = 1 + log2_bucket(bytes - 1, 1);
+    return (bucket < I2C_TRACE_HIST_BUCKETS) ? bucket : I2C_TRACE_HIST_BUCKETS - 1;
+}
+
+static i2c_trace_device_t* ICACHE_FLASH_ATTR
+find_device(uint8_t addr, uint8_t create) {
+    for (uint8_t i = 0; i < devices_len; ++i) {
+        if (devices[i].addr == addr) {
+            return &devices[i];
+        }
+    }
+
+    if (!create || devices_len >= I2C_TRACE_MAX_DEVICES) {
+        return NULL;
+    }
+
+    os_memset(&devices[devices_len], 0, sizeof(i2c_trace_device_t));
+    devices[devices_len].addr = addr;
+
+    return &devices[devices_len++];
+}
+
+static void ICACHE_FLASH_ATTR
+close_transaction(uint32_t now) {
+    i2c_trace_device_t* p_dev;
+
+    current.duration_us = now - current.start_us;
+    current.stretch_us  = i2c_master_get_stretch_us() - current_stretch_start;
+
+    ring[ring_head & I2C_TRACE_RING_MASK] = current;
+    ring_head += 1;
+
+    p_dev = find_device(current.addr, 1);
+    if (p_dev != NULL) {
+        p_dev->transactions += 1;
+        p_dev->bytes        += current.bytes;
+        p_dev->nacks        += current.nacks;
+        p_dev->busy_us      += current.duration_us;
+        p_dev->stretch_us   += current.stretch_us;
+
+        if (current.duration_us > p_dev->max_us) {
+            p_dev->max_us = current.duration_us;
+        }
+
+        p_dev->duration_hist[log2_bucket(current.duration_us, I2C_TRACE_DURATION_MIN)] += 1;
+        p_dev->bytes_hist[bytes_bucket(current.bytes)] += 1;
+    }
+
+    last_addr    = current.addr;
+    last_stop_us = now;
+    current_open = 0;
+}
+
+void ICACHE_FLASH_ATTR
+i2c_trace_start(uint8_t addr, uint8_t op) {
+    uint32_t now = system_get_time();
+    i2c_trace_device_t* p_dev;
+
+    if (current_open) {
+        /* Repeated START or a previous transaction aborted without STOP */
+        close_transaction(now);
+    }
+
+    if (addr == last_addr && ring_head != 0 && (now - last_stop_us) < I2C_TRACE_GAP_MAX) {
+        p_dev = find_device(addr, 0);
+        if (p_dev != NULL) {
+            p_dev->gap_us += now - last_stop_us;
+        }
+    }
+
+    os_memset(&current, 0, sizeof(current));
+    current.start_us = now;
+    current.addr     = addr;
+    current.op       = op;
+
+    current_stretch_start = i2c_master_get_stretch_us();
+    current_open = 1;
+}
+
+void ICACHE_FLASH_ATTR
+i2c_trace_ack(uint8_t ack) {
+    if (current_open && !ack && current.nacks < 0x7F) {
+        current.nacks += 1;
+    }
+}
+
+void ICACHE_FLASH_ATTR
+i2c_trace_bytes(uint16_t bytes) {
+    if (current_open) {
+        current.bytes += bytes;
+    }
+}
+
+void ICACHE_FLASH_ATTR
+i2c_trace_stop(void) {
+    if (current_open) {
+        close_transaction(system_get_time());
+    }
+}
+
+void ICACHE_FLASH_ATTR
+i2c_trace_reset(void) {
+    os_memset(devices, 0, sizeof(devices));
+    devices_len  = 0;
+    ring_head    = 0;
+    current_open = 0;
+    last_addr    = 0;
+}
+
+size_t ICACHE_FLASH_ATTR
+i2c_trace_get_entries(i2c_trace_entry_t* p_entries, size_t max_entries) {
+    uint32_t head, first;
+    size_t n_entries;
+
+    do {
+        head = ring_head;
+        n_entries = (head < I2C_TRACE_RING_SIZE) ? head : I2C_TRACE_RING_SIZE;
+        if (n_entries > max_entries) {
+            n_entries = max_entries;
+        }
+
+        first = head - n_entries;
+        for (size_t i = 0; i < n_entries; ++i) {
+            p_entries[i] = ring[(first + i) & I2C_TRACE_RING_MASK];
+        }
+    } while (ring_head - first > I2C_TRACE_RING_SIZE);  /* Overwritten while copying */
+
+    return n_entries;
+}
+
+const i2c_trace_device_t* ICACHE_FLASH_ATTR
+i2c_trace_get_device(uint8_t addr) {
+    return find_device(addr, 0);
+}
+
+static size_t ICACHE_FLASH_ATTR
+sprintf_hist(char* buff, const char* name, const uint32_t* hist) {
+    size_t len = os_sprintf(buff, "  %s:", name);
+
+    for (uint8_t i = 0; i < I2C_TRACE_HIST_BUCKETS; ++i) {
+        len += os_sprintf(buff + len, " %u", hist[i]);
+    }
+
+    len += os_sprintf(buff + len, "\n");
+    return len;
+}
+
+size_t ICACHE_FLASH_ATTR
+i2c_trace_sprintf(char* buff) {
+    static i2c_trace_entry_t entries[I2C_TRACE_RING_SIZE];
+    const i2c_trace_device_t* p_dev;
+    size_t n_entries;
+    size_t len = 0;
+
+    len += os_sprintf(buff + len, "# addr trans bytes nacks busy_us stretch_us gap_us max_us\n");
+    for (uint8_t i = 0; i < devices_len; ++i) {
+        p_dev = &devices[i];
+        len += os_sprintf(buff + len, "0x%02x %u %u %u %u %u %u %u\n",
+                          p_dev->addr, p_dev->transactions, p_dev->bytes, p_dev->nacks,
+                          p_dev->busy_us, p_dev->stretch_us, p_dev->gap_us, p_dev->max_us);
+        len += sprintf_hist(buff + len, "duration", p_dev->duration_hist);
+        len += sprintf_hist(buff + len, "bytes", p_dev->bytes_hist);
+    }
+
+    len += os_sprintf(buff + len, "# start_us addr op bytes nacks duration_us stretch_us\n");
+    n_entries = i2c_trace_get_entries(entries, I2C_TRACE_RING_SIZE);
+    for (size_t i = 0; i < n_entries; ++i) {
+        len += os_sprintf(buff + len, "%u 0x%02x %c %u %u %u %u\n",
+                          entries[i].start_us, entries[i].addr, entries[i].op ? 'R' : 'W',
+                          entries[i].bytes, entries[i].nacks, entries[i].duration_us, entries[i].stretch_us);
+    }
+
+    return len;
+}
+
+void ICACHE_FLASH_ATTR
+i2c_trace_print(void) {
+    char* buff = (char*)os_malloc(sizeof(char) * I2C_TRACE_REPORT_SIZE);
+
+    if (buff == NULL) {
+        os_printf("I2C trace: no memory\n");
+        return;
+    }
+
+    i2c_trace_sprintf(buff);
+    os_printf("%s", buff);
+
+    os_free(buff);
+}
+
+#ifdef SERIAL_CMD_ENABLE
+static void ICACHE_FLASH_ATTR
+i2c_trace_cmd(const char* args) {
+    if (os_strcmp(args, "reset") == 0) {
+        i2c_trace_reset();
+        os_printf("I2C trace cleared\n");
+    } else {
+        i2c_trace_print();
+    }
+}
+#endif /* SERIAL_CMD_ENABLE */
+
+void ICACHE_FLASH_ATTR
+i2c_trace_init(void) {
+    i2c_trace_reset();
+
+#ifdef SERIAL_CMD_ENABLE
+    serial_cmd_register("i2c", i2c_trace_cmd);
+#endif
+}
+
+#endif /* I2C_TRACE_ENABLE */
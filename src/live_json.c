@@ -0,0 +1,341 @@
+/**
+ * \file live_json.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Latest sample of every sensor as a precomputed JSON document. Source file.
+ * \version 0.1
+ * \date 2021-04-12
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <sntp.h>
+
+#include "live_json.h"
+#include "common.h"
+#include "user_config.h"
+
+#ifdef WEB_ENABLE
+
+#define SLOT_BOOL_WIDTH 5                       /* "false" */
+#define SLOT_UINT_WIDTH 10                      /* 4294967295 */
+#define SLOT_NUM_WIDTH  14                      /* -2147483647.99 */
+
+typedef enum {
+    SLOT_BOOL,
+    SLOT_UINT,
+    SLOT_NUM,
+} slot_kind_t;
+
+typedef struct {
+    const char* prefix;                         /* Text before the value */
+    slot_kind_t kind;
+} field_t;
+
+/* Slot indices, in document order. Must match `fields` */
+enum {
+    SLOT_SCD30_VALID,
+    SLOT_SCD30_TS,
+    SLOT_SCD30_CO2,
+    SLOT_SCD30_TEMP,
+    SLOT_SCD30_RH,
+
+    SLOT_CCS811_VALID,
+    SLOT_CCS811_TS,
+    SLOT_CCS811_ECO2,
+    SLOT_CCS811_TVOC,
+
+    SLOT_ZMOD,                                  /* First lane, SLOT_ZMOD_LEN slots per lane */
+};
+
+/* Slot indices inside a ZMOD lane */
+enum {
+    SLOT_ZMOD_VALID,
+    SLOT_ZMOD_TS,
+    SLOT_ZMOD_ECO2,
+    SLOT_ZMOD_ETOH,
+    SLOT_ZMOD_IAQ,
+    SLOT_ZMOD_TVOC,
+    SLOT_ZMOD_RCDA,
+    SLOT_ZMOD_RMOX,
+    SLOT_ZMOD_LEN,
+};
+
+#define SLOT_MAX (SLOT_ZMOD + SLOT_ZMOD_LEN * LIVE_JSON_ZMOD_MAX)
+
+#define ZMOD_FIELDS(name)                               \
+    {"},\"" name "\":{\"valid\":", SLOT_BOOL},          \
+    {",\"ts\":",                   SLOT_UINT},          \
+    {",\"eco2\":",                 SLOT_NUM},           \
+    {",\"etoh\":",                 SLOT_NUM},           \
+    {",\"iaq\":",                  SLOT_NUM},           \
+    {",\"tvoc\":",                 SLOT_NUM},           \
+    {",\"rcda\":",                 SLOT_NUM},           \
+    {",\"rmox\":",                 SLOT_NUM}
+
+static const field_t fields[SLOT_MAX] = {
+    {"{\"scd30\":{\"valid\":",     SLOT_BOOL},
+    {",\"ts\":",                   SLOT_UINT},
+    {",\"co2\":",                  SLOT_NUM},
+    {",\"temp\":",                 SLOT_NUM},
+    {",\"rh\":",                   SLOT_NUM},
+
+    {"},\"ccs811\":{\"valid\":",   SLOT_BOOL},
+    {",\"ts\":",                   SLOT_UINT},
+    {",\"eco2\":",                 SLOT_UINT},
+    {",\"tvoc\":",                 SLOT_UINT},
+
+    ZMOD_FIELDS("zmod"),
+    ZMOD_FIELDS("zmod_reset"),
+    ZMOD_FIELDS("zmod_halt"),
+};
+
+#define DOC_END "}}"
+
+/* Every sensor object starts with its valid flag */
+#define SECTION_START "{\"valid\":"
+
+static const uint8_t section_slot[LIVE_JSON_SECTION_MAX] = {
+    [LIVE_JSON_SECTION_SCD30]      = SLOT_SCD30_VALID,
+    [LIVE_JSON_SECTION_CCS811]     = SLOT_CCS811_VALID,
+    [LIVE_JSON_SECTION_ZMOD]       = SLOT_ZMOD + LIVE_JSON_ZMOD * SLOT_ZMOD_LEN,
+    [LIVE_JSON_SECTION_ZMOD_RESET] = SLOT_ZMOD + LIVE_JSON_ZMOD_RESET * SLOT_ZMOD_LEN,
+    [LIVE_JSON_SECTION_ZMOD_HALT]  = SLOT_ZMOD + LIVE_JSON_ZMOD_HALT * SLOT_ZMOD_LEN,
+};
+
+static const uint8_t slot_width[] = {
+    [SLOT_BOOL] = SLOT_BOOL_WIDTH,
+    [SLOT_UINT] = SLOT_UINT_WIDTH,
+    [SLOT_NUM]  = SLOT_NUM_WIDTH,
+};
+
+static uint16_t slot_offset[SLOT_MAX];
+
+/* Copy handed out to responses, untouched while pinned */
+typedef struct {
+    char text[LIVE_JSON_SIZE];
+    uint32_t seq;                               /* Sequence number of the master it was taken from */
+    uint8_t pins;                               /* Responses in flight */
+} copy_t;
+
+static char    doc[LIVE_JSON_SIZE];             /* Master, patched in place */
+static size_t  doc_len;
+static uint32_t doc_seq;
+static uint8_t doc_dirty;                       /* Sample written since the last commit */
+
+static copy_t  copies[LIVE_JSON_COPIES];
+static uint8_t copy_idx;                        /* Most recent copy */
+
+/* Right align `text` in the slot */
+static void ICACHE_FLASH_ATTR
+slot_write(char* p_doc, uint8_t slot, const char* text, size_t text_len) {
+    char* p_slot = p_doc + slot_offset[slot];
+    uint8_t width = slot_width[fields[slot].kind];
+
+    if (text_len > width) {
+        text = "null";
+        text_len = 4;
+    }
+
+    os_memset(p_slot, ' ', width - text_len);
+    os_memcpy(p_slot + width - text_len, text, text_len);
+}
+
+static void ICACHE_FLASH_ATTR
+slot_bool(char* p_doc, uint8_t slot, uint8_t value) {
+    if (value) {
+        slot_write(p_doc, slot, "true", 4);
+    } else {
+        slot_write(p_doc, slot, "false", 5);
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+slot_uint(char* p_doc, uint8_t slot, uint32_t value) {
+    char text[SLOT_UINT_WIDTH + 1];
+
+    slot_write(p_doc, slot, text, os_sprintf(text, "%u", value));
+}
+
+static void ICACHE_FLASH_ATTR
+slot_num(char* p_doc, uint8_t slot, float value) {
+    char text[SLOT_NUM_WIDTH + 1];
+    size_t len = common_ftoa(text, value);
+
+    if (len == 0) {
+        slot_write(p_doc, slot, "null", 4);
+    } else {
+        slot_write(p_doc, slot, text, len);
+    }
+}
+
+void ICACHE_FLASH_ATTR
+live_json_init(void) {
+    char* p_doc = doc;
+    size_t len = 0;
+    size_t prefix_len;
+
+    for (uint8_t i = 0; i < SLOT_MAX; ++i) {
+        prefix_len = os_strlen(fields[i].prefix);
+        if (len + prefix_len + slot_width[fields[i].kind] + sizeof(DOC_END) > LIVE_JSON_SIZE) {
+#ifdef DEBUG_PRINT_MODE
+            os_printf("live_json: LIVE_JSON_SIZE too small\n");
+#endif
+            doc_len = 0;
+            return;
+        }
+
+        os_memcpy(p_doc + len, fields[i].prefix, prefix_len);
+        len += prefix_len;
+        slot_offset[i] = len;
+        len += slot_width[fields[i].kind];
+
+        if (fields[i].kind == SLOT_BOOL) {
+            slot_bool(p_doc, i, 0);
+        } else if (fields[i].kind == SLOT_UINT) {
+            slot_uint(p_doc, i, 0);
+        } else {
+            slot_write(p_doc, i, "null", 4);
+        }
+    }
+
+    os_memcpy(p_doc + len, DOC_END, sizeof(DOC_END) - 1);
+    len += sizeof(DOC_END) - 1;
+
+    doc_len = len;
+    doc_seq = os_random();
+
+    copy_idx = 0;
+    for (uint8_t i = 0; i < LIVE_JSON_COPIES; ++i) {
+        os_memcpy(copies[i].text, doc, doc_len);
+        copies[i].seq  = doc_seq;
+        copies[i].pins = 0;
+    }
+}
+
+void ICACHE_FLASH_ATTR
+live_json_update_scd30(uint8_t valid, const scd30_result_t* p_result) {
+    float value;
+
+    if (doc_len == 0 || !valid) {
+        return;
+    }
+
+    slot_bool(doc, SLOT_SCD30_VALID, 1);
+    slot_uint(doc, SLOT_SCD30_TS, sntp_get_current_timestamp());
+
+    /* Raw IEEE754 words from the sensor */
+    os_memcpy(&value, &p_result->co2, sizeof(value));
+    slot_num(doc, SLOT_SCD30_CO2, value);
+    os_memcpy(&value, &p_result->temp, sizeof(value));
+    slot_num(doc, SLOT_SCD30_TEMP, value);
+    os_memcpy(&value, &p_result->rh, sizeof(value));
+    slot_num(doc, SLOT_SCD30_RH, value);
+    doc_dirty = 1;
+}
+
+void ICACHE_FLASH_ATTR
+live_json_update_ccs811(uint8_t valid, const ccs811_data_t* p_data) {
+    if (doc_len == 0 || !valid) {
+        return;
+    }
+
+    slot_bool(doc, SLOT_CCS811_VALID, 1);
+    slot_uint(doc, SLOT_CCS811_TS, sntp_get_current_timestamp());
+    slot_uint(doc, SLOT_CCS811_ECO2, p_data->eco2);
+    slot_uint(doc, SLOT_CCS811_TVOC, p_data->tvoc);
+    doc_dirty = 1;
+}
+
+void ICACHE_FLASH_ATTR
+live_json_update_zmod(live_json_zmod_lane_t lane, uint8_t valid, const iaq_1st_gen_results_t* p_results) {
+    uint8_t base = SLOT_ZMOD + lane * SLOT_ZMOD_LEN;
+
+    if (doc_len == 0 || lane >= LIVE_JSON_ZMOD_MAX || !valid) {
+        return;
+    }
+
+    slot_bool(doc, base + SLOT_ZMOD_VALID, 1);
+    slot_uint(doc, base + SLOT_ZMOD_TS, sntp_get_current_timestamp());
+    slot_num(doc, base + SLOT_ZMOD_ECO2, p_results->eco2);
+    slot_num(doc, base + SLOT_ZMOD_ETOH, p_results->etoh);
+    slot_num(doc, base + SLOT_ZMOD_IAQ,  p_results->iaq);
+    slot_num(doc, base + SLOT_ZMOD_TVOC, p_results->tvoc);
+    slot_num(doc, base + SLOT_ZMOD_RCDA, p_results->rcda);
+    slot_num(doc, base + SLOT_ZMOD_RMOX, p_results->rmox);
+    doc_dirty = 1;
+}
+
+void ICACHE_FLASH_ATTR
+live_json_commit(void) {
+    if (doc_dirty) {
+        doc_seq += 1;
+        doc_dirty = 0;
+    }
+}
+
+char* ICACHE_FLASH_ATTR
+live_json_get(size_t* p_len, uint32_t* p_seq) {
+    copy_t* p_copy = &copies[copy_idx];
+    uint8_t idx;
+
+    /* Refresh the most recent copy, or the next one if a response is still sending it */
+    if (p_copy->seq != doc_seq) {
+        for (uint8_t i = 0; i < LIVE_JSON_COPIES; ++i) {
+            idx = (copy_idx + i) % LIVE_JSON_COPIES;
+            if (copies[idx].pins == 0) {
+                os_memcpy(copies[idx].text, doc, doc_len);
+                copies[idx].seq = doc_seq;
+                copy_idx = idx;
+                break;
+            }
+        }
+        p_copy = &copies[copy_idx];
+    }
+
+    p_copy->pins += 1;
+    *p_len = doc_len;
+    *p_seq = p_copy->seq;
+    return p_copy->text;
+}
+
+void ICACHE_FLASH_ATTR
+live_json_release(void* arg) {
+    for (uint8_t i = 0; i < LIVE_JSON_COPIES; ++i) {
+        if (copies[i].text == arg && copies[i].pins > 0) {
+            copies[i].pins -= 1;
+        }
+    }
+}
+
+const char* ICACHE_FLASH_ATTR
+live_json_section(live_json_section_t section, size_t* p_len) {
+    uint8_t slot;
+    size_t start;
+    size_t end;
+
+    if (doc_len == 0 || section >= LIVE_JSON_SECTION_MAX) {
+        *p_len = 0;
+        return NULL;
+    }
+
+    slot  = section_slot[section];
+    start = slot_offset[slot] - (sizeof(SECTION_START) - 1);
+
+    /* Up to the closing brace, right before the prefix of the next object */
+    if (section + 1 < LIVE_JSON_SECTION_MAX) {
+        slot = section_slot[section + 1];
+        end  = slot_offset[slot] - os_strlen(fields[slot].prefix) + 1;
+    } else {
+        end  = doc_len - (sizeof(DOC_END) - 2);
+    }
+
+    *p_len = end - start;
+    return doc + start;
+}
+
+uint32_t ICACHE_FLASH_ATTR
+live_json_seq(void) {
+    return doc_seq;
+}
+
+#endif /* WEB_ENABLE */
@@ -12,12 +12,27 @@
 #include <espconn.h>
 #include <sntp.h>
 #include <user_interface.h>
+#include <stddef.h>
 
 #include "extra_time.h"
 #include "user_config.h"
 #include "fast_gpio.h"
 #include "uc_init.h"
 #include "sensors.h"
+#include "i2c_trace.h"
+#include "i2c_bus.h"
+#include "sensor_irq.h"
+#include "live_json.h"
+#include "web_events.h"
+#include "web_metrics.h"
+#include "web_dashboard.h"
+#include "history.h"
+#include "web_history.h"
+#include "udp_sink.h"
+#include "telemetry.h"
+#include "telemetry_sinks.h"
+#include "upload_sched.h"
+#include "gateway.h"
 
 #include "f2c/f2c.h"
 
@@ -25,6 +40,7 @@
 #include "zmod4xxx/zmod4xxx_types.h"
 
 #include "simple_http/simple_http.h"
+#include "simple_mqtt/simple_mqtt.h"
 
 #include "ccs811/ccs811.h"
 #include "ccs811/ccs811_defs.h"
@@ -54,6 +70,11 @@ static uint8_t zmod4410_data_valid, zmod4410_data_valid_reset, zmod4410_data_val
 static uint8_t ccs811_data_valid;
 static uint8_t scd30_data_valid;
 
+static uint8_t zmod4410_stabilizing, zmod4410_stabilizing_reset, zmod4410_stabilizing_halt;
+
+/* Reads that failed on the bus or in the sensor, not the "no data yet" results */
+static uint32_t sensor_errors[I2C_BUS_DEV_MAX];
+
 static volatile os_timer_t timer_blink;
 static volatile os_timer_t timer_scd30;
 static volatile os_timer_t timer_zmod;
@@ -65,68 +86,494 @@ static volatile os_timer_t timer_logger;
 static struct espconn web_conn;
 #endif
 
+#ifdef SENSOR_IRQ_ENABLE
+/* Timers only as a fallback, reads are triggered by the data ready lines */
+#define SCD30_POLL_INTERVAL SENSOR_IRQ_FALLBACK_INTERVAL
+#ifdef CCS811_THRESH_ENABLE
+/* nINT is only asserted when eCO2 crosses a band threshold, the timer is the heartbeat */
+#define CCS_POLL_INTERVAL   CCS811_HEARTBEAT_INTERVAL
+#else
+#define CCS_POLL_INTERVAL   SENSOR_IRQ_FALLBACK_INTERVAL
+#endif
+
+#define SCD30_JOB_RDY ((void*)1)
+#else
+#ifdef CCS811_THRESH_ENABLE
+#error "CCS811_THRESH_ENABLE needs SENSOR_IRQ_ENABLE"
+#endif
+#define SCD30_POLL_INTERVAL SCD30_READ_INTERVAL
+#define CCS_POLL_INTERVAL   CCS_READ_INTERVAL
+#endif
+
+#ifdef CCS811_THRESH_ENABLE
+static uint8_t ccs811_band;
+static uint8_t ccs811_uploaded;                 /* Sample already sent, it stays valid for web and history */
+#endif
+
 
 #ifdef WEB_ENABLE
-char* ICACHE_FLASH_ATTR
-web_view(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
-    char* temp_data;
+#ifdef I2C_TRACE_ENABLE
+static char* ICACHE_FLASH_ATTR
+web_view_i2c(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
     char* data;
-    char* f2c_str;
 
-    /* Check if there is a GET request */
-    if (os_strcmp(p_data->request_method, "GET") != 0) {
-        *p_response_code = 403;
-        *p_content_type = HTTP_CONTENT_TYPE_TEXT_HTML;
+    *p_response_code = 200;
+    *p_content_type = HTTP_CONTENT_TYPE_TEXT_PLAIN;
 
-        data = (char*)os_malloc(sizeof(char) * 14);
-        os_strcpy(data, "Nothing here!");
-        *p_data_size = os_strlen(data);
+    data = (char*)os_malloc(sizeof(char) * I2C_TRACE_REPORT_SIZE);
+    if (data == NULL) {
+        *p_response_code = 500;
+        *p_data_size = 0;
     } else {
-        data = (char*)os_malloc(sizeof(char) * ((F2C_CHAR_BUFF_SIZE + 6 + 4) * 5 + 4 + 2 + 2 + 4 + 10));
-        temp_data = (char*)os_zalloc(sizeof(char) * F2C_CHAR_BUFF_SIZE);
-
-        *p_response_code = 200;
-        *p_content_type = HTTP_CONTENT_TYPE_TEXT_HTML;
-
-        os_strcpy(data, "");
-        if (scd30_data_valid) {
-            os_strcat(data, "CO2: ");
-            f2c_str = f2c(*((real32_t*) &scd30_result.co2), temp_data);
-            os_strcat(data, f2c_str);
-            os_strcat(data, " ppm<br>");
-
-            os_strcat(data, "TEMP: ");
-            f2c_str = f2c(*((real32_t*) &scd30_result.temp), temp_data);
-            os_strcat(data, f2c_str);
-            os_strcat(data, " C<br>");
-
-            os_strcat(data, " RH: ");
-            f2c_str = f2c(*((real32_t*) &scd30_result.rh), temp_data);
-            os_strcat(data, f2c_str);
-            os_strcat(data, " %<br>");
-        } else {
-            os_strcat(data, "SCD30 data not ready!<br>");
-        }
+        *p_data_size = i2c_trace_sprintf(data);
+    }
 
-        if (zmod4410_data_valid) {
-            os_strcat(data, "eCO2: ");
-            f2c_str = f2c(*((real32_t*) &iaq_results.eco2), temp_data);
-            os_strcat(data, f2c_str);
-            os_strcat(data, " ppm<br>");
+    return data;
+}
+#endif /* I2C_TRACE_ENABLE */
 
-            os_strcat(data, "IAQ: ");
-            f2c_str = f2c(*((real32_t*) &iaq_results.iaq), temp_data);
-            os_strcat(data, f2c_str);
-        } else {
-            os_strcat(data, "ZMOD4410 data not ready!");
-        }
+/* Push the sensor object of the JSON document to the `/events` subscribers */
+static void ICACHE_FLASH_ATTR
+web_publish(const char* name, live_json_section_t section, uint8_t valid) {
+    const char* data;
+    size_t data_len;
 
-        os_free(temp_data);
-        *p_data_size = os_strlen(data);
+    if (!valid) {
+        return;
+    }
+
+    data = live_json_section(section, &data_len);
+    if (data != NULL) {
+        web_events_publish(name, data, data_len);
     }
+}
 
+/* Patched in place on every sample, nothing to format or allocate. Tagged with the sample sequence number */
+static char* ICACHE_FLASH_ATTR
+web_view_latest(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    static char etag[11];
+    char* data;
+    uint32_t seq;
+
+    *p_response_code = 200;
+    *p_content_type = HTTP_CONTENT_TYPE_APPLICATION_JSON;
+
+    data = live_json_get(p_data_size, &seq);
+    os_sprintf(etag, "\"%08x\"", seq);
+    p_data->etag = etag;
+    p_data->headers = "Cache-Control: no-cache\r\n";
+    p_data->keep_response = 1;
+    p_data->release = live_json_release;
+    p_data->release_arg = data;
     return data;
 }
+
+static char* ICACHE_FLASH_ATTR
+web_view_bus(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    char* data;
+
+    *p_response_code = 200;
+    *p_content_type = HTTP_CONTENT_TYPE_TEXT_PLAIN;
+
+    data = (char*)os_malloc(sizeof(char) * I2C_BUS_REPORT_SIZE);
+    if (data == NULL) {
+        *p_response_code = 500;
+        *p_data_size = 0;
+    } else {
+        *p_data_size = i2c_bus_sprintf(data);
+    }
+
+    return data;
+}
+
+static const char* const zmod_lane_labels[LIVE_JSON_ZMOD_MAX] = {
+    "lane=\"lp\"",
+    "lane=\"reset\"",
+    "lane=\"halt\"",
+};
+
+static const char* const bus_dev_labels[I2C_BUS_DEV_MAX] = {
+    "dev=\"zmod\"",
+    "dev=\"ccs811\"",
+    "dev=\"scd30\"",
+};
+
+typedef struct {
+    const char* name;
+    size_t      offset;                         /* Value offset in iaq_1st_gen_results_t */
+} zmod_metric_t;
+
+static const zmod_metric_t zmod_metrics[] = {
+    {"zmod_eco2_ppm",    offsetof(iaq_1st_gen_results_t, eco2)},
+    {"zmod_etoh_ppm",    offsetof(iaq_1st_gen_results_t, etoh)},
+    {"zmod_iaq",         offsetof(iaq_1st_gen_results_t, iaq)},
+    {"zmod_tvoc_mg_m3",  offsetof(iaq_1st_gen_results_t, tvoc)},
+};
+
+typedef struct {
+    const char* name;
+    const char* type;
+    size_t      offset;                         /* Value offset in telemetry_stats_t */
+} telemetry_metric_t;
+
+static const telemetry_metric_t telemetry_metrics[] = {
+    {"telemetry_queued_samples",        "gauge",   offsetof(telemetry_stats_t, queued)},
+    {"telemetry_sent_samples_total",    "counter", offsetof(telemetry_stats_t, sent)},
+    {"telemetry_dropped_samples_total", "counter", offsetof(telemetry_stats_t, dropped)},
+    {"telemetry_busy_total",            "counter", offsetof(telemetry_stats_t, busy)},
+};
+
+#ifdef INFLUX_HTTP_ENABLE
+typedef struct {
+    const char* name;
+    const char* type;
+    size_t      offset;                         /* Value offset in simple_http_client_stats_t */
+} http_client_metric_t;
+
+static const http_client_metric_t http_client_metrics[] = {
+    {"http_client_connects_total",      "counter", offsetof(simple_http_client_stats_t, connects)},
+    {"http_client_reused_total",        "counter", offsetof(simple_http_client_stats_t, reused)},
+    {"http_client_heap_free_min_bytes", "gauge",   offsetof(simple_http_client_stats_t, heap_free_min)},
+    {"http_client_heap_used_max_bytes", "gauge",   offsetof(simple_http_client_stats_t, heap_used_max)},
+    {"http_client_send_errors_total",   "counter", offsetof(simple_http_client_stats_t, send_errors)},
+};
+
+/* arg: http_client_metric_t */
+static size_t ICACHE_FLASH_ATTR
+metrics_http_client(char* buff, void* arg) {
+    const http_client_metric_t* p_metric = (const http_client_metric_t*)arg;
+    const uint8_t* p_stats = (const uint8_t*)simple_http_client_get_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, p_metric->name, p_metric->type);
+    len += web_metrics_uint(buff + len, p_metric->name, NULL, *(const uint32_t*)(p_stats + p_metric->offset));
+
+    return len;
+}
+
+static size_t ICACHE_FLASH_ATTR
+metrics_tls_handshake(char* buff, void* arg) {
+    const simple_http_client_stats_t* p_stats = simple_http_client_get_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "http_client_handshake_us", "summary");
+    len += web_metrics_uint(buff + len, "http_client_handshake_us_sum", NULL, p_stats->handshake_sum_us);
+    len += web_metrics_uint(buff + len, "http_client_handshake_us_count", NULL, p_stats->handshakes);
+    len += web_metrics_type(buff + len, "http_client_handshake_max_us", "gauge");
+    len += web_metrics_uint(buff + len, "http_client_handshake_max_us", NULL, p_stats->handshake_max_us);
+
+    return len;
+}
+
+#ifdef UPLOAD_SPREAD_ENABLE
+static size_t ICACHE_FLASH_ATTR
+metrics_upload_sched(char* buff, void* arg) {
+    const upload_sched_stats_t* p_stats = upload_sched_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "upload_phase_ms", "gauge");
+    len += web_metrics_uint(buff + len, "upload_phase_ms", NULL, p_stats->phase_ms);
+    len += web_metrics_type(buff + len, "upload_slot_hints_total", "counter");
+    len += web_metrics_uint(buff + len, "upload_slot_hints_total", NULL, p_stats->hints);
+    len += web_metrics_type(buff + len, "upload_retry_after_seconds_total", "counter");
+    len += web_metrics_uint(buff + len, "upload_retry_after_seconds_total", NULL, p_stats->held_s);
+
+    return len;
+}
+#endif /* UPLOAD_SPREAD_ENABLE */
+
+static size_t ICACHE_FLASH_ATTR
+metrics_uploads(char* buff, void* arg) {
+    const telemetry_http_stats_t* p_stats = telemetry_http_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "upload_requests_total", "counter");
+    len += web_metrics_uint(buff + len, "upload_requests_total", "result=\"ok\"", p_stats->ok);
+    len += web_metrics_uint(buff + len, "upload_requests_total", "result=\"error\"", p_stats->err);
+
+    return len;
+}
+#endif /* INFLUX_HTTP_ENABLE */
+
+#if defined(GATEWAY_ENABLE) || defined(GATEWAY_PEER_ENABLE)
+static size_t ICACHE_FLASH_ATTR
+metrics_gateway(char* buff, void* arg) {
+    const gateway_stats_t* p_stats = gateway_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "gateway_datagrams_total", "counter");
+    len += web_metrics_uint(buff + len, "gateway_datagrams_total", "result=\"ok\"", p_stats->datagrams);
+    len += web_metrics_uint(buff + len, "gateway_datagrams_total", "result=\"invalid\"", p_stats->invalid);
+    len += web_metrics_uint(buff + len, "gateway_datagrams_total", "result=\"lost\"", p_stats->lost);
+    len += web_metrics_type(buff + len, "gateway_peers", "gauge");
+    len += web_metrics_uint(buff + len, "gateway_peers", NULL, gateway_peers());
+
+    return len;
+}
+
+static size_t ICACHE_FLASH_ATTR
+metrics_gateway_lines(char* buff, void* arg) {
+    const gateway_stats_t* p_stats = gateway_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "gateway_lines_total", "counter");
+    len += web_metrics_uint(buff + len, "gateway_lines_total", "result=\"ok\"", p_stats->lines);
+    len += web_metrics_uint(buff + len, "gateway_lines_total", "result=\"dropped\"", p_stats->dropped);
+    len += web_metrics_type(buff + len, "gateway_requests_total", "counter");
+    len += web_metrics_uint(buff + len, "gateway_requests_total", "result=\"ok\"", p_stats->ok);
+    len += web_metrics_uint(buff + len, "gateway_requests_total", "result=\"error\"", p_stats->err);
+
+    return len;
+}
+#endif /* GATEWAY_ENABLE || GATEWAY_PEER_ENABLE */
+
+#if defined(INFLUX_HTTP_ENABLE) || defined(UDP_SINK_ENABLE)
+static size_t ICACHE_FLASH_ATTR
+metrics_upload_busy(char* buff, void* arg) {
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "upload_busy_us_total", "counter");
+#ifdef INFLUX_HTTP_ENABLE
+    len += web_metrics_uint(buff + len, "upload_busy_us_total", "path=\"http\"", telemetry_http_stats()->busy_us);
+#endif
+#ifdef UDP_SINK_ENABLE
+    len += web_metrics_uint(buff + len, "upload_busy_us_total", "path=\"udp\"", udp_sink_stats()->busy_us);
+#endif
+    len += web_metrics_type(buff + len, "upload_lines_total", "counter");
+#ifdef INFLUX_HTTP_ENABLE
+    len += web_metrics_uint(buff + len, "upload_lines_total", "path=\"http\"", telemetry_http_stats()->lines);
+#endif
+#ifdef UDP_SINK_ENABLE
+    len += web_metrics_uint(buff + len, "upload_lines_total", "path=\"udp\"", udp_sink_stats()->lines);
+#endif
+
+    return len;
+}
+#endif /* INFLUX_HTTP_ENABLE || UDP_SINK_ENABLE */
+
+/* arg: telemetry_metric_t */
+static size_t ICACHE_FLASH_ATTR
+metrics_telemetry(char* buff, void* arg) {
+    const telemetry_metric_t* p_metric = (const telemetry_metric_t*)arg;
+    telemetry_stats_t stats;
+    char labels[24];
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, p_metric->name, p_metric->type);
+    for (uint8_t i = 0; i < telemetry_sinks_len(); ++i) {
+        telemetry_sink_stats(i, &stats);
+        os_sprintf(labels, "sink=\"%s\"", telemetry_sink_name(i));
+        len += web_metrics_uint(buff + len, p_metric->name, labels, *(uint32_t*)((uint8_t*)&stats + p_metric->offset));
+    }
+
+    return len;
+}
+
+#ifdef UDP_SINK_ENABLE
+static size_t ICACHE_FLASH_ATTR
+metrics_udp_sink(char* buff, void* arg) {
+    const udp_sink_stats_t* p_stats = udp_sink_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "udp_sink_datagrams_total", "counter");
+    len += web_metrics_uint(buff + len, "udp_sink_datagrams_total", "result=\"ok\"", p_stats->datagrams);
+    len += web_metrics_uint(buff + len, "udp_sink_datagrams_total", "result=\"error\"", p_stats->errors);
+    len += web_metrics_type(buff + len, "udp_sink_dropped_lines_total", "counter");
+    len += web_metrics_uint(buff + len, "udp_sink_dropped_lines_total", NULL, p_stats->dropped);
+
+    return len;
+}
+#endif /* UDP_SINK_ENABLE */
+
+#ifdef MQTT_ENABLE
+static size_t ICACHE_FLASH_ATTR
+metrics_mqtt(char* buff, void* arg) {
+    const simple_mqtt_stats_t* p_stats = simple_mqtt_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "mqtt_connected", "gauge");
+    len += web_metrics_uint(buff + len, "mqtt_connected", NULL, simple_mqtt_state() == SIMPLE_MQTT_STATE_CONNECTED);
+    len += web_metrics_type(buff + len, "mqtt_connections_total", "counter");
+    len += web_metrics_uint(buff + len, "mqtt_connections_total", "result=\"ok\"", p_stats->connects);
+    len += web_metrics_uint(buff + len, "mqtt_connections_total", "result=\"error\"", p_stats->failures);
+
+    return len;
+}
+
+static size_t ICACHE_FLASH_ATTR
+metrics_mqtt_messages(char* buff, void* arg) {
+    const simple_mqtt_stats_t* p_stats = simple_mqtt_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "mqtt_messages_total", "counter");
+    len += web_metrics_uint(buff + len, "mqtt_messages_total", "state=\"published\"", p_stats->published);
+    len += web_metrics_uint(buff + len, "mqtt_messages_total", "state=\"acked\"", p_stats->acked);
+    len += web_metrics_uint(buff + len, "mqtt_messages_total", "state=\"resent\"", p_stats->resent);
+    len += web_metrics_uint(buff + len, "mqtt_messages_total", "state=\"dropped\"", p_stats->dropped);
+
+    return len;
+}
+#endif /* MQTT_ENABLE */
+
+static size_t ICACHE_FLASH_ATTR
+metrics_read_errors(char* buff, void* arg) {
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "sensor_read_errors_total", "counter");
+    for (uint8_t i = 0; i < I2C_BUS_DEV_MAX; ++i) {
+        len += web_metrics_uint(buff + len, "sensor_read_errors_total", bus_dev_labels[i], sensor_errors[i]);
+    }
+
+    return len;
+}
+
+static size_t ICACHE_FLASH_ATTR
+metrics_scd30(char* buff, void* arg) {
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "scd30_valid", "gauge");
+    len += web_metrics_uint(buff + len, "scd30_valid", NULL, scd30_data_valid);
+    len += web_metrics_type(buff + len, "scd30_co2_ppm", "gauge");
+    len += web_metrics_float(buff + len, "scd30_co2_ppm", NULL, *((real32_t*) &scd30_result.co2));
+    len += web_metrics_type(buff + len, "scd30_temperature_celsius", "gauge");
+    len += web_metrics_float(buff + len, "scd30_temperature_celsius", NULL, *((real32_t*) &scd30_result.temp));
+    len += web_metrics_type(buff + len, "scd30_humidity_percent", "gauge");
+    len += web_metrics_float(buff + len, "scd30_humidity_percent", NULL, *((real32_t*) &scd30_result.rh));
+
+    return len;
+}
+
+static size_t ICACHE_FLASH_ATTR
+metrics_ccs811(char* buff, void* arg) {
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "ccs811_valid", "gauge");
+    len += web_metrics_uint(buff + len, "ccs811_valid", NULL, ccs811_data_valid);
+    len += web_metrics_type(buff + len, "ccs811_eco2_ppm", "gauge");
+    len += web_metrics_uint(buff + len, "ccs811_eco2_ppm", NULL, ccs_data.eco2);
+    len += web_metrics_type(buff + len, "ccs811_tvoc_ppb", "gauge");
+    len += web_metrics_uint(buff + len, "ccs811_tvoc_ppb", NULL, ccs_data.tvoc);
+
+    return len;
+}
+
+static size_t ICACHE_FLASH_ATTR
+metrics_zmod_state(char* buff, void* arg) {
+    const uint8_t valid[LIVE_JSON_ZMOD_MAX] = {zmod4410_data_valid, zmod4410_data_valid_reset, zmod4410_data_valid_halt};
+    const uint8_t stab[LIVE_JSON_ZMOD_MAX]  = {zmod4410_stabilizing, zmod4410_stabilizing_reset, zmod4410_stabilizing_halt};
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "zmod_valid", "gauge");
+    for (uint8_t i = 0; i < LIVE_JSON_ZMOD_MAX; ++i) {
+        len += web_metrics_uint(buff + len, "zmod_valid", zmod_lane_labels[i], valid[i]);
+    }
+    len += web_metrics_type(buff + len, "zmod_stabilizing", "gauge");
+    for (uint8_t i = 0; i < LIVE_JSON_ZMOD_MAX; ++i) {
+        len += web_metrics_uint(buff + len, "zmod_stabilizing", zmod_lane_labels[i], stab[i]);
+    }
+
+    return len;
+}
+
+/* arg: zmod_metric_t, one family with all the lanes */
+static size_t ICACHE_FLASH_ATTR
+metrics_zmod_value(char* buff, void* arg) {
+    const iaq_1st_gen_results_t* results[LIVE_JSON_ZMOD_MAX] = {&iaq_results, &iaq_results_test_reset, &iaq_results_test_halt};
+    const zmod_metric_t* p_metric = (const zmod_metric_t*)arg;
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, p_metric->name, "gauge");
+    for (uint8_t i = 0; i < LIVE_JSON_ZMOD_MAX; ++i) {
+        len += web_metrics_float(buff + len, p_metric->name, zmod_lane_labels[i],
+                                 *(const float*)((const uint8_t*)results[i] + p_metric->offset));
+    }
+
+    return len;
+}
+
+static size_t ICACHE_FLASH_ATTR
+metrics_zmod_counters(char* buff, void* arg) {
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "zmod_reset_counter", "gauge");
+    len += web_metrics_uint(buff + len, "zmod_reset_counter", "state=\"on\"", zmod_reset_counter_on);
+    len += web_metrics_uint(buff + len, "zmod_reset_counter", "state=\"off\"", zmod_reset_counter_off);
+    len += web_metrics_type(buff + len, "zmod_halt_counter", "gauge");
+    len += web_metrics_uint(buff + len, "zmod_halt_counter", "state=\"on\"", zmod_halt_counter_on);
+    len += web_metrics_uint(buff + len, "zmod_halt_counter", "state=\"off\"", zmod_halt_counter_off);
+
+    return len;
+}
+
+static size_t ICACHE_FLASH_ATTR
+metrics_events(char* buff, void* arg) {
+    const web_events_stats_t* p_stats = web_events_get_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "sse_subscribers", "gauge");
+    len += web_metrics_uint(buff + len, "sse_subscribers", NULL, p_stats->subscribers);
+    len += web_metrics_type(buff + len, "sse_dropped_events_total", "counter");
+    len += web_metrics_uint(buff + len, "sse_dropped_events_total", NULL, p_stats->dropped);
+
+    return len;
+}
+
+static void ICACHE_FLASH_ATTR
+web_metrics_setup(void) {
+    web_metrics_init();
+
+#ifdef INFLUX_HTTP_ENABLE
+    web_metrics_register(metrics_uploads, NULL);
+    web_metrics_register(metrics_tls_handshake, NULL);
+#ifdef UPLOAD_SPREAD_ENABLE
+    web_metrics_register(metrics_upload_sched, NULL);
+#endif
+    for (uint8_t i = 0; i < sizeof(http_client_metrics) / sizeof(http_client_metrics[0]); ++i) {
+        web_metrics_register(metrics_http_client, (void*)&http_client_metrics[i]);
+    }
+#endif
+#if defined(INFLUX_HTTP_ENABLE) || defined(UDP_SINK_ENABLE)
+    web_metrics_register(metrics_upload_busy, NULL);
+#endif
+#ifdef UDP_SINK_ENABLE
+    web_metrics_register(metrics_udp_sink, NULL);
+#endif
+#if defined(GATEWAY_ENABLE) || defined(GATEWAY_PEER_ENABLE)
+    web_metrics_register(metrics_gateway, NULL);
+    web_metrics_register(metrics_gateway_lines, NULL);
+#endif
+#ifdef MQTT_ENABLE
+    web_metrics_register(metrics_mqtt, NULL);
+    web_metrics_register(metrics_mqtt_messages, NULL);
+#endif
+    for (uint8_t i = 0; i < sizeof(telemetry_metrics) / sizeof(telemetry_metrics[0]); ++i) {
+        web_metrics_register(metrics_telemetry, (void*)&telemetry_metrics[i]);
+    }
+    web_metrics_register(metrics_read_errors, NULL);
+    web_metrics_register(metrics_scd30, NULL);
+    web_metrics_register(metrics_ccs811, NULL);
+    web_metrics_register(metrics_zmod_state, NULL);
+    for (uint8_t i = 0; i < sizeof(zmod_metrics) / sizeof(zmod_metrics[0]); ++i) {
+        web_metrics_register(metrics_zmod_value, (void*)&zmod_metrics[i]);
+    }
+    web_metrics_register(metrics_zmod_counters, NULL);
+    web_metrics_register(metrics_events, NULL);
+}
+
+/* Sorted by path */
+static const simple_http_server_route_t web_routes[] = {
+    {"/", "GET", web_dashboard_view},
+#ifdef HISTORY_ENABLE
+    {"/api/v1/history", "GET", web_history_view},
+#endif
+    {"/api/v1/latest", "GET", web_view_latest},
+    {"/bus", "GET", web_view_bus},
+    {"/events", "GET", web_events_view},
+#ifdef I2C_TRACE_ENABLE
+    {"/i2c", "GET", web_view_i2c},
+#endif
+    {"/metrics", "GET", web_metrics_view},
+};
 #endif /* WEB_ENABLE */
 
 static size_t ICACHE_FLASH_ATTR
@@ -168,6 +615,58 @@ zmod_sprintf(char* name, iaq_1st_gen_results_t* zmod_results, size_t print_len,
     return int_print_len;
 }
 
+static void ICACHE_FLASH_ATTR
+count_read_error(i2c_bus_dev_t dev, sensor_status_t result) {
+    if (result != SENSOR_READ_VALID && result != SENSOR_NOT_READY && result != SENSOR_ZMOD_STABILIZATION) {
+        sensor_errors[dev] += 1;
+    }
+}
+
+#ifdef HISTORY_ENABLE
+static int32_t ICACHE_FLASH_ATTR
+history_centi(float value) {
+    return (int32_t)(value * 100.0f);
+}
+
+/* Current sample to the flash history, needs the SNTP time */
+static void ICACHE_FLASH_ATTR
+history_store(void) {
+    history_record_t record;
+
+    os_memset(&record, 0, sizeof(record));
+    record.ts = sntp_get_current_timestamp();
+    if (record.ts == 0) {
+        return;
+    }
+
+    if (scd30_data_valid) {
+        record.scd30_co2  = (uint16_t)*((real32_t*) &scd30_result.co2);
+        record.scd30_temp = (int16_t)history_centi(*((real32_t*) &scd30_result.temp));
+        record.scd30_rh   = (uint16_t)history_centi(*((real32_t*) &scd30_result.rh));
+        record.valid     |= HISTORY_VALID_SCD30;
+    }
+
+    if (ccs811_data_valid) {
+        record.ccs811_eco2 = ccs_data.eco2;
+        record.ccs811_tvoc = ccs_data.tvoc;
+        record.valid      |= HISTORY_VALID_CCS811;
+    }
+
+    if (zmod4410_data_valid) {
+        record.zmod_eco2 = (uint16_t)iaq_results.eco2;
+        record.zmod_iaq  = (uint16_t)history_centi(iaq_results.iaq);
+        record.zmod_tvoc = (uint16_t)history_centi(iaq_results.tvoc);
+        record.valid    |= HISTORY_VALID_ZMOD;
+    }
+
+    if (record.valid && history_append(&record) != STA_OK) {
+#ifdef DEBUG_PRINT_MODE
+        os_printf("history: append failed\n");
+#endif
+    }
+}
+#endif /* HISTORY_ENABLE */
+
 static void ICACHE_FLASH_ATTR
 timer_send_data(void* args) {
     char* http_data_buff = (char*)os_malloc(sizeof(char) * (F2C_CHAR_BUFF_SIZE * 25 + 55*4));
@@ -180,8 +679,11 @@ timer_send_data(void* args) {
     size_t print_len = 0;
 
     uint8_t send_en = 0;
+    uint8_t ccs811_send;
 
-    simple_http_status_t http_status;
+#ifdef HISTORY_ENABLE
+    history_store();
+#endif
 
     if (value_temp == NULL || http_data_buff == NULL) {
         return;
@@ -224,7 +726,13 @@ timer_send_data(void* args) {
         print_len += os_sprintf(http_data_buff + print_len, "\n");
     }
 
-    if (ccs811_data_valid) {
+    ccs811_send = ccs811_data_valid;
+#ifdef CCS811_THRESH_ENABLE
+    /* Each sample is uploaded once, the next one comes with a band change or the heartbeat */
+    ccs811_send = ccs811_send && !ccs811_uploaded;
+#endif
+
+    if (ccs811_send) {
         ccs_eco2  = ccs_data.eco2;
         ccs_tvocs = ccs_data.tvoc;
         ccs_raw   = ccs_data.raw_data;
@@ -236,12 +744,15 @@ timer_send_data(void* args) {
         print_len += os_sprintf(http_data_buff + print_len, "current=%u,", CCS811_RAW_DATA_CURRENT(ccs_raw));
         print_len += os_sprintf(http_data_buff + print_len, "adc=%u", CCS811_RAW_DATA_ADC(ccs_raw));
         print_len += os_sprintf(http_data_buff + print_len, "\n");
+
+#ifdef CCS811_THRESH_ENABLE
+        ccs811_uploaded = 1;
+#endif
     }
 
     // os_printf("Free dyn mem = %lu\n", system_get_free_heap_size());
     if (send_en) {
-        http_status = simple_http_request(INFLUX_URL, http_data_buff, INFLUX_AUTH_HEADER"\r\n", "POST", NULL);
-        os_printf("Sending:\n%s\nResult = %d\n\n", http_data_buff, http_status);
+        telemetry_publish(http_data_buff, print_len, sntp_get_current_timestamp());
 
         os_delay_us(2000);
         system_soft_wdt_feed();
@@ -250,7 +761,11 @@ timer_send_data(void* args) {
     os_free(http_data_buff);
     os_free(value_temp);
 
+#ifdef UPLOAD_SPREAD_ENABLE
+    os_timer_arm((os_timer_t*)&timer_logger, upload_sched_next(), 0);
+#else
     os_timer_arm((os_timer_t*)&timer_logger, SERVER_WRITE_INTERVAL, 0);
+#endif
 }
 
 #ifdef PRINT_ON_MEASURE_ENABLE
@@ -333,14 +848,24 @@ timer_func_blink(void* args) {
     // GPIO2_IN ? GPIO2_L : GPIO2_H;
 }
 
-void ICACHE_FLASH_ATTR
-timer_func_scd30(void* args) {
+static void ICACHE_FLASH_ATTR
+bus_job_scd30(void* args) {
     sensor_status_t result;
 
     system_soft_wdt_feed();
 
     scd30_data_valid = 0;
+#ifdef SENSOR_IRQ_ENABLE
+    /* RDY is high, skip the data ready status transaction */
+    if (args == SCD30_JOB_RDY) {
+        result = read_scd30_data(&scd30_result);
+    } else {
+        result = read_scd30(&scd30_result);
+    }
+#else
     result = read_scd30(&scd30_result);
+#endif
+    count_read_error(I2C_BUS_DEV_SCD30, result);
 
     if (result == SENSOR_READ_VALID) {
 #ifdef PRINT_ON_MEASURE_ENABLE
@@ -348,18 +873,29 @@ timer_func_scd30(void* args) {
 #endif
         scd30_data_valid = 1;
     }
+
+#ifdef WEB_ENABLE
+    live_json_update_scd30(scd30_data_valid, &scd30_result);
+    live_json_commit();
+    web_publish("scd30", LIVE_JSON_SECTION_SCD30, scd30_data_valid);
+#endif
+
+#ifdef SENSOR_IRQ_ENABLE
+    sensor_irq_done(SENSOR_IRQ_SCD30, result == SENSOR_READ_VALID);
+#endif
 }
 
-void ICACHE_FLASH_ATTR
-timer_func_zmod(void* args) {
+static void ICACHE_FLASH_ATTR
+bus_job_zmod(void* args) {
     sensor_status_t result;
 
-    os_timer_disarm((os_timer_t*)&timer_zmod);
     system_soft_wdt_feed();
 
     // LP continuous mode
     zmod4410_data_valid = 0;
     result = read_zmod(&zmod_dev, &iaq_handle, &iaq_results, zmod_adc_result);
+    count_read_error(I2C_BUS_DEV_ZMOD, result);
+    zmod4410_stabilizing = result == SENSOR_ZMOD_STABILIZATION;
 
     if (result == SENSOR_READ_VALID) {
 #ifdef PRINT_ON_MEASURE_ENABLE
@@ -377,6 +913,11 @@ timer_func_zmod(void* args) {
 #endif
     }
 
+#ifdef WEB_ENABLE
+    live_json_update_zmod(LIVE_JSON_ZMOD, zmod4410_data_valid, &iaq_results);
+    web_publish("zmod", LIVE_JSON_SECTION_ZMOD, zmod4410_data_valid);
+#endif
+
     // LP mode with halt and reset
     zmod4410_data_valid_reset = 0;
     if (zmod_reset_counter_on >= ZMOD_TEST_RESET_COUNT_ON) {
@@ -397,6 +938,7 @@ timer_func_zmod(void* args) {
 
     } else {
         result = calc_zmod_result(&zmod_dev, &iaq_handle_test_reset, &iaq_results_test_reset, zmod_adc_result);
+        zmod4410_stabilizing_reset = result == SENSOR_ZMOD_STABILIZATION;
 
         if (result == SENSOR_READ_VALID) {
 #ifdef PRINT_ON_MEASURE_ENABLE
@@ -432,6 +974,7 @@ timer_func_zmod(void* args) {
 
     } else {
         result = calc_zmod_result(&zmod_dev, &iaq_handle_test_halt, &iaq_results_test_halt, zmod_adc_result);
+        zmod4410_stabilizing_halt = result == SENSOR_ZMOD_STABILIZATION;
 
         if (result == SENSOR_READ_VALID) {
 #ifdef PRINT_ON_MEASURE_ENABLE
@@ -451,23 +994,56 @@ timer_func_zmod(void* args) {
         }
     }
 
+#ifdef WEB_ENABLE
+    live_json_update_zmod(LIVE_JSON_ZMOD_RESET, zmod4410_data_valid_reset, &iaq_results_test_reset);
+    live_json_update_zmod(LIVE_JSON_ZMOD_HALT, zmod4410_data_valid_halt, &iaq_results_test_halt);
+    live_json_commit();                         /* One document for the three lanes */
+    web_publish("zmod_reset", LIVE_JSON_SECTION_ZMOD_RESET, zmod4410_data_valid_reset);
+    web_publish("zmod_halt", LIVE_JSON_SECTION_ZMOD_HALT, zmod4410_data_valid_halt);
+#endif
+
     os_timer_arm((os_timer_t*)&timer_zmod, ZMOD_READ_INTERVAL, 0);
 }
 
-void ICACHE_FLASH_ATTR
-timer_func_ccs(void* args) {
+#ifdef CCS811_THRESH_ENABLE
+static uint8_t ICACHE_FLASH_ATTR
+ccs811_eco2_band(uint16_t eco2) {
+    if (eco2 < CCS811_THRESH_LOW_MEDIUM) {
+        return 0;
+    } else if (eco2 < CCS811_THRESH_MEDIUM_HIGH) {
+        return 1;
+    }
+
+    return 2;
+}
+#endif /* CCS811_THRESH_ENABLE */
+
+static void ICACHE_FLASH_ATTR
+bus_job_ccs(void* args) {
     sensor_status_t result;
 
-    os_timer_disarm((os_timer_t*)&timer_ccs);
     system_soft_wdt_feed();
 
     ccs811_data_valid = 0;
     result = read_ccs811(&ccs_dev, &ccs_data);
+    count_read_error(I2C_BUS_DEV_CCS811, result);
 
     if (result == SENSOR_READ_VALID) {
 #ifdef PRINT_ON_MEASURE_ENABLE
         print_ccs_results();
 #endif
+#ifdef CCS811_THRESH_ENABLE
+        uint8_t band = ccs811_eco2_band(ccs_data.eco2);
+#ifdef PRINT_ON_MEASURE_ENABLE
+        if (band != ccs811_band) {
+            os_printf("CCS811 eCO2 band %u -> %u\n", ccs811_band, band);
+        } else {
+            os_printf("CCS811 heartbeat\n");
+        }
+#endif
+        ccs811_band = band;
+        ccs811_uploaded = 0;
+#endif /* CCS811_THRESH_ENABLE */
         ccs811_data_valid = 1;
     } else if (result == SENSOR_NOT_READY) {
 #ifdef PRINT_ON_MEASURE_ENABLE
@@ -479,8 +1055,56 @@ timer_func_ccs(void* args) {
 #endif
     }
 
-    os_timer_arm((os_timer_t*)&timer_ccs, CCS_READ_INTERVAL, 0);
+#ifdef WEB_ENABLE
+    live_json_update_ccs811(ccs811_data_valid, &ccs_data);
+    live_json_commit();
+    web_publish("ccs811", LIVE_JSON_SECTION_CCS811, ccs811_data_valid);
+#endif
+
+#ifdef SENSOR_IRQ_ENABLE
+    sensor_irq_done(SENSOR_IRQ_CCS811, result == SENSOR_READ_VALID);
+#endif
+
+    os_timer_disarm((os_timer_t*)&timer_ccs);
+    os_timer_arm((os_timer_t*)&timer_ccs, CCS_POLL_INTERVAL, 0);
+}
+
+/* The sensor timers only queue the bus jobs. ZMOD LP sequence is timing-sensitive, so it goes first */
+void ICACHE_FLASH_ATTR
+timer_func_scd30(void* args) {
+    i2c_bus_submit(I2C_BUS_DEV_SCD30, I2C_BUS_PRIO_LOW, bus_job_scd30, NULL);
+}
+
+void ICACHE_FLASH_ATTR
+timer_func_zmod(void* args) {
+    os_timer_disarm((os_timer_t*)&timer_zmod);
+
+    if (i2c_bus_submit(I2C_BUS_DEV_ZMOD, I2C_BUS_PRIO_HIGH, bus_job_zmod, NULL) != STA_OK) {
+        os_timer_arm((os_timer_t*)&timer_zmod, ZMOD_READ_INTERVAL, 0);
+    }
+}
+
+void ICACHE_FLASH_ATTR
+timer_func_ccs(void* args) {
+    os_timer_disarm((os_timer_t*)&timer_ccs);
+
+    if (i2c_bus_submit(I2C_BUS_DEV_CCS811, I2C_BUS_PRIO_MEDIUM, bus_job_ccs, NULL) != STA_OK) {
+        os_timer_arm((os_timer_t*)&timer_ccs, CCS_POLL_INTERVAL, 0);
+    }
+}
+
+#ifdef SENSOR_IRQ_ENABLE
+/* A failed submit means a job of the device is already queued, it re-arms the line when done */
+static void ICACHE_FLASH_ATTR
+irq_func_scd30(void) {
+    i2c_bus_submit(I2C_BUS_DEV_SCD30, I2C_BUS_PRIO_LOW, bus_job_scd30, SCD30_JOB_RDY);
+}
+
+static void ICACHE_FLASH_ATTR
+irq_func_ccs(void) {
+    i2c_bus_submit(I2C_BUS_DEV_CCS811, I2C_BUS_PRIO_MEDIUM, bus_job_ccs, NULL);
 }
+#endif /* SENSOR_IRQ_ENABLE */
 
 void ICACHE_FLASH_ATTR
 user_pre_init() {}
@@ -498,6 +1122,9 @@ user_init() {
     status = uc_init_gpio();
     status = uc_init_i2c();
     status = uc_init_sntp();
+
+    /* Sensor init talks to the bus outside of a job, keep the scheduler off it */
+    i2c_bus_acquire();
     status = uc_init_sensors(&zmod_dev, &iaq_handle, &ccs_dev);
     status = uc_init_zmod_test(&zmod_dev, &iaq_handle_test_reset);
     status = uc_init_zmod_test(&zmod_dev, &iaq_handle_test_halt);
@@ -519,6 +1146,7 @@ user_init() {
         zmod_halt_counter_on   = 0;
         zmod_halt_counter_off  = 0;
         read_zmod(&zmod_dev, &iaq_handle, &iaq_results, zmod_adc_result);
+        i2c_bus_release();
 
         // Timers
         os_timer_setfn((os_timer_t*)&timer_blink, (os_timer_func_t *)timer_func_blink, NULL);
@@ -529,19 +1157,39 @@ user_init() {
 #endif /* STATUS_LED_ENABLE */
 
         os_timer_setfn((os_timer_t*)&timer_scd30, (os_timer_func_t *)timer_func_scd30, NULL);
-        os_timer_arm((os_timer_t*)&timer_scd30, SCD30_READ_INTERVAL, 1);
+        os_timer_arm((os_timer_t*)&timer_scd30, SCD30_POLL_INTERVAL, 1);
 
         os_timer_setfn((os_timer_t*)&timer_zmod, (os_timer_func_t *)timer_func_zmod, NULL);
         os_timer_arm((os_timer_t*)&timer_zmod, ZMOD_READ_INTERVAL, 0);
 
         os_timer_setfn((os_timer_t*)&timer_ccs, (os_timer_func_t *)timer_func_ccs, NULL);
-        os_timer_arm((os_timer_t*)&timer_ccs, CCS_READ_INTERVAL, 0);
+        os_timer_arm((os_timer_t*)&timer_ccs, CCS_POLL_INTERVAL, 0);
+
+#ifdef SENSOR_IRQ_ENABLE
+        sensor_irq_init(irq_func_scd30, irq_func_ccs);
+        sensor_irq_arm(SENSOR_IRQ_SCD30);
+        sensor_irq_arm(SENSOR_IRQ_CCS811);
+#endif
+
+#ifdef HISTORY_ENABLE
+        history_init();
+#endif
+
+        telemetry_sinks_init();
 
         os_timer_setfn((os_timer_t*)&timer_logger, (os_timer_func_t *)timer_send_data, NULL);
+#ifdef UPLOAD_SPREAD_ENABLE
+        upload_sched_init();
+        os_timer_arm((os_timer_t*)&timer_logger, upload_sched_first(), 0);
+#else
         os_timer_arm((os_timer_t*)&timer_logger, SERVER_WRITE_INTERVAL, 0);
+#endif
 
 #ifdef WEB_ENABLE
-        create_basic_http_server(&web_conn, 80, web_view);
+        live_json_init();
+        web_events_init();
+        web_metrics_setup();
+        create_http_server(&web_conn, 80, web_routes, sizeof(web_routes) / sizeof(web_routes[0]), NULL);
 #endif
     }
 }
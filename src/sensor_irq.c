@@ -0,0 +1,185 @@
+/**
+ * \file sensor_irq.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Sensor data ready interrupts. Source file.
+ * \version 0.1
+ * \date 2021-04-08
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <ets_sys.h>
+#include <gpio.h>
+#include <user_interface.h>
+
+#include "sensor_irq.h"
+#include "user_config.h"
+
+#ifdef SERIAL_CMD_ENABLE
+#include "serial_cmd.h"
+#endif
+
+typedef struct {
+    uint32_t      mux;
+    uint8_t       gpio;
+    uint8_t       func;
+    uint8_t       active;                       /*!< Line level when data is ready */
+    uint8_t       pullup;
+    GPIO_INT_TYPE edge;
+    uint32_t      backoff_ms;                   /*!< Re-arm delay after a failed read with the line active */
+} sensor_irq_pin_t;
+
+/* Backoff: the polling period the interrupts replaced */
+static const sensor_irq_pin_t pins[SENSOR_IRQ_MAX] = {
+    {SENSOR_IRQ_SCD30_MUX,  SENSOR_IRQ_SCD30_GPIO,  SENSOR_IRQ_SCD30_FUNC,  1, 0, GPIO_PIN_INTR_POSEDGE, SCD30_READ_INTERVAL},
+    {SENSOR_IRQ_CCS811_MUX, SENSOR_IRQ_CCS811_GPIO, SENSOR_IRQ_CCS811_FUNC, 0, 1, GPIO_PIN_INTR_NEGEDGE, CCS_READ_INTERVAL},
+};
+
+static sensor_irq_cb_t callbacks[SENSOR_IRQ_MAX];
+static os_timer_t timers[SENSOR_IRQ_MAX];
+static os_timer_t backoff_timers[SENSOR_IRQ_MAX];
+static sensor_irq_stats_t stats[SENSOR_IRQ_MAX];
+
+static void ICACHE_FLASH_ATTR
+sensor_irq_dispatch(void* arg) {
+    sensor_irq_src_t src = (const sensor_irq_pin_t*)arg - pins;
+
+    if (callbacks[src] != NULL) {
+        callbacks[src]();
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+sensor_irq_backoff_end(void* arg) {
+    sensor_irq_arm((const sensor_irq_pin_t*)arg - pins);
+}
+
+/* Called with the GPIO interrupt masked or from the ISR */
+static void
+sensor_irq_fire(sensor_irq_src_t src) {
+    gpio_pin_intr_state_set(GPIO_ID_PIN(pins[src].gpio), GPIO_PIN_INTR_DISABLE);
+    GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, BIT(pins[src].gpio));
+
+    os_timer_disarm(&timers[src]);
+    os_timer_arm(&timers[src], 0, 0);
+}
+
+static void
+sensor_irq_handler(void* arg) {
+    uint32 gpio_status = GPIO_REG_READ(GPIO_STATUS_ADDRESS);
+
+    for (uint8_t i = 0; i < SENSOR_IRQ_MAX; ++i) {
+        if (gpio_status & BIT(pins[i].gpio)) {
+            stats[i].irqs += 1;
+            sensor_irq_fire(i);
+        }
+    }
+
+    /* Clear anything else, nothing more is attached to the GPIO interrupt */
+    GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, gpio_status);
+}
+
+void ICACHE_FLASH_ATTR
+sensor_irq_arm(sensor_irq_src_t src) {
+    const sensor_irq_pin_t* p_pin;
+
+    if (src >= SENSOR_IRQ_MAX) {
+        return;
+    }
+    p_pin = &pins[src];
+
+    ETS_GPIO_INTR_DISABLE();
+
+    GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, BIT(p_pin->gpio));
+    gpio_pin_intr_state_set(GPIO_ID_PIN(p_pin->gpio), p_pin->edge);
+
+    /* Edge happened while disarmed (e.g. during the read), no new one will come */
+    if (GPIO_INPUT_GET(GPIO_ID_PIN(p_pin->gpio)) == p_pin->active) {
+        stats[src].rearm_active += 1;
+        sensor_irq_fire(src);
+    }
+
+    ETS_GPIO_INTR_ENABLE();
+}
+
+void ICACHE_FLASH_ATTR
+sensor_irq_done(sensor_irq_src_t src, uint8_t data_ready) {
+    if (src >= SENSOR_IRQ_MAX) {
+        return;
+    }
+
+    stats[src].reads += 1;
+    if (!data_ready) {
+        stats[src].not_ready += 1;
+
+        /* Still active without data: the sensor is stuck or in error, do not read it back to back */
+        if (GPIO_INPUT_GET(GPIO_ID_PIN(pins[src].gpio)) == pins[src].active) {
+            stats[src].backoffs += 1;
+            os_timer_disarm(&backoff_timers[src]);
+            os_timer_arm(&backoff_timers[src], pins[src].backoff_ms, 0);
+            return;
+        }
+    }
+
+    sensor_irq_arm(src);
+}
+
+const sensor_irq_stats_t* ICACHE_FLASH_ATTR
+sensor_irq_get_stats(sensor_irq_src_t src) {
+    if (src >= SENSOR_IRQ_MAX) {
+        return NULL;
+    }
+
+    return &stats[src];
+}
+
+#ifdef SERIAL_CMD_ENABLE
+static const char* const src_names[SENSOR_IRQ_MAX] = {
+    "scd30",
+    "ccs811",
+};
+
+static void ICACHE_FLASH_ATTR
+sensor_irq_cmd(const char* args) {
+    os_printf("# src irqs rearm_active reads not_ready backoffs\n");
+    for (uint8_t i = 0; i < SENSOR_IRQ_MAX; ++i) {
+        os_printf("%s %u %u %u %u %u\n", src_names[i],
+                  stats[i].irqs, stats[i].rearm_active, stats[i].reads, stats[i].not_ready, stats[i].backoffs);
+    }
+}
+#endif /* SERIAL_CMD_ENABLE */
+
+status_t ICACHE_FLASH_ATTR
+sensor_irq_init(sensor_irq_cb_t scd30_cb, sensor_irq_cb_t ccs811_cb) {
+    callbacks[SENSOR_IRQ_SCD30]  = scd30_cb;
+    callbacks[SENSOR_IRQ_CCS811] = ccs811_cb;
+
+    ETS_GPIO_INTR_ATTACH(sensor_irq_handler, NULL);
+    ETS_GPIO_INTR_DISABLE();
+
+    for (uint8_t i = 0; i < SENSOR_IRQ_MAX; ++i) {
+        PIN_FUNC_SELECT(pins[i].mux, pins[i].func);
+        if (pins[i].pullup) {
+            PIN_PULLUP_EN(pins[i].mux);
+        }
+
+        gpio_output_set(0, 0, 0, GPIO_ID_PIN(pins[i].gpio));
+        gpio_register_set(GPIO_PIN_ADDR(pins[i].gpio), GPIO_PIN_INT_TYPE_SET(GPIO_PIN_INTR_DISABLE)
+                          | GPIO_PIN_PAD_DRIVER_SET(GPIO_PAD_DRIVER_DISABLE)
+                          | GPIO_PIN_SOURCE_SET(GPIO_AS_PIN_SOURCE));
+        GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, BIT(pins[i].gpio));
+
+        os_timer_disarm(&timers[i]);
+        os_timer_setfn(&timers[i], (os_timer_func_t *)sensor_irq_dispatch, (void*)&pins[i]);
+        os_timer_disarm(&backoff_timers[i]);
+        os_timer_setfn(&backoff_timers[i], (os_timer_func_t *)sensor_irq_backoff_end, (void*)&pins[i]);
+    }
+
+    ETS_GPIO_INTR_ENABLE();
+
+#ifdef SERIAL_CMD_ENABLE
+    serial_cmd_register("irq", sensor_irq_cmd);
+#endif
+
+    return STA_OK;
+}
@@ -22,27 +22,33 @@
 
 sensor_status_t ICACHE_FLASH_ATTR
 read_scd30(scd30_result_t* p_result) {
-    uint32_t co2, temp, rh;
-    uint8_t status;
     uint8_t rdy = 0;
 
     scd30_check_data_ready(&rdy);
     if (rdy) {
-        status = scd30_read_measurement(&co2, &temp, &rh);
-        if (status != 1) {
-            return SENSOR_READ_ERROR;
-        }
-
-        p_result->rh   = rh;
-        p_result->co2  = co2;
-        p_result->temp = temp;
-
-        return SENSOR_READ_VALID;
+        return read_scd30_data(p_result);
     } else {
         return SENSOR_NOT_READY; 
     }
 }
 
+sensor_status_t ICACHE_FLASH_ATTR
+read_scd30_data(scd30_result_t* p_result) {
+    uint32_t co2, temp, rh;
+    uint8_t status;
+
+    status = scd30_read_measurement(&co2, &temp, &rh);
+    if (status != 1) {
+        return SENSOR_READ_ERROR;
+    }
+
+    p_result->rh   = rh;
+    p_result->co2  = co2;
+    p_result->temp = temp;
+
+    return SENSOR_READ_VALID;
+}
+
 sensor_status_t ICACHE_FLASH_ATTR
 calc_zmod_result(zmod4xxx_dev_t* p_zmod_dev, iaq_1st_gen_handle_t* p_iaq_handle, iaq_1st_gen_results_t* p_iaq_results, uint8_t* adc_result) {
     int8_t zmod_result;
@@ -0,0 +1,101 @@
+/**
+ * \file serial_cmd.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Minimal line based command console over UART0. Source file.
+ * \version 0.1
+ * \date 2021-04-02
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+
+#include "serial_cmd.h"
+#include "driver/uart.h"
+
+
+typedef struct {
+    const char* name;
+    serial_cmd_handler_t handler;
+} serial_cmd_t;
+
+static serial_cmd_t cmds[SERIAL_CMD_MAX_CMDS];
+static uint8_t cmds_len;
+
+static char line_buff[SERIAL_CMD_LINE_SIZE];
+static uint8_t line_len;
+
+static void ICACHE_FLASH_ATTR
+print_help(const char* args) {
+    os_printf("Commands:\n");
+    for (uint8_t i = 0; i < cmds_len; ++i) {
+        os_printf("\t%s\n", cmds[i].name);
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+dispatch_line(char* line) {
+    char* args;
+    size_t name_len;
+
+    args = os_strchr(line, ' ');
+    if (args == NULL) {
+        name_len = os_strlen(line);
+        args = line + name_len;
+    } else {
+        name_len = args - line;
+        *args++ = '\0';
+    }
+
+    if (name_len == 0) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < cmds_len; ++i) {
+        if (os_strcmp(cmds[i].name, line) == 0) {
+            cmds[i].handler(args);
+            return;
+        }
+    }
+
+    os_printf("Unknown command '%s'. Type 'help'\n", line);
+}
+
+static void ICACHE_FLASH_ATTR
+serial_cmd_rx(uint8 rx_char) {
+    if (rx_char == '\r' || rx_char == '\n') {
+        line_buff[line_len] = '\0';
+        line_len = 0;
+        dispatch_line(line_buff);
+    } else if (line_len < SERIAL_CMD_LINE_SIZE - 1) {
+        line_buff[line_len++] = rx_char;
+    }
+}
+
+status_t ICACHE_FLASH_ATTR
+serial_cmd_register(const char* name, serial_cmd_handler_t handler) {
+    if (name == NULL || handler == NULL) {
+        return STA_ERR;
+    }
+
+    /* The callers do not check, say it on the console that would miss the command */
+    if (cmds_len >= SERIAL_CMD_MAX_CMDS) {
+        os_printf("serial_cmd: no room for '%s', raise SERIAL_CMD_MAX_CMDS\n", name);
+        return STA_ERR;
+    }
+
+    cmds[cmds_len].name    = name;
+    cmds[cmds_len].handler = handler;
+    cmds_len += 1;
+
+    return STA_OK;
+}
+
+status_t ICACHE_FLASH_ATTR
+serial_cmd_init(void) {
+    line_len = 0;
+    cmds_len = 0;
+
+    uart_rx_callback_set(serial_cmd_rx);
+
+    return serial_cmd_register("help", print_help);
+}
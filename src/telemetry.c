@@ -0,0 +1,209 @@
+/**
+ * \file telemetry.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Sample fan-out to the upload sinks. Source file.
+ * \version 0.1
+ * \date 2021-04-19
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <user_interface.h>
+
+#include "telemetry.h"
+
+#ifdef SERIAL_CMD_ENABLE
+#include "serial_cmd.h"
+#endif
+
+#define TELEMETRY_RING_MASK (TELEMETRY_RING_LEN - 1)
+#define TS_LEN_MAX          11                  /* " 4294967295" */
+
+typedef struct {
+    uint32_t next;                              /* Next sample to hand over, sequence number */
+    uint32_t sent;
+    uint32_t dropped;
+    uint32_t busy;
+} sink_state_t;
+
+static telemetry_sample_t ring[TELEMETRY_RING_LEN];
+static uint32_t ring_head;                      /* Sequence number of the next sample */
+
+static const telemetry_sink_t* sinks;
+static uint8_t sinks_len;
+static sink_state_t sink_state[TELEMETRY_MAX_SINKS];
+
+static os_timer_t timer_retry;
+
+static uint32_t ICACHE_FLASH_ATTR
+sink_depth(uint8_t sink) {
+    uint32_t depth = sinks[sink].depth;
+
+    return depth == 0 || depth > TELEMETRY_RING_LEN ? TELEMETRY_RING_LEN : depth;
+}
+
+/* Hand the queued samples over until the sink refuses one */
+static void ICACHE_FLASH_ATTR
+sink_pump(uint8_t sink) {
+    sink_state_t* p_state = &sink_state[sink];
+    uint32_t depth = sink_depth(sink);
+
+    if (ring_head - p_state->next > depth) {
+        p_state->dropped += ring_head - p_state->next - depth;
+        p_state->next = ring_head - depth;
+    }
+
+    while (p_state->next != ring_head) {
+        if (!sinks[sink].enqueue(&ring[p_state->next & TELEMETRY_RING_MASK])) {
+            p_state->busy += 1;
+            break;
+        }
+        p_state->next += 1;
+        p_state->sent += 1;
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+telemetry_retry(void* arg) {
+    for (uint8_t i = 0; i < sinks_len; ++i) {
+        if (sink_state[i].next != ring_head) {
+            sink_pump(i);
+        }
+    }
+}
+
+#ifdef SERIAL_CMD_ENABLE
+static void ICACHE_FLASH_ATTR
+telemetry_cmd(const char* args) {
+    telemetry_stats_t stats;
+
+    if (os_strcmp(args, "flush") == 0) {
+        telemetry_flush();
+    }
+
+    os_printf("telemetry: %u samples\n", ring_head);
+    for (uint8_t i = 0; i < sinks_len; ++i) {
+        telemetry_sink_stats(i, &stats);
+        os_printf("  %-6s queued %u/%u sent %u dropped %u busy %u\n",
+                  sinks[i].name, stats.queued, sink_depth(i), stats.sent, stats.dropped, stats.busy);
+    }
+}
+#endif /* SERIAL_CMD_ENABLE */
+
+status_t ICACHE_FLASH_ATTR
+telemetry_init(const telemetry_sink_t* p_sinks, uint8_t len) {
+    status_t status = STA_OK;
+
+#ifdef SERIAL_CMD_ENABLE
+    serial_cmd_register("tele", telemetry_cmd);
+#endif
+
+    sinks = p_sinks;
+    sinks_len = len > TELEMETRY_MAX_SINKS ? TELEMETRY_MAX_SINKS : len;
+    ring_head = 0;
+
+    for (uint8_t i = 0; i < sinks_len; ++i) {
+        os_memset(&sink_state[i], 0, sizeof(sink_state_t));
+
+        if (sinks[i].init != NULL && sinks[i].init() != STA_OK) {
+#ifdef DEBUG_PRINT_MODE
+            os_printf("telemetry: %s sink init failed\n", sinks[i].name);
+#endif
+            status = STA_ERR;
+        }
+    }
+
+    os_timer_disarm(&timer_retry);
+    os_timer_setfn(&timer_retry, (os_timer_func_t *)telemetry_retry, NULL);
+    os_timer_arm(&timer_retry, TELEMETRY_RETRY_INTERVAL, 1);
+
+    return status;
+}
+
+status_t ICACHE_FLASH_ATTR
+telemetry_publish(const char* lines, size_t len, uint32_t ts) {
+    telemetry_sample_t* p_sample = &ring[ring_head & TELEMETRY_RING_MASK];
+    const char* p_end = lines + len;
+    const char* p_eol;
+    size_t line_len;
+
+    p_sample->seq   = ring_head;
+    p_sample->ts    = ts;
+    p_sample->len   = 0;
+    p_sample->lines = 0;
+
+    for (; lines < p_end; lines = p_eol + 1) {
+        for (p_eol = lines; p_eol < p_end && *p_eol != '\n'; ++p_eol);
+
+        line_len = p_eol - lines;
+        if (line_len == 0) {
+            continue;
+        }
+        /* Whole lines only */
+        if (p_sample->len + line_len + TS_LEN_MAX + 2 > TELEMETRY_SAMPLE_SIZE) {
+            break;
+        }
+
+        os_memcpy(p_sample->text + p_sample->len, lines, line_len);
+        p_sample->len += line_len;
+        if (ts) {
+            p_sample->len += os_sprintf(p_sample->text + p_sample->len, " %u", ts);
+        }
+        p_sample->text[p_sample->len++] = '\n';
+        p_sample->lines += 1;
+    }
+    p_sample->text[p_sample->len] = '\0';
+
+    if (p_sample->lines == 0) {
+        return STA_ERR;
+    }
+
+    ring_head += 1;
+    for (uint8_t i = 0; i < sinks_len; ++i) {
+        sink_pump(i);
+    }
+
+    return STA_OK;
+}
+
+void ICACHE_FLASH_ATTR
+telemetry_flush(void) {
+    telemetry_retry(NULL);
+
+    for (uint8_t i = 0; i < sinks_len; ++i) {
+        if (sinks[i].flush != NULL) {
+            sinks[i].flush();
+        }
+    }
+}
+
+uint8_t ICACHE_FLASH_ATTR
+telemetry_sinks_len(void) {
+    return sinks_len;
+}
+
+const char* ICACHE_FLASH_ATTR
+telemetry_sink_name(uint8_t sink) {
+    return sink < sinks_len ? sinks[sink].name : NULL;
+}
+
+void ICACHE_FLASH_ATTR
+telemetry_sink_stats(uint8_t sink, telemetry_stats_t* p_stats) {
+    uint32_t queued;
+
+    if (sink >= sinks_len) {
+        os_memset(p_stats, 0, sizeof(telemetry_stats_t));
+        return;
+    }
+
+    /* Not pumped yet after the last publish */
+    queued = ring_head - sink_state[sink].next;
+    if (queued > sink_depth(sink)) {
+        queued = sink_depth(sink);
+    }
+
+    p_stats->queued  = queued;
+    p_stats->sent    = sink_state[sink].sent;
+    p_stats->dropped = sink_state[sink].dropped;
+    p_stats->busy    = sink_state[sink].busy;
+}
@@ -0,0 +1,228 @@
+/**
+ * \file telemetry_sinks.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief HTTP (InfluxDB), UDP, MQTT and serial telemetry sinks. Source file.
+ * \version 0.1
+ * \date 2021-04-19
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <user_interface.h>
+
+#include "telemetry_sinks.h"
+#include "telemetry.h"
+#include "udp_sink.h"
+#include "upload_sched.h"
+#include "gateway.h"
+
+#include "simple_http/simple_http.h"
+#include "simple_mqtt/simple_mqtt.h"
+
+#if !defined(INFLUX_HTTP_ENABLE) && !defined(UDP_SINK_ENABLE) && !defined(MQTT_ENABLE) && !defined(TELEMETRY_SERIAL_ENABLE) && \
+    !defined(GATEWAY_ENABLE) && !defined(GATEWAY_PEER_ENABLE)
+#error "No telemetry sink enabled"
+#endif
+
+#if defined(INFLUX_HTTP_ENABLE) && (defined(GATEWAY_ENABLE) || defined(GATEWAY_PEER_ENABLE))
+#error "The gateway uploads for the room, disable INFLUX_HTTP_ENABLE"
+#endif
+
+static telemetry_http_stats_t http_stats;
+
+#ifdef INFLUX_HTTP_ENABLE
+static uint32_t http_start_us;
+static uint8_t http_in_flight;
+static uint32_t http_seq;                       /* Sample of the last POST */
+static uint8_t http_acked;                      /* `http_seq` got a 2xx, take it on the next enqueue */
+static uint8_t http_lines;
+
+static void ICACHE_FLASH_ATTR
+http_done(const char* const data, size_t data_len, uint16_t status, const char* const buffer) {
+    if (!http_in_flight) {
+        return;
+    }
+
+#ifdef UPLOAD_SPREAD_ENABLE
+    upload_sched_response(status, buffer);
+#endif
+
+    http_in_flight = 0;
+    http_stats.busy_us += system_get_time() - http_start_us;
+
+    if (status / 100 == 2) {
+        http_acked = 1;
+        http_stats.ok += 1;
+        http_stats.lines += http_lines;
+    } else {
+        http_stats.err += 1;
+    }
+}
+
+/* A sample stays queued until its POST is acknowledged, an error or timeout posts it again */
+static uint8_t ICACHE_FLASH_ATTR
+http_enqueue(const telemetry_sample_t* p_sample) {
+    simple_http_status_t status;
+
+    if (http_acked) {
+        http_acked = 0;
+        if (p_sample->seq == http_seq) {
+            return 1;
+        }
+    }
+
+#ifdef UPLOAD_SPREAD_ENABLE
+    if (upload_sched_held()) {
+        return 0;
+    }
+#endif
+
+    if (http_in_flight) {
+        if (system_get_time() - http_start_us < TELEMETRY_HTTP_TIMEOUT) {
+            return 0;
+        }
+        http_in_flight = 0;
+        http_stats.err += 1;
+    }
+
+    http_start_us = system_get_time();
+    status = simple_http_request(INFLUX_URL, (char*)p_sample->text, INFLUX_AUTH_HEADER"\r\n", "POST", http_done);
+
+    if (status == SIMPLE_HTTP_NO_CONNECTION || status == SIMPLE_HTTP_CLIENT_NOT_READY) {
+        return 0;
+    }
+    if (status != SIMPLE_HTTP_REQUEST_SENT) {
+        http_stats.err += 1;
+        return 1;
+    }
+
+    http_in_flight = 1;
+    http_seq = p_sample->seq;
+    http_lines = p_sample->lines;
+    return 0;
+}
+#endif /* INFLUX_HTTP_ENABLE */
+
+#ifdef UDP_SINK_ENABLE
+static uint8_t ICACHE_FLASH_ATTR
+udp_enqueue(const telemetry_sample_t* p_sample) {
+    /* Timestamps already in the lines */
+    udp_sink_write(p_sample->text, p_sample->len, 0);
+    return 1;
+}
+#endif /* UDP_SINK_ENABLE */
+
+#if defined(GATEWAY_ENABLE) || defined(GATEWAY_PEER_ENABLE)
+static uint8_t ICACHE_FLASH_ATTR
+gateway_enqueue(const telemetry_sample_t* p_sample) {
+    return gateway_write(p_sample->text, p_sample->len, p_sample->ts);
+}
+#endif /* GATEWAY_ENABLE || GATEWAY_PEER_ENABLE */
+
+#ifdef MQTT_ENABLE
+/* The client id names the persistent session */
+static const simple_mqtt_config_t mqtt_config = {MQTT_HOST, MQTT_PORT, HOSTNAME, MQTT_USER, MQTT_PASSWORD};
+
+static status_t ICACHE_FLASH_ATTR
+mqtt_init(void) {
+    return simple_mqtt_init(&mqtt_config) == SIMPLE_MQTT_OK ? STA_OK : STA_ERR;
+}
+
+/* MQTT_TOPIC_PREFIX + measurement of a line. 0 if it has no usable name */
+static uint8_t ICACHE_FLASH_ATTR
+mqtt_topic(char* topic, const char* line, const char* p_eol) {
+    size_t name_len;
+
+    for (name_len = 0; line + name_len < p_eol && line[name_len] != ' ' && line[name_len] != ','; ++name_len);
+    if (name_len == 0 || name_len > 15) {
+        return 0;
+    }
+
+    os_memcpy(topic, MQTT_TOPIC_PREFIX, sizeof(MQTT_TOPIC_PREFIX) - 1);
+    os_memcpy(topic + sizeof(MQTT_TOPIC_PREFIX) - 1, line, name_len);
+    topic[sizeof(MQTT_TOPIC_PREFIX) - 1 + name_len] = '\0';
+
+    return 1;
+}
+
+static uint8_t ICACHE_FLASH_ATTR
+mqtt_enqueue(const telemetry_sample_t* p_sample) {
+    char topic[sizeof(MQTT_TOPIC_PREFIX) + 16];
+    const char* p_end = p_sample->text + p_sample->len;
+    const char* lines;
+    const char* p_eol;
+    size_t pkt_len;
+    size_t total = 0;
+    uint8_t count = 0;
+
+    if (MQTT_QOS == 0 && simple_mqtt_state() != SIMPLE_MQTT_STATE_CONNECTED) {
+        return 0;
+    }
+
+    /* All the lines or none, a retry must not publish them twice. So everything is checked first */
+    for (lines = p_sample->text; lines < p_end; lines = p_eol + 1) {
+        for (p_eol = lines; p_eol < p_end && *p_eol != '\n'; ++p_eol);
+        if (!mqtt_topic(topic, lines, p_eol)) {
+            continue;
+        }
+
+        /* Over SIMPLE_MQTT_MSG_SIZE. Kept, and counted as dropped once over the depth */
+        pkt_len = simple_mqtt_publish_len(topic, p_eol - lines, MQTT_QOS);
+        if (pkt_len == 0) {
+            return 0;
+        }
+        total += pkt_len;
+        count += 1;
+    }
+
+    if (MQTT_QOS == 0 ? total > simple_mqtt_tx_room() : count > simple_mqtt_window_free()) {
+        return 0;
+    }
+
+    /* Cannot be refused after the checks above */
+    for (lines = p_sample->text; lines < p_end; lines = p_eol + 1) {
+        for (p_eol = lines; p_eol < p_end && *p_eol != '\n'; ++p_eol);
+        if (mqtt_topic(topic, lines, p_eol)) {
+            simple_mqtt_publish(topic, lines, p_eol - lines, MQTT_QOS);
+        }
+    }
+
+    return 1;
+}
+#endif /* MQTT_ENABLE */
+
+#ifdef TELEMETRY_SERIAL_ENABLE
+static uint8_t ICACHE_FLASH_ATTR
+serial_enqueue(const telemetry_sample_t* p_sample) {
+    os_printf("Sample %u:\n%s\n", p_sample->seq, p_sample->text);
+    return 1;
+}
+#endif /* TELEMETRY_SERIAL_ENABLE */
+
+static const telemetry_sink_t sinks[] = {
+#ifdef INFLUX_HTTP_ENABLE
+    {"http",   NULL,          http_enqueue,   NULL,           TELEMETRY_HTTP_DEPTH},
+#endif
+#if defined(GATEWAY_ENABLE) || defined(GATEWAY_PEER_ENABLE)
+    {"gw",     gateway_init,  gateway_enqueue, gateway_flush, TELEMETRY_GW_DEPTH},
+#endif
+#ifdef UDP_SINK_ENABLE
+    {"udp",    udp_sink_init, udp_enqueue,    udp_sink_flush, TELEMETRY_UDP_DEPTH},
+#endif
+#ifdef MQTT_ENABLE
+    {"mqtt",   mqtt_init,     mqtt_enqueue,   NULL,           TELEMETRY_MQTT_DEPTH},
+#endif
+#ifdef TELEMETRY_SERIAL_ENABLE
+    {"serial", NULL,          serial_enqueue, NULL,           TELEMETRY_SERIAL_DEPTH},
+#endif
+};
+
+status_t ICACHE_FLASH_ATTR
+telemetry_sinks_init(void) {
+    return telemetry_init(sinks, sizeof(sinks) / sizeof(sinks[0]));
+}
+
+const telemetry_http_stats_t* ICACHE_FLASH_ATTR
+telemetry_http_stats(void) {
+    return &http_stats;
+}
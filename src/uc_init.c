@@ -15,6 +15,9 @@
 #include "simple_i2c.h"
 #include "user_config.h"
 #include "driver/uart.h"
+#include "serial_cmd.h"
+#include "i2c_trace.h"
+#include "i2c_bus.h"
 
 #include "zmod4xxx/zmod4xxx.h"
 #include "zmod4xxx/iaq_1st_gen.h"
@@ -28,7 +31,12 @@
 
 status_t ICACHE_FLASH_ATTR
 uc_init_uart() {
+#ifdef SERIAL_CMD_ENABLE
+    uart_init(BITRATE, BITRATE);
+    serial_cmd_init();
+#else
     uart_div_modify(UART0, UART_CLK_FREQ / BITRATE);
+#endif
     os_delay_us(1000);
 
 #ifdef DEBUG_PRINT_MODE
@@ -85,8 +93,19 @@ uc_init_gpio() {
 status_t ICACHE_FLASH_ATTR
 uc_init_i2c() {
     uint8_t result;
+
+#ifdef I2C_TRACE_ENABLE
+    i2c_trace_init();
+#endif
     I2C_INIT(&result);
 
+    if (i2c_bus_init() != STA_OK) {
+#ifdef DEBUG_PRINT_MODE
+        os_printf("I2C bus scheduler init error!\n");
+#endif
+        return STA_ERR;
+    }
+
 #ifdef DEBUG_PRINT_MODE
     os_printf("I2C init - Ok\n");
 #endif
@@ -217,7 +236,21 @@ uc_init_sensors(zmod4xxx_dev_t* zmod_dev, iaq_1st_gen_handle_t* iaq_1st_handle,
         return STA_ERR;
     }
 
+#if defined(CCS811_THRESH_ENABLE)
+    css_result = ccs811_set_thresholds(ccs_dev, CCS811_THRESH_LOW_MEDIUM, CCS811_THRESH_MEDIUM_HIGH);
+    if (css_result != CCS811_OK) {
+#ifdef DEBUG_PRINT_MODE
+        os_printf("CCS811 error setting thresholds [%d]!\n", css_result);
+#endif
+        return STA_ERR;
+    }
+
+    css_result = ccs811_set_meas_mode(ccs_dev, CCS811_DRIVE_MODE_10S, CCS811_INT_ENABLE, CCS811_INT_THRESH_ON);
+#elif defined(SENSOR_IRQ_ENABLE)
+    css_result = ccs811_set_meas_mode(ccs_dev, CCS811_DRIVE_MODE_10S, CCS811_INT_ENABLE, CCS811_INT_THRESH_OFF);
+#else
     css_result = ccs811_set_meas_mode(ccs_dev, CCS811_DRIVE_MODE_10S, CCS811_INT_DISABLE, CCS811_INT_THRESH_OFF);
+#endif
     if (css_result != CCS811_OK) {
 #ifdef DEBUG_PRINT_MODE
         os_printf("CCS811 error setting measurement mode [%d]!\n", css_result);
@@ -0,0 +1,177 @@
+/**
+ * \file udp_sink.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Line protocol upload over UDP (InfluxDB / Telegraf UDP listener). Source file.
+ * \version 0.1
+ * \date 2021-04-17
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <espconn.h>
+#include <user_interface.h>
+
+#include "udp_sink.h"
+
+#ifdef SERIAL_CMD_ENABLE
+#include "serial_cmd.h"
+#endif
+
+#ifdef UDP_SINK_ENABLE
+
+#define TS_LEN_MAX 11                           /* " 4294967295" */
+
+static struct espconn sink_conn;
+static esp_udp sink_udp;
+static const uint8_t sink_ip[4] = UDP_SINK_IP;
+
+static char datagram[UDP_SINK_PAYLOAD];
+static size_t datagram_len;                     /* 0 if no header yet */
+static size_t header_len;
+static uint16_t datagram_lines;
+static uint32_t seq;
+
+static uint32_t send_start_us;
+static uint8_t send_pending;
+
+static os_timer_t timer_flush;
+static udp_sink_stats_t stats;
+
+static void ICACHE_FLASH_ATTR
+sink_sent(void* arg) {
+    if (send_pending) {
+        stats.busy_us += system_get_time() - send_start_us;
+        send_pending = 0;
+    }
+}
+
+static void ICACHE_FLASH_ATTR
+datagram_begin(void) {
+    header_len = os_sprintf(datagram, "udp_sink,host=%s seq=%ui\n", HOSTNAME, seq);
+    datagram_len = header_len;
+    datagram_lines = 0;
+}
+
+#ifdef SERIAL_CMD_ENABLE
+static void ICACHE_FLASH_ATTR
+udp_sink_cmd(const char* args) {
+    os_printf("udp: seq %u datagrams %u lines %u bytes %u errors %u dropped %u busy %u us",
+              seq, stats.datagrams, stats.lines, stats.bytes, stats.errors, stats.dropped, stats.busy_us);
+    if (stats.lines) {
+        os_printf(" (%u us/line)", stats.busy_us / stats.lines);
+    }
+    os_printf("\n");
+}
+#endif /* SERIAL_CMD_ENABLE */
+
+status_t ICACHE_FLASH_ATTR
+udp_sink_init(void) {
+#ifdef SERIAL_CMD_ENABLE
+    serial_cmd_register("udp", udp_sink_cmd);
+#endif
+
+    sink_conn.type = ESPCONN_UDP;
+    sink_conn.state = ESPCONN_NONE;
+    sink_conn.proto.udp = &sink_udp;
+    sink_udp.local_port = espconn_port();
+    sink_udp.remote_port = UDP_SINK_PORT;
+    os_memcpy(sink_udp.remote_ip, sink_ip, sizeof(sink_ip));
+
+    /* Sequence numbers restart on a reboot, a random start tells the receiver apart */
+    seq = os_random();
+    datagram_len = 0;
+
+    os_timer_disarm(&timer_flush);
+    os_timer_setfn(&timer_flush, (os_timer_func_t *)udp_sink_flush, NULL);
+
+    if (espconn_create(&sink_conn) != 0) {
+        return STA_ERR;
+    }
+    espconn_regist_sentcb(&sink_conn, sink_sent);
+
+    return STA_OK;
+}
+
+void ICACHE_FLASH_ATTR
+udp_sink_flush(void) {
+    sint16 err;
+
+    os_timer_disarm(&timer_flush);
+
+    if (datagram_len == 0 || datagram_lines == 0) {
+        return;
+    }
+
+    /* A received datagram overwrites the remote address */
+    sink_udp.remote_port = UDP_SINK_PORT;
+    os_memcpy(sink_udp.remote_ip, sink_ip, sizeof(sink_ip));
+
+    if (!send_pending) {
+        send_start_us = system_get_time();
+        send_pending = 1;
+    }
+
+    err = espconn_sendto(&sink_conn, (uint8*)datagram, datagram_len);
+    if (err == 0) {
+        stats.datagrams += 1;
+        stats.bytes += datagram_len;
+        stats.lines += datagram_lines;
+    } else {
+        send_pending = 0;
+        stats.errors += 1;
+#ifdef DEBUG_PRINT_MODE
+        os_printf("udp_sink: send error %d, seq %u lost\n", err, seq);
+#endif
+    }
+
+    seq += 1;
+    datagram_len = 0;
+}
+
+void ICACHE_FLASH_ATTR
+udp_sink_write(const char* lines, size_t len, uint32_t ts) {
+    const char* p_end = lines + len;
+    const char* p_eol;
+    size_t line_len, need;
+
+    for (; lines < p_end; lines = p_eol + 1) {
+        for (p_eol = lines; p_eol < p_end && *p_eol != '\n'; ++p_eol);
+
+        line_len = p_eol - lines;
+        if (line_len == 0) {
+            continue;
+        }
+        need = line_len + (ts ? TS_LEN_MAX : 0) + 1;
+
+        if (datagram_len + need > UDP_SINK_PAYLOAD) {
+            udp_sink_flush();
+        }
+        if (datagram_len == 0) {
+            datagram_begin();
+        }
+        if (datagram_len + need > UDP_SINK_PAYLOAD) {
+            stats.dropped += 1;
+            continue;
+        }
+
+        /* First line of the datagram, bound the wait for the rest */
+        if (datagram_lines == 0) {
+            os_timer_arm(&timer_flush, UDP_SINK_FLUSH_DELAY, 0);
+        }
+
+        os_memcpy(datagram + datagram_len, lines, line_len);
+        datagram_len += line_len;
+        if (ts) {
+            datagram_len += os_sprintf(datagram + datagram_len, " %u", ts);
+        }
+        datagram[datagram_len++] = '\n';
+        datagram_lines += 1;
+    }
+}
+
+const udp_sink_stats_t* ICACHE_FLASH_ATTR
+udp_sink_stats(void) {
+    return &stats;
+}
+
+#endif /* UDP_SINK_ENABLE */
@@ -0,0 +1,125 @@
+/**
+ * \file upload_sched.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Upload timing across a fleet: phase, jitter and server hints. Source file.
+ * \version 0.1
+ * \date 2021-04-21
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <stdlib.h>
+#include <user_interface.h>
+
+#include "upload_sched.h"
+
+#include "simple_http/simple_http.h"
+
+#ifdef SERIAL_CMD_ENABLE
+#include "serial_cmd.h"
+#endif
+
+#ifdef UPLOAD_SPREAD_ENABLE
+
+#if UPLOAD_JITTER * 2 >= SERVER_WRITE_INTERVAL
+#error "UPLOAD_JITTER must be below half SERVER_WRITE_INTERVAL"
+#endif
+
+static upload_sched_stats_t stats;
+static uint32_t hint_ms;                        /* Pending one-shot delay */
+static uint32_t hold_until_us;
+static uint8_t hold;
+
+#ifdef SERIAL_CMD_ENABLE
+static void ICACHE_FLASH_ATTR
+upload_sched_cmd(const char* args) {
+    os_printf("upload: phase %u ms jitter +-%u ms hints %u holds %u (%u s)%s\n",
+              stats.phase_ms, UPLOAD_JITTER, stats.hints, stats.holds, stats.held_s,
+              upload_sched_held() ? ", held" : "");
+}
+#endif /* SERIAL_CMD_ENABLE */
+
+void ICACHE_FLASH_ATTR
+upload_sched_init(void) {
+    uint8_t mac[6];
+    uint32_t hash = 2166136261u;                /* FNV-1a */
+
+    os_memset(mac, 0, sizeof(mac));
+    wifi_get_macaddr(STATION_IF, mac);
+    for (uint8_t i = 0; i < sizeof(mac); ++i) {
+        hash = (hash ^ mac[i]) * 16777619u;
+    }
+
+    os_memset(&stats, 0, sizeof(stats));
+    stats.phase_ms = hash % SERVER_WRITE_INTERVAL;
+    hint_ms = 0;
+    hold = 0;
+
+#ifdef SERIAL_CMD_ENABLE
+    serial_cmd_register("upload", upload_sched_cmd);
+#endif
+}
+
+uint32_t ICACHE_FLASH_ATTR
+upload_sched_first(void) {
+    return SERVER_WRITE_INTERVAL + stats.phase_ms;
+}
+
+uint32_t ICACHE_FLASH_ATTR
+upload_sched_next(void) {
+    uint32_t delay = SERVER_WRITE_INTERVAL - UPLOAD_JITTER + (uint32_t)os_random() % (2 * UPLOAD_JITTER + 1);
+
+    delay += hint_ms;
+    hint_ms = 0;
+
+    return delay;
+}
+
+void ICACHE_FLASH_ATTR
+upload_sched_response(uint16_t status, const char* buffer) {
+    const char* value;
+    uint32_t seconds;
+
+    if (buffer == NULL) {
+        return;
+    }
+
+    if ((value = simple_http_client_response_header(buffer, UPLOAD_SLOT_HEADER, NULL)) != NULL) {
+        hint_ms = strtoul(value, NULL, 10);
+        if (hint_ms > SERVER_WRITE_INTERVAL) {
+            hint_ms = SERVER_WRITE_INTERVAL;
+        }
+        stats.hints += 1;
+    }
+
+    /* Delta seconds only */
+    if ((status == 429 || status == 503) &&
+        (value = simple_http_client_response_header(buffer, "retry-after", NULL)) != NULL &&
+        *value >= '0' && *value <= '9') {
+        seconds = strtoul(value, NULL, 10);
+        if (seconds > UPLOAD_RETRY_AFTER_MAX) {
+            seconds = UPLOAD_RETRY_AFTER_MAX;
+        }
+
+        hold_until_us = system_get_time() + seconds * 1000000;
+        hold = seconds > 0;
+        stats.holds  += 1;
+        stats.held_s += seconds;
+    }
+}
+
+uint8_t ICACHE_FLASH_ATTR
+upload_sched_held(void) {
+    if (hold && (int32_t)(hold_until_us - system_get_time()) <= 0) {
+        hold = 0;
+    }
+
+    return hold;
+}
+
+const upload_sched_stats_t* ICACHE_FLASH_ATTR
+upload_sched_stats(void) {
+    return &stats;
+}
+
+#endif /* UPLOAD_SPREAD_ENABLE */
@@ -0,0 +1,37 @@
+/**
+ * \file web_dashboard.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Static HTML dashboard served from flash. Source file.
+ * \version 0.1
+ * \date 2021-04-16
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+
+#include "web_dashboard.h"
+#include "user_config.h"
+
+#ifdef WEB_ENABLE
+
+#define DASHBOARD_HEADERS "Content-Encoding: gzip\r\n" \
+                          "Cache-Control: no-cache\r\n"
+
+/* Generated by the Makefile from web/dashboard.html */
+extern const uint8_t web_dashboard_gz[];
+extern const uint32_t web_dashboard_gz_len;
+extern const char web_dashboard_etag[];
+
+char* ICACHE_FLASH_ATTR
+web_dashboard_view(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    *p_response_code = 200;
+    *p_content_type = HTTP_CONTENT_TYPE_TEXT_HTML;
+    *p_data_size = web_dashboard_gz_len;
+
+    p_data->flash_response = 1;
+    p_data->headers = DASHBOARD_HEADERS;
+    p_data->etag = web_dashboard_etag;
+    return (char*)web_dashboard_gz;
+}
+
+#endif /* WEB_ENABLE */
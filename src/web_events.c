@@ -0,0 +1,196 @@
+/**
+ * \file web_events.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Server-Sent Events stream of new samples. Source file.
+ * \version 0.1
+ * \date 2021-04-13
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <user_interface.h>
+
+#include "web_events.h"
+#include "user_config.h"
+
+#ifdef SERIAL_CMD_ENABLE
+#include "serial_cmd.h"
+#endif
+
+#ifdef WEB_ENABLE
+
+#define WEB_EVENTS_RING_MASK (WEB_EVENTS_RING_LEN - 1)
+
+#define EVENTS_HELLO     "retry: 5000\n\n"
+#define EVENTS_KEEPALIVE ": keepalive\n\n"
+
+typedef struct {
+    uint32_t publish_us;                        /* system_get_time() on publish */
+    uint16_t len;
+    char     text[WEB_EVENTS_EVENT_SIZE];       /* Formatted event, ready to send */
+} event_t;
+
+typedef struct {
+    struct espconn* p_conn;                     /* NULL if the slot is free */
+    uint32_t cursor;                            /* Next event to send, sequence number */
+    uint8_t  hello;                             /* Reconnection delay not sent yet */
+} subscriber_t;
+
+static event_t ring[WEB_EVENTS_RING_LEN];
+static uint32_t ring_head;                      /* Sequence number of the next event */
+
+static subscriber_t subs[WEB_EVENTS_MAX_SUBS];
+
+static web_events_stats_t stats;
+
+static os_timer_t timer_keepalive;
+
+static void ICACHE_FLASH_ATTR
+ring_push(const char* name, const char* data, size_t data_len) {
+    event_t* p_event = &ring[ring_head & WEB_EVENTS_RING_MASK];
+    size_t len;
+
+    if (name == NULL) {
+        len = os_sprintf(p_event->text, EVENTS_KEEPALIVE);
+    } else {
+        len = os_sprintf(p_event->text, "id: %u\nevent: %s\ndata: ", ring_head, name);
+        if (len + data_len + 2 > WEB_EVENTS_EVENT_SIZE) {
+            return;
+        }
+        os_memcpy(p_event->text + len, data, data_len);
+        len += data_len;
+        os_memcpy(p_event->text + len, "\n\n", 2);
+        len += 2;
+    }
+
+    p_event->len = len;
+    p_event->publish_us = system_get_time();
+    ++ring_head;
+
+    /* Wake up the streams waiting for events, the busy ones pull it on their sent callback */
+    for (uint8_t i = 0; i < WEB_EVENTS_MAX_SUBS; ++i) {
+        if (subs[i].p_conn != NULL) {
+            simple_http_server_stream_resume(subs[i].p_conn);
+        }
+    }
+}
+
+/* Called from the HTTP server sent callback */
+static size_t ICACHE_FLASH_ATTR
+events_produce(void* arg, char* p_buff, size_t buff_len, uint8_t* p_done) {
+    subscriber_t* p_sub = (subscriber_t*)arg;
+    uint32_t now = system_get_time();
+    size_t len = 0;
+    uint32_t lag;
+
+    /* Connection closed */
+    if (p_buff == NULL) {
+        p_sub->p_conn = NULL;
+        --stats.subscribers;
+        return 0;
+    }
+
+    if (p_sub->hello) {
+        len = sizeof(EVENTS_HELLO) - 1;
+        os_memcpy(p_buff, EVENTS_HELLO, len);
+        p_sub->hello = 0;
+    }
+
+    /* Drop the oldest events, already overwritten */
+    lag = ring_head - p_sub->cursor;
+    if (lag > WEB_EVENTS_RING_LEN) {
+        stats.dropped += lag - WEB_EVENTS_RING_LEN;
+        p_sub->cursor = ring_head - WEB_EVENTS_RING_LEN;
+    }
+
+    while (p_sub->cursor != ring_head) {
+        const event_t* p_event = &ring[p_sub->cursor & WEB_EVENTS_RING_MASK];
+        uint32_t latency = now - p_event->publish_us;
+
+        if (len + p_event->len > buff_len) {
+            break;
+        }
+
+        os_memcpy(p_buff + len, p_event->text, p_event->len);
+        len += p_event->len;
+        ++p_sub->cursor;
+
+        stats.delivered += 1;
+        stats.latency_sum_us += latency;
+        if (latency > stats.latency_max_us) {
+            stats.latency_max_us = latency;
+        }
+    }
+
+    /* Never done, the stream pauses until the next event */
+    return len;
+}
+
+/* Every tick, events or not. Skipping it after a publish allowed almost two ticks of silence */
+static void ICACHE_FLASH_ATTR
+events_keepalive(void* arg) {
+    if (stats.subscribers > 0) {
+        ring_push(NULL, NULL, 0);
+    }
+}
+
+void ICACHE_FLASH_ATTR
+web_events_publish(const char* name, const char* data, size_t data_len) {
+    stats.published += 1;
+
+    ring_push(name, data, data_len);
+}
+
+char* ICACHE_FLASH_ATTR
+web_events_view(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    *p_data_size = 0;
+    *p_content_type = HTTP_CONTENT_TYPE_TEXT_EVENT_STREAM;
+
+    for (uint8_t i = 0; i < WEB_EVENTS_MAX_SUBS; ++i) {
+        if (subs[i].p_conn == NULL) {
+            subs[i].p_conn = p_data->p_conn;
+            subs[i].cursor = ring_head;
+            subs[i].hello  = 1;
+            stats.subscribers += 1;
+
+            p_data->producer = events_produce;
+            p_data->producer_arg = &subs[i];
+            *p_response_code = 200;
+            return NULL;
+        }
+    }
+
+    stats.rejected += 1;
+    *p_response_code = 503;
+    return NULL;
+}
+
+const web_events_stats_t* ICACHE_FLASH_ATTR
+web_events_get_stats(void) {
+    return &stats;
+}
+
+#ifdef SERIAL_CMD_ENABLE
+static void ICACHE_FLASH_ATTR
+web_events_cmd(const char* args) {
+    uint32_t latency_avg = stats.delivered ? stats.latency_sum_us / stats.delivered : 0;
+
+    os_printf("subs %u published %u delivered %u dropped %u rejected %u\n",
+              stats.subscribers, stats.published, stats.delivered, stats.dropped, stats.rejected);
+    os_printf("latency avg %u us max %u us, %u B per subscriber, %u B ring\n",
+              latency_avg, stats.latency_max_us, sizeof(subscriber_t), sizeof(ring));
+}
+#endif /* SERIAL_CMD_ENABLE */
+
+void ICACHE_FLASH_ATTR
+web_events_init(void) {
+    os_timer_disarm(&timer_keepalive);
+    os_timer_setfn(&timer_keepalive, (os_timer_func_t *)events_keepalive, NULL);
+    os_timer_arm(&timer_keepalive, WEB_EVENTS_KEEPALIVE, 1);
+
+#ifdef SERIAL_CMD_ENABLE
+    serial_cmd_register("sse", web_events_cmd);
+#endif
+}
+
+#endif /* WEB_ENABLE */
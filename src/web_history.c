@@ -0,0 +1,201 @@
+/**
+ * \file web_history.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief `/api/v1/history` endpoint, streamed from the flash history. Source file.
+ * \version 0.1
+ * \date 2021-04-15
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+
+#include "web_history.h"
+#include "history.h"
+#include "user_config.h"
+
+#if defined(WEB_ENABLE) && defined(HISTORY_ENABLE)
+
+#define HISTORY_HEADER "{\"fields\":[\"ts\",\"scd30_co2\",\"scd30_temp\",\"scd30_rh\",\"ccs811_eco2\"," \
+                       "\"ccs811_tvoc\",\"zmod_eco2\",\"zmod_iaq\",\"zmod_tvoc\"],\"rows\":["
+#define HISTORY_FOOTER "]}"
+#define HISTORY_ROW_MAX 96                      /* Longest formatted row, separator included */
+
+typedef enum {
+    STREAM_HEADER,
+    STREAM_ROWS,
+    STREAM_FOOTER,
+} stream_state_t;
+
+/* Query in flight. One per server connection */
+typedef struct {
+    uint8_t        in_use;
+    stream_state_t state;
+    history_pos_t  pos;
+    uint32_t       to;
+    uint32_t       step;
+    uint32_t       next_ts;                     /* Earliest timestamp of the next row */
+    uint32_t       rows;
+} cursor_t;
+
+static cursor_t cursors[SIMPLE_HTTP_SERVER_MAX_CONN];
+
+/* Copied by the server right after the callback */
+static char etag[11];
+
+static uint32_t ICACHE_FLASH_ATTR
+param_uint(const char* query, const char* name, uint32_t default_value) {
+    size_t len;
+    const char* p = simple_http_server_query_param(query, name, &len);
+    uint32_t value = 0;
+
+    if (p == NULL || len == 0) {
+        return default_value;
+    }
+
+    for (; len > 0; --len, ++p) {
+        if (*p < '0' || *p > '9') {
+            return default_value;
+        }
+        value = value * 10 + (*p - '0');
+    }
+
+    return value;
+}
+
+/* Fixed point value with two decimals */
+static size_t ICACHE_FLASH_ATTR
+write_centi(char* buff, int32_t value) {
+    const char* sign = "";
+
+    if (value < 0) {
+        sign  = "-";
+        value = -value;
+    }
+
+    return os_sprintf(buff, ",%s%d.%02d", sign, value / 100, value % 100);
+}
+
+static size_t ICACHE_FLASH_ATTR
+write_row(char* buff, const history_record_t* p_record, uint8_t first) {
+    size_t len = 0;
+
+    len += os_sprintf(buff + len, "%s[%u", first ? "" : ",", p_record->ts);
+
+    if (p_record->valid & HISTORY_VALID_SCD30) {
+        len += os_sprintf(buff + len, ",%u", p_record->scd30_co2);
+        len += write_centi(buff + len, p_record->scd30_temp);
+        len += write_centi(buff + len, p_record->scd30_rh);
+    } else {
+        len += os_sprintf(buff + len, ",null,null,null");
+    }
+
+    if (p_record->valid & HISTORY_VALID_CCS811) {
+        len += os_sprintf(buff + len, ",%u,%u", p_record->ccs811_eco2, p_record->ccs811_tvoc);
+    } else {
+        len += os_sprintf(buff + len, ",null,null");
+    }
+
+    if (p_record->valid & HISTORY_VALID_ZMOD) {
+        len += os_sprintf(buff + len, ",%u", p_record->zmod_eco2);
+        len += write_centi(buff + len, p_record->zmod_iaq);
+        len += write_centi(buff + len, p_record->zmod_tvoc);
+    } else {
+        len += os_sprintf(buff + len, ",null,null,null");
+    }
+
+    len += os_sprintf(buff + len, "]");
+
+    return len;
+}
+
+/* Called from the HTTP server sent callback */
+static size_t ICACHE_FLASH_ATTR
+history_produce(void* arg, char* p_buff, size_t buff_len, uint8_t* p_done) {
+    cursor_t* p_cursor = (cursor_t*)arg;
+    history_record_t record;
+    size_t len = 0;
+
+    if (p_buff == NULL) {
+        p_cursor->in_use = 0;
+        return 0;
+    }
+
+    if (p_cursor->state == STREAM_HEADER) {
+        len += os_sprintf(p_buff, HISTORY_HEADER);
+        p_cursor->state = STREAM_ROWS;
+    }
+
+    while (p_cursor->state == STREAM_ROWS && len + HISTORY_ROW_MAX + sizeof(HISTORY_FOOTER) <= buff_len) {
+        if (!history_next(&p_cursor->pos, &record) || record.ts > p_cursor->to) {
+            p_cursor->state = STREAM_FOOTER;
+            break;
+        }
+
+        /* Inside the step, jump over the gap */
+        if (record.ts < p_cursor->next_ts) {
+            if (!history_seek(p_cursor->next_ts, &p_cursor->pos)) {
+                p_cursor->state = STREAM_FOOTER;
+            }
+            continue;
+        }
+
+        len += write_row(p_buff + len, &record, p_cursor->rows == 0);
+        p_cursor->rows += 1;
+        p_cursor->next_ts = record.ts + p_cursor->step;
+    }
+
+    if (p_cursor->state == STREAM_FOOTER) {
+        os_memcpy(p_buff + len, HISTORY_FOOTER, sizeof(HISTORY_FOOTER) - 1);
+        len += sizeof(HISTORY_FOOTER) - 1;
+
+        p_cursor->in_use = 0;
+        *p_done = 1;
+    }
+
+    return len;
+}
+
+char* ICACHE_FLASH_ATTR
+web_history_view(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    uint32_t from = param_uint(p_data->request_query, "from", 0);
+    cursor_t* p_cursor = NULL;
+
+    *p_data_size = 0;
+    *p_content_type = HTTP_CONTENT_TYPE_APPLICATION_JSON;
+
+    for (uint8_t i = 0; i < SIMPLE_HTTP_SERVER_MAX_CONN; ++i) {
+        if (!cursors[i].in_use) {
+            p_cursor = &cursors[i];
+            break;
+        }
+    }
+    if (p_cursor == NULL) {
+        *p_response_code = 503;
+        return NULL;
+    }
+
+    p_cursor->in_use  = 1;
+    p_cursor->state   = STREAM_HEADER;
+    p_cursor->to      = param_uint(p_data->request_query, "to", HISTORY_TS_EMPTY);
+    p_cursor->step    = param_uint(p_data->request_query, "step", 0);
+    p_cursor->next_ts = from;
+    p_cursor->rows    = 0;
+
+    /* Nothing stored in range, header and footer only */
+    if (!history_seek(from, &p_cursor->pos)) {
+        p_cursor->pos.slot = 0;
+        p_cursor->pos.sector_ts = HISTORY_TS_EMPTY;
+    }
+
+    /* The stored records only change with an append */
+    os_sprintf(etag, "\"%08x\"", history_last_ts());
+    p_data->etag = etag;
+    p_data->headers = "Cache-Control: no-cache\r\n";
+
+    p_data->producer = history_produce;
+    p_data->producer_arg = p_cursor;
+    *p_response_code = 200;
+    return NULL;
+}
+
+#endif /* WEB_ENABLE && HISTORY_ENABLE */
@@ -0,0 +1,231 @@
+/**
+ * \file web_metrics.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Prometheus text exposition at /metrics. Source file.
+ * \version 0.1
+ * \date 2021-04-14
+ */
+
+#include <osapi.h>
+#include <c_types.h>
+#include <user_interface.h>
+#include <stddef.h>
+
+#include "web_metrics.h"
+#include "common.h"
+#include "i2c_bus.h"
+#include "user_config.h"
+
+#ifdef WEB_ENABLE
+
+/* Size line and trailers of a chunk take 12 bytes */
+#if WEB_METRICS_WRITER_SIZE > SIMPLE_HTTP_SERVER_CHUNK_SIZE - 12
+#error "WEB_METRICS_WRITER_SIZE does not fit a response chunk"
+#endif
+
+typedef struct {
+    web_metrics_writer_t writer;
+    void*                arg;
+} writer_entry_t;
+
+/* Position of a response in flight. One per server connection */
+typedef struct {
+    uint8_t in_use;
+    uint8_t next;                               /* Next writer */
+} cursor_t;
+
+static writer_entry_t writers[WEB_METRICS_MAX_WRITERS];
+static uint8_t writers_len;
+
+static cursor_t cursors[SIMPLE_HTTP_SERVER_MAX_CONN];
+
+typedef struct {
+    const char* name;
+    size_t      offset;                         /* Counter offset in i2c_bus_stats_t */
+} bus_counter_t;
+
+static const bus_counter_t bus_counters[] = {
+    {"i2c_bus_jobs_total",      offsetof(i2c_bus_stats_t, jobs)},
+    {"i2c_bus_rejected_total",  offsetof(i2c_bus_stats_t, rejected)},
+    {"i2c_bus_coalesced_total", offsetof(i2c_bus_stats_t, coalesced)},
+};
+
+typedef struct {
+    const char* name;
+    const char* type;
+    size_t      offset;                         /* Value offset in simple_http_server_stats_t */
+} http_stat_t;
+
+static const http_stat_t http_stats[] = {
+    {"http_server_not_modified_total", "counter", offsetof(simple_http_server_stats_t, not_modified)},
+    {"http_server_shed_total",         "counter", offsetof(simple_http_server_stats_t, shed)},
+    {"http_server_deferred_total",     "counter", offsetof(simple_http_server_stats_t, deferred)},
+    {"http_server_defer_max_us",       "gauge",   offsetof(simple_http_server_stats_t, defer_max_us)},
+};
+
+static const char* const bus_dev_labels[I2C_BUS_DEV_MAX] = {
+    "dev=\"zmod\"",
+    "dev=\"ccs811\"",
+    "dev=\"scd30\"",
+};
+
+size_t ICACHE_FLASH_ATTR
+web_metrics_type(char* buff, const char* name, const char* type) {
+    return os_sprintf(buff, "# TYPE %s %s\n", name, type);
+}
+
+size_t ICACHE_FLASH_ATTR
+web_metrics_uint(char* buff, const char* name, const char* labels, uint32_t value) {
+    if (labels == NULL) {
+        return os_sprintf(buff, "%s %u\n", name, value);
+    }
+
+    return os_sprintf(buff, "%s{%s} %u\n", name, labels, value);
+}
+
+size_t ICACHE_FLASH_ATTR
+web_metrics_float(char* buff, const char* name, const char* labels, float value) {
+    char text[16];
+
+    if (common_ftoa(text, value) == 0) {
+        os_strcpy(text, "NaN");
+    }
+
+    if (labels == NULL) {
+        return os_sprintf(buff, "%s %s\n", name, text);
+    }
+
+    return os_sprintf(buff, "%s{%s} %s\n", name, labels, text);
+}
+
+static size_t ICACHE_FLASH_ATTR
+write_heap(char* buff, void* arg) {
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "esp_free_heap_bytes", "gauge");
+    len += web_metrics_uint(buff + len, "esp_free_heap_bytes", NULL, system_get_free_heap_size());
+
+    return len;
+}
+
+static size_t ICACHE_FLASH_ATTR
+write_http(char* buff, void* arg) {
+    const simple_http_server_stats_t* p_stats = simple_http_server_get_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, "http_server_requests_total", "counter");
+    len += web_metrics_uint(buff + len, "http_server_requests_total", NULL, p_stats->requests);
+    len += web_metrics_type(buff + len, "http_server_latency_us", "summary");
+    len += web_metrics_uint(buff + len, "http_server_latency_us_sum", NULL, p_stats->latency_sum_us);
+    len += web_metrics_uint(buff + len, "http_server_latency_us_count", NULL, p_stats->responses);
+    len += web_metrics_type(buff + len, "http_server_latency_max_us", "gauge");
+    len += web_metrics_uint(buff + len, "http_server_latency_max_us", NULL, p_stats->latency_max_us);
+
+    return len;
+}
+
+/* arg: http_stat_t */
+static size_t ICACHE_FLASH_ATTR
+write_http_stat(char* buff, void* arg) {
+    const http_stat_t* p_stat = (const http_stat_t*)arg;
+    const uint8_t* p_stats = (const uint8_t*)simple_http_server_get_stats();
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, p_stat->name, p_stat->type);
+    len += web_metrics_uint(buff + len, p_stat->name, NULL, *(const uint32_t*)(p_stats + p_stat->offset));
+
+    return len;
+}
+
+/* arg: bus_counter_t */
+static size_t ICACHE_FLASH_ATTR
+write_bus(char* buff, void* arg) {
+    const bus_counter_t* p_counter = (const bus_counter_t*)arg;
+    size_t len = 0;
+
+    len += web_metrics_type(buff + len, p_counter->name, "counter");
+    for (uint8_t i = 0; i < I2C_BUS_DEV_MAX; ++i) {
+        const uint8_t* p_stats = (const uint8_t*)i2c_bus_get_stats(i);
+
+        len += web_metrics_uint(buff + len, p_counter->name, bus_dev_labels[i],
+                                *(const uint32_t*)(p_stats + p_counter->offset));
+    }
+
+    return len;
+}
+
+/* Called from the HTTP server sent callback */
+static size_t ICACHE_FLASH_ATTR
+metrics_produce(void* arg, char* p_buff, size_t buff_len, uint8_t* p_done) {
+    cursor_t* p_cursor = (cursor_t*)arg;
+    size_t len = 0;
+
+    if (p_buff == NULL) {
+        p_cursor->in_use = 0;
+        return 0;
+    }
+
+    while (p_cursor->next < writers_len && len + WEB_METRICS_WRITER_SIZE <= buff_len) {
+        const writer_entry_t* p_entry = &writers[p_cursor->next];
+
+        len += p_entry->writer(p_buff + len, p_entry->arg);
+        ++p_cursor->next;
+    }
+
+    if (p_cursor->next >= writers_len) {
+        p_cursor->in_use = 0;
+        *p_done = 1;
+    }
+
+    return len;
+}
+
+char* ICACHE_FLASH_ATTR
+web_metrics_view(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    *p_data_size = 0;
+    *p_content_type = HTTP_CONTENT_TYPE_TEXT_PLAIN;
+
+    for (uint8_t i = 0; i < SIMPLE_HTTP_SERVER_MAX_CONN; ++i) {
+        if (!cursors[i].in_use) {
+            cursors[i].in_use = 1;
+            cursors[i].next   = 0;
+
+            p_data->producer = metrics_produce;
+            p_data->producer_arg = &cursors[i];
+            *p_response_code = 200;
+            return NULL;
+        }
+    }
+
+    *p_response_code = 503;
+    return NULL;
+}
+
+status_t ICACHE_FLASH_ATTR
+web_metrics_register(web_metrics_writer_t writer, void* arg) {
+    if (writer == NULL || writers_len >= WEB_METRICS_MAX_WRITERS) {
+        return STA_ERR;
+    }
+
+    writers[writers_len].writer = writer;
+    writers[writers_len].arg    = arg;
+    writers_len += 1;
+
+    return STA_OK;
+}
+
+void ICACHE_FLASH_ATTR
+web_metrics_init(void) {
+    writers_len = 0;
+
+    web_metrics_register(write_heap, NULL);
+    web_metrics_register(write_http, NULL);
+    for (uint8_t i = 0; i < sizeof(http_stats) / sizeof(http_stats[0]); ++i) {
+        web_metrics_register(write_http_stat, (void*)&http_stats[i]);
+    }
+    for (uint8_t i = 0; i < sizeof(bus_counters) / sizeof(bus_counters[0]); ++i) {
+        web_metrics_register(write_bus, (void*)&bus_counters[i]);
+    }
+}
+
+#endif /* WEB_ENABLE */
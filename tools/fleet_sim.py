@@ -0,0 +1,409 @@
+#!/usr/bin/env python3
+"""Fleet simulator: N virtual loggers uploading to one collector, in one process.
+
+Each virtual logger models the upload path of src/main.c. Timing constants are read
+from include/ so the model follows the firmware configuration:
+
+  - timer_logger fires SERVER_WRITE_INTERVAL ms after boot. timer_send_data re-arms it
+    when it is done, so the period is the interval plus the tick cost (--tick-cost).
+  - Every tick builds the scd30 / ccs811 / zmod lines from its own sensor models, once
+    each sensor is warm, and publishes them with the SNTP timestamp.
+  - The HTTP sink keeps up to TELEMETRY_HTTP_DEPTH samples, sends one at a time, and
+    drops the oldest sample past the depth. The TELEMETRY_RETRY_INTERVAL ms retry timer
+    runs from boot. A request without an answer is given up after TELEMETRY_HTTP_TIMEOUT.
+  - Requests are HTTP/1.0 POSTs with `Connection: close`, one connection each, like
+    simple_http_client.c without SIMPLE_HTTP_CLIENT_KEEP_OPEN.
+  - Uploads fail (samples queue) until the station has an IP, --wifi seconds after boot.
+  - With UPLOAD_SPREAD_ENABLE (upload_sched.c, on if enabled in user_config.h, or
+    --spread / --no-spread): first upload after the interval plus a phase hashed
+    from a random MAC, UPLOAD_JITTER on every interval, Retry-After holds on 429/503
+    and UPLOAD_SLOT_HEADER one-shot delays.
+
+Without spreading, boards powered together (--boot-spread 0) stay phase aligned,
+since every one of them uses the same period. The report shows how that aligns the
+fleet's requests.
+
+Run it against tools/influx_write_standin.py or a real InfluxDB:
+
+    python3 tools/influx_write_standin.py -p 8086 --report 0 &
+    python3 tools/fleet_sim.py -n 300 --duration 120 --url "http://127.0.0.1:8086/api/v2/write?org=o&bucket=b&precision=s"
+
+Report: requests per second (mean, peak, peak/mean), the busiest 100 ms window,
+response latency percentiles, answers by status, dropped samples and the queue depth.
+--csv writes the requests started per second.
+
+The upload_sched.c model is checked against the firmware code, built on the host:
+
+    python3 tools/fleet_sim.py --check-sched tools/host/build/upload_sched_test
+"""
+
+import argparse
+import asyncio
+import math
+import os
+import random
+import re
+import subprocess
+import sys
+import time
+import urllib.parse
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+
+def read_defines(*headers):
+    """Integer and string #defines of the given headers under include/, flags as True"""
+    defines = {}
+    for header in headers:
+        with open(os.path.join(ROOT, "include", header)) as f:
+            for line in f:
+                m = re.match(r"\s*#define\s+(\w+)\s*(\d+\b|\"[^\"]*\")?", line)
+                if m:
+                    value = m.group(2)
+                    if value is None:
+                        defines[m.group(1)] = True
+                    elif value.startswith('"'):
+                        defines[m.group(1)] = value.strip('"')
+                    else:
+                        defines[m.group(1)] = int(value)
+    return defines
+
+
+CONFIG = read_defines("user_config.h", "telemetry.h", "telemetry_sinks.h")
+SERVER_WRITE_INTERVAL_MS = CONFIG.get("SERVER_WRITE_INTERVAL", 10201)
+SERVER_WRITE_INTERVAL = SERVER_WRITE_INTERVAL_MS / 1000
+RETRY_INTERVAL = CONFIG.get("TELEMETRY_RETRY_INTERVAL", 1000) / 1000
+HTTP_DEPTH = CONFIG.get("TELEMETRY_HTTP_DEPTH", 4)
+HTTP_TIMEOUT = CONFIG.get("TELEMETRY_HTTP_TIMEOUT", 30000000) / 1e6
+UPLOAD_SPREAD = CONFIG.get("UPLOAD_SPREAD_ENABLE", False) is True
+UPLOAD_JITTER_MS = CONFIG.get("UPLOAD_JITTER", 500)
+UPLOAD_RETRY_AFTER_MAX = CONFIG.get("UPLOAD_RETRY_AFTER_MAX", 300)
+UPLOAD_SLOT_HEADER = CONFIG.get("UPLOAD_SLOT_HEADER", "x-upload-delay")
+
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def random_mac(rng):
+    """Espressif OUI, random device part"""
+    return bytes([0x5C, 0xCF, 0x7F] + [rng.randrange(256) for _ in range(3)])
+
+
+def phase_ms(mac):
+    """upload_sched_init"""
+    return fnv1a(mac) % SERVER_WRITE_INTERVAL_MS
+
+
+def interval_bounds_ms():
+    """upload_sched_next without a hint"""
+    return SERVER_WRITE_INTERVAL_MS - UPLOAD_JITTER_MS, SERVER_WRITE_INTERVAL_MS + UPLOAD_JITTER_MS
+
+
+def slot_hint_ms(value):
+    """Delay of an UPLOAD_SLOT_HEADER value in upload_sched_response"""
+    return min(int(value), SERVER_WRITE_INTERVAL_MS)
+
+
+class Stats:
+    def __init__(self):
+        self.starts = []                        # Request start times, relative to the run
+        self.latency = []
+        self.status = {}
+        self.samples = 0
+        self.dropped = 0
+        self.timeouts = 0
+        self.offline = 0                        # Attempts before the station had an IP
+        self.queue_max = 0
+        self.hints = 0
+        self.holds = 0
+
+
+class Sensors:
+    """Slow random walks around plausible indoor values"""
+
+    def __init__(self, rng, warmup):
+        self.rng = rng
+        self.co2 = rng.uniform(450, 900)
+        self.temp = rng.uniform(19, 25)
+        self.rh = rng.uniform(30, 60)
+        self.tvoc = rng.uniform(0.1, 1.0)
+        self.warm = {name: rng.uniform(0.5, 1.5) * seconds for name, seconds in warmup.items()}
+
+    def step(self):
+        r = self.rng
+        self.co2 = min(5000, max(400, self.co2 + r.gauss(0, 15)))
+        self.temp += r.gauss(0, 0.05)
+        self.rh = min(95, max(5, self.rh + r.gauss(0, 0.3)))
+        self.tvoc = max(0.0, self.tvoc + r.gauss(0, 0.02))
+
+    def lines(self, uptime):
+        """Lines in the timer_send_data format, sensors still warming up are left out"""
+        out = []
+        if uptime >= self.warm["zmod"]:
+            iaq = 1 + self.tvoc * 2
+            out.append("zmod eco2=%.2f,etoh=%.2f,rcda=%.2f,iaq=%.2f,tvoc=%.2f,rmox=%.2f" % (
+                400 + self.tvoc * 600, self.tvoc * 0.4, 10 + self.rng.random(), iaq, self.tvoc, 1000 + self.rng.random() * 50))
+        if uptime >= self.warm["scd30"]:
+            out.append("scd30 temp=%.2f,co2=%.2f,rh=%.2f" % (self.temp, self.co2, self.rh))
+        if uptime >= self.warm["ccs811"]:
+            out.append("ccs811 eco2=%u,tvoc=%u,current=%u,adc=%u" % (
+                400 + int(self.tvoc * 500), int(self.tvoc * 200), 8 + self.rng.randrange(8), 400 + self.rng.randrange(200)))
+        return out
+
+
+class Logger:
+    def __init__(self, index, args, stats, t0, rng):
+        self.index = index
+        self.args = args
+        self.stats = stats
+        self.t0 = t0
+        self.rng = rng
+        self.boot = rng.uniform(0, args.boot_spread)
+        self.online = self.boot + args.wifi * rng.uniform(0.5, 1.5)
+        self.sensors = Sensors(rng, {"scd30": args.warmup_scd30, "ccs811": args.warmup_ccs811, "zmod": args.warmup_zmod})
+        self.queue = []
+        self.in_flight = False
+        self.in_flight_start = 0.0
+        # upload_sched.c
+        self.phase = phase_ms(random_mac(rng)) / 1000
+        self.hint = 0.0
+        self.hold_until = 0.0
+
+    def now(self):
+        return time.monotonic() - self.t0
+
+    async def run(self, stop):
+        await asyncio.sleep(max(0.0, self.boot - self.now()))
+        booted = self.now()
+        await asyncio.gather(self.timer_logger(booted, stop), self.timer_retry(booted, stop))
+
+    def next_interval(self):
+        if not self.args.spread:
+            return SERVER_WRITE_INTERVAL
+        delay = self.rng.uniform(*interval_bounds_ms()) / 1000 + self.hint
+        self.hint = 0.0
+        return delay
+
+    async def timer_logger(self, booted, stop):
+        due = booted + SERVER_WRITE_INTERVAL + (self.phase if self.args.spread else 0)
+        while due < stop:
+            await asyncio.sleep(max(0.0, due - self.now()))
+            self.sensors.step()
+            lines = self.sensors.lines(self.now() - booted)
+            if lines:
+                self.publish(lines)
+            # Re-armed at the end of timer_send_data
+            due = self.now() + self.args.tick_cost / 1000 + self.next_interval()
+
+    async def timer_retry(self, booted, stop):
+        due = booted + RETRY_INTERVAL
+        while due < stop:
+            await asyncio.sleep(max(0.0, due - self.now()))
+            if self.queue:
+                self.pump()
+            due += RETRY_INTERVAL
+
+    def publish(self, lines):
+        ts = int(time.time())
+        self.stats.samples += 1
+        self.queue.append("".join("%s %d\n" % (line, ts) for line in lines))
+        if len(self.queue) > HTTP_DEPTH:
+            self.stats.dropped += len(self.queue) - HTTP_DEPTH
+            del self.queue[:len(self.queue) - HTTP_DEPTH]
+        self.stats.queue_max = max(self.stats.queue_max, len(self.queue))
+        self.pump()
+
+    def pump(self):
+        if self.in_flight:
+            if self.now() - self.in_flight_start < HTTP_TIMEOUT:
+                return
+            self.stats.timeouts += 1
+            self.in_flight = False
+        if self.now() < self.online:
+            self.stats.offline += 1
+            return
+        if self.now() < self.hold_until:
+            return
+
+        body = self.queue.pop(0)
+        self.in_flight = True
+        self.in_flight_start = self.now()
+        self.stats.starts.append(self.in_flight_start)
+        asyncio.ensure_future(self.post(body, self.in_flight_start))
+
+    async def post(self, body, start):
+        url = self.args.parsed
+        status = 0
+        headers = {}
+        writer = None
+        try:
+            reader, writer = await asyncio.wait_for(
+                asyncio.open_connection(url.hostname, url.port or 80), timeout=HTTP_TIMEOUT)
+            data = body.encode()
+            head = ("POST %s HTTP/1.0\r\nHost: %s:%d\r\nConnection: close\r\nUser-Agent: ESP8266\r\n"
+                    "%sContent-Length: %d\r\n\r\n" % (
+                        url.path + ("?" + url.query if url.query else ""), url.hostname, url.port or 80,
+                        "Authorization: Token %s\r\n" % self.args.token if self.args.token else "", len(data)))
+            writer.write(head.encode() + data)
+            await writer.drain()
+            response = await asyncio.wait_for(reader.read(), timeout=HTTP_TIMEOUT)
+            lines = response.split(b"\r\n\r\n", 1)[0].decode("latin-1").split("\r\n")
+            parts = lines[0].split()
+            status = int(parts[1]) if len(parts) > 1 and parts[1].isdigit() else 0
+            headers = dict((name.strip().lower(), value.strip()) for name, _, value in
+                           (line.partition(":") for line in lines[1:]))
+        except (OSError, asyncio.TimeoutError, ValueError):
+            status = 0
+        finally:
+            if writer is not None:
+                writer.close()
+
+        # Given up by the timeout already
+        if not self.in_flight or self.in_flight_start != start:
+            return
+        self.in_flight = False
+        self.stats.latency.append(self.now() - start)
+        self.stats.status[status] = self.stats.status.get(status, 0) + 1
+
+        if self.args.spread and status:
+            self.hints(status, headers)
+
+    def hints(self, status, headers):
+        """upload_sched_response"""
+        value = headers.get(UPLOAD_SLOT_HEADER, "")
+        if value.isdigit():
+            self.hint = slot_hint_ms(value) / 1000
+            self.stats.hints += 1
+        value = headers.get("retry-after", "")
+        if status in (429, 503) and value.isdigit():
+            self.hold_until = self.now() + min(int(value), UPLOAD_RETRY_AFTER_MAX)
+            self.stats.holds += 1
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(math.ceil(p / 100 * len(values))) - 1)]
+
+
+def report(args, stats, duration):
+    seconds = int(math.ceil(duration))
+    per_second = [0] * max(seconds, 1)
+    for start in stats.starts:
+        per_second[min(int(start), len(per_second) - 1)] += 1
+
+    # Skip the boot transient, one interval plus the Wi-Fi time
+    settle = min(len(per_second) - 1, int(args.boot_spread + args.wifi * 1.5 + SERVER_WRITE_INTERVAL))
+    steady = per_second[settle:] or per_second
+    mean = sum(steady) / len(steady)
+    peak = max(steady)
+
+    starts = sorted(s for s in stats.starts if s >= settle)
+    burst, j = 0, 0
+    for i, start in enumerate(starts):
+        while start - starts[j] > 0.1:
+            j += 1
+        burst = max(burst, i - j + 1)
+
+    print("loggers %d, interval %.3f s, http depth %d, boot spread %.1f s, upload spread %s, %.0f s run" % (
+        args.loggers, SERVER_WRITE_INTERVAL, HTTP_DEPTH, args.boot_spread,
+        "+-%d ms jitter" % UPLOAD_JITTER_MS if args.spread else "off", duration))
+    print("requests %d, steady state from %d s: %.1f req/s mean, %d req/s peak, peak/mean %.1f, busiest 100 ms %d" % (
+        len(stats.starts), settle, mean, peak, peak / mean if mean else 0, burst))
+    print("latency p50 %.0f ms p95 %.0f ms p99 %.0f ms max %.0f ms" % tuple(
+        percentile(stats.latency, p) * 1000 for p in (50, 95, 99, 100)))
+    print("status %s, timeouts %d" % (" ".join("%d:%d" % kv for kv in sorted(stats.status.items())), stats.timeouts))
+    print("samples %d, dropped %d, offline attempts %d, max queue %d, slot hints %d, retry-after holds %d" % (
+        stats.samples, stats.dropped, stats.offline, stats.queue_max, stats.hints, stats.holds))
+
+    if args.csv:
+        with open(args.csv, "w") as f:
+            f.write("second,requests\n")
+            for second, count in enumerate(per_second):
+                f.write("%d,%d\n" % (second, count))
+
+
+def check_sched(program, count=200):
+    """Compare the model with upload_sched.c run by tools/host/upload_sched_test"""
+    rng = random.Random(1)
+    macs = [bytes(6), b"\xff" * 6] + [random_mac(rng) for _ in range(count)]
+    names = [":".join("%02x" % b for b in mac) for mac in macs]
+    result = subprocess.run([program] + names, stdout=subprocess.PIPE, universal_newlines=True)
+    errors = []
+    phases = {}
+    hints = 0
+
+    for line in result.stdout.splitlines():
+        fields = line.split()
+        if fields[0] == "phase":
+            phases[fields[1]] = int(fields[2])
+        elif fields[0] == "next" and tuple(map(int, fields[1:])) != interval_bounds_ms():
+            errors.append("next interval %s-%s ms, model %d-%d ms" % (tuple(fields[1:]) + interval_bounds_ms()))
+        elif fields[0] == "hint":
+            hints += 1
+            if int(fields[2]) != slot_hint_ms(fields[1]):
+                errors.append("slot header %s delays %s ms, model %d ms" % (fields[1], fields[2], slot_hint_ms(fields[1])))
+        elif fields[0] == "FAIL":
+            errors.append(line)
+
+    for name, mac in zip(names, macs):
+        if phases.get(name) != phase_ms(mac):
+            errors.append("MAC %s phase %s ms, model %d ms" % (name, phases.get(name), phase_ms(mac)))
+
+    for error in errors[:10]:
+        print(error)
+    print("upload_sched: %d phases, next %d-%d ms, %d slot hints, %s" % (
+        len(phases), *interval_bounds_ms(), hints, "FAILED" if errors or result.returncode else "OK"))
+    return 1 if errors or result.returncode else 0
+
+
+async def simulate(args):
+    stats = Stats()
+    master = random.Random(args.seed)
+    t0 = time.monotonic()
+    loggers = [Logger(i, args, stats, t0, random.Random(master.random())) for i in range(args.loggers)]
+    await asyncio.gather(*(logger.run(args.duration) for logger in loggers))
+    # Let the last requests finish
+    await asyncio.sleep(min(HTTP_TIMEOUT, args.drain))
+    report(args, stats, args.duration)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-n", "--loggers", type=int, default=100)
+    parser.add_argument("--url", default="http://127.0.0.1:8086/api/v2/write?org=o&bucket=b&precision=s")
+    parser.add_argument("--token")
+    parser.add_argument("--duration", type=float, default=60, help="[s]")
+    parser.add_argument("--boot-spread", type=float, default=0, help="[s] boards boot uniformly in this window")
+    parser.add_argument("--wifi", type=float, default=3, help="[s] mean time from boot to an IP")
+    parser.add_argument("--tick-cost", type=float, default=5, help="[ms] timer_send_data run time")
+    parser.add_argument("--warmup-scd30", type=float, default=2, help="[s]")
+    parser.add_argument("--warmup-ccs811", type=float, default=20, help="[s]")
+    parser.add_argument("--warmup-zmod", type=float, default=6, help="[s]")
+    parser.add_argument("--drain", type=float, default=5, help="[s] wait for the last answers")
+    parser.add_argument("--csv", help="write the requests per second here")
+    parser.add_argument("--spread", dest="spread", action="store_true", default=UPLOAD_SPREAD,
+                        help="model UPLOAD_SPREAD_ENABLE%s" % (" (default)" if UPLOAD_SPREAD else ""))
+    parser.add_argument("--no-spread", dest="spread", action="store_false")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--check-sched", metavar="PROGRAM",
+                        help="compare the upload_sched.c model with tools/host/build/upload_sched_test and exit")
+    args = parser.parse_args()
+
+    if args.check_sched:
+        sys.exit(check_sched(args.check_sched))
+
+    args.parsed = urllib.parse.urlsplit(args.url)
+    if args.parsed.scheme != "http":
+        parser.error("only http:// URLs")
+
+    asyncio.run(simulate(args))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+"""Gateway peer simulator: N virtual peer loggers sending datagrams to a gateway (src/gateway.c).
+
+`peers` sends, every --interval seconds per node, one datagram with the five lines of
+timer_send_data (zmod, zmod_reset, zmod_halt, scd30, ccs811) of that node, in the format
+of include/gateway.h. That is a full gateway batch with -n GATEWAY_MAX_PEERS. Every node has its own
+MAC, a random sequence start and a random phase. To exercise the gateway bookkeeping:
+
+  --loss P      datagrams not sent, the gateway should count them as lost.
+  --dup P       datagrams sent twice, the second copy must be ignored.
+  --invalid P   datagrams with a bad length, counted as invalid.
+  --restart P   node reboots: new random sequence start, not counted as lost.
+
+`listen` is the gateway side for testing peer firmware: it decodes the datagrams and
+prints the line protocol the gateway would post, with the per-peer gaps.
+
+    python3 tools/gateway_peer_sim.py peers -n 6 --gateway 192.168.1.3 --interval 10
+    python3 tools/gateway_peer_sim.py listen [-p 8090]
+"""
+
+import argparse
+import random
+import socket
+import struct
+import time
+
+VERSION = 1
+HEADER = struct.Struct("<2sBB6sHI")
+SEQ_WINDOW = 256                                # Larger sequence jumps are peer reboots
+
+# Index + 1 is the id, as in gateway.c
+MEASUREMENTS = [
+    ("zmod",       ("eco2", "etoh", "rcda", "iaq", "tvoc", "rmox")),
+    ("zmod_reset", ("eco2", "etoh", "rcda", "iaq", "tvoc", "rmox")),
+    ("zmod_halt",  ("eco2", "etoh", "rcda", "iaq", "tvoc", "rmox")),
+    ("scd30",      ("temp", "co2", "rh")),
+    ("ccs811",     ("eco2", "tvoc", "current", "adc")),
+]
+IDS = {name: i + 1 for i, (name, _) in enumerate(MEASUREMENTS)}
+
+
+def milli(value):
+    """x1000 fixed point, clamped like gateway.c"""
+    return max(-2147483000, min(round(value * 1000), 2147483000))
+
+
+def encode(mac, seq, ts, lines):
+    """lines: [(measurement, {field: value})]"""
+    body = b""
+    for name, values in lines:
+        _, fields = MEASUREMENTS[IDS[name] - 1]
+        body += struct.pack("<B%di" % len(fields), IDS[name], *(milli(values[f]) for f in fields))
+    return HEADER.pack(b"GW", VERSION, len(lines), mac, seq & 0xffff, ts) + body
+
+
+def decode(data):
+    """(mac, seq, ts, [(measurement, [(field, value)])]), ValueError if invalid"""
+    if len(data) < HEADER.size:
+        raise ValueError("short datagram")
+    magic, version, count, mac, seq, ts = HEADER.unpack_from(data)
+    if magic != b"GW" or version != VERSION:
+        raise ValueError("bad magic or version")
+
+    lines, pos = [], HEADER.size
+    for _ in range(count):
+        if pos >= len(data) or not 1 <= data[pos] <= len(MEASUREMENTS):
+            raise ValueError("bad id")
+        name, fields = MEASUREMENTS[data[pos] - 1]
+        values = struct.unpack_from("<%di" % len(fields), data, pos + 1)
+        lines.append((name, [(f, v / 1000) for f, v in zip(fields, values)]))
+        pos += 1 + 4 * len(fields)
+    if pos != len(data):
+        raise ValueError("length %d, expected %d" % (len(data), pos))
+
+    return mac, seq, ts, lines
+
+
+class Node:
+    def __init__(self, index, rng):
+        self.rng = rng
+        self.mac = bytes([0x5c, 0xcf, 0x7f, rng.randrange(256), index >> 8 & 0xff, index & 0xff])
+        self.seq = rng.randrange(1 << 16)
+        self.co2 = rng.uniform(450, 900)
+
+    def zmod(self, eco2):
+        rng = self.rng
+        return {"eco2": eco2 + rng.gauss(0, 30), "etoh": rng.uniform(0, 2), "rcda": rng.uniform(1e3, 1e5),
+                "iaq": rng.uniform(1, 3), "tvoc": rng.uniform(0, 1), "rmox": rng.uniform(1e4, 1e6)}
+
+    def lines(self):
+        """The timer_send_data order"""
+        rng = self.rng
+        self.co2 = min(max(self.co2 + rng.gauss(0, 15), 400), 5000)
+        eco2 = self.co2 + rng.gauss(0, 30)
+        return [
+            ("zmod", self.zmod(eco2)),
+            ("zmod_reset", self.zmod(eco2)),
+            ("zmod_halt", self.zmod(eco2)),
+            ("scd30", {"temp": rng.uniform(19, 25), "co2": self.co2, "rh": rng.uniform(30, 60)}),
+            ("ccs811", {"eco2": eco2, "tvoc": rng.uniform(0, 300), "current": 10, "adc": rng.randrange(300, 600)}),
+        ]
+
+
+def run_peers(args):
+    rng = random.Random(args.seed)
+    nodes = [Node(i, rng) for i in range(args.nodes)]
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    target = (args.gateway, args.port)
+    counts = {"sent": 0, "lines": 0, "lost": 0, "dup": 0, "invalid": 0, "restart": 0}
+
+    start = time.monotonic()
+    due = [(start + rng.uniform(0, args.interval), i) for i in range(args.nodes)]
+    end = start + args.duration if args.duration else None
+
+    try:
+        while end is None or time.monotonic() < end:
+            due.sort()
+            when, i = due.pop(0)
+            time.sleep(max(0, when - time.monotonic()))
+            due.append((when + args.interval, i))
+            node = nodes[i]
+
+            if rng.random() < args.restart:
+                node.seq = rng.randrange(1 << 16)
+                counts["restart"] += 1
+
+            lines = node.lines()
+            data = encode(node.mac, node.seq, int(time.time()), lines)
+            node.seq += 1
+
+            if rng.random() < args.loss:
+                counts["lost"] += 1
+                continue
+            if rng.random() < args.invalid:
+                data = data[:-1]
+                counts["invalid"] += 1
+
+            sock.sendto(data, target)
+            counts["sent"] += 1
+            counts["lines"] += len(lines)
+            if rng.random() < args.dup:
+                sock.sendto(data, target)
+                counts["dup"] += 1
+    except KeyboardInterrupt:
+        pass
+
+    print("nodes %d datagrams sent %d (lines %d) not sent %d duplicated %d invalid %d restarts %d" % (
+        args.nodes, counts["sent"], counts["lines"], counts["lost"], counts["dup"], counts["invalid"], counts["restart"]))
+
+
+def run_listen(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    print("listening on %s:%d" % (args.bind, args.port))
+    next_seq = {}
+
+    try:
+        while True:
+            data, addr = sock.recvfrom(2048)
+            try:
+                mac, seq, ts, lines = decode(data)
+            except ValueError as err:
+                print("%s:%d: invalid datagram: %s" % (addr[0], addr[1], err))
+                continue
+
+            peer = mac.hex()
+            gap = (seq - next_seq[peer]) & 0xffff if peer in next_seq else 0
+            if gap and -gap & 0xffff <= SEQ_WINDOW:
+                print("%s: duplicate or late seq %d" % (peer, seq))
+                continue
+            if gap > SEQ_WINDOW:
+                print("%s: restarted" % peer)
+            elif gap:
+                print("%s: %d datagrams lost" % (peer, gap))
+            next_seq[peer] = (seq + 1) & 0xffff
+
+            for name, fields in lines:
+                print("%s,peer=%s %s%s" % (name, peer, ",".join("%s=%.3f" % fv for fv in fields),
+                                           " %d" % ts if ts else ""))
+    except KeyboardInterrupt:
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    peers = sub.add_parser("peers", help="send datagrams as N peer nodes")
+    peers.add_argument("-n", "--nodes", type=int, default=6)
+    peers.add_argument("-g", "--gateway", default="127.0.0.1")
+    peers.add_argument("-p", "--port", type=int, default=8090)
+    peers.add_argument("-i", "--interval", type=float, default=10, help="seconds between datagrams of a node")
+    peers.add_argument("-d", "--duration", type=float, default=0, help="seconds, 0 to run until interrupted")
+    peers.add_argument("--loss", type=float, default=0)
+    peers.add_argument("--dup", type=float, default=0)
+    peers.add_argument("--invalid", type=float, default=0)
+    peers.add_argument("--restart", type=float, default=0)
+    peers.add_argument("--seed", type=int)
+
+    listen = sub.add_parser("listen", help="decode datagrams like the gateway")
+    listen.add_argument("-p", "--port", type=int, default=8090)
+    listen.add_argument("-b", "--bind", default="0.0.0.0")
+
+    args = parser.parse_args()
+    if args.mode == "peers":
+        run_peers(args)
+    else:
+        run_listen(args)
+
+
+if __name__ == "__main__":
+    main()
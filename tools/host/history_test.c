@@ -0,0 +1,291 @@
+/**
+ * \file history_test.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief src/history.c on a host flash image, against a model of the ring. Source file.
+ * \version 0.1
+ * \date 2021-04-21
+ *
+ * Appends millions of samples, so the ring wraps many times, with random gaps
+ * between timestamps. Every few tens of thousands of samples the board "reboots":
+ * history_init() rebuilds the index from the same flash image. Some reboots happen
+ * right after the oldest sector was erased and its magic written, before its first
+ * record, like a power loss in the middle of history_append().
+ *
+ * After every append the record count must match the model. Around every reboot and
+ * at random points, seeks to random timestamps must land on the first stored record
+ * at or after them and history_next() must walk the following records in order.
+ * A read position taken in the oldest sector must stop once the writer erases it.
+ *
+ *     make -C tools/host test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <osapi.h>
+#include <spi_flash.h>
+
+#include "host_sdk.h"
+#include "history.h"
+
+#define SAMPLES      3000000
+#define CAPACITY     ((uint32_t)HISTORY_FLASH_SECTORS * HISTORY_SECTOR_SLOTS)
+#define REBOOT_EVERY 60000                      /* Max appends between reboots */
+#define SEEKS        200                        /* Random seeks per check */
+#define WALK         400                        /* Records read after every seek */
+
+static uint32_t* model;                         /* Timestamp of every appended sample */
+static uint32_t  appended;
+static uint32_t  failures;
+static uint32_t  reboots;
+static uint32_t  torn_reboots;
+static uint32_t  seeks;
+static uint64_t  walked;
+static uint8_t   torn;                          /* Oldest sector lost to a torn append, until the next append */
+
+static uint32_t rng = 2463534242u;
+
+#define CHECK(cond, ...)                                                        \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            if (failures++ < 10) {                                              \
+                printf("FAIL %s:%d after %u samples: ", __FILE__, __LINE__, appended); \
+                printf(__VA_ARGS__);                                            \
+                printf("\n");                                                   \
+            }                                                                   \
+        }                                                                       \
+    } while (0)
+
+/* xorshift32, independent of os_random() */
+static uint32_t
+rand32(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/* Every field derived from the timestamp, so a record read back can be checked alone */
+static void
+record_fill(history_record_t* p_record, uint32_t ts) {
+    os_memset(p_record, 0, sizeof(*p_record));
+    p_record->ts          = ts;
+    p_record->scd30_co2   = ts;
+    p_record->scd30_temp  = ts >> 3;
+    p_record->scd30_rh    = ts >> 5;
+    p_record->ccs811_eco2 = ~ts;
+    p_record->ccs811_tvoc = ts ^ 0x5A5A;
+    p_record->zmod_eco2   = ts >> 16;
+    p_record->zmod_iaq    = ts * 7;
+    p_record->zmod_tvoc   = ts * 13;
+    p_record->valid       = ts & 0x07;
+}
+
+static uint8_t
+record_ok(const history_record_t* p_record) {
+    history_record_t expected;
+
+    record_fill(&expected, p_record->ts);
+    return os_memcmp(&expected, p_record, sizeof(expected)) == 0;
+}
+
+/* Records the ring holds after `n` appends: whole sectors, the oldest one erased on wrap */
+static uint32_t
+ring_count(uint32_t n) {
+    uint32_t sectors = (n + HISTORY_SECTOR_SLOTS - 1) / HISTORY_SECTOR_SLOTS;
+    uint32_t head_slot = n - (sectors - 1) * HISTORY_SECTOR_SLOTS;
+
+    if (n == 0) {
+        return 0;
+    }
+    if (sectors > HISTORY_FLASH_SECTORS) {
+        sectors = HISTORY_FLASH_SECTORS;
+    }
+    return (sectors - 1) * HISTORY_SECTOR_SLOTS + head_slot;
+}
+
+/* Append `n` samples, 1 to 30 s apart */
+static void
+append_n(uint32_t n) {
+    history_record_t record;
+    uint32_t ts;
+
+    while (n-- > 0) {
+        ts = (appended ? model[appended - 1] : 1600000000) + 1 + rand32() % 30;
+        record_fill(&record, ts);
+        if (history_append(&record) != STA_OK) {
+            CHECK(0, "append %u failed", ts);
+            return;
+        }
+        model[appended++] = ts;
+        torn = 0;
+        CHECK(history_count() == ring_count(appended), "count %u, model %u", history_count(), ring_count(appended));
+    }
+}
+
+/* The same, after a torn append erased the oldest sector of a full ring early */
+static uint32_t
+stored(void) {
+    uint32_t count = ring_count(appended);
+
+    if (torn && count == CAPACITY) {
+        count -= HISTORY_SECTOR_SLOTS;
+    }
+    return count;
+}
+
+/* Index in `model` of the first stored sample at or after `ts`. `appended` if none */
+static uint32_t
+model_seek(uint32_t ts) {
+    uint32_t lo = appended - stored();
+    uint32_t hi = appended;
+    uint32_t mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (model[mid] < ts) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void
+check_seek(uint32_t ts) {
+    history_pos_t pos;
+    history_record_t record;
+    uint32_t i = model_seek(ts);
+    uint32_t n;
+    uint8_t found = history_seek(ts, &pos);
+
+    seeks += 1;
+    CHECK(found == (i < appended), "seek %u found %u, model index %u of %u", ts, found, i, appended);
+    if (!found) {
+        return;
+    }
+
+    for (n = 0; n < WALK && i < appended; ++n, ++i) {
+        if (!history_next(&pos, &record)) {
+            CHECK(0, "next stopped %u records after seek %u", n, ts);
+            return;
+        }
+        if (record.ts != model[i]) {
+            CHECK(0, "seek %u record %u ts %u, model %u", ts, n, record.ts, model[i]);
+            return;
+        }
+        CHECK(record_ok(&record), "record %u corrupted", record.ts);
+    }
+    walked += n;
+
+    if (i == appended) {
+        CHECK(!history_next(&pos, &record), "next past the newest record");
+    }
+}
+
+static void
+check_ring(void) {
+    uint32_t oldest;
+    uint32_t newest;
+
+    CHECK(history_count() == stored(), "count %u, model %u", history_count(), stored());
+    CHECK(history_last_ts() == (appended ? model[appended - 1] : 0), "last ts %u", history_last_ts());
+    if (appended == 0) {
+        return;
+    }
+
+    oldest = model[appended - stored()];
+    newest = model[appended - 1];
+
+    check_seek(0);
+    check_seek(oldest);
+    check_seek(newest);
+    check_seek(newest + 1);
+    for (uint16_t i = 0; i < SEEKS; ++i) {
+        check_seek(oldest - 5 + rand32() % (newest - oldest + 10));
+    }
+}
+
+static void
+reboot(void) {
+    reboots += 1;
+    CHECK(history_init() == STA_OK, "init failed");
+    check_ring();
+}
+
+/* Power loss in history_append() after erasing the next sector and writing its magic */
+static void
+torn_reboot(void) {
+    uint32_t next = (appended / HISTORY_SECTOR_SLOTS) % HISTORY_FLASH_SECTORS;
+    uint32_t magic = HISTORY_SECTOR_MAGIC;
+
+    spi_flash_erase_sector(HISTORY_FLASH_SECTOR + next);
+    spi_flash_write((HISTORY_FLASH_SECTOR + next) * HISTORY_SECTOR_SIZE, &magic, 4);
+
+    torn = 1;
+    torn_reboots += 1;
+    reboot();
+}
+
+/* A reader in the oldest sector while the writer wraps over it */
+static void
+check_reused(void) {
+    history_pos_t pos;
+    history_record_t record;
+    uint32_t oldest = model[appended - stored()];
+
+    CHECK(history_seek(oldest, &pos), "seek oldest %u", oldest);
+    CHECK(history_next(&pos, &record) && record.ts == oldest, "read oldest %u", oldest);
+    append_n(HISTORY_SECTOR_SLOTS);
+    CHECK(!history_next(&pos, &record), "next in an erased sector returned %u", record.ts);
+}
+
+int
+main(int argc, char** argv) {
+    uint32_t samples = argc > 1 ? strtoul(argv[1], NULL, 0) : SAMPLES;
+    uint32_t next_reboot;
+    host_flash_stats_t* p_flash = host_flash_stats();
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    model = malloc(sizeof(*model) * (samples + 2 * HISTORY_SECTOR_SLOTS));
+    if (model == NULL) {
+        return 1;
+    }
+
+    CHECK(history_init() == STA_OK, "init on blank flash");
+    check_ring();
+
+    next_reboot = 1 + rand32() % REBOOT_EVERY;
+    while (appended < samples && failures == 0) {
+        append_n(1);
+
+        if (appended == next_reboot) {
+            /* Every third reboot on a full head sector, the only place an append can tear */
+            if (reboots % 3 == 0 && appended % HISTORY_SECTOR_SLOTS != 0) {
+                next_reboot += HISTORY_SECTOR_SLOTS - appended % HISTORY_SECTOR_SLOTS;
+                continue;
+            }
+            if (appended % HISTORY_SECTOR_SLOTS == 0) {
+                torn_reboot();
+            } else {
+                reboot();
+            }
+            next_reboot = appended + 1 + rand32() % REBOOT_EVERY;
+        } else if (appended % 100003 == 0) {
+            check_ring();
+        }
+    }
+
+    check_reused();
+    reboot();
+
+    printf("%u samples, %u wraps, %u reboots (%u torn), %u seeks, %llu records walked\n",
+           appended, appended / CAPACITY, reboots, torn_reboots, seeks, (unsigned long long)walked);
+    printf("flash erases %u writes %u reads %u errors %u\n",
+           p_flash->erases, p_flash->writes, p_flash->reads, p_flash->errors);
+    CHECK(p_flash->errors == 0, "%u flash access errors", p_flash->errors);
+
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,750 @@
+/**
+ * \file host_sdk.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief NONOS SDK stand-in to run firmware modules on a Linux host. Source file.
+ * \version 0.1
+ * \date 2021-04-20
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <osapi.h>
+#include <mem.h>
+#include <espconn.h>
+#include <sntp.h>
+#include <spi_flash.h>
+#include <user_interface.h>
+
+#include "host_sdk.h"
+
+/* Heap */
+
+typedef union {
+    size_t size;
+    max_align_t align;
+} heap_header_t;
+
+static host_heap_stats_t heap;
+
+void*
+host_malloc(size_t size) {
+    heap_header_t* p = malloc(sizeof(heap_header_t) + size);
+
+    if (p == NULL || heap.used + size > HOST_HEAP_FREE) {
+        free(p);
+        return NULL;
+    }
+
+    p->size = size;
+    heap.allocs += 1;
+    heap.used += size;
+    if (heap.used > heap.peak) {
+        heap.peak = heap.used;
+    }
+
+    return p + 1;
+}
+
+void*
+host_zalloc(size_t size) {
+    void* p = host_malloc(size);
+
+    if (p != NULL) {
+        memset(p, 0, size);
+    }
+
+    return p;
+}
+
+void
+host_free(void* ptr) {
+    heap_header_t* p = (heap_header_t*)ptr - 1;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    heap.used -= p->size;
+    free(p);
+}
+
+void*
+host_realloc(void* ptr, size_t size) {
+    void* p = host_malloc(size);
+
+    if (p != NULL && ptr != NULL) {
+        size_t old = ((heap_header_t*)ptr - 1)->size;
+
+        memcpy(p, ptr, old < size ? old : size);
+        host_free(ptr);
+    }
+
+    return p;
+}
+
+host_heap_stats_t*
+host_heap_stats(void) {
+    return &heap;
+}
+
+uint32
+system_get_free_heap_size(void) {
+    return HOST_HEAP_FREE - heap.used;
+}
+
+/* Time */
+
+static uint64_t start_us;
+static uint32_t fixed_ts;
+
+uint64_t
+host_monotonic_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t
+now_us(void) {
+    if (start_us == 0) {
+        start_us = host_monotonic_us();
+    }
+
+    return host_monotonic_us() - start_us;
+}
+
+uint32
+system_get_time(void) {
+    return (uint32)now_us();
+}
+
+void
+os_delay_us(uint16 us) {
+    uint64_t end = now_us() + us;
+
+    while (now_us() < end);
+}
+
+void
+system_soft_wdt_feed(void) {
+}
+
+void
+host_set_timestamp(uint32_t ts) {
+    fixed_ts = ts;
+}
+
+uint32
+sntp_get_current_timestamp(void) {
+    return fixed_ts != 0 ? fixed_ts : (uint32)time(NULL);
+}
+
+/* Wi-Fi */
+
+static uint8_t macaddr[6] = {0x5C, 0xCF, 0x7F, 0x00, 0x00, 0x01};
+
+void
+host_set_macaddr(const uint8_t* mac) {
+    os_memcpy(macaddr, mac, sizeof(macaddr));
+}
+
+bool
+wifi_get_macaddr(uint8 if_index, uint8* mac) {
+    os_memcpy(mac, macaddr, sizeof(macaddr));
+    return true;
+}
+
+/* Timers, a list sorted by expiry. `timer_expire` is in ms since start */
+
+static os_timer_t* timers;
+
+static uint32_t
+now_ms(void) {
+    return (uint32_t)(now_us() / 1000);
+}
+
+void
+os_timer_disarm(os_timer_t* ptimer) {
+    for (os_timer_t** pp = &timers; *pp != NULL; pp = &(*pp)->timer_next) {
+        if (*pp == ptimer) {
+            *pp = ptimer->timer_next;
+            break;
+        }
+    }
+    ptimer->timer_next = NULL;
+}
+
+static void
+timer_insert(os_timer_t* ptimer) {
+    os_timer_t** pp = &timers;
+
+    while (*pp != NULL && (int32_t)((*pp)->timer_expire - ptimer->timer_expire) <= 0) {
+        pp = &(*pp)->timer_next;
+    }
+    ptimer->timer_next = *pp;
+    *pp = ptimer;
+}
+
+void
+os_timer_setfn(os_timer_t* ptimer, os_timer_func_t* pfunction, void* parg) {
+    os_timer_disarm(ptimer);
+    ptimer->timer_func = pfunction;
+    ptimer->timer_arg = parg;
+}
+
+void
+os_timer_arm(os_timer_t* ptimer, uint32 msec, bool repeat_flag) {
+    os_timer_disarm(ptimer);
+    ptimer->timer_expire = now_ms() + msec;
+    ptimer->timer_period = repeat_flag ? (msec > 0 ? msec : 1) : 0;
+    timer_insert(ptimer);
+}
+
+static void
+timers_run(void) {
+    uint32_t now = now_ms();
+    os_timer_t* ptimer;
+
+    while (timers != NULL && (int32_t)(timers->timer_expire - now) <= 0) {
+        ptimer = timers;
+        timers = ptimer->timer_next;
+        ptimer->timer_next = NULL;
+
+        if (ptimer->timer_period) {
+            ptimer->timer_expire += ptimer->timer_period;
+            timer_insert(ptimer);
+        }
+        ptimer->timer_func(ptimer->timer_arg);
+    }
+}
+
+/* Tasks, one per priority */
+
+typedef struct {
+    os_task_t   task;
+    os_event_t* queue;
+    uint8_t     len;
+    uint8_t     head;
+    uint8_t     count;
+} task_t;
+
+static task_t tasks[USER_TASK_PRIO_MAX];
+
+bool
+system_os_task(os_task_t task, uint8 prio, os_event_t* queue, uint8 qlen) {
+    if (prio >= USER_TASK_PRIO_MAX || tasks[prio].task != NULL || qlen == 0) {
+        return false;
+    }
+
+    tasks[prio].task  = task;
+    tasks[prio].queue = queue;
+    tasks[prio].len   = qlen;
+    return true;
+}
+
+bool
+system_os_post(uint8 prio, os_signal_t sig, os_param_t par) {
+    task_t* p_task;
+    os_event_t* p_event;
+
+    if (prio >= USER_TASK_PRIO_MAX) {
+        return false;
+    }
+    p_task = &tasks[prio];
+    if (p_task->task == NULL || p_task->count == p_task->len) {
+        return false;
+    }
+
+    p_event = &p_task->queue[(p_task->head + p_task->count) % p_task->len];
+    p_event->sig = sig;
+    p_event->par = par;
+    p_task->count += 1;
+    return true;
+}
+
+/* One event of the highest priority task with work. 0 if none */
+static uint8_t
+tasks_run_one(void) {
+    for (int8_t prio = USER_TASK_PRIO_MAX - 1; prio >= 0; --prio) {
+        task_t* p_task = &tasks[prio];
+        os_event_t event;
+
+        if (p_task->count == 0) {
+            continue;
+        }
+
+        event = p_task->queue[p_task->head];
+        p_task->head = (p_task->head + 1) % p_task->len;
+        p_task->count -= 1;
+        p_task->task(&event);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* espconn over host sockets */
+
+typedef struct {
+    int fd;                                     /* -1 if the slot is free */
+    struct espconn* p_conn;
+    struct espconn* p_listener;                 /* NULL for a listening socket */
+    uint8_t max_conn;                           /* Listener only */
+    uint32_t idle_s;                            /* Listener only, 0 for no timeout */
+    const uint8_t* tx;                          /* Data of the espconn_send in flight */
+    uint16_t tx_len;
+    uint16_t tx_off;
+    uint64_t last_us;                           /* Last traffic */
+    uint8_t closing;                            /* espconn_disconnect, close once sent */
+} sock_t;
+
+static sock_t socks[HOST_MAX_SOCKS];
+static uint8_t socks_ready;
+
+static void
+socks_init(void) {
+    if (!socks_ready) {
+        for (uint8_t i = 0; i < HOST_MAX_SOCKS; ++i) {
+            socks[i].fd = -1;
+        }
+        signal(SIGPIPE, SIG_IGN);
+        socks_ready = 1;
+    }
+}
+
+static sock_t*
+sock_find(struct espconn* p_conn) {
+    for (uint8_t i = 0; i < HOST_MAX_SOCKS; ++i) {
+        if (socks[i].fd >= 0 && socks[i].p_conn == p_conn) {
+            return &socks[i];
+        }
+    }
+
+    return NULL;
+}
+
+static sock_t*
+sock_alloc(int fd) {
+    socks_init();
+
+    for (uint8_t i = 0; i < HOST_MAX_SOCKS; ++i) {
+        if (socks[i].fd < 0) {
+            memset(&socks[i], 0, sizeof(sock_t));
+            socks[i].fd = fd;
+            socks[i].last_us = now_us();
+            return &socks[i];
+        }
+    }
+
+    return NULL;
+}
+
+static uint8_t
+listener_clients(struct espconn* p_listener) {
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < HOST_MAX_SOCKS; ++i) {
+        if (socks[i].fd >= 0 && socks[i].p_listener == p_listener) {
+            count += 1;
+        }
+    }
+
+    return count;
+}
+
+/* Close a client and report it, like lwIP does after a FIN, RST or timeout */
+static void
+sock_close(sock_t* p_sock) {
+    struct espconn* p_conn = p_sock->p_conn;
+
+    close(p_sock->fd);
+    p_sock->fd = -1;
+
+    if (p_conn->proto.tcp->disconnect_callback != NULL) {
+        p_conn->proto.tcp->disconnect_callback(p_conn);
+    }
+
+    free(p_conn->proto.tcp);
+    free(p_conn);
+}
+
+sint8
+espconn_accept(struct espconn* espconn) {
+    struct sockaddr_in addr = {0};
+    int one = 1;
+    sock_t* p_sock;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return ESPCONN_MEM;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(espconn->proto.tcp->local_port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return ESPCONN_ISCONN;
+    }
+
+    p_sock = sock_alloc(fd);
+    if (p_sock == NULL) {
+        close(fd);
+        return ESPCONN_MEM;
+    }
+    p_sock->p_conn = espconn;
+    p_sock->max_conn = 5;                       /* SDK default */
+    espconn->state = ESPCONN_LISTEN;
+
+    return ESPCONN_OK;
+}
+
+sint8
+espconn_tcp_set_max_con_allow(struct espconn* espconn, uint8 num) {
+    sock_t* p_sock = sock_find(espconn);
+
+    if (p_sock == NULL || p_sock->p_listener != NULL) {
+        return ESPCONN_ARG;
+    }
+
+    p_sock->max_conn = num;
+    return ESPCONN_OK;
+}
+
+sint8
+espconn_regist_time(struct espconn* espconn, uint32 interval, uint8 type_flag) {
+    sock_t* p_sock = sock_find(espconn);
+
+    if (p_sock == NULL) {
+        return ESPCONN_ARG;
+    }
+
+    /* Listener: all its connections. type_flag 1 would be this one only */
+    p_sock->idle_s = interval;
+    return ESPCONN_OK;
+}
+
+sint8
+espconn_regist_connectcb(struct espconn* espconn, espconn_connect_callback connect_cb) {
+    espconn->proto.tcp->connect_callback = connect_cb;
+    return ESPCONN_OK;
+}
+
+sint8
+espconn_regist_recvcb(struct espconn* espconn, espconn_recv_callback recv_cb) {
+    espconn->recv_callback = recv_cb;
+    return ESPCONN_OK;
+}
+
+sint8
+espconn_regist_sentcb(struct espconn* espconn, espconn_sent_callback sent_cb) {
+    espconn->sent_callback = sent_cb;
+    return ESPCONN_OK;
+}
+
+sint8
+espconn_regist_disconcb(struct espconn* espconn, espconn_connect_callback discon_cb) {
+    espconn->proto.tcp->disconnect_callback = discon_cb;
+    return ESPCONN_OK;
+}
+
+sint8
+espconn_regist_reconcb(struct espconn* espconn, espconn_reconnect_callback recon_cb) {
+    espconn->proto.tcp->reconnect_callback = recon_cb;
+    return ESPCONN_OK;
+}
+
+sint8
+espconn_send(struct espconn* espconn, uint8* psent, uint16 length) {
+    sock_t* p_sock = sock_find(espconn);
+
+    if (p_sock == NULL || p_sock->p_listener == NULL || p_sock->closing) {
+        return ESPCONN_ARG;
+    }
+    /* The previous send is not done, lwIP has no room */
+    if (p_sock->tx != NULL) {
+        return ESPCONN_MAXNUM;
+    }
+
+    p_sock->tx = psent;
+    p_sock->tx_len = length;
+    p_sock->tx_off = 0;
+    return ESPCONN_OK;
+}
+
+sint8
+espconn_disconnect(struct espconn* espconn) {
+    sock_t* p_sock = sock_find(espconn);
+
+    if (p_sock == NULL || p_sock->p_listener == NULL) {
+        return ESPCONN_ARG;
+    }
+
+    p_sock->closing = 1;
+    return ESPCONN_OK;
+}
+
+static void
+listener_accept(sock_t* p_listener) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    struct espconn* p_conn;
+    sock_t* p_sock;
+    int one = 1;
+    int fd;
+
+    while ((fd = accept4(p_listener->fd, (struct sockaddr*)&addr, &addr_len, SOCK_NONBLOCK)) >= 0) {
+        /* Over the limit lwIP refuses the connection */
+        if (listener_clients(p_listener->p_conn) >= p_listener->max_conn || (p_sock = sock_alloc(fd)) == NULL) {
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        p_conn = calloc(1, sizeof(struct espconn));
+        p_conn->type = ESPCONN_TCP;
+        p_conn->state = ESPCONN_CONNECT;
+        p_conn->proto.tcp = calloc(1, sizeof(esp_tcp));
+        p_conn->proto.tcp->local_port = p_listener->p_conn->proto.tcp->local_port;
+        p_conn->proto.tcp->remote_port = ntohs(addr.sin_port);
+        memcpy(p_conn->proto.tcp->remote_ip, &addr.sin_addr.s_addr, 4);
+        p_conn->reverse = p_listener->p_conn->reverse;
+
+        p_sock->p_conn = p_conn;
+        p_sock->p_listener = p_listener->p_conn;
+        p_sock->idle_s = p_listener->idle_s;
+
+        if (p_listener->p_conn->proto.tcp->connect_callback != NULL) {
+            p_listener->p_conn->proto.tcp->connect_callback(p_conn);
+        }
+        addr_len = sizeof(addr);
+    }
+}
+
+static void
+sock_read(sock_t* p_sock) {
+    char buff[1460];
+    ssize_t len = recv(p_sock->fd, buff, sizeof(buff), 0);
+
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+        sock_close(p_sock);
+        return;
+    }
+    if (len < 0) {
+        return;
+    }
+
+    p_sock->last_us = now_us();
+    if (p_sock->p_conn->recv_callback != NULL) {
+        p_sock->p_conn->recv_callback(p_sock->p_conn, buff, (unsigned short)len);
+    }
+}
+
+/* One segment per pass, the data is read from the sender buffer only now */
+static void
+sock_write(sock_t* p_sock) {
+    size_t len = p_sock->tx_len - p_sock->tx_off;
+    ssize_t sent;
+
+    if (len > HOST_TCP_MSS) {
+        len = HOST_TCP_MSS;
+    }
+
+    sent = send(p_sock->fd, p_sock->tx + p_sock->tx_off, len, 0);
+    if (sent < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            sock_close(p_sock);
+        }
+        return;
+    }
+
+    p_sock->tx_off += sent;
+    p_sock->last_us = now_us();
+    if (p_sock->tx_off < p_sock->tx_len) {
+        return;
+    }
+
+    p_sock->tx = NULL;
+    if (p_sock->p_conn->sent_callback != NULL) {
+        p_sock->p_conn->sent_callback(p_sock->p_conn);
+    }
+}
+
+static void
+socks_poll(int timeout_ms) {
+    struct pollfd fds[HOST_MAX_SOCKS];
+    sock_t* p_socks[HOST_MAX_SOCKS];
+    nfds_t count = 0;
+    uint64_t now = now_us();
+
+    socks_init();
+
+    for (uint8_t i = 0; i < HOST_MAX_SOCKS; ++i) {
+        sock_t* p_sock = &socks[i];
+
+        if (p_sock->fd < 0) {
+            continue;
+        }
+        if (p_sock->p_listener != NULL && p_sock->idle_s != 0 && now - p_sock->last_us > p_sock->idle_s * 1000000ULL) {
+            sock_close(p_sock);
+            continue;
+        }
+        if (p_sock->closing && p_sock->tx == NULL) {
+            sock_close(p_sock);
+            continue;
+        }
+
+        fds[count].fd = p_sock->fd;
+        fds[count].events = POLLIN | (p_sock->tx != NULL ? POLLOUT : 0);
+        fds[count].revents = 0;
+        p_socks[count] = p_sock;
+        ++count;
+    }
+
+    if (poll(fds, count, timeout_ms) <= 0) {
+        return;
+    }
+
+    for (nfds_t i = 0; i < count; ++i) {
+        sock_t* p_sock = p_socks[i];
+
+        /* Closed by a callback of an earlier socket */
+        if (p_sock->fd != fds[i].fd) {
+            continue;
+        }
+
+        if (p_sock->p_listener == NULL) {
+            if (fds[i].revents & POLLIN) {
+                listener_accept(p_sock);
+            }
+            continue;
+        }
+
+        if ((fds[i].revents & POLLOUT) && p_sock->tx != NULL) {
+            sock_write(p_sock);
+        }
+        if (p_sock->fd == fds[i].fd && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+            sock_read(p_sock);
+        }
+    }
+}
+
+/* Flash */
+
+static uint8_t* flash;
+static host_flash_stats_t flash_stats;
+
+uint8_t*
+host_flash(void) {
+    if (flash == NULL) {
+        flash = malloc(HOST_FLASH_SIZE);
+        memset(flash, 0xFF, HOST_FLASH_SIZE);
+    }
+
+    return flash;
+}
+
+host_flash_stats_t*
+host_flash_stats(void) {
+    return &flash_stats;
+}
+
+static uint8_t
+flash_access_ok(uint32 addr, uint32 size) {
+    if (addr % 4 || size % 4 || addr > HOST_FLASH_SIZE || size > HOST_FLASH_SIZE - addr) {
+        flash_stats.errors += 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+SpiFlashOpResult
+spi_flash_erase_sector(uint16 sec) {
+    if ((uint32)sec * SPI_FLASH_SEC_SIZE >= HOST_FLASH_SIZE) {
+        flash_stats.errors += 1;
+        return SPI_FLASH_RESULT_ERR;
+    }
+
+    memset(host_flash() + (uint32)sec * SPI_FLASH_SEC_SIZE, 0xFF, SPI_FLASH_SEC_SIZE);
+    flash_stats.erases += 1;
+    return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult
+spi_flash_write(uint32 des_addr, uint32* src_addr, uint32 size) {
+    const uint8_t* p_src = (const uint8_t*)src_addr;
+    uint8_t* p_dst;
+
+    if (!flash_access_ok(des_addr, size) || (uintptr_t)src_addr % 4) {
+        return SPI_FLASH_RESULT_ERR;
+    }
+
+    /* NOR flash, a write only clears bits */
+    p_dst = host_flash() + des_addr;
+    for (uint32 i = 0; i < size; ++i) {
+        p_dst[i] &= p_src[i];
+    }
+
+    flash_stats.writes += 1;
+    return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult
+spi_flash_read(uint32 src_addr, uint32* des_addr, uint32 size) {
+    if (!flash_access_ok(src_addr, size) || (uintptr_t)des_addr % 4) {
+        return SPI_FLASH_RESULT_ERR;
+    }
+
+    memcpy(des_addr, host_flash() + src_addr, size);
+    flash_stats.reads += 1;
+    return SPI_FLASH_RESULT_OK;
+}
+
+/* Main loop */
+
+static volatile sig_atomic_t stop;
+
+void
+host_stop(void) {
+    stop = 1;
+}
+
+void
+host_run(uint32_t ms) {
+    uint64_t end = now_us() + (uint64_t)ms * 1000;
+    int timeout;
+
+    stop = 0;
+    while (!stop && (ms == 0 || now_us() < end)) {
+        /* Tasks first, one event each round so timers and sockets get a turn */
+        if (tasks_run_one()) {
+            timers_run();
+            socks_poll(0);
+            continue;
+        }
+
+        timers_run();
+
+        timeout = 10;
+        if (timers != NULL) {
+            int32_t due = (int32_t)(timers->timer_expire - now_ms());
+
+            timeout = due < 0 ? 0 : (due < timeout ? due : timeout);
+        }
+        socks_poll(timeout);
+    }
+}
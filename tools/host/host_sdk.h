@@ -0,0 +1,110 @@
+/**
+ * \file host_sdk.h
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief NONOS SDK stand-in to run firmware modules on a Linux host. Header file.
+ * \version 0.1
+ * \date 2021-04-20
+ *
+ * The firmware sources are built unchanged against the headers in tools/host/sdk.
+ * host_run() is the SDK main loop, everything runs from it in one thread:
+ *
+ *  - system_os_task: one task per priority, like the SDK. Events are run one at a
+ *    time, highest priority first, before timers and network callbacks.
+ *  - os_timer: millisecond software timers on the host monotonic clock.
+ *  - espconn: TCP server connections over host sockets. espconn_send keeps the
+ *    pointer, the data is read when it goes out, HOST_TCP_MSS bytes per loop pass,
+ *    and the sent callback runs once all of it is written. So a buffer changed
+ *    before its sent callback shows up on the wire, as on the ESP8266.
+ *  - os_malloc: libc with accounting, free heap is HOST_HEAP_FREE minus the bytes
+ *    in use.
+ *  - spi_flash: RAM image of HOST_FLASH_SIZE, erased to 0xFF. Writes only clear
+ *    bits and need word aligned addresses and sizes.
+ *  - wifi_get_macaddr: the MAC set with host_set_macaddr(), the same on both
+ *    interfaces.
+ */
+
+#ifndef HOST_SDK_H
+#define HOST_SDK_H
+
+#include <c_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define HOST_HEAP_FREE  40960                   /* Typical free heap after boot with WiFi up */
+#define HOST_FLASH_SIZE (4 * 1024 * 1024)
+#define HOST_TCP_MSS    536                     /* lwIP default TCP_MSS */
+#define HOST_MAX_SOCKS  64
+
+/**
+ * \brief           Heap accounting
+ */
+typedef struct {
+    uint32_t allocs;                            /*!< os_malloc / os_zalloc calls */
+    uint32_t used;                              /*!< Bytes in use */
+    uint32_t peak;                              /*!< Max bytes in use */
+} host_heap_stats_t;
+
+/**
+ * \brief           Flash accounting
+ */
+typedef struct {
+    uint32_t erases;                            /*!< Sectors erased */
+    uint32_t writes;                            /*!< spi_flash_write calls */
+    uint32_t reads;                             /*!< spi_flash_read calls */
+    uint32_t errors;                            /*!< Unaligned or out of range accesses */
+} host_flash_stats_t;
+
+/**
+ * \brief           Run the SDK loop
+ * \param[in]       ms: Time to run. 0 to run until host_stop()
+ */
+void host_run(uint32_t ms);
+
+/**
+ * \brief           Make host_run() return. Safe from a signal handler
+ */
+void host_stop(void);
+
+/**
+ * \brief           Fix the SNTP time
+ * \param[in]       ts: Timestamp. 0 to use the host clock
+ */
+void host_set_timestamp(uint32_t ts);
+
+/**
+ * \brief           Set the MAC wifi_get_macaddr returns
+ * \param[in]       mac: 6 bytes
+ */
+void host_set_macaddr(const uint8_t* mac);
+
+/**
+ * \brief           Host CLOCK_MONOTONIC time, the clock of Python time.monotonic()
+ * \return          Microseconds
+ */
+uint64_t host_monotonic_us(void);
+
+/**
+ * \brief           Get the heap accounting
+ * \return          Pointer to the statistics
+ */
+host_heap_stats_t* host_heap_stats(void);
+
+/**
+ * \brief           Get the flash image, to inspect it or to keep it over a simulated reboot
+ * \return          HOST_FLASH_SIZE bytes
+ */
+uint8_t* host_flash(void);
+
+/**
+ * \brief           Get the flash accounting
+ * \return          Pointer to the statistics
+ */
+host_flash_stats_t* host_flash_stats(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* HOST_SDK_H */
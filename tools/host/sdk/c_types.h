@@ -0,0 +1,45 @@
+/* Host build of the NONOS SDK header, only what the firmware sources use */
+#ifndef _C_TYPES_H_
+#define _C_TYPES_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef uint8_t  uint8;
+typedef int8_t   sint8;
+typedef int8_t   int8;
+typedef uint16_t uint16;
+typedef int16_t  sint16;
+typedef int16_t  int16;
+typedef uint32_t uint32;
+typedef int32_t  sint32;
+typedef int32_t  int32;
+typedef uint64_t uint64;
+typedef int64_t  sint64;
+typedef float    real32_t;
+typedef double   real64_t;
+
+#define LOCAL static
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+#define ICACHE_RAM_ATTR
+#define STORE_ATTR __attribute__((aligned(4)))
+
+#define BIT(nr) (1UL << (nr))
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+typedef enum {
+    OK = 0,
+    FAIL,
+    PENDING,
+    BUSY,
+    CANCEL,
+} STATUS;
+
+#endif /* _C_TYPES_H_ */
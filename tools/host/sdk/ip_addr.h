@@ -0,0 +1,20 @@
+/* Host build of the NONOS SDK header */
+#ifndef __IP_ADDR_H__
+#define __IP_ADDR_H__
+
+#include "c_types.h"
+
+typedef struct ip_addr {
+    uint32 addr;
+} ip_addr_t;
+
+struct ip_info {
+    struct ip_addr ip;
+    struct ip_addr netmask;
+    struct ip_addr gw;
+};
+
+#define IP2STR(ipaddr) ((uint8*)(ipaddr))[0], ((uint8*)(ipaddr))[1], ((uint8*)(ipaddr))[2], ((uint8*)(ipaddr))[3]
+#define IPSTR "%d.%d.%d.%d"
+
+#endif /* __IP_ADDR_H__ */
@@ -0,0 +1,17 @@
+/* Host build of the NONOS SDK header. Allocations are counted, see host_sdk.h */
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stddef.h>
+
+void* host_malloc(size_t size);
+void* host_zalloc(size_t size);
+void* host_realloc(void* ptr, size_t size);
+void  host_free(void* ptr);
+
+#define os_malloc(s)     host_malloc(s)
+#define os_zalloc(s)     host_zalloc(s)
+#define os_realloc(p, s) host_realloc(p, s)
+#define os_free(p)       host_free(p)
+
+#endif /* _MEM_H_ */
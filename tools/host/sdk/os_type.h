@@ -0,0 +1,26 @@
+/* Host build of the NONOS SDK header */
+#ifndef _OS_TYPE_H_
+#define _OS_TYPE_H_
+
+#include "c_types.h"
+
+typedef uint32 os_signal_t;
+typedef uint32 os_param_t;
+
+typedef struct {
+    os_signal_t sig;
+    os_param_t  par;
+} os_event_t;
+
+typedef void (*os_task_t)(os_event_t* e);
+typedef void os_timer_func_t(void* timer_arg);
+
+typedef struct _os_timer_t {
+    struct _os_timer_t* timer_next;
+    uint32              timer_expire;
+    uint32              timer_period;
+    os_timer_func_t*    timer_func;
+    void*               timer_arg;
+} os_timer_t;
+
+#endif /* _OS_TYPE_H_ */
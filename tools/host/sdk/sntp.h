@@ -0,0 +1,9 @@
+/* Host build of the NONOS SDK header. Time from host_set_timestamp() or the host clock */
+#ifndef __SNTP_H__
+#define __SNTP_H__
+
+#include "c_types.h"
+
+uint32 sntp_get_current_timestamp(void);
+
+#endif /* __SNTP_H__ */
@@ -0,0 +1,28 @@
+/* Host build of the NONOS SDK header */
+#ifndef __USER_INTERFACE_H__
+#define __USER_INTERFACE_H__
+
+#include "c_types.h"
+#include "os_type.h"
+#include "ip_addr.h"
+
+enum {
+    USER_TASK_PRIO_0 = 0,
+    USER_TASK_PRIO_1,
+    USER_TASK_PRIO_2,
+    USER_TASK_PRIO_MAX,
+};
+
+#define STATION_IF 0x00
+#define SOFTAP_IF  0x01
+
+bool system_os_task(os_task_t task, uint8 prio, os_event_t* queue, uint8 qlen);
+bool system_os_post(uint8 prio, os_signal_t sig, os_param_t par);
+
+uint32 system_get_time(void);
+uint32 system_get_free_heap_size(void);
+void system_soft_wdt_feed(void);
+
+bool wifi_get_macaddr(uint8 if_index, uint8* macaddr);
+
+#endif /* __USER_INTERFACE_H__ */
@@ -0,0 +1,20 @@
+/* Stand-in for the Renesas header, not redistributable. Only the types sensors.h needs */
+#ifndef IAQ_1ST_GEN_H
+#define IAQ_1ST_GEN_H
+
+#include "zmod4xxx_types.h"
+
+typedef struct {
+    float rmox;
+    float rcda;
+    float iaq;
+    float tvoc;
+    float etoh;
+    float eco2;
+} iaq_1st_gen_results_t;
+
+typedef struct {
+    uint32_t opaque[64];
+} iaq_1st_gen_handle_t;
+
+#endif /* IAQ_1ST_GEN_H */
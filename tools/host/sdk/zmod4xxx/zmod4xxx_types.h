@@ -0,0 +1,24 @@
+/* Stand-in for the Renesas header, not redistributable. Only the types sensors.h needs */
+#ifndef ZMOD4XXX_TYPES_H
+#define ZMOD4XXX_TYPES_H
+
+#include <stdint.h>
+
+typedef int8_t (*zmod4xxx_i2c_ptr_t)(uint8_t addr, uint8_t reg_addr, uint8_t* data_buf, uint8_t len);
+typedef void (*zmod4xxx_delay_ptr_p)(uint32_t ms);
+
+typedef struct {
+    uint8_t i2c_addr;
+    uint8_t config[6];
+    uint16_t mox_er;
+    uint16_t mox_lr;
+    uint16_t pid;
+    uint8_t* prod_data;
+    zmod4xxx_i2c_ptr_t read;
+    zmod4xxx_i2c_ptr_t write;
+    zmod4xxx_delay_ptr_p delay_ms;
+    void* init_conf;
+    void* meas_conf;
+} zmod4xxx_dev_t;
+
+#endif /* ZMOD4XXX_TYPES_H */
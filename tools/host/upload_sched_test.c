@@ -0,0 +1,150 @@
+/**
+ * \file upload_sched_test.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief src/upload_sched.c on the host, the reference for tools/fleet_sim.py. Source file.
+ * \version 0.1
+ * \date 2021-04-21
+ *
+ * fleet_sim.py models the upload timing in Python. This runs the firmware code for
+ * the MACs given on the command line and prints what it computes, one line each:
+ *
+ *     phase <mac> <ms>      upload_sched_init phase of that MAC
+ *     next <min> <max>      range of upload_sched_next over NEXT_DRAWS draws
+ *     hint <value> <ms>     extra delay of the next upload after a slot header of <value>
+ *
+ * Its own checks (first upload, hold, one-shot hint) fail the run. The comparison with
+ * the Python values is `fleet_sim.py --check-sched`:
+ *
+ *     make -C tools/host test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <osapi.h>
+
+#include "host_sdk.h"
+#include "upload_sched.h"
+
+#include "simple_http/simple_http.h"
+
+#define NEXT_DRAWS 200000
+
+static uint32_t failures;
+
+#define CHECK(cond, ...)                                                        \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            failures += 1;                                                      \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                         \
+            printf(__VA_ARGS__);                                                \
+            printf("\n");                                                       \
+        }                                                                       \
+    } while (0)
+
+/* simple_http_client.c needs the espconn client, which host_sdk does not have. Same lookup */
+const char*
+simple_http_client_response_header(const char* buffer, const char* name, size_t* p_len) {
+    const char* end = os_strstr(buffer, "\r\n\r\n");
+    const size_t name_len = os_strlen(name);
+    const char* p_line;
+    const char* p_value;
+    size_t i;
+
+    if (end == NULL) {
+        return NULL;
+    }
+
+    for (p_line = os_strstr(buffer, "\r\n"); p_line != NULL && p_line < end; p_line = os_strstr(p_line + 2, "\r\n")) {
+        for (i = 0; i < name_len && (p_line[2 + i] | 0x20) == name[i]; ++i);
+        if (i == name_len && p_line[2 + i] == ':') {
+            for (p_value = p_line + 3 + name_len; *p_value == ' '; ++p_value);
+            for (i = 0; p_value[i] != '\r' && p_value[i] != '\0'; ++i);
+            if (p_len != NULL) {
+                *p_len = i;
+            }
+            return p_value;
+        }
+    }
+
+    return NULL;
+}
+
+static uint8_t
+parse_mac(const char* str, uint8_t* mac) {
+    unsigned int b[6];
+
+    if (sscanf(str, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < 6; ++i) {
+        mac[i] = b[i];
+    }
+    return 1;
+}
+
+/* Extra delay of the next upload after a response with a slot header of `value` */
+static uint32_t
+hint_delay(uint32_t value) {
+    char response[128];
+    uint32_t plain;
+    uint32_t hinted;
+
+    os_sprintf(response, "HTTP/1.1 204 No Content\r\n%s: %u\r\n\r\n", UPLOAD_SLOT_HEADER, value);
+
+    /* Same draw of os_random for both */
+    srandom(value + 1);
+    plain = upload_sched_next();
+    srandom(value + 1);
+    upload_sched_response(204, response);
+    hinted = upload_sched_next();
+
+    CHECK(upload_sched_next() <= SERVER_WRITE_INTERVAL + UPLOAD_JITTER, "hint %u applied twice", value);
+    return hinted - plain;
+}
+
+int
+main(int argc, char** argv) {
+    uint8_t mac[6];
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    uint32_t delay;
+    const uint32_t hints[] = {0, 1, 2500, SERVER_WRITE_INTERVAL, SERVER_WRITE_INTERVAL + 1, 4000000000u};
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for (int i = 1; i < argc; ++i) {
+        if (!parse_mac(argv[i], mac)) {
+            CHECK(0, "bad MAC %s", argv[i]);
+            continue;
+        }
+        host_set_macaddr(mac);
+        upload_sched_init();
+        printf("phase %s %u\n", argv[i], upload_sched_stats()->phase_ms);
+        CHECK(upload_sched_first() == SERVER_WRITE_INTERVAL + upload_sched_stats()->phase_ms,
+              "first %u, phase %u", upload_sched_first(), upload_sched_stats()->phase_ms);
+    }
+
+    for (uint32_t i = 0; i < NEXT_DRAWS; ++i) {
+        delay = upload_sched_next();
+        min = delay < min ? delay : min;
+        max = delay > max ? delay : max;
+    }
+    printf("next %u %u\n", min, max);
+
+    for (uint8_t i = 0; i < sizeof(hints) / sizeof(hints[0]); ++i) {
+        printf("hint %u %u\n", hints[i], hint_delay(hints[i]));
+    }
+
+    /* Delta seconds only, on 429 and 503 */
+    upload_sched_response(200, "HTTP/1.1 200 OK\r\nRetry-After: 5\r\n\r\n");
+    CHECK(!upload_sched_held(), "held after a 200");
+    upload_sched_response(503, "HTTP/1.1 503 Service Unavailable\r\nRetry-After: Wed, 21 Oct 2015 07:28:00 GMT\r\n\r\n");
+    CHECK(!upload_sched_held(), "held by an HTTP-date");
+    upload_sched_response(429, "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 999999\r\n\r\n");
+    CHECK(upload_sched_held(), "not held after a 429");
+    CHECK(upload_sched_stats()->held_s == UPLOAD_RETRY_AFTER_MAX, "held %u s", upload_sched_stats()->held_s);
+
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
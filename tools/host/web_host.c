@@ -0,0 +1,357 @@
+/**
+ * \file web_host.c
+ * \author Mario Rubio (mario@mrrb.eu)
+ * \brief Firmware web server on the host, for tools/web_load.py. Source file.
+ * \version 0.1
+ * \date 2021-04-20
+ *
+ * simple_http_server and live_json from the firmware tree, on host_sdk. Routes:
+ *
+ *  - `/api/v1/latest`: as web_view_latest in src/main.c, the precomputed document.
+ *  - `/legacy`: the text page of the first firmware version, rendered on every GET
+ *    into two os_malloc buffers with os_strcat and f2c. The "before" of the page
+ *    snapshot.
+ *  - `/snapshot`: the same page rendered once per sensor job into a static buffer
+ *    and served as is, the "after".
+ *  - `/events`: web_events, the Server-Sent Events stream of src/web_events.c.
+ *
+ * A sensor job runs every -u ms and updates all sensors with the same value, the
+ * job number, so every field of a consistent document has one value. It publishes
+ * every sensor object as main.c does, then a `probe` event carrying
+ * host_monotonic_us(), for web_load.py --events to measure the push latency.
+ *
+ * On exit (-t seconds or SIGINT) it prints the server statistics, the time spent in
+ * every route callback, the event stream statistics and the heap peak.
+ *
+ *     make -C tools/host web_host && tools/host/web_host -p 8080 -u 1000
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <osapi.h>
+#include <mem.h>
+#include <user_interface.h>
+
+#include "host_sdk.h"
+#include "simple_http/simple_http.h"
+#include "f2c/f2c.h"
+#include "live_json.h"
+#include "web_events.h"
+
+typedef struct {
+    const char* path;
+    simple_http_server_callback_t callback;
+    uint32_t calls;
+    uint64_t ns;
+} route_timing_t;
+
+static struct espconn web_conn;
+static os_timer_t timer_job;
+static uint32_t job;
+static uint8_t  subs_max;                       /* Most event subscribers at a time */
+static uint32_t subs_heap;                      /* Heap in use with `subs_max` subscribers */
+
+/* Globals of the first firmware version */
+static scd30_result_t scd30_result;
+static iaq_1st_gen_results_t iaq_results;
+static uint8_t scd30_data_valid;
+static uint8_t zmod4410_data_valid;
+
+#define SNAPSHOT_SIZE ((F2C_CHAR_BUFF_SIZE + 16) * 5 + 64)
+
+static char    snapshot[2][SNAPSHOT_SIZE];
+static size_t  snapshot_len[2];
+static uint8_t snapshot_idx;
+
+/* Page body, rendered once per sample. Double buffered like the firmware snapshot was */
+static void
+snapshot_render(void) {
+    uint8_t next = snapshot_idx ^ 1;
+    char* buff = snapshot[next];
+    char f2c_buff[F2C_CHAR_BUFF_SIZE];
+    size_t len = 0;
+
+    if (scd30_data_valid) {
+        len += os_sprintf(buff + len, "CO2: %s ppm<br>", f2c(*((real32_t*) &scd30_result.co2), f2c_buff));
+        len += os_sprintf(buff + len, "TEMP: %s C<br>", f2c(*((real32_t*) &scd30_result.temp), f2c_buff));
+        len += os_sprintf(buff + len, " RH: %s %%<br>", f2c(*((real32_t*) &scd30_result.rh), f2c_buff));
+    } else {
+        len += os_sprintf(buff + len, "SCD30 data not ready!<br>");
+    }
+
+    if (zmod4410_data_valid) {
+        len += os_sprintf(buff + len, "eCO2: %s ppm<br>", f2c(*((real32_t*) &iaq_results.eco2), f2c_buff));
+        len += os_sprintf(buff + len, "IAQ: %s", f2c(*((real32_t*) &iaq_results.iaq), f2c_buff));
+    } else {
+        len += os_sprintf(buff + len, "ZMOD4410 data not ready!");
+    }
+
+    snapshot_len[next] = len;
+    snapshot_idx = next;
+}
+
+/* As web_publish in src/main.c, then the probe */
+static void
+events_job(void) {
+    static const char* const names[LIVE_JSON_SECTION_MAX] = {"scd30", "ccs811", "zmod", "zmod_reset", "zmod_halt"};
+    const web_events_stats_t* p_events = web_events_get_stats();
+    const char* data;
+    size_t data_len;
+    char probe[32];
+
+    for (uint8_t i = 0; i < LIVE_JSON_SECTION_MAX; ++i) {
+        data = live_json_section(i, &data_len);
+        if (data != NULL) {
+            web_events_publish(names[i], data, data_len);
+        }
+    }
+
+    data_len = os_sprintf(probe, "{\"us\":%llu}", (unsigned long long)host_monotonic_us());
+    web_events_publish("probe", probe, data_len);
+
+    if (p_events->subscribers >= subs_max) {
+        subs_max = p_events->subscribers;
+        subs_heap = host_heap_stats()->used;
+    }
+}
+
+static void
+sensor_job(void* arg) {
+    ccs811_data_t ccs_data = {0};
+    float value;
+
+    job += 1;
+    value = job;
+
+    os_memcpy(&scd30_result.co2, &value, sizeof(value));
+    os_memcpy(&scd30_result.temp, &value, sizeof(value));
+    os_memcpy(&scd30_result.rh, &value, sizeof(value));
+    scd30_data_valid = 1;
+
+    iaq_results.eco2 = iaq_results.etoh = iaq_results.iaq = value;
+    iaq_results.tvoc = iaq_results.rcda = iaq_results.rmox = value;
+    zmod4410_data_valid = 1;
+
+    ccs_data.eco2 = job;
+    ccs_data.tvoc = job;
+    host_set_timestamp(job);
+
+    snapshot_render();
+
+    live_json_update_scd30(1, &scd30_result);
+    live_json_update_ccs811(1, &ccs_data);
+    live_json_update_zmod(LIVE_JSON_ZMOD, 1, &iaq_results);
+    live_json_update_zmod(LIVE_JSON_ZMOD_RESET, 1, &iaq_results);
+    live_json_update_zmod(LIVE_JSON_ZMOD_HALT, 1, &iaq_results);
+    live_json_commit();
+
+    events_job();
+}
+
+/* As web_view_latest in src/main.c */
+static char*
+view_latest(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    static char etag[11];
+    char* data;
+    uint32_t seq;
+
+    *p_response_code = 200;
+    *p_content_type = HTTP_CONTENT_TYPE_APPLICATION_JSON;
+
+    data = live_json_get(p_data_size, &seq);
+    os_sprintf(etag, "\"%08x\"", seq);
+    p_data->etag = etag;
+    p_data->headers = "Cache-Control: no-cache\r\n";
+    p_data->keep_response = 1;
+    p_data->release = live_json_release;
+    p_data->release_arg = data;
+    return data;
+}
+
+/* web_view of the first firmware version, unchanged */
+static char*
+view_legacy(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    char* temp_data;
+    char* data;
+    char* f2c_str;
+
+    /* Check if there is a GET request */
+    if (os_strcmp(p_data->request_method, "GET") != 0) {
+        *p_response_code = 403;
+        *p_content_type = HTTP_CONTENT_TYPE_TEXT_HTML;
+
+        data = (char*)os_malloc(sizeof(char) * 14);
+        os_strcpy(data, "Nothing here!");
+        *p_data_size = os_strlen(data);
+    } else {
+        data = (char*)os_malloc(sizeof(char) * ((F2C_CHAR_BUFF_SIZE + 6 + 4) * 5 + 4 + 2 + 2 + 4 + 10));
+        temp_data = (char*)os_zalloc(sizeof(char) * F2C_CHAR_BUFF_SIZE);
+
+        *p_response_code = 200;
+        *p_content_type = HTTP_CONTENT_TYPE_TEXT_HTML;
+
+        os_strcpy(data, "");
+        if (scd30_data_valid) {
+            os_strcat(data, "CO2: ");
+            f2c_str = f2c(*((real32_t*) &scd30_result.co2), temp_data);
+            os_strcat(data, f2c_str);
+            os_strcat(data, " ppm<br>");
+
+            os_strcat(data, "TEMP: ");
+            f2c_str = f2c(*((real32_t*) &scd30_result.temp), temp_data);
+            os_strcat(data, f2c_str);
+            os_strcat(data, " C<br>");
+
+            os_strcat(data, " RH: ");
+            f2c_str = f2c(*((real32_t*) &scd30_result.rh), temp_data);
+            os_strcat(data, f2c_str);
+            os_strcat(data, " %<br>");
+        } else {
+            os_strcat(data, "SCD30 data not ready!<br>");
+        }
+
+        if (zmod4410_data_valid) {
+            os_strcat(data, "eCO2: ");
+            f2c_str = f2c(*((real32_t*) &iaq_results.eco2), temp_data);
+            os_strcat(data, f2c_str);
+            os_strcat(data, " ppm<br>");
+
+            os_strcat(data, "IAQ: ");
+            f2c_str = f2c(*((real32_t*) &iaq_results.iaq), temp_data);
+            os_strcat(data, f2c_str);
+        } else {
+            os_strcat(data, "ZMOD4410 data not ready!");
+        }
+
+        os_free(temp_data);
+        *p_data_size = os_strlen(data);
+    }
+
+    return data;
+}
+
+static char*
+view_snapshot(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    *p_response_code = 200;
+    *p_content_type = HTTP_CONTENT_TYPE_TEXT_HTML;
+
+    p_data->keep_response = 1;
+    *p_data_size = snapshot_len[snapshot_idx];
+    return snapshot[snapshot_idx];
+}
+
+/* Same order as `routes` */
+static route_timing_t timings[] = {
+    {"/api/v1/latest", view_latest},
+    {"/legacy",        view_legacy},
+    {"/snapshot",      view_snapshot},
+};
+
+static char*
+timed_view(route_timing_t* p_timing, simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    struct timespec t0, t1;
+    char* data;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    data = p_timing->callback(p_data, p_data_size, p_response_code, p_content_type);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    p_timing->calls += 1;
+    p_timing->ns += (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+    return data;
+}
+
+static char*
+route_latest(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    return timed_view(&timings[0], p_data, p_data_size, p_response_code, p_content_type);
+}
+
+static char*
+route_legacy(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    return timed_view(&timings[1], p_data, p_data_size, p_response_code, p_content_type);
+}
+
+static char*
+route_snapshot(simple_http_server_request_info_t* p_data, size_t* p_data_size, uint16_t* p_response_code, http_content_type_t* p_content_type) {
+    return timed_view(&timings[2], p_data, p_data_size, p_response_code, p_content_type);
+}
+
+/* Sorted by path */
+static const simple_http_server_route_t routes[] = {
+    {"/api/v1/latest", "GET", route_latest},
+    {"/events",        "GET", web_events_view},
+    {"/legacy",        "GET", route_legacy},
+    {"/snapshot",      "GET", route_snapshot},
+};
+
+static void
+on_signal(int sig) {
+    host_stop();
+}
+
+static void
+print_stats(void) {
+    const simple_http_server_stats_t* p_stats = simple_http_server_get_stats();
+    host_heap_stats_t* p_heap = host_heap_stats();
+    const web_events_stats_t* p_events = web_events_get_stats();
+
+    os_printf("requests %u responses %u not_modified %u shed %u deferred %u\n",
+              p_stats->requests, p_stats->responses, p_stats->not_modified, p_stats->shed, p_stats->deferred);
+    os_printf("latency avg %u us max %u us, queue wait max %u us\n",
+              p_stats->responses ? p_stats->latency_sum_us / p_stats->responses : 0,
+              p_stats->latency_max_us, p_stats->defer_max_us);
+    for (uint8_t i = 0; i < sizeof(timings) / sizeof(timings[0]); ++i) {
+        os_printf("%-15s calls %u callback avg %.0f ns\n", timings[i].path, timings[i].calls,
+                  timings[i].calls ? (double)timings[i].ns / timings[i].calls : 0.0);
+    }
+    os_printf("events published %u delivered %u dropped %u rejected %u, latency avg %u us max %u us\n",
+              p_events->published, p_events->delivered, p_events->dropped, p_events->rejected,
+              p_events->delivered ? p_events->latency_sum_us / p_events->delivered : 0, p_events->latency_max_us);
+    os_printf("subscribers max %u, heap in use with them %u B\n", subs_max, subs_heap);
+    os_printf("heap allocs %u peak %u B, in use %u B\n", p_heap->allocs, p_heap->peak, p_heap->used);
+    os_printf("sensor jobs %u\n", job);
+}
+
+int
+main(int argc, char** argv) {
+    uint16_t port = 8080;
+    uint32_t update_ms = 1000;
+    uint32_t run_s = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:u:t:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'u': update_ms = atoi(optarg); break;
+            case 't': run_s = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-p port] [-u job interval ms] [-t seconds]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    live_json_init();
+    web_events_init();
+    sensor_job(NULL);
+    os_timer_setfn(&timer_job, (os_timer_func_t*)sensor_job, NULL);
+    os_timer_arm(&timer_job, update_ms, 1);
+
+    if (create_http_server(&web_conn, port, routes, sizeof(routes) / sizeof(routes[0]), NULL) != SIMPLE_HTTP_OK) {
+        fprintf(stderr, "server start failed\n");
+        return 1;
+    }
+    os_printf("listening on %u, rate %u/s burst %u, %u connections\n", port,
+              SIMPLE_HTTP_SERVER_RATE, SIMPLE_HTTP_SERVER_BURST, SIMPLE_HTTP_SERVER_MAX_CONN);
+
+    host_run(run_s * 1000);
+    print_stats();
+
+    return 0;
+}
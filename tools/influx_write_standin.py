@@ -0,0 +1,375 @@
+#!/usr/bin/env python3
+"""Stand-in for the InfluxDB 2.x write API (POST /api/v2/write), for load tests.
+
+It accepts the INFLUX_URL form, `/api/v2/write?org=<org>&bucket=<bucket>&precision=s`,
+parses every line of the body and checks it against the line protocol grammar and
+the measurements the logger writes (timer_send_data, zmod_sprintf):
+
+    zmod|zmod_reset|zmod_halt eco2,etoh,rcda,iaq,tvoc,rmox
+    scd30                     temp,co2,rh
+    ccs811                    eco2,tvoc,current,adc
+
+Like InfluxDB, a request with a bad line is answered 400 and none of its lines are
+stored. Unknown measurements are only counted, --strict rejects them.
+
+Load shaping options:
+  --latency MS         answer after MS milliseconds, plus up to --jitter MS more.
+  --error-rate P       answer a fraction P of the writes with --error-status (503).
+  --drop-rate P        close the connection without answering a fraction P of the writes.
+  --cap-lines N        accept N lines per second over all clients, 429 with Retry-After
+                       above it. --burst sets the bucket size (default N).
+  --max-body BYTES     answer 413 to larger bodies.
+  --slot-limit N       when more than N writes arrived in the last 100 ms, tell the
+                       client to move with an `X-Upload-Delay: <ms>` header, random in
+                       [0, --slot-spread). See upload_sched.h.
+
+Every --report seconds, and on exit, it prints per client: requests, accepted lines,
+rejections by reason, ingest rate and the delay from the sample timestamp to its
+arrival (backlog drain shows as a falling max delay).
+
+    python3 tools/influx_write_standin.py [-p 8086] [--token T] [--cap-lines 50] [--error-rate 0.1]
+"""
+
+import argparse
+import http.server
+import json
+import random
+import re
+import socketserver
+import sys
+import threading
+import time
+import urllib.parse
+
+SCHEMA = {
+    "zmod":       {"eco2", "etoh", "rcda", "iaq", "tvoc", "rmox"},
+    "zmod_reset": {"eco2", "etoh", "rcda", "iaq", "tvoc", "rmox"},
+    "zmod_halt":  {"eco2", "etoh", "rcda", "iaq", "tvoc", "rmox"},
+    "scd30":      {"temp", "co2", "rh"},
+    "ccs811":     {"eco2", "tvoc", "current", "adc"},
+}
+
+PRECISION = {"ns": 1e-9, "us": 1e-6, "ms": 1e-3, "s": 1.0}
+
+FLOAT = re.compile(r"^[-+]?(\d+(\.\d*)?|\.\d+)([eE][-+]?\d+)?$")
+INTEGER = re.compile(r"^[-+]?\d+i$")
+UNSIGNED = re.compile(r"^\d+u$")
+BOOLEAN = {"t", "T", "true", "True", "TRUE", "f", "F", "false", "False", "FALSE"}
+
+lock = threading.Lock()
+clients = {}
+arrivals = []                                   # Recent write arrival times, for --slot-limit
+started = time.monotonic()
+
+
+class LineError(ValueError):
+    pass
+
+
+class ClientStats:
+    def __init__(self):
+        self.requests = 0
+        self.accepted = 0                       # Requests answered 204
+        self.lines = 0                          # Lines stored
+        self.bytes = 0
+        self.rejected = {}                      # Reason -> requests
+        self.unknown = 0                        # Lines of unknown measurements
+        self.hints = 0                          # Slot hints sent
+        self.measurements = {}
+        self.delay_sum = 0.0
+        self.delay_max = 0.0
+        self.delay_window = 0.0                 # Max delay since the last report
+
+    def reject(self, reason):
+        self.rejected[reason] = self.rejected.get(reason, 0) + 1
+
+
+def split_unescaped(text, sep, quotes=False):
+    """Split on `sep` outside backslash escapes and, optionally, double quotes"""
+    parts, start, i, quoted = [], 0, 0, False
+    while i < len(text):
+        c = text[i]
+        if c == "\\":
+            i += 2
+            continue
+        if quotes and c == '"':
+            quoted = not quoted
+        elif c == sep and not quoted:
+            parts.append(text[start:i])
+            start = i + 1
+        i += 1
+    if quoted:
+        raise LineError("unterminated string")
+    parts.append(text[start:])
+    return parts
+
+
+def parse_value(value):
+    if FLOAT.match(value) or INTEGER.match(value) or UNSIGNED.match(value) or value in BOOLEAN:
+        return value
+    if len(value) >= 2 and value[0] == '"' and value[-1] == '"':
+        return value
+    raise LineError("bad field value %r" % value)
+
+
+def parse_line(line):
+    """Return (measurement, tags, fields, timestamp or None)"""
+    sections = split_unescaped(line, " ", quotes=True)
+    sections = [s for s in sections if s != ""]
+    if len(sections) not in (2, 3):
+        raise LineError("expected measurement, fields and timestamp")
+
+    key = split_unescaped(sections[0], ",")
+    measurement = key[0]
+    if not measurement:
+        raise LineError("empty measurement")
+
+    tags = {}
+    for tag in key[1:]:
+        name, sep, value = tag.partition("=")
+        if not sep or not name or not value:
+            raise LineError("bad tag %r" % tag)
+        tags[name] = value
+
+    fields = {}
+    for field in split_unescaped(sections[1], ",", quotes=True):
+        name, sep, value = field.partition("=")
+        if not sep or not name:
+            raise LineError("bad field %r" % field)
+        fields[name] = parse_value(value)
+    if not fields:
+        raise LineError("no fields")
+
+    ts = None
+    if len(sections) == 3:
+        if not re.match(r"^-?\d+$", sections[2]):
+            raise LineError("bad timestamp %r" % sections[2])
+        ts = int(sections[2])
+
+    return measurement, tags, fields, ts
+
+
+def check_schema(measurement, fields):
+    """Return False for unknown measurements, raise on known ones with other fields"""
+    expected = SCHEMA.get(measurement)
+    if expected is None:
+        return False
+    if set(fields) != expected:
+        raise LineError("%s fields %s, expected %s" % (measurement, ",".join(sorted(fields)), ",".join(sorted(expected))))
+    return True
+
+
+class Bucket:
+    """Token bucket in lines per second, shared by all clients"""
+
+    def __init__(self, rate, burst):
+        self.rate = rate
+        self.size = burst or rate
+        self.tokens = self.size
+        self.stamp = time.monotonic()
+        self.lock = threading.Lock()
+
+    def take(self, lines):
+        """Return 0 if admitted, else the seconds until `lines` fit"""
+        with self.lock:
+            now = time.monotonic()
+            self.tokens = min(self.size, self.tokens + (now - self.stamp) * self.rate)
+            self.stamp = now
+            if lines > self.size:
+                lines = self.size
+            if self.tokens >= lines:
+                self.tokens -= lines
+                return 0
+            return (lines - self.tokens) / self.rate
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"               # Keep-alive, for SIMPLE_HTTP_CLIENT_KEEP_OPEN
+
+    def log_message(self, fmt, *args):
+        if self.server.args.verbose:
+            sys.stderr.write("%s: %s\n" % (self.address_string(), fmt % args))
+
+    def reply(self, status, message=None, headers=None):
+        body = b""
+        if message is not None:
+            body = json.dumps({"code": "invalid" if status == 400 else "error", "message": message}).encode()
+        self.send_response(status)
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        if body:
+            self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_POST(self):
+        args = self.server.args
+        url = urllib.parse.urlsplit(self.path)
+        query = urllib.parse.parse_qs(url.query)
+        length = int(self.headers.get("Content-Length", "0"))
+        client = self.client_address[0]
+        if args.by_port:
+            client = "%s:%d" % self.client_address
+
+        hint = None
+        with lock:
+            stats = clients.setdefault(client, ClientStats())
+            stats.requests += 1
+
+            if args.slot_limit:
+                now = time.monotonic()
+                arrivals.append(now)
+                while arrivals[0] < now - 0.1:
+                    arrivals.pop(0)
+                if len(arrivals) > args.slot_limit:
+                    hint = {"X-Upload-Delay": str(random.randrange(args.slot_spread))}
+                    stats.hints += 1
+
+        def reject(status, reason, message=None, headers=None):
+            with lock:
+                stats.reject(reason)
+            if args.verbose or status == 400:
+                print("%s: %d %s%s" % (client, status, reason, ": " + message if message else ""))
+            self.reply(status, message or reason, dict(headers or {}, **(hint or {})))
+
+        if args.max_body and length > args.max_body:
+            self.rfile.read(length)
+            return reject(413, "too large")
+        body = self.rfile.read(length).decode("utf-8", "replace")
+
+        if url.path != "/api/v2/write":
+            return reject(404, "not found", "path %s" % url.path)
+        if not query.get("org") or not query.get("bucket"):
+            return reject(400, "org/bucket", "org and bucket are required")
+        precision = query.get("precision", ["ns"])[0]
+        if precision not in PRECISION:
+            return reject(400, "precision", "precision %r" % precision)
+        if args.token and self.headers.get("Authorization", "") != "Token " + args.token:
+            return reject(401, "unauthorized")
+
+        if args.drop_rate and random.random() < args.drop_rate:
+            with lock:
+                stats.reject("dropped")
+            self.close_connection = True
+            return
+
+        points = []
+        unknown = 0
+        for number, line in enumerate(body.split("\n"), 1):
+            line = line.strip("\r")
+            if not line or line.startswith("#"):
+                continue
+            try:
+                measurement, tags, fields, ts = parse_line(line)
+                if not check_schema(measurement, fields):
+                    if args.strict:
+                        raise LineError("unknown measurement %r" % measurement)
+                    unknown += 1
+            except LineError as err:
+                return reject(400, "bad line", "line %d: %s: %r" % (number, err, line))
+            points.append((measurement, ts))
+
+        if not points:
+            return reject(400, "empty", "no lines")
+
+        if self.server.bucket is not None:
+            wait = self.server.bucket.take(len(points))
+            if wait:
+                return reject(429, "throttled", None, {"Retry-After": str(max(1, int(wait + 0.999)))})
+
+        if args.latency or args.jitter:
+            time.sleep((args.latency + random.uniform(0, args.jitter)) / 1000)
+
+        if args.error_rate and random.random() < args.error_rate:
+            return reject(args.error_status, "injected")
+
+        now = time.time()
+        with lock:
+            stats.accepted += 1
+            stats.lines += len(points)
+            stats.bytes += length
+            stats.unknown += unknown
+            for measurement, ts in points:
+                stats.measurements[measurement] = stats.measurements.get(measurement, 0) + 1
+                if ts is not None:
+                    delay = max(0.0, now - ts * PRECISION[precision])
+                    stats.delay_sum += delay
+                    stats.delay_max = max(stats.delay_max, delay)
+                    stats.delay_window = max(stats.delay_window, delay)
+            if self.server.out is not None:
+                self.server.out.write(body if body.endswith("\n") else body + "\n")
+                self.server.out.flush()
+
+        self.reply(204, None, hint)
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+    request_queue_size = 256                    # Fleet bursts, see tools/fleet_sim.py
+
+
+def report():
+    with lock:
+        elapsed = time.monotonic() - started
+        total_lines = sum(s.lines for s in clients.values())
+        print("--- %.0f s, %d clients, %d lines, %.1f lines/s" % (elapsed, len(clients), total_lines,
+              total_lines / elapsed if elapsed else 0))
+        for client, s in sorted(clients.items()):
+            rejected = " ".join("%s %d" % kv for kv in sorted(s.rejected.items())) or "-"
+            print("%-21s req %5d ok %5d lines %6d (%5.2f/s) bytes %7d unknown %d hints %d rejected: %s delay avg %.1f s max %.1f s (window %.1f s)" % (
+                client, s.requests, s.accepted, s.lines, s.lines / elapsed if elapsed else 0, s.bytes, s.unknown, s.hints,
+                rejected, s.delay_sum / s.lines if s.lines else 0, s.delay_max, s.delay_window))
+            s.delay_window = 0.0
+        sys.stdout.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-p", "--port", type=int, default=8086)
+    parser.add_argument("-b", "--bind", default="0.0.0.0")
+    parser.add_argument("--token", help="require `Authorization: Token <token>`")
+    parser.add_argument("--strict", action="store_true", help="reject unknown measurements")
+    parser.add_argument("--latency", type=float, default=0, help="[ms]")
+    parser.add_argument("--jitter", type=float, default=0, help="[ms]")
+    parser.add_argument("--error-rate", type=float, default=0)
+    parser.add_argument("--error-status", type=int, default=503)
+    parser.add_argument("--drop-rate", type=float, default=0)
+    parser.add_argument("--cap-lines", type=float, default=0, help="[lines/s] over all clients")
+    parser.add_argument("--burst", type=float, default=0, help="[lines] bucket size, --cap-lines if 0")
+    parser.add_argument("--max-body", type=int, default=0, help="[bytes]")
+    parser.add_argument("--slot-limit", type=int, default=0, help="[writes per 100 ms] before slot hints")
+    parser.add_argument("--slot-spread", type=int, default=10201, help="[ms] slot hint range")
+    parser.add_argument("--by-port", action="store_true", help="one client per source port, not per address")
+    parser.add_argument("--report", type=float, default=10, help="[s] 0 to report only on exit")
+    parser.add_argument("--out", help="append the accepted lines to this file")
+    parser.add_argument("--seed", type=int)
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+
+    server = Server((args.bind, args.port), Handler)
+    server.args = args
+    server.bucket = Bucket(args.cap_lines, args.burst) if args.cap_lines else None
+    server.out = open(args.out, "a") if args.out else None
+    print("listening on %s:%d" % (args.bind, args.port))
+    sys.stdout.flush()
+
+    if args.report:
+        def reporter():
+            while True:
+                time.sleep(args.report)
+                report()
+        threading.Thread(target=reporter, daemon=True).start()
+
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    report()
+
+
+if __name__ == "__main__":
+    main()
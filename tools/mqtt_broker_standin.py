@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""Stand-in MQTT 3.1.1 broker for testing the logger MQTT publisher (simple_mqtt.c).
+
+It accepts CONNECT, PUBLISH (QoS 0/1), PINGREQ and DISCONNECT, and prints every
+message. Sessions are kept per client id, so with clean session 0 a reconnect gets
+`session present`. It enforces 1.5x the keepalive like a real broker.
+
+Options to test the client recovery paths:
+  --kill-every N   close the connection on every Nth QoS 1 PUBLISH, without PUBACK.
+                   The client must send it again with DUP set after reconnecting.
+  --refuse N       refuse the first N CONNECTs (return code 3, server unavailable).
+
+    python3 tools/mqtt_broker_standin.py [-p 1883] [--kill-every 5] [-v]
+"""
+
+import argparse
+import socket
+import socketserver
+import struct
+import threading
+
+CONNECT, CONNACK, PUBLISH, PUBACK, PINGREQ, PINGRESP, DISCONNECT = 1, 2, 3, 4, 12, 13, 14
+
+lock = threading.Lock()
+sessions = {}
+totals = {"connects": 0, "refused": 0, "messages": 0, "dup": 0, "redelivered": 0, "killed": 0}
+
+
+class Session:
+    def __init__(self):
+        self.acked = set()                      # QoS 1 packet ids already acknowledged
+        self.qos1 = 0
+
+
+def read_exact(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError("closed")
+        data += chunk
+    return data
+
+
+def read_packet(sock):
+    first = read_exact(sock, 1)[0]
+    length, shift = 0, 0
+    while True:
+        b = read_exact(sock, 1)[0]
+        length |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            break
+        if shift > 21:
+            raise ValueError("bad remaining length")
+    return first, read_exact(sock, length)
+
+
+def read_str(body, pos):
+    n = struct.unpack_from("!H", body, pos)[0]
+    return body[pos + 2:pos + 2 + n].decode("utf-8", "replace"), pos + 2 + n
+
+
+class Handler(socketserver.BaseRequestHandler):
+    def handle(self):
+        sock = self.request
+        peer = self.client_address[0]
+        client = None
+
+        try:
+            first, body = read_packet(sock)
+            if first >> 4 != CONNECT:
+                print("%s: first packet is not CONNECT" % peer)
+                return
+
+            proto, pos = read_str(body, 0)
+            level, flags, keepalive = struct.unpack_from("!BBH", body, pos)
+            client, pos = read_str(body, pos + 4)
+            clean = bool(flags & 0x02)
+
+            with lock:
+                if totals["refused"] < self.server.args.refuse:
+                    totals["refused"] += 1
+                    print("%s: refusing CONNECT" % client)
+                    sock.sendall(bytes([CONNACK << 4, 2, 0, 3]))
+                    return
+                present = client in sessions and not clean
+                if not present:
+                    sessions[client] = Session()
+                session = sessions[client]
+                totals["connects"] += 1
+
+            if proto != "MQTT" or level != 4:
+                print("%s: protocol %s level %d, expected MQTT 4" % (client, proto, level))
+            print("%s (%s): connected, clean %d keepalive %d, session present %d"
+                  % (client, peer, clean, keepalive, present))
+            sock.sendall(bytes([CONNACK << 4, 2, int(present), 0]))
+
+            if keepalive:
+                sock.settimeout(keepalive * 1.5)
+
+            while True:
+                first, body = read_packet(sock)
+                kind = first >> 4
+
+                if kind == PUBLISH:
+                    qos = (first >> 1) & 3
+                    dup = bool(first & 0x08)
+                    topic, pos = read_str(body, 0)
+                    pid = None
+                    if qos:
+                        pid = struct.unpack_from("!H", body, pos)[0]
+                        pos += 2
+                    payload = body[pos:].decode("utf-8", "replace")
+
+                    with lock:
+                        totals["messages"] += 1
+                        totals["dup"] += dup
+                        again = qos == 1 and pid in session.acked
+                        totals["redelivered"] += again
+                        if qos == 1:
+                            session.qos1 += 1
+
+                    if self.server.args.verbose or dup:
+                        print("%s: %s qos %d id %s%s%s: %s" % (client, topic, qos, pid,
+                              " dup" if dup else "", " (already acked)" if again else "", payload))
+
+                    if qos == 1:
+                        kill = self.server.args.kill_every
+                        if kill and session.qos1 % kill == 0 and not dup:
+                            with lock:
+                                totals["killed"] += 1
+                            print("%s: closing before PUBACK of id %d" % (client, pid))
+                            return
+                        session.acked.add(pid)
+                        sock.sendall(bytes([PUBACK << 4, 2]) + struct.pack("!H", pid))
+                elif kind == PINGREQ:
+                    if self.server.args.verbose:
+                        print("%s: ping" % client)
+                    sock.sendall(bytes([PINGRESP << 4, 0]))
+                elif kind == DISCONNECT:
+                    print("%s: disconnect" % client)
+                    return
+                else:
+                    print("%s: unexpected packet type %d" % (client, kind))
+        except socket.timeout:
+            print("%s: keepalive expired" % client)
+        except (ConnectionError, ValueError, struct.error) as err:
+            print("%s: %s" % (client or peer, err))
+        finally:
+            with lock:
+                print("totals: %s" % " ".join("%s %d" % kv for kv in totals.items()))
+
+
+class Server(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-p", "--port", type=int, default=1883)
+    parser.add_argument("-b", "--bind", default="0.0.0.0")
+    parser.add_argument("--kill-every", type=int, default=0)
+    parser.add_argument("--refuse", type=int, default=0)
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    server = Server((args.bind, args.port), Handler)
+    server.args = args
+    print("listening on %s:%d" % (args.bind, args.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
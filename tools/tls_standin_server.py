@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""Stand-in HTTPS server for testing the logger HTTP client (simple_http_client.c).
+
+It answers every request with 204, or --status, and prints per connection the TLS
+handshake time, whether the session was resumed and how many requests it carried.
+HTTP/1.1 keep-alive is honoured, so with SIMPLE_HTTP_CLIENT_KEEP_OPEN the device
+should show one handshake for many requests.
+
+A self-signed certificate is generated with the openssl CLI if --cert is not given.
+The device does not verify it (espconn_secure_ca_disable).
+
+Options to test the client recovery paths:
+  --idle N         close connections idle for N seconds, like a load balancer.
+  --max-requests N close a connection after N requests, with `Connection: close`.
+  --delay S        wait S seconds before answering.
+
+    python3 tools/tls_standin_server.py [-p 8443] [--idle 20] [--max-requests 50]
+"""
+
+import argparse
+import os
+import socket
+import socketserver
+import ssl
+import subprocess
+import tempfile
+import threading
+import time
+
+lock = threading.Lock()
+totals = {"connections": 0, "resumed": 0, "requests": 0, "handshake_ms": 0.0, "errors": 0}
+
+
+def make_cert(directory):
+    cert = os.path.join(directory, "cert.pem")
+    key = os.path.join(directory, "key.pem")
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "30",
+                    "-subj", "/CN=logger-standin", "-keyout", key, "-out", cert],
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return cert, key
+
+
+def read_request(sock, buf):
+    """Return (request line, headers, body, rest) of the next request, None on a clean close"""
+    while b"\r\n\r\n" not in buf:
+        chunk = sock.recv(4096)
+        if not chunk:
+            if buf:
+                raise ConnectionError("closed inside a request")
+            return None
+        buf += chunk
+
+    head, buf = buf.split(b"\r\n\r\n", 1)
+    lines = head.decode("latin-1").split("\r\n")
+    headers = {}
+    for line in lines[1:]:
+        name, _, value = line.partition(":")
+        headers[name.strip().lower()] = value.strip()
+
+    length = int(headers.get("content-length", "0"))
+    while len(buf) < length:
+        chunk = sock.recv(4096)
+        if not chunk:
+            raise ConnectionError("closed inside a body")
+        buf += chunk
+
+    return lines[0], headers, buf[:length], buf[length:]
+
+
+class Handler(socketserver.BaseRequestHandler):
+    def handle(self):
+        args = self.server.args
+        peer = "%s:%d" % self.client_address
+        raw = self.request
+        raw.settimeout(args.idle or None)
+
+        start = time.monotonic()
+        try:
+            sock = self.server.context.wrap_socket(raw, server_side=True)
+        except (ssl.SSLError, OSError) as err:
+            with lock:
+                totals["errors"] += 1
+            print("%s: handshake failed: %s" % (peer, err))
+            return
+
+        handshake_ms = (time.monotonic() - start) * 1000
+        resumed = sock.session_reused
+        with lock:
+            totals["connections"] += 1
+            totals["resumed"] += resumed
+            totals["handshake_ms"] += handshake_ms
+        print("%s: %s %s, handshake %.1f ms%s" % (peer, sock.version(), sock.cipher()[0],
+              handshake_ms, ", session resumed" if resumed else ""))
+
+        requests, buf, reason = 0, b"", "client closed"
+        try:
+            while True:
+                request = read_request(sock, buf)
+                if request is None:
+                    break
+                line, headers, body, buf = request
+                requests += 1
+                with lock:
+                    totals["requests"] += 1
+
+                keep = line.endswith("HTTP/1.1") and headers.get("connection", "").lower() != "close"
+                if args.max_requests and requests >= args.max_requests:
+                    keep = False
+                if args.verbose:
+                    print("%s: #%d %s, %d bytes%s" % (peer, requests, line, len(body), "" if keep else ", closing"))
+
+                if args.delay:
+                    time.sleep(args.delay)
+
+                status = args.status
+                response = "HTTP/1.1 %d %s\r\nConnection: %s\r\n" % (status, "No Content" if status == 204 else "Status",
+                                                                     "keep-alive" if keep else "close")
+                if status != 204:
+                    response += "Content-Length: 0\r\n"
+                sock.sendall((response + "\r\n").encode())
+
+                if not keep:
+                    reason = "server closed"
+                    break
+        except socket.timeout:
+            reason = "idle timeout"
+        except (ConnectionError, ssl.SSLError, OSError, ValueError) as err:
+            reason = str(err)
+        finally:
+            try:
+                sock.close()
+            except OSError:
+                pass
+            print("%s: %d requests, %s" % (peer, requests, reason))
+            with lock:
+                connections = max(totals["connections"], 1)
+                print("totals: connections %d resumed %d requests %d requests/connection %.1f "
+                      "handshake avg %.1f ms errors %d" % (
+                          totals["connections"], totals["resumed"], totals["requests"],
+                          totals["requests"] / connections, totals["handshake_ms"] / connections, totals["errors"]))
+
+
+class Server(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-p", "--port", type=int, default=8443)
+    parser.add_argument("-b", "--bind", default="0.0.0.0")
+    parser.add_argument("--cert", help="PEM certificate, generated if not given")
+    parser.add_argument("--key", help="PEM key of --cert")
+    parser.add_argument("--status", type=int, default=204)
+    parser.add_argument("--idle", type=float, default=0)
+    parser.add_argument("--max-requests", type=int, default=0)
+    parser.add_argument("--delay", type=float, default=0)
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    # The ESP8266 stack is TLS 1.2 at most, with the classic RSA suites
+    context.minimum_version = ssl.TLSVersion.TLSv1_2
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+    context.set_ciphers("DEFAULT:AES128-SHA:AES256-SHA:AES128-SHA256:AES256-SHA256:@SECLEVEL=0")
+
+    with tempfile.TemporaryDirectory() as directory:
+        if args.cert:
+            context.load_cert_chain(args.cert, args.key)
+        else:
+            context.load_cert_chain(*make_cert(directory))
+
+        server = Server((args.bind, args.port), Handler)
+        server.args = args
+        server.context = context
+        print("listening on %s:%d" % (args.bind, args.port))
+        try:
+            server.serve_forever()
+        except KeyboardInterrupt:
+            pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Stand-in for the InfluxDB / Telegraf UDP listener of the logger UDP sink.
+
+Receives the line protocol datagrams of udp_sink.c, checks the `udp_sink,host=<h> seq=<n>i`
+header line of every datagram and reports lost, duplicated and reordered datagrams per
+host. With -v every received line is printed.
+
+    python3 tools/udp_sink_listener.py [-p 8089] [-v]
+"""
+
+import argparse
+import re
+import socket
+import time
+
+HEADER = re.compile(r"^udp_sink,host=(\S+) seq=(\d+)i$")
+LINE = re.compile(r"^[A-Za-z_][\w-]*(,\S+)? \S+=\S+( \d+)?$")
+
+
+class Host:
+    def __init__(self, seq):
+        self.first = seq
+        self.next = seq
+        self.datagrams = 0
+        self.lost = 0
+        self.late = 0
+        self.lines = 0
+        self.bytes = 0
+        self.bad = 0
+
+    def datagram(self, seq):
+        self.datagrams += 1
+        if seq == self.next:
+            self.next = (seq + 1) & 0xFFFFFFFF
+        elif (seq - self.next) & 0xFFFFFFFF < 0x80000000:
+            self.lost += (seq - self.next) & 0xFFFFFFFF
+            self.next = (seq + 1) & 0xFFFFFFFF
+        else:
+            # Counted as lost when its successor arrived
+            self.late += 1
+            self.lost -= 1
+
+    def __str__(self):
+        return ("datagrams %d lost %d late %d lines %d bytes %d bad %d"
+                % (self.datagrams, self.lost, self.late, self.lines, self.bytes, self.bad))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-p", "--port", type=int, default=8089)
+    parser.add_argument("-b", "--bind", default="0.0.0.0")
+    parser.add_argument("-i", "--interval", type=float, default=60, help="report period [s]")
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    sock.settimeout(1)
+    print("listening on %s:%d" % (args.bind, args.port))
+
+    hosts = {}
+    report = time.monotonic() + args.interval
+
+    try:
+        while True:
+            try:
+                data, addr = sock.recvfrom(2048)
+            except socket.timeout:
+                data = None
+
+            if data:
+                lines = data.decode("utf-8", "replace").rstrip("\n").split("\n")
+                header = HEADER.match(lines[0])
+                if header is None:
+                    print("%s: datagram without header, %d B" % (addr[0], len(data)))
+                    continue
+
+                name, seq = header.group(1), int(header.group(2))
+                if name not in hosts:
+                    hosts[name] = Host(seq)
+                    print("%s (%s): first seq %d" % (name, addr[0], seq))
+                host = hosts[name]
+                host.datagram(seq)
+                host.bytes += len(data)
+
+                for line in lines[1:]:
+                    host.lines += 1
+                    if not LINE.match(line):
+                        host.bad += 1
+                        print("%s: bad line %r" % (name, line))
+                    elif args.verbose:
+                        print("%s: %s" % (name, line))
+
+            if time.monotonic() >= report:
+                report += args.interval
+                for name, host in sorted(hosts.items()):
+                    print("%s: %s" % (name, host))
+    except KeyboardInterrupt:
+        pass
+
+    for name, host in sorted(hosts.items()):
+        print("%s: %s" % (name, host))
+
+
+if __name__ == "__main__":
+    main()
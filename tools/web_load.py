@@ -0,0 +1,310 @@
+#!/usr/bin/env python3
+"""Web server load test: N concurrent clients requesting the logger web routes.
+
+Each client keeps its connection open and sends the next GET once the previous
+response is in, like a browser tab polling the page. Connections refused or closed
+by the server (SIMPLE_HTTP_SERVER_MAX_CONN, idle timeout) are counted and opened
+again. Run it against a board or against the firmware server on the host
+(tools/host/web_host.c, no admission control there, so it measures the server):
+
+    make -C tools/host web_host SANITIZE= && tools/host/build/web_host -p 8080 &
+    python3 tools/web_load.py -p 8080 -c 3 -d 10 -P /legacy
+    python3 tools/web_load.py -p 8080 -c 3 -d 10 -P /api/v1/latest
+
+Options:
+  -P PATH             route to request, repeat it to alternate between several.
+  --new-conn          one connection per request, `Connection: close` behaviour.
+  --conditional       send the last entity tag of the path in If-None-Match.
+  --split N           send every request in N pieces, --split-delay ms apart, so the
+                      server has to put it together over several receive callbacks.
+  --idle K            also open K connections that never send anything. They hold
+                      pool slots until the server idle timeout closes them.
+  --events N          also subscribe N clients to /events (Server-Sent Events). Reports
+                      events received, id gaps (events dropped by the server), keepalive
+                      comments, the longest silence of a stream, and the push latency of
+                      the `probe` events of web_host, `{"us":<host monotonic us>}`.
+                      -c 0 to measure the streams alone.
+  --check             an entity tag must always come with the same body. A body that
+                      does not match the one first seen with its tag is reported as torn.
+
+Report per path: answered requests, requests per second, latency percentiles and
+answers by status, then the connection errors. Run -c below, at and above
+SIMPLE_HTTP_SERVER_MAX_CONN to see where the server starts refusing clients.
+"""
+
+import argparse
+import asyncio
+import collections
+import time
+
+REQUEST = "GET {path} HTTP/1.1\r\nHost: {host}\r\n{extra}\r\n"
+
+
+class Stats:
+    def __init__(self):
+        self.latency = collections.defaultdict(list)
+        self.status = collections.defaultdict(collections.Counter)
+        self.errors = collections.Counter()
+        self.bodies = {}                        # (path, etag) -> body
+        self.torn = 0
+        self.torn_example = None
+        self.idle_closed = []                   # Seconds until the server closed an idle connection
+        self.subscribed = 0
+        self.events = 0
+        self.keepalives = 0
+        self.gaps = 0                           # Event ids never received
+        self.silence = 0                        # Longest time without stream data, seconds
+        self.push = []                          # Probe publish to receive, seconds
+
+
+async def read_head(reader):
+    """(status, {header: value})"""
+    head = await reader.readuntil(b"\r\n\r\n")
+    lines = head.decode("latin-1").split("\r\n")
+    status = int(lines[0].split(" ", 2)[1])
+    headers = {}
+    for line in lines[1:]:
+        if ":" in line:
+            name, value = line.split(":", 1)
+            headers[name.strip().lower()] = value.strip()
+    return status, headers
+
+
+async def read_response(reader):
+    """(status, {header: value}, body). Content-Length bodies only"""
+    status, headers = await read_head(reader)
+    length = int(headers.get("content-length", 0)) if status != 304 else 0
+    body = await reader.readexactly(length) if length else b""
+    return status, headers, body
+
+
+async def send_request(writer, request, args):
+    if args.split <= 1:
+        writer.write(request)
+        return
+
+    size = -(-len(request) // args.split)
+    for i in range(0, len(request), size):
+        if i:
+            await asyncio.sleep(args.split_delay / 1000)
+        writer.write(request[i:i + size])
+        await writer.drain()
+
+
+async def idle_client(args, stats, end):
+    """Connection without requests, records when the server closes it"""
+    try:
+        reader, writer = await asyncio.open_connection(args.host, args.port)
+    except OSError:
+        stats.errors["idle refused"] += 1
+        return
+
+    start = time.monotonic()
+    try:
+        if not await asyncio.wait_for(reader.read(1), max(0, end - start)):
+            stats.idle_closed.append(time.monotonic() - start)
+    except ConnectionError:
+        stats.idle_closed.append(time.monotonic() - start)
+    except asyncio.TimeoutError:
+        pass
+    writer.close()
+
+
+def parse_event(raw, stream, stats, now):
+    fields = {}
+    for line in raw.decode("utf-8", "replace").split("\n"):
+        if line.startswith(":"):
+            stats.keepalives += 1
+            stream["skip"] += 1                 # Keepalives take an event id too
+        elif ":" in line:
+            name, value = line.split(":", 1)
+            fields[name] = value.lstrip()
+
+    if "id" in fields:
+        seq = int(fields["id"])
+        if stream["id"] is not None:
+            stats.gaps += max(0, seq - stream["id"] - 1 - stream["skip"])
+        stream["id"] = seq
+        stream["skip"] = 0
+    if "event" in fields:
+        stats.events += 1
+    if fields.get("event") == "probe":
+        sent_us = int(fields["data"].split(":")[1].rstrip("}"))
+        stats.push.append(now - sent_us / 1e6)
+
+
+async def subscriber(args, stats, end):
+    """One /events stream until the end of the run"""
+    try:
+        reader, writer = await asyncio.open_connection(args.host, args.port)
+    except OSError:
+        stats.errors["events refused"] += 1
+        return
+
+    try:
+        writer.write(REQUEST.format(path="/events", host=args.host, extra="").encode())
+        status, headers = await asyncio.wait_for(read_head(reader), args.timeout)
+        stats.status["/events"][status] += 1
+        if status != 200:
+            writer.close()
+            return
+        stats.subscribed += 1
+
+        stream = {"id": None, "skip": 0}
+        pending = b""
+        last = time.monotonic()
+        while last < end:
+            size = await asyncio.wait_for(reader.readuntil(b"\r\n"), end - last)
+            now = time.monotonic()
+            stats.silence = max(stats.silence, now - last)
+            last = now
+
+            size = int(size.split(b";")[0], 16)
+            pending += (await reader.readexactly(size + 2))[:-2]
+            if size == 0:
+                stats.errors["events ended"] += 1
+                break
+            while b"\n\n" in pending:
+                raw, pending = pending.split(b"\n\n", 1)
+                parse_event(raw, stream, stats, now)
+    except asyncio.TimeoutError:
+        stats.silence = max(stats.silence, time.monotonic() - last)
+    except (asyncio.IncompleteReadError, ConnectionError):
+        stats.errors["events closed"] += 1
+    writer.close()
+
+
+async def client(index, args, stats, end):
+    reader = writer = None
+    etags = {}
+    n = index
+
+    while time.monotonic() < end:
+        path = args.paths[n % len(args.paths)]
+        n += 1
+
+        if writer is None:
+            try:
+                reader, writer = await asyncio.open_connection(args.host, args.port)
+            except OSError:
+                stats.errors["connect refused"] += 1
+                await asyncio.sleep(0.01)
+                continue
+
+        extra = ""
+        if args.conditional and path in etags:
+            extra = "If-None-Match: %s\r\n" % etags[path]
+
+        request = REQUEST.format(path=path, host=args.host, extra=extra).encode()
+        start = time.monotonic()
+        try:
+            await send_request(writer, request, args)
+            status, headers, body = await asyncio.wait_for(read_response(reader), args.timeout)
+        except asyncio.TimeoutError:
+            stats.errors["timeout"] += 1
+            writer.close()
+            writer = None
+            continue
+        except (asyncio.IncompleteReadError, ConnectionError):
+            stats.errors["closed by server"] += 1
+            writer.close()
+            writer = None
+            await asyncio.sleep(0.01)
+            continue
+
+        stats.latency[path].append(time.monotonic() - start)
+        stats.status[path][status] += 1
+
+        etag = headers.get("etag")
+        if etag is not None:
+            etags[path] = etag
+        if args.check and etag is not None and status == 200:
+            seen = stats.bodies.setdefault((path, etag), body)
+            if seen != body:
+                stats.torn += 1
+                if stats.torn_example is None:
+                    stats.torn_example = (path, etag, seen, body)
+
+        if args.new_conn:
+            writer.close()
+            writer = None
+
+    if writer is not None:
+        writer.close()
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def report(args, stats, elapsed):
+    print("%d clients, %.1f s" % (args.clients, elapsed))
+    for path in args.paths if args.clients else []:
+        values = sorted(stats.latency[path])
+        if not values:
+            print("%-20s no answers" % path)
+            continue
+        print("%-20s %7d answers %8.1f req/s  latency ms p50 %.2f p90 %.2f p99 %.2f max %.2f  %s" % (
+            path, len(values), len(values) / elapsed,
+            percentile(values, 50) * 1e3, percentile(values, 90) * 1e3, percentile(values, 99) * 1e3,
+            values[-1] * 1e3, " ".join("%d:%d" % kv for kv in sorted(stats.status[path].items()))))
+    for error, count in sorted(stats.errors.items()):
+        print("%-20s %7d" % (error, count))
+    if args.events:
+        push = sorted(stats.push)
+        print("events: %d of %d subscribed, %d events, %d id gaps, %d keepalives, longest silence %.2f s" % (
+            stats.subscribed, args.events, stats.events, stats.gaps, stats.keepalives, stats.silence))
+        if push:
+            print("push latency ms p50 %.2f p90 %.2f p99 %.2f max %.2f over %d probes" % (
+                percentile(push, 50) * 1e3, percentile(push, 90) * 1e3, percentile(push, 99) * 1e3,
+                push[-1] * 1e3, len(push)))
+    if args.idle:
+        closed = stats.idle_closed
+        print("idle connections %d, closed by server %d%s" % (
+            args.idle, len(closed), " after %.1f-%.1f s" % (min(closed), max(closed)) if closed else ""))
+    if args.check:
+        print("torn bodies %d" % stats.torn)
+        if stats.torn_example:
+            path, etag, seen, body = stats.torn_example
+            print("  %s %s\n  first: %s\n  later: %s" % (path, etag, seen[:160], body[:160]))
+
+
+async def run(args):
+    stats = Stats()
+    start = time.monotonic()
+    end = start + args.duration
+    idle = [asyncio.ensure_future(idle_client(args, stats, end)) for _ in range(args.idle)]
+    if idle:
+        await asyncio.sleep(0.1)                # Let them take their pool slots first
+    subs = [asyncio.ensure_future(subscriber(args, stats, end)) for _ in range(args.events)]
+    await asyncio.gather(*(client(i, args, stats, end) for i in range(args.clients)), *idle, *subs)
+    report(args, stats, time.monotonic() - start)
+    return stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-H", "--host", default="127.0.0.1")
+    parser.add_argument("-p", "--port", type=int, default=80)
+    parser.add_argument("-P", "--path", dest="paths", action="append", help="default /api/v1/latest")
+    parser.add_argument("-c", "--clients", type=int, default=3)
+    parser.add_argument("-d", "--duration", type=float, default=10, help="seconds")
+    parser.add_argument("-t", "--timeout", type=float, default=5, help="seconds per response")
+    parser.add_argument("--new-conn", action="store_true")
+    parser.add_argument("--conditional", action="store_true")
+    parser.add_argument("--check", action="store_true")
+    parser.add_argument("--split", type=int, default=1, help="pieces per request")
+    parser.add_argument("--split-delay", type=float, default=5, help="ms between pieces")
+    parser.add_argument("--idle", type=int, default=0, help="silent connections")
+    parser.add_argument("--events", type=int, default=0, help="/events subscribers")
+    args = parser.parse_args()
+    args.paths = args.paths or ["/api/v1/latest"]
+
+    try:
+        asyncio.run(run(args))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()